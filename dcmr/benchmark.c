@@ -0,0 +1,393 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "dicom.h"
+#include "dcm.h"
+#include "pixel-data.h"
+#include "parallel.h"
+#include "lut.h"
+#include "rle.h"
+#include "overlay.h"
+#include "color.h"
+#include "stats.h"
+#include "dcmr.h"
+
+#define MIN_DURATION 0.5 // seconds
+#define MIN_RUNS 3
+
+typedef struct dataset_s {
+  file_t         file;
+  dicom_meta_t   dicom_meta;
+  tag_t          tags[MAX_LOADED_TAG];
+  tag_t          pixel_data;
+  ssize_t        offset; // Where the header decoding stopped
+  pixel_module_t pixel_module;
+} dataset_t;
+
+typedef struct benchmark_s {
+  char *name;
+  // Prepare the benchmark of a dataset. Return ERROR if it does not apply.
+  int8_t (*prepare)(dataset_t *dataset, void **context);
+  int8_t (*run)(dataset_t *dataset, void *context, uint32_t nthreads);
+  void (*release)(void *context);
+} benchmark_t;
+
+typedef struct voi_context_s {
+  display_lut_t display_lut;
+  uint8_t       *output;
+  overlay_t     overlays[MAX_OVERLAYS];
+  ssize_t       noverlays;
+} voi_context_t;
+
+// Fit the window on the middle frame
+static int8_t auto_voi_lut(dataset_t *dataset, modality_lut_t *modality_lut,
+                           voi_lut_t *voi_lut) {
+  pixel_module_t *pixel_module = &dataset->pixel_module;
+  padding_t padding;
+  frame_view_t view;
+  if (get_native_frame(&dataset->file, &dataset->pixel_data, pixel_module,
+                       pixel_module->number_of_frames / 2, 0, &view) == ERROR)
+    return ERROR;
+  return compute_auto_voi_lut(pixel_module, modality_lut,
+                              decode_padding(dataset->tags, pixel_module,
+                                             &padding) == ERROR ?
+                              NULL : &padding, view.data,
+                              (size_t) pixel_module->rows *
+                              pixel_module->columns, voi_lut);
+}
+
+static int8_t prepare_voi(dataset_t *dataset, void **context) {
+  pixel_module_t *pixel_module = &dataset->pixel_module;
+  modality_lut_t modality_lut;
+  voi_lut_t voi_lut;
+  if (dataset->pixel_data.datasize == UNDEFINED_LENGTH) return ERROR;
+  decode_modality_lut(dataset->tags, &modality_lut);
+  if (decode_voi_lut(dataset->tags, &voi_lut) == ERROR &&
+      auto_voi_lut(dataset, &modality_lut, &voi_lut) == ERROR) {
+    // Window over the whole range of stored values
+    voi_lut.function = VOI_LINEAR;
+    voi_lut.window_width = 1 << pixel_module->bits_stored;
+    voi_lut.window_center = pixel_module->pixel_representation ? 0 :
+      voi_lut.window_width / 2;
+    voi_lut.window_center = voi_lut.window_center *
+      modality_lut.rescale_slope + modality_lut.rescale_intercept;
+    voi_lut.window_width *= modality_lut.rescale_slope;
+  }
+  voi_context_t *voi = malloc(sizeof (voi_context_t));
+  if (voi == NULL) {
+    perror("malloc");
+    return ERROR;
+  }
+  if (build_display_lut(pixel_module, &modality_lut, &voi_lut,
+                        &voi->display_lut) == ERROR) {
+    free(voi);
+    return ERROR;
+  }
+  voi->output = malloc((size_t) pixel_module->rows * pixel_module->columns *
+                       pixel_module->number_of_frames);
+  if (voi->output == NULL) {
+    perror("malloc");
+    free_display_lut(&voi->display_lut);
+    free(voi);
+    return ERROR;
+  }
+  *context = voi;
+  return 0;
+}
+
+static int8_t run_voi(dataset_t *dataset, void *context, uint32_t nthreads) {
+  voi_context_t *voi = (voi_context_t *) context;
+  return render_frames_to_uint8(&dataset->file, &dataset->pixel_data,
+                                &dataset->pixel_module, &voi->display_lut,
+                                voi->output, nthreads);
+}
+
+static void release_voi(void *context) {
+  voi_context_t *voi = (voi_context_t *) context;
+  free_display_lut(&voi->display_lut);
+  free(voi->output);
+  free(voi);
+}
+
+// Render the frames and burn the overlay planes in, white
+static int8_t prepare_overlay(dataset_t *dataset, void **context) {
+  if (prepare_voi(dataset, context) == ERROR) return ERROR;
+  voi_context_t *voi = (voi_context_t *) *context;
+  voi->noverlays = decode_overlays(&dataset->file, dataset->offset,
+                                   &dataset->dicom_meta, voi->overlays,
+                                   MAX_OVERLAYS);
+  if (voi->noverlays <= 0) {
+    release_voi(voi);
+    return ERROR;
+  }
+  return 0;
+}
+
+static int8_t run_overlay(dataset_t *dataset, void *context,
+                          uint32_t nthreads) {
+  voi_context_t *voi = (voi_context_t *) context;
+  pixel_module_t *pixel_module = &dataset->pixel_module;
+  size_t npixels = (size_t) pixel_module->rows * pixel_module->columns;
+  if (run_voi(dataset, context, nthreads) == ERROR) return ERROR;
+  for (uint32_t i = 0; i < pixel_module->number_of_frames; ++i)
+    if (burn_overlays(voi->overlays, voi->noverlays, i,
+                      voi->output + npixels * i, pixel_module->rows,
+                      pixel_module->columns, 0xFF) == ERROR)
+      return ERROR;
+  return 0;
+}
+
+typedef struct color_context_s {
+  palette_t palette;
+  uint8_t   *output;
+} color_context_t;
+
+static void release_color(void *context) {
+  color_context_t *color = (color_context_t *) context;
+  free_palette(&color->palette);
+  free(color->output);
+  free(color);
+}
+
+// Convert the frames to interleaved RGB8
+static int8_t prepare_color(dataset_t *dataset, void **context) {
+  pixel_module_t *pixel_module = &dataset->pixel_module;
+  frame_view_t view;
+  if (dataset->pixel_data.datasize == UNDEFINED_LENGTH) return ERROR;
+  color_context_t *color = calloc(1, sizeof (color_context_t));
+  if (color == NULL) {
+    perror("calloc");
+    return ERROR;
+  }
+  if (!strcmp(pixel_module->photometric_interpretation, "PALETTE COLOR") &&
+      decode_palette(dataset->tags, pixel_module, &color->palette) == ERROR) {
+    free(color);
+    return ERROR;
+  }
+  color->output = malloc((size_t) pixel_module->rows * pixel_module->columns *
+                         3 * pixel_module->number_of_frames);
+  if (color->output == NULL) {
+    perror("malloc");
+    release_color(color);
+    return ERROR;
+  }
+  // Check that the photometric interpretation is supported
+  if (get_native_frame(&dataset->file, &dataset->pixel_data, pixel_module, 0,
+                       0, &view) == ERROR ||
+      convert_to_rgb(pixel_module, &color->palette, view.data,
+                     color->output) == ERROR) {
+    release_color(color);
+    return ERROR;
+  }
+  *context = color;
+  return 0;
+}
+
+static int8_t run_color(dataset_t *dataset, void *context, uint32_t nthreads) {
+  color_context_t *color = (color_context_t *) context;
+  return convert_frames_to_rgb(&dataset->file, &dataset->pixel_data,
+                               &dataset->pixel_module, &color->palette,
+                               color->output, nthreads);
+}
+
+typedef struct decode_context_s {
+  frame_index_t index;
+  uint32_t      *frames;
+  uint8_t       *output;
+} decode_context_t;
+
+static void release_decode(void *context) {
+  decode_context_t *decode = (decode_context_t *) context;
+  free_frame_index(&decode->index);
+  free(decode->frames);
+  free(decode->output);
+  free(decode);
+}
+
+// Decode all the frames, through the codec of encapsulated pixel data or by
+// copying them out of the mapping for native pixel data, the latter being
+// the reference the codecs are compared to
+static int8_t prepare_decode(dataset_t *dataset, void **context) {
+  pixel_module_t *pixel_module = &dataset->pixel_module;
+  decode_context_t *decode = calloc(1, sizeof (decode_context_t));
+  if (decode == NULL) {
+    perror("calloc");
+    return ERROR;
+  }
+  decode->frames = malloc(sizeof (uint32_t) * pixel_module->number_of_frames);
+  decode->output = malloc(get_frame_bits(pixel_module) / 8 *
+                          pixel_module->number_of_frames);
+  if (decode->frames == NULL || decode->output == NULL) {
+    perror("malloc");
+    release_decode(decode);
+    return ERROR;
+  }
+  for (uint32_t i = 0; i < pixel_module->number_of_frames; ++i)
+    decode->frames[i] = i;
+  if (dataset->pixel_data.datasize == UNDEFINED_LENGTH &&
+      build_frame_index(&dataset->file, dataset->offset, &dataset->dicom_meta,
+                        pixel_module->number_of_frames,
+                        &decode->index) == ERROR) {
+    release_decode(decode);
+    return ERROR;
+  }
+  *context = decode;
+  return 0;
+}
+
+static int8_t copy_native_frame(dataset_t *dataset, decode_context_t *decode,
+                                size_t frame) {
+  frame_view_t view;
+  size_t size = get_frame_bits(&dataset->pixel_module) / 8;
+  if (get_native_frame(&dataset->file, &dataset->pixel_data,
+                       &dataset->pixel_module, frame, 0, &view) == ERROR)
+    return ERROR;
+  memcpy(decode->output + size * frame, view.data, size);
+  return 0;
+}
+
+static int8_t run_decode(dataset_t *dataset, void *context,
+                         uint32_t nthreads) {
+  decode_context_t *decode = (decode_context_t *) context;
+  pixel_module_t *pixel_module = &dataset->pixel_module;
+  if (dataset->pixel_data.datasize == UNDEFINED_LENGTH)
+    return decode_encapsulated_frames(&dataset->file, &dataset->dicom_meta,
+                                      &decode->index, pixel_module,
+                                      decode->frames,
+                                      pixel_module->number_of_frames,
+                                      decode->output, nthreads);
+  for (uint32_t i = 0; i < pixel_module->number_of_frames; ++i)
+    if (copy_native_frame(dataset, decode, i) == ERROR) return ERROR;
+  return 0;
+}
+
+// Encode native pixel data to RLE Lossless, written to /dev/null
+static int8_t prepare_encode(dataset_t *dataset, void **context) {
+  if (dataset->pixel_data.datasize == UNDEFINED_LENGTH) return ERROR;
+  int *fd = malloc(sizeof (int));
+  if (fd == NULL) {
+    perror("malloc");
+    return ERROR;
+  }
+  if ((*fd = open("/dev/null", O_WRONLY)) < 0) {
+    perror("open");
+    free(fd);
+    return ERROR;
+  }
+  *context = fd;
+  return 0;
+}
+
+static int8_t run_encode(dataset_t *dataset, void *context,
+                         uint32_t nthreads) {
+  return write_rle_pixel_data(*(int *) context, &dataset->file,
+                              &dataset->pixel_data, &dataset->pixel_module,
+                              nthreads);
+}
+
+static void release_encode(void *context) {
+  close(*(int *) context);
+  free(context);
+}
+
+static const benchmark_t g_benchmarks[] = {
+  { "voi", prepare_voi, run_voi, release_voi },
+  { "overlay", prepare_overlay, run_overlay, release_voi },
+  { "color", prepare_color, run_color, release_color },
+  { "decode", prepare_decode, run_decode, release_decode },
+  { "encode", prepare_encode, run_encode, release_encode },
+};
+
+#define NUMBER_OF_BENCHMARKS \
+  (sizeof (g_benchmarks) / sizeof (g_benchmarks[0]))
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int8_t load_dataset(char *path, dataset_t *dataset) {
+  memset(dataset, 0, sizeof (dataset_t));
+  if (load_file(path, &dataset->file) == ERROR) return ERROR;
+  dataset->offset = decode_dataset(&dataset->file, &dataset->dicom_meta,
+                                   dataset->tags, MAX_LOADED_TAG);
+  if (dataset->offset < 0 ||
+      decode_pixel_module(dataset->tags, &dataset->pixel_module) == ERROR ||
+      find_tag(&dataset->file, dataset->offset, &dataset->dicom_meta,
+               PIXEL_DATA, &dataset->pixel_data) == ERROR) {
+    fprintf(stderr, "error: %s: no pixel data to benchmark\n", path);
+    munmap(dataset->file.content, dataset->file.size);
+    close_file(&dataset->file);
+    return ERROR;
+  }
+  return 0;
+}
+
+// Time the benchmark on a dataset with one thread, then with all the
+// processors, and print the throughputs
+static void time_benchmark(const benchmark_t *b, dataset_t *dataset,
+                           void *context) {
+  pixel_module_t *pixel_module = &dataset->pixel_module;
+  double megapixels = (double) pixel_module->rows * pixel_module->columns *
+    pixel_module->number_of_frames / 1e6;
+  uint32_t threads[2] = { 1, get_number_of_threads(0) };
+  for (uint8_t i = 0; i < (threads[1] > 1 ? 2 : 1); ++i) {
+    // Warm up the page cache and the tables
+    if (b->run(dataset, context, threads[i]) == ERROR) {
+      fprintf(stderr, "error: %s: %s benchmark failed\n",
+              dataset->file.filename, b->name);
+      return;
+    }
+    uint32_t runs = 0;
+    double start = now();
+    double elapsed;
+    do {
+      b->run(dataset, context, threads[i]);
+      ++runs;
+    } while ((elapsed = now() - start) < MIN_DURATION || runs < MIN_RUNS);
+    printf("{\"filename\":\"%s\",\"benchmark\":\"%s\","
+           "\"TransferSyntaxUID\":\"%s\",\"threads\":%u,"
+           "\"megapixels\":%.3f,\"runs\":%u,\"seconds\":%.6f,"
+           "\"megapixels_per_second\":%.1f}\n",
+           dataset->file.filename, b->name,
+           dataset->dicom_meta.transfer_syntax_uid, threads[i], megapixels,
+           runs, elapsed, megapixels * runs / elapsed);
+  }
+}
+
+int32_t benchmark(char *name, path_t *paths) {
+  const benchmark_t *b = NULL;
+  for (size_t i = 0; i < NUMBER_OF_BENCHMARKS; ++i)
+    if (!strcmp(name, g_benchmarks[i].name)) b = &g_benchmarks[i];
+  if (b == NULL) {
+    fprintf(stderr, "error: unknown benchmark %s\n", name);
+    return ERROR;
+  }
+  dataset_t *dataset = malloc(sizeof (dataset_t));
+  if (dataset == NULL) {
+    perror("malloc");
+    return ERROR;
+  }
+  for (path_t *p = paths; p; p = p->next) {
+    void *context;
+    if (load_dataset(p->path, dataset) == ERROR) continue;
+    if (b->prepare(dataset, &context) == ERROR) {
+      fprintf(stderr, "error: %s: %s benchmark does not apply\n", p->path,
+              b->name);
+    } else {
+      time_benchmark(b, dataset, context);
+      b->release(context);
+    }
+    munmap(dataset->file.content, dataset->file.size);
+    close_file(&dataset->file);
+  }
+  free(dataset);
+  return 0;
+}
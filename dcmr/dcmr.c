@@ -11,29 +11,57 @@
 #include <sys/mman.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <getopt.h>
 
 #include "dicom.h"
 #include "dcm.h"
 #include "data-dictionary.h"
+#include "dcmr.h"
 
 #define ERROR -1
-
-typedef struct path_s {
-  char *path;
-  struct path_s *next;
-} path_t;
+// Bytes read ahead, or read directly, for the header of a file
+#define HEADER_LENGTH (256 << 10)
 
 void usage(char **argv) {
-  fprintf(stderr, "usage: %s [FILE|DIRECTORY ...]\n", argv[0]);
+  fprintf(stderr, "usage: %s [OPTION ...] [FILE|DIRECTORY ...]\n", argv[0]);
+  fprintf(stderr, "  -b, --benchmark=NAME  time pixel processing, NAME being one of\n"
+                  "                        voi, overlay, color, decode, encode\n"
+                  "  -s, --stats           add the statistics of the stored pixel values\n"
+                  "  -e, --export=FILE     write the series as a volume to FILE, NRRD\n"
+                  "                        if it ends with .nrrd, NIfTI-1 otherwise\n"
+                  "  -w, --window=MB       map the files by windows of MB megabytes\n"
+                  "                        instead of as a whole\n"
+                  "  -a, --advise          read the files sequentially and drop them\n"
+                  "                        from the page cache once processed\n"
+                  "  -d, --direct          read the first 256 KiB of the files only,\n"
+                  "                        with O_DIRECT, bypassing the page cache\n"
+                  "  -i, --io              add the bytes read and the page faults of\n"
+                  "                        each file\n"
+                  "  -p, --shard=I/N       process the I-th of N parts of the files,\n"
+                  "                        I from 0 to N-1, split by path\n"
+                  "  -l, --lines           write one record per line sorted by filename,\n"
+                  "                        outputs of shards merge with sort -m\n"
+                  "  -f, --follow          watch the DIRECTORY arguments and write the\n"
+                  "                        record of each file written into them\n"
+                  "  -u, --serve=SOCKET    answer tag queries on the Unix socket SOCKET,\n"
+                  "                        keeping the queried files parsed\n"
+                  "  -c, --store=PORT      receive the objects sent with C-STORE on PORT\n"
+                  "                        into DIRECTORY and write their record, answer\n"
+                  "                        C-FIND study and series queries on them\n"
+                  "  -m, --dicomdir[=N]    write the records of the files listed by the\n"
+                  "                        DICOMDIR arguments, or of the media whose root\n"
+                  "                        DIRECTORY holds one, without opening them but\n"
+                  "                        one out of N checked against its record\n");
 }
 
-int8_t output(file_t *file, dicom_meta_t *dicom_meta, tag_t *tags) {
+int8_t output(file_t *file, ssize_t offset, dicom_meta_t *dicom_meta,
+              tag_t *tags, options_t *options, io_counters_t *io) {
   char *sopInstanceUid = (char *) get_tag_data(tags, SOP_INSTANCE_UID);
   char *studyUid = (char *) get_tag_data(tags, STUDY_INSTANCE_UID);
   char *seriesUid = (char *) get_tag_data(tags, SERIES_INSTANCE_UID);
 
   if (sopInstanceUid == NULL && dicom_meta->media_storage_sop_instance_uid[0])
-    sopInstanceUid = dicom_meta->media_storage_sop_instance_uid;
+    sopInstanceUid = strdup(dicom_meta->media_storage_sop_instance_uid);
   else if (sopInstanceUid == NULL)
     fprintf(stderr, "error: SOP instance UID not found in dataset %s\n",
             file->filename);
@@ -47,9 +75,12 @@ int8_t output(file_t *file, dicom_meta_t *dicom_meta, tag_t *tags) {
 
   printf(
     "{\"filename\":\"%s\",\"MediaStorageSOPInstanceUID\":\"%.64s\","
-    "\"StudyInstanceUID\":\"%.64s\",\"SeriesInstanceUID\":\"%.64s\"}",
+    "\"StudyInstanceUID\":\"%.64s\",\"SeriesInstanceUID\":\"%.64s\"",
     file->filename, sopInstanceUid ? sopInstanceUid : "",
     studyUid ? studyUid : "", seriesUid ? seriesUid : "");
+  if (options->stats) output_stats(file, offset, dicom_meta, tags);
+  if (options->io) output_io_counters(io);
+  printf("}");
 
   if (studyUid) free(studyUid);
   if (seriesUid) free(seriesUid);
@@ -57,20 +88,34 @@ int8_t output(file_t *file, dicom_meta_t *dicom_meta, tag_t *tags) {
   return 0;
 }
 
-int32_t parse_files(int32_t nfiles, path_t *path) {
+static int8_t load(char *path, options_t *options, file_t *file) {
+  if (options->direct) return load_file_header(path, HEADER_LENGTH, file);
+  if ((options->window ? load_file_window(path, options->window, file) :
+       load_file(path, file)) == ERROR)
+    return ERROR;
+  if (options->advise) advise_file(file, HEADER_LENGTH);
+  return 0;
+}
+
+int32_t parse_files(int32_t nfiles, path_t *path, options_t *options) {
   int8_t first_file = 1;
   for (path_t *p = path; p; p = p->next) {
     file_t file;
     ssize_t offset = 0;
     tag_t tags[MAX_LOADED_TAG];
+    io_counters_t io;
     memset(&file, 0, sizeof (file_t));
     memset(&tags, 0, sizeof (tag_t) * MAX_LOADED_TAG);
-    if (load_file(p->path, &file) != ERROR) {
+    if (options->io) get_io_counters(&io);
+    if (load(p->path, options, &file) != ERROR) {
       if (!is_dicom(&file)) {
-        if (nfiles == 1)
+        if (nfiles == 1) {
           fprintf(stderr, "error: %s does not appear to be a dicom file\n",
                   file.filename);
-        if (nfiles == 1) return ERROR;
+          unmap_file(&file);
+          close_file(&file);
+          return ERROR;
+        }
       } else {
         dicom_meta_t dicom_meta;
         offset = check_preamble(&file, 0);
@@ -81,21 +126,23 @@ int32_t parse_files(int32_t nfiles, path_t *path) {
         } else {
           if (first_file) {
             first_file = 0;
-            if (nfiles > 1) printf("[");
+            if (nfiles > 1 && !options->lines) printf("[");
           } else {
-            if (nfiles > 1) printf(",");
+            if (nfiles > 1 && !options->lines) printf(",");
           }
           size_t tag_offset = 0;
           offset = decode_n_tags(&file, offset, &dicom_meta, tags, &tag_offset,
                                  MAX_LOADED_TAG);
-          output(&file, &dicom_meta, tags);
+          output(&file, offset, &dicom_meta, tags, options, &io);
+          if (options->lines) printf("\n");
         }
       }
-      munmap(file.content, file.size);
+      unmap_file(&file);
+      if (options->advise || options->direct) drop_file_cache(&file);
       close_file(&file);
     }
   }
-  if (nfiles > 1) printf("]");
+  if (nfiles > 1 && !options->lines) printf("]");
   return 0;
 }
 
@@ -138,7 +185,56 @@ size_t count_paths(path_t *paths) {
   return c;
 }
 
-int32_t generate_path(char *arg, path_t **paths) {
+// Order the paths as their records, where the filename is followed by a
+// quote, so that the sorted outputs of shards merge with sort -m
+static int compare_paths(const void *a, const void *b) {
+  uint8_t *p = (uint8_t *) (*(path_t **) a)->path;
+  uint8_t *q = (uint8_t *) (*(path_t **) b)->path;
+  for (; *p && *p == *q; ++p, ++q);
+  return (*p ? *p : '"') - (*q ? *q : '"');
+}
+
+int8_t sort_paths(path_t **paths) {
+  size_t npaths = count_paths(*paths);
+  if (npaths < 2) return 0;
+  path_t **array = malloc(sizeof (path_t *) * npaths);
+  if (array == NULL) {
+    perror("malloc");
+    return ERROR;
+  }
+  npaths = 0;
+  for (path_t *p = *paths; p; p = p->next) array[npaths++] = p;
+  qsort(array, npaths, sizeof (path_t *), compare_paths);
+  for (size_t i = 0; i + 1 < npaths; ++i) array[i]->next = array[i + 1];
+  array[npaths - 1]->next = NULL;
+  *paths = array[0];
+  free(array);
+  return 0;
+}
+
+// Parse I/N into a shard
+static int8_t parse_shard(char *arg, shard_t *shard) {
+  char *end;
+  shard->index = strtoul(arg, &end, 10);
+  if (end == arg || *end != '/') return ERROR;
+  arg = end + 1;
+  shard->count = strtoul(arg, &end, 10);
+  if (end == arg || *end || shard->index >= shard->count) return ERROR;
+  return 0;
+}
+
+// Whether the file belongs to the shard, from the FNV-1a hash of its path,
+// which stays the same across processes and nodes walking the same paths
+// Cf http://www.isthe.com/chongo/tech/comp/fnv/
+uint8_t in_shard(char *path, shard_t *shard) {
+  uint64_t hash = 0xCBF29CE484222325;
+  if (shard->count == 0) return 1;
+  for (uint8_t *c = (uint8_t *) path; *c; ++c)
+    hash = (hash ^ *c) * 0x100000001B3;
+  return hash % shard->count == shard->index;
+}
+
+int32_t generate_path(char *arg, path_t **paths, shard_t *shard) {
   struct stat buf;
   if (stat(arg, &buf)) {
     perror(arg);
@@ -160,28 +256,142 @@ int32_t generate_path(char *arg, path_t **paths) {
             continue;
           char path[1024];
           snprintf(path, 1024, "%s/%s", arg, result->d_name);
-          generate_path(path, paths);
+          // Files of other shards are skipped before being even stat'ed
+          if (result->d_type == DT_REG && !in_shard(path, shard))
+            continue;
+          generate_path(path, paths, shard);
         }
         if (ret != 0)
           perror(arg);
         else
           closedir(dir);
       }
-    } else add_path(paths, arg);
+    } else if (in_shard(arg, shard)) add_path(paths, arg);
   }
   return 0;
 }
 
 int main(int argc, char **argv) {
-  if (argc < 2) {
+  static struct option long_options[] = {
+    { "benchmark", required_argument, NULL, 'b' },
+    { "stats", no_argument, NULL, 's' },
+    { "export", required_argument, NULL, 'e' },
+    { "window", required_argument, NULL, 'w' },
+    { "advise", no_argument, NULL, 'a' },
+    { "direct", no_argument, NULL, 'd' },
+    { "io", no_argument, NULL, 'i' },
+    { "shard", required_argument, NULL, 'p' },
+    { "lines", no_argument, NULL, 'l' },
+    { "follow", no_argument, NULL, 'f' },
+    { "serve", required_argument, NULL, 'u' },
+    { "store", required_argument, NULL, 'c' },
+    { "dicomdir", optional_argument, NULL, 'm' },
+    { NULL, 0, NULL, 0 }
+  };
+  char *benchmark_name = NULL;
+  char *export_filename = NULL;
+  char *socket_path = NULL;
+  char *store_port = NULL;
+  options_t options;
+  shard_t shard;
+  int8_t follow_mode = 0;
+  int8_t dicomdir_mode = 0;
+  uint32_t verify = 0;
+  int opt;
+  memset(&options, 0, sizeof (options_t));
+  memset(&shard, 0, sizeof (shard_t));
+  while ((opt = getopt_long(argc, argv, "b:se:w:adip:lfu:c:m::", long_options, NULL)) != -1) {
+    switch (opt) {
+    case 'b':
+      benchmark_name = optarg;
+      break;
+    case 's':
+      options.stats = 1;
+      break;
+    case 'e':
+      export_filename = optarg;
+      break;
+    case 'w':
+      options.window = strtoul(optarg, NULL, 10) << 20;
+      if (options.window == 0) {
+        usage(argv);
+        return ERROR;
+      }
+      break;
+    case 'a':
+      options.advise = 1;
+      break;
+    case 'd':
+      options.direct = 1;
+      break;
+    case 'i':
+      options.io = 1;
+      break;
+    case 'p':
+      if (parse_shard(optarg, &shard) == ERROR) {
+        usage(argv);
+        return ERROR;
+      }
+      break;
+    case 'l':
+      options.lines = 1;
+      break;
+    case 'f':
+      follow_mode = 1;
+      break;
+    case 'u':
+      socket_path = optarg;
+      break;
+    case 'c':
+      store_port = optarg;
+      break;
+    case 'm':
+      dicomdir_mode = 1;
+      if (optarg && (verify = strtoul(optarg, NULL, 10)) == 0) {
+        usage(argv);
+        return ERROR;
+      }
+      break;
+    default:
+      usage(argv);
+      return ERROR;
+    }
+  }
+  if (socket_path) return serve(socket_path);
+  // Direct reads stop at the header
+  if (optind >= argc ||
+      (options.direct && (options.stats || options.window))) {
     usage(argv);
     return ERROR;
   }
+  if (store_port) {
+    if (optind + 1 != argc) {
+      usage(argv);
+      return ERROR;
+    }
+    return store(store_port, argv[optind]);
+  }
+  if (dicomdir_mode) {
+    // The referenced files are not read, but for the ones verified
+    if (options.stats || options.io) {
+      usage(argv);
+      return ERROR;
+    }
+    return read_media(argv + optind, argc - optind, &shard, &options, verify);
+  }
+  if (follow_mode) {
+    // Records are written as the files come
+    options.lines = 1;
+    return follow(argv + optind, argc - optind, &shard, &options);
+  }
   path_t *paths = NULL;
-  for (int32_t i = 1; i < argc; ++i)
-    generate_path(argv[i], &paths);
+  for (int32_t i = optind; i < argc; ++i)
+    generate_path(argv[i], &paths, &shard);
+  if (options.lines) sort_paths(&paths);
   size_t nfiles = count_paths(paths);
-  int8_t ret = parse_files(nfiles, paths);
+  int8_t ret = benchmark_name ? benchmark(benchmark_name, paths) :
+    export_filename ? export_volume(export_filename, paths) :
+    parse_files(nfiles, paths, &options);
   free_paths(&paths);
   return ret;
 }
@@ -0,0 +1,67 @@
+#ifndef __DCMR_H__
+#define __DCMR_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "dcm.h"
+
+typedef struct path_s {
+  char *path;
+  struct path_s *next;
+} path_t;
+
+// Part of the files to process, the files being spread by a hash of their
+// path. count is 0 when all the files are processed.
+typedef struct shard_s {
+  uint32_t index;
+  uint32_t count;
+} shard_t;
+
+typedef struct options_s {
+  int8_t stats;
+  int8_t advise; // Page cache hints, processed files dropped from the cache
+  int8_t direct; // Headers only, read with O_DIRECT
+  int8_t io;     // Per-file I/O counters
+  int8_t lines;  // One record per line, sorted by filename
+  size_t window; // Bytes mapped at once, 0 to map whole files
+} options_t;
+
+typedef struct io_counters_s {
+  uint64_t read_bytes;    // Through read(2) and alike
+  uint64_t storage_bytes; // From the storage, page faults included
+  uint64_t minor_faults;
+  uint64_t major_faults;
+} io_counters_t;
+
+// Attributes of the studies and series found in files, queried by C-FIND
+typedef struct find_index_s find_index_t;
+
+int32_t generate_path(char *arg, path_t **paths, shard_t *shard);
+void free_paths(path_t **paths);
+size_t count_paths(path_t *paths);
+int8_t output(file_t *file, ssize_t offset, dicom_meta_t *dicom_meta,
+              tag_t *tags, options_t *options, io_counters_t *io);
+int32_t parse_files(int32_t nfiles, path_t *path, options_t *options);
+uint8_t in_shard(char *path, shard_t *shard);
+int32_t follow(char **directories, size_t ndirectories, shard_t *shard,
+               options_t *options);
+int32_t serve(char *path);
+int32_t store(char *port, char *directory);
+int32_t read_media(char **args, size_t nargs, shard_t *shard,
+                   options_t *options, uint32_t verify);
+find_index_t *create_find_index(void);
+void free_find_index(find_index_t *index);
+int8_t index_directory(find_index_t *index, char *directory);
+void index_object(find_index_t *index, tag_t *tags);
+ssize_t find_matches(find_index_t *index, uint8_t *identifier, size_t length,
+                     transfer_syntax_t transfer_syntax, uint8_t **responses,
+                     size_t *responses_length, uint16_t *status);
+int32_t benchmark(char *name, path_t *paths);
+int32_t export_volume(char *filename, path_t *paths);
+int8_t output_stats(file_t *file, ssize_t offset, dicom_meta_t *dicom_meta,
+                    tag_t *tags);
+void get_io_counters(io_counters_t *counters);
+void output_io_counters(io_counters_t *before);
+
+#endif // __DCMR_H__
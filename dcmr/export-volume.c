@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "dicom.h"
+#include "dcm.h"
+#include "volume.h"
+#include "export.h"
+#include "dcmr.h"
+
+// Whether filename ends with extension
+static uint8_t has_extension(char *filename, char *extension) {
+  size_t length = strlen(filename);
+  size_t n = strlen(extension);
+  return length >= n && !strcmp(filename + length - n, extension);
+}
+
+static int8_t write_volume(char *filename, volume_t *volume) {
+  uint8_t nrrd = has_extension(filename, ".nrrd");
+  export_type_t type = EXPORT_STORED;
+  // Stored values are copied as is when they allow it, rescaled otherwise
+  if (can_export_stored(volume) == ERROR ||
+      (nrrd && (volume->modality_lut.rescale_slope != 1.0 ||
+                volume->modality_lut.rescale_intercept != 0.0)))
+    type = EXPORT_FLOAT;
+  int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    perror(filename);
+    return ERROR;
+  }
+  int8_t ret = nrrd ? write_nrrd(fd, volume, type, 0) :
+    write_nifti(fd, volume, type, 0);
+  close(fd);
+  return ret;
+}
+
+// Assemble the first series found in paths into a volume and write it to
+// filename, as NRRD if its extension is .nrrd, as NIfTI-1 otherwise
+int32_t export_volume(char *filename, path_t *paths) {
+  volume_t volume;
+  size_t npaths = 0;
+  for (path_t *p = paths; p; p = p->next) ++npaths;
+  char **array = malloc(sizeof (char *) * npaths);
+  if (array == NULL) {
+    perror("malloc");
+    return ERROR;
+  }
+  npaths = 0;
+  for (path_t *p = paths; p; p = p->next) array[npaths++] = p->path;
+  if (build_volume(array, npaths, NULL, 0, &volume) == ERROR) {
+    fprintf(stderr, "error: no series could be assembled into a volume\n");
+    free(array);
+    return ERROR;
+  }
+  if (!volume.uniform)
+    fprintf(stderr, "warning: %s: the spacing between slices is not "
+            "uniform\n", volume.series_instance_uid);
+  int8_t ret = write_volume(filename, &volume);
+  if (ret == ERROR)
+    fprintf(stderr, "error: %s: export failed\n", filename);
+  else
+    printf("{\"filename\":\"%s\",\"SeriesInstanceUID\":\"%s\","
+           "\"slices\":%zu,\"spacing\":%.6g,\"uniform\":%s}", filename,
+           volume.series_instance_uid, volume.nslices, volume.spacing,
+           volume.uniform ? "true" : "false");
+  free_volume(&volume);
+  free(array);
+  return ret;
+}
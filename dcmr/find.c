@@ -0,0 +1,921 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "dicom.h"
+#include "dcm.h"
+#include "parallel.h"
+#include "dcmr.h"
+
+#define ERROR -1
+#define FIND_BUCKETS (1 << 16)
+#define FIND_MAX_KEYS 256
+#define FIND_MAX_VALUE 1024
+
+#define QUERY_RETRIEVE_LEVEL 0x00080052
+#define STUDY_LEVEL 0
+#define SERIES_LEVEL 1
+// How the matching records of an attribute are found
+#define HASHED 1 // By single value or UID list
+#define SORTED 2 // By single value, range or wildcard with a literal prefix
+#define DERIVED 4 // Computed from the series or instances
+
+// Cf DICOM standard Part 4 Sect C.6.2.1
+typedef struct attribute_s {
+  uint32_t number;
+  char     vr[3];
+  uint8_t  level;
+  uint8_t  flags;
+} attribute_t;
+
+// Sorted by number, as the keys of a response
+static const attribute_t g_attributes[] = {
+  { 0x00080020, "DA", STUDY_LEVEL, SORTED },  // StudyDate
+  { 0x00080021, "DA", SERIES_LEVEL, SORTED }, // SeriesDate
+  { 0x00080030, "TM", STUDY_LEVEL, SORTED },  // StudyTime
+  { 0x00080050, "SH", STUDY_LEVEL, HASHED },  // AccessionNumber
+  { 0x00080060, "CS", SERIES_LEVEL, SORTED }, // Modality
+  { 0x00080061, "CS", STUDY_LEVEL, DERIVED }, // ModalitiesInStudy
+  { 0x00080090, "PN", STUDY_LEVEL, 0 },       // ReferringPhysicianName
+  { 0x00081030, "LO", STUDY_LEVEL, 0 },       // StudyDescription
+  { 0x0008103E, "LO", SERIES_LEVEL, 0 },      // SeriesDescription
+  { 0x00100010, "PN", STUDY_LEVEL, SORTED },  // PatientName
+  { 0x00100020, "LO", STUDY_LEVEL, HASHED },  // PatientID
+  { 0x00100030, "DA", STUDY_LEVEL, SORTED },  // PatientBirthDate
+  { 0x00100040, "CS", STUDY_LEVEL, 0 },       // PatientSex
+  { 0x0020000D, "UI", STUDY_LEVEL, HASHED },  // StudyInstanceUID
+  { 0x0020000E, "UI", SERIES_LEVEL, HASHED }, // SeriesInstanceUID
+  { 0x00200010, "SH", STUDY_LEVEL, HASHED },  // StudyID
+  { 0x00200011, "IS", SERIES_LEVEL, 0 },      // SeriesNumber
+  { 0x00201206, "IS", STUDY_LEVEL, DERIVED }, // NumberOfStudyRelatedSeries
+  { 0x00201208, "IS", STUDY_LEVEL, DERIVED }, // NumberOfStudyRelatedInstances
+  { 0x00201209, "IS", SERIES_LEVEL, DERIVED } // NumberOfSeriesRelatedInstances
+};
+
+#define NATTRIBUTES (sizeof (g_attributes) / sizeof (g_attributes[0]))
+#define MODALITIES_IN_STUDY 5
+#define STUDY_INSTANCE_UID_ATTRIBUTE 13
+#define SERIES_INSTANCE_UID_ATTRIBUTE 14
+#define NUMBER_OF_STUDY_RELATED_SERIES 17
+#define NUMBER_OF_STUDY_RELATED_INSTANCES 18
+#define NUMBER_OF_SERIES_RELATED_INSTANCES 19
+
+typedef struct hash_entry_s {
+  char                *value;
+  uint32_t            record;
+  struct hash_entry_s *next;
+} hash_entry_t;
+
+typedef struct sorted_entry_s {
+  char     *value;
+  uint32_t record;
+} sorted_entry_t;
+
+// A study or a series. The values are those of the attributes of its level,
+// NULL when absent.
+typedef struct record_s {
+  char     *values[NATTRIBUTES];
+  uint32_t parent; // Study of a series
+  uint32_t *children; // Series of a study
+  uint32_t nchildren;
+  uint32_t ninstances;
+} record_t;
+
+typedef struct level_s {
+  record_t *records;
+  uint32_t nrecords;
+  uint32_t capacity;
+} level_t;
+
+struct find_index_s {
+  level_t          levels[2];
+  hash_entry_t     **hashes[NATTRIBUTES]; // HASHED attributes only
+  sorted_entry_t   *sorted[NATTRIBUTES]; // SORTED attributes only
+  uint32_t         nsorted[NATTRIBUTES];
+  uint32_t         capacities[NATTRIBUTES];
+  hash_entry_t     **instances; // To count every instance once
+  uint8_t          loading; // Sorted indexes are sorted once loaded
+  pthread_rwlock_t lock;
+};
+
+// A key of an identifier
+typedef struct query_key_s {
+  uint32_t number;
+  char     vr[2];
+  char     *value; // Without padding, empty for universal matching
+  int32_t  attribute; // -1 when not supported
+} query_key_t;
+
+typedef struct query_s {
+  query_key_t keys[FIND_MAX_KEYS];
+  size_t      nkeys;
+  uint8_t     level;
+  uint8_t     unsupported; // Some keys are not supported
+  char        *values; // Where the values of the keys are
+} query_t;
+
+// FNV-1a
+static uint32_t hash_value(char *value) {
+  uint32_t hash = 0x811C9DC5;
+  for (uint8_t *c = (uint8_t *) value; *c; ++c)
+    hash = (hash ^ *c) * 0x01000193;
+  return hash;
+}
+
+static int compare_sorted(const void *a, const void *b) {
+  sorted_entry_t *p = (sorted_entry_t *) a;
+  sorted_entry_t *q = (sorted_entry_t *) b;
+  int c = strcmp(p->value, q->value);
+  if (c) return c;
+  return p->record < q->record ? -1 : p->record > q->record;
+}
+
+// First entry whose value is not less than value, or whose prefix of length
+// characters is greater than value when length is not 0
+static uint32_t lower_bound(sorted_entry_t *entries, uint32_t n, char *value,
+                            size_t length, uint8_t upper) {
+  uint32_t first = 0;
+  while (n) {
+    uint32_t half = n / 2;
+    int c = length ? strncmp(entries[first + half].value, value, length) :
+      strcmp(entries[first + half].value, value);
+    if (c < 0 || (upper && c == 0)) {
+      first += half + 1;
+      n -= half + 1;
+    } else {
+      n = half;
+    }
+  }
+  return first;
+}
+
+static int8_t add_hash(hash_entry_t **buckets, char *value, uint32_t record) {
+  hash_entry_t *entry = malloc(sizeof (hash_entry_t));
+  if (entry == NULL) {
+    perror("malloc");
+    return ERROR;
+  }
+  hash_entry_t **bucket = &buckets[hash_value(value) % FIND_BUCKETS];
+  entry->value = value;
+  entry->record = record;
+  entry->next = *bucket;
+  *bucket = entry;
+  return 0;
+}
+
+static hash_entry_t *find_hash(hash_entry_t **buckets, char *value) {
+  hash_entry_t *entry = buckets[hash_value(value) % FIND_BUCKETS];
+  while (entry && strcmp(entry->value, value)) entry = entry->next;
+  return entry;
+}
+
+// Entries are appended while loading, to be sorted at once
+static int8_t add_sorted(find_index_t *index, size_t attribute, char *value,
+                         uint32_t record) {
+  uint32_t n = index->nsorted[attribute];
+  if (n == index->capacities[attribute]) {
+    uint32_t size = n ? n * 2 : 1024;
+    sorted_entry_t *entries = realloc(index->sorted[attribute],
+                                      sizeof (sorted_entry_t) * size);
+    if (entries == NULL) {
+      perror("realloc");
+      return ERROR;
+    }
+    index->sorted[attribute] = entries;
+    index->capacities[attribute] = size;
+  }
+  sorted_entry_t *entries = index->sorted[attribute];
+  sorted_entry_t entry = { value, record };
+  uint32_t i = index->loading ? n :
+    lower_bound(entries, n, value, 0, 1);
+  memmove(&entries[i + 1], &entries[i], sizeof (sorted_entry_t) * (n - i));
+  entries[i] = entry;
+  ++index->nsorted[attribute];
+  return 0;
+}
+
+// Set a value absent from a record, other instances of a study or a series
+// may miss some
+static int8_t set_value(find_index_t *index, uint8_t level, uint32_t record,
+                        size_t attribute, char *value) {
+  char **field = &index->levels[level].records[record].values[attribute];
+  if (*field || *value == 0) return 0;
+  if ((*field = strdup(value)) == NULL) {
+    perror("strdup");
+    return ERROR;
+  }
+  if (g_attributes[attribute].flags & HASHED)
+    return add_hash(index->hashes[attribute], *field, record);
+  if (g_attributes[attribute].flags & SORTED)
+    return add_sorted(index, attribute, *field, record);
+  return 0;
+}
+
+static ssize_t add_record(find_index_t *index, uint8_t level) {
+  level_t *records = &index->levels[level];
+  if (records->nrecords == records->capacity) {
+    uint32_t size = records->capacity ? records->capacity * 2 : 1024;
+    record_t *array = realloc(records->records, sizeof (record_t) * size);
+    if (array == NULL) {
+      perror("realloc");
+      return ERROR;
+    }
+    records->records = array;
+    records->capacity = size;
+  }
+  memset(&records->records[records->nrecords], 0, sizeof (record_t));
+  return records->nrecords++;
+}
+
+static int8_t add_child(record_t *study, uint32_t series) {
+  if ((study->nchildren & (study->nchildren - 1)) == 0) {
+    uint32_t *children = realloc(study->children, sizeof (uint32_t) *
+                                 (study->nchildren ? study->nchildren * 2 : 1));
+    if (children == NULL) {
+      perror("realloc");
+      return ERROR;
+    }
+    study->children = children;
+  }
+  study->children[study->nchildren++] = series;
+  return 0;
+}
+
+// The study or the series of an instance, added if new
+static ssize_t get_record(find_index_t *index, uint8_t level, size_t attribute,
+                          char *uid, uint32_t parent) {
+  hash_entry_t *entry = find_hash(index->hashes[attribute], uid);
+  if (entry) return entry->record;
+  ssize_t record = add_record(index, level);
+  if (record == ERROR ||
+      set_value(index, level, record, attribute, uid) == ERROR)
+    return ERROR;
+  if (level == SERIES_LEVEL) {
+    index->levels[SERIES_LEVEL].records[record].parent = parent;
+    if (add_child(&index->levels[STUDY_LEVEL].records[parent],
+                  record) == ERROR)
+      return ERROR;
+  }
+  return record;
+}
+
+// Copy the value of a tag without its padding
+static char *copy_value(tag_t *tags, uint32_t number, char *value) {
+  tag_t *tag = get_tag(tags, number);
+  *value = 0;
+  if (tag == NULL || !is_str_of_char_vr(tag->vr) ||
+      tag->datasize >= FIND_MAX_VALUE)
+    return value;
+  size_t length = tag->datasize;
+  char *s = (char *) tag->data;
+  while (length && (s[length - 1] == ' ' || s[length - 1] == 0)) --length;
+  while (length && *s == ' ') ++s, --length;
+  memcpy(value, s, length);
+  value[length] = 0;
+  return value;
+}
+
+static int8_t add_modality(find_index_t *index, record_t *study,
+                           uint32_t record, char *modality) {
+  char modalities[FIND_MAX_VALUE];
+  char *current = study->values[MODALITIES_IN_STUDY];
+  if (*modality == 0) return 0;
+  if (current == NULL)
+    return set_value(index, STUDY_LEVEL, record, MODALITIES_IN_STUDY,
+                     modality);
+  size_t length = strlen(modality);
+  for (char *p = current; p; p = strchr(p, '\\') ? strchr(p, '\\') + 1 : NULL)
+    if (!strncmp(p, modality, length) && (p[length] == '\\' || !p[length]))
+      return 0;
+  size_t current_length = strlen(current);
+  if (current_length + length + 2 > FIND_MAX_VALUE) return 0;
+  memcpy(modalities, current, current_length);
+  modalities[current_length] = '\\';
+  memcpy(modalities + current_length + 1, modality, length + 1);
+  char *value = strdup(modalities);
+  if (value == NULL) {
+    perror("strdup");
+    return ERROR;
+  }
+  free(current);
+  study->values[MODALITIES_IN_STUDY] = value;
+  return 0;
+}
+
+static int8_t add_instance(find_index_t *index, tag_t *tags) {
+  char value[FIND_MAX_VALUE];
+  char *sop_instance = copy_value(tags, SOP_INSTANCE_UID, value);
+  if (*sop_instance == 0 || find_hash(index->instances, sop_instance) ||
+      *copy_value(tags, STUDY_INSTANCE_UID, value) == 0 ||
+      *copy_value(tags, SERIES_INSTANCE_UID, value) == 0)
+    return 0;
+  copy_value(tags, SOP_INSTANCE_UID, value);
+  if ((sop_instance = strdup(sop_instance)) == NULL) {
+    perror("strdup");
+    return ERROR;
+  }
+  if (add_hash(index->instances, sop_instance, 0) == ERROR) {
+    free(sop_instance);
+    return ERROR;
+  }
+  ssize_t study = get_record(index, STUDY_LEVEL, STUDY_INSTANCE_UID_ATTRIBUTE,
+                             copy_value(tags, STUDY_INSTANCE_UID, value), 0);
+  if (study == ERROR) return ERROR;
+  ssize_t series = get_record(index, SERIES_LEVEL,
+                              SERIES_INSTANCE_UID_ATTRIBUTE,
+                              copy_value(tags, SERIES_INSTANCE_UID, value),
+                              study);
+  if (series == ERROR) return ERROR;
+  for (size_t i = 0; i < NATTRIBUTES; ++i) {
+    const attribute_t *attribute = &g_attributes[i];
+    if (attribute->flags & DERIVED) continue;
+    if (set_value(index, attribute->level, attribute->level == STUDY_LEVEL ?
+                  study : series, i,
+                  copy_value(tags, attribute->number, value)) == ERROR)
+      return ERROR;
+  }
+  level_t *studies = &index->levels[STUDY_LEVEL];
+  level_t *serieses = &index->levels[SERIES_LEVEL];
+  ++studies->records[study].ninstances;
+  ++serieses->records[series].ninstances;
+  return add_modality(index, &studies->records[study], study,
+                      copy_value(tags, 0x00080060, value));
+}
+
+// Index an instance in its study and its series. Instances already indexed,
+// or whose study or series is not identified, are ignored.
+void index_object(find_index_t *index, tag_t *tags) {
+  pthread_rwlock_wrlock(&index->lock);
+  add_instance(index, tags);
+  pthread_rwlock_unlock(&index->lock);
+}
+
+typedef struct load_s {
+  find_index_t *index;
+  char         **paths;
+} load_t;
+
+static int8_t load_task(void *context, size_t i) {
+  load_t *load = (load_t *) context;
+  static __thread tag_t tags[MAX_LOADED_TAG];
+  file_t file;
+  dicom_meta_t dicom_meta;
+  memset(&file, 0, sizeof (file_t));
+  if (load_file(load->paths[i], &file) == ERROR) return 0;
+  if (decode_dataset(&file, &dicom_meta, tags, MAX_LOADED_TAG) != ERROR)
+    index_object(load->index, tags);
+  unmap_file(&file);
+  close_file(&file);
+  return 0;
+}
+
+// Index the files found in directory, the temporary files of the objects
+// being received (hidden) excepted
+int8_t index_directory(find_index_t *index, char *directory) {
+  path_t *paths = NULL;
+  shard_t shard = { 0, 0 };
+  load_t load = { index, NULL };
+  struct timespec begin, end;
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  generate_path(directory, &paths, &shard);
+  size_t npaths = 0;
+  load.paths = malloc(sizeof (char *) * (count_paths(paths) + 1));
+  if (load.paths == NULL) {
+    perror("malloc");
+    free_paths(&paths);
+    return ERROR;
+  }
+  for (path_t *p = paths; p; p = p->next) {
+    char *name = strrchr(p->path, '/');
+    if ((name ? name[1] : p->path[0]) != '.') load.paths[npaths++] = p->path;
+  }
+  index->loading = 1;
+  parallel_for(npaths, 0, load_task, &load);
+  index->loading = 0;
+  for (size_t i = 0; i < NATTRIBUTES; ++i)
+    if (index->sorted[i])
+      qsort(index->sorted[i], index->nsorted[i], sizeof (sorted_entry_t),
+            compare_sorted);
+  free(load.paths);
+  free_paths(&paths);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  fprintf(stderr, "{\"indexed\":%zu,\"studies\":%u,\"series\":%u,"
+          "\"ms\":%.0f}\n", npaths, index->levels[STUDY_LEVEL].nrecords,
+          index->levels[SERIES_LEVEL].nrecords,
+          (end.tv_sec - begin.tv_sec) * 1e3 +
+          (end.tv_nsec - begin.tv_nsec) / 1e6);
+  return 0;
+}
+
+find_index_t *create_find_index(void) {
+  find_index_t *index = calloc(1, sizeof (find_index_t));
+  if (index == NULL) {
+    perror("calloc");
+    return NULL;
+  }
+  pthread_rwlock_init(&index->lock, NULL);
+  index->instances = calloc(FIND_BUCKETS, sizeof (hash_entry_t *));
+  for (size_t i = 0; index->instances && i < NATTRIBUTES; ++i) {
+    if (!(g_attributes[i].flags & HASHED)) continue;
+    if ((index->hashes[i] = calloc(FIND_BUCKETS,
+                                   sizeof (hash_entry_t *))) == NULL)
+      break;
+  }
+  for (size_t i = 0; i < NATTRIBUTES; ++i) {
+    if (index->instances == NULL ||
+        ((g_attributes[i].flags & HASHED) && index->hashes[i] == NULL)) {
+      perror("calloc");
+      free_find_index(index);
+      return NULL;
+    }
+  }
+  return index;
+}
+
+static void free_buckets(hash_entry_t **buckets, uint8_t values) {
+  if (buckets == NULL) return;
+  for (size_t i = 0; i < FIND_BUCKETS; ++i) {
+    while (buckets[i]) {
+      hash_entry_t *next = buckets[i]->next;
+      if (values) free(buckets[i]->value);
+      free(buckets[i]);
+      buckets[i] = next;
+    }
+  }
+  free(buckets);
+}
+
+void free_find_index(find_index_t *index) {
+  for (uint8_t level = STUDY_LEVEL; level <= SERIES_LEVEL; ++level) {
+    for (uint32_t i = 0; i < index->levels[level].nrecords; ++i) {
+      record_t *record = &index->levels[level].records[i];
+      for (size_t j = 0; j < NATTRIBUTES; ++j) free(record->values[j]);
+      free(record->children);
+    }
+    free(index->levels[level].records);
+  }
+  for (size_t i = 0; i < NATTRIBUTES; ++i) {
+    free_buckets(index->hashes[i], 0);
+    free(index->sorted[i]);
+  }
+  free_buckets(index->instances, 1);
+  pthread_rwlock_destroy(&index->lock);
+  free(index);
+}
+
+// Cf DICOM standard Part 4 Sect C.2.2.2.4
+static uint8_t match_wildcard(char *pattern, char *value) {
+  char *star = NULL;
+  char *resume = NULL;
+  while (*value) {
+    if (*pattern == '*') {
+      star = pattern++;
+      resume = value;
+    } else if (*pattern == '?' || *pattern == *value) {
+      ++pattern;
+      ++value;
+    } else if (star) {
+      pattern = star + 1;
+      value = ++resume;
+    } else {
+      return 0;
+    }
+  }
+  while (*pattern == '*') ++pattern;
+  return *pattern == 0;
+}
+
+static uint8_t is_range_vr(char *vr) {
+  return !strncmp(vr, "DA", 2) || !strncmp(vr, "TM", 2) ||
+    !strncmp(vr, "DT", 2);
+}
+
+// Match a value against a key which is not universal
+// Cf DICOM standard Part 4 Sect C.2.2.2
+static uint8_t match_one(query_key_t *key, char *value) {
+  char *dash;
+  if (!strncmp(key->vr, "UI", 2)) {
+    // UID list matching
+    size_t length = strlen(value);
+    for (char *p = key->value; p; p = strchr(p, '\\') ? strchr(p, '\\') + 1 :
+         NULL)
+      if (!strncmp(p, value, length) && (p[length] == '\\' || !p[length]))
+        return 1;
+    return 0;
+  }
+  if (is_range_vr(key->vr) && (dash = strchr(key->value, '-'))) {
+    // Range matching, the upper bound comparing on its length only so that
+    // 1200 includes the fractions of second of 120000
+    size_t length = strlen(dash + 1);
+    if (*value == 0) return 0;
+    *dash = 0;
+    uint8_t match = strcmp(value, key->value) >= 0 &&
+      (length == 0 || strncmp(value, dash + 1, length) <= 0);
+    *dash = '-';
+    return match;
+  }
+  if (strpbrk(key->value, "*?")) return match_wildcard(key->value, value);
+  return !strcmp(key->value, value);
+}
+
+// A value of a multi-valued attribute matches if one of its values does
+static uint8_t match_attribute(query_key_t *key, char *value) {
+  char component[FIND_MAX_VALUE];
+  if (!strchr(value, '\\')) return match_one(key, value);
+  for (char *p = value; p;) {
+    char *end = strchr(p, '\\');
+    size_t length = end ? (size_t) (end - p) : strlen(p);
+    memcpy(component, p, length);
+    component[length] = 0;
+    if (match_one(key, component)) return 1;
+    p = end ? end + 1 : NULL;
+  }
+  return 0;
+}
+
+// A multi-valued key matches if one of its values does, UIDs being matched
+// as a list by match_one
+// Cf DICOM standard Part 4 Sect C.2.2.2.8
+static uint8_t match_key(query_key_t *key, char *value) {
+  if (*key->value == 0 || !strcmp(key->value, "*")) return 1;
+  if (value == NULL) return 0;
+  if (!strncmp(key->vr, "UI", 2) || !strchr(key->value, '\\'))
+    return match_attribute(key, value);
+  char *values = key->value;
+  uint8_t match = 0;
+  for (char *p = values; p && !match;) {
+    char *end = strchr(p, '\\');
+    if (end) *end = 0;
+    key->value = p;
+    match = match_attribute(key, value);
+    if (end) *end = '\\';
+    p = end ? end + 1 : NULL;
+  }
+  key->value = values;
+  return match;
+}
+
+// The value of an attribute for a study or a series, from its study for the
+// attributes of the study level
+static char *get_value(find_index_t *index, uint8_t level, uint32_t record,
+                       size_t attribute, char buffer[16]) {
+  record_t *records = index->levels[level].records;
+  if (g_attributes[attribute].level == STUDY_LEVEL && level == SERIES_LEVEL) {
+    record = records[record].parent;
+    level = STUDY_LEVEL;
+    records = index->levels[level].records;
+  }
+  switch (attribute) {
+  case NUMBER_OF_STUDY_RELATED_SERIES:
+    snprintf(buffer, 16, "%u", records[record].nchildren);
+    return buffer;
+  case NUMBER_OF_STUDY_RELATED_INSTANCES:
+  case NUMBER_OF_SERIES_RELATED_INSTANCES:
+    snprintf(buffer, 16, "%u", records[record].ninstances);
+    return buffer;
+  default:
+    return records[record].values[attribute];
+  }
+}
+
+static uint8_t match_record(find_index_t *index, query_t *query,
+                            uint32_t record) {
+  char buffer[16];
+  for (size_t i = 0; i < query->nkeys; ++i) {
+    query_key_t *key = &query->keys[i];
+    if (key->attribute < 0) continue;
+    if (!match_key(key, get_value(index, query->level, record, key->attribute,
+                                  buffer)))
+      return 0;
+  }
+  return 1;
+}
+
+static int8_t add_candidate(uint32_t **candidates, size_t *n,
+                            size_t *capacity, uint32_t record) {
+  if (*n == *capacity) {
+    size_t size = *capacity ? *capacity * 2 : 64;
+    uint32_t *array = realloc(*candidates, sizeof (uint32_t) * size);
+    if (array == NULL) {
+      perror("realloc");
+      return ERROR;
+    }
+    *candidates = array;
+    *capacity = size;
+  }
+  (*candidates)[(*n)++] = record;
+  return 0;
+}
+
+// Add the records of the query level holding a record of an index, the
+// series of a study for a study attribute in a series query
+static int8_t add_candidates(find_index_t *index, query_t *query,
+                             size_t attribute, uint32_t record,
+                             uint32_t **candidates, size_t *n,
+                             size_t *capacity) {
+  if (g_attributes[attribute].level == query->level)
+    return add_candidate(candidates, n, capacity, record);
+  record_t *study = &index->levels[STUDY_LEVEL].records[record];
+  for (uint32_t i = 0; i < study->nchildren; ++i)
+    if (add_candidate(candidates, n, capacity, study->children[i]) == ERROR)
+      return ERROR;
+  return 0;
+}
+
+// Records found by the index of a key, ERROR if its index cannot answer it
+static ssize_t find_candidates(find_index_t *index, query_t *query,
+                               query_key_t *key, uint32_t **candidates) {
+  size_t n = 0;
+  size_t capacity = 0;
+  size_t attribute = key->attribute;
+  uint8_t flags = g_attributes[attribute].flags;
+  char *value = key->value;
+  *candidates = NULL;
+  // The values of a multi-valued key are matched by the scan
+  if (strncmp(key->vr, "UI", 2) && strchr(value, '\\')) return ERROR;
+  if (flags & HASHED) {
+    if (strpbrk(value, "*?")) return ERROR;
+    // A single value or a list of UIDs
+    for (char *p = value; p;) {
+      char uid[FIND_MAX_VALUE];
+      char *end = strncmp(key->vr, "UI", 2) ? NULL : strchr(p, '\\');
+      size_t length = end ? (size_t) (end - p) : strlen(p);
+      memcpy(uid, p, length);
+      uid[length] = 0;
+      for (hash_entry_t *entry =
+             index->hashes[attribute][hash_value(uid) % FIND_BUCKETS];
+           entry; entry = entry->next)
+        if (!strcmp(entry->value, uid) &&
+            add_candidates(index, query, attribute, entry->record,
+                           candidates, &n, &capacity) == ERROR)
+          return ERROR;
+      p = end ? end + 1 : NULL;
+    }
+    return n;
+  }
+  if (!(flags & SORTED)) return ERROR;
+  sorted_entry_t *entries = index->sorted[attribute];
+  uint32_t nentries = index->nsorted[attribute];
+  uint32_t first, last;
+  char *dash = is_range_vr(key->vr) ? strchr(value, '-') : NULL;
+  char *wildcard = strpbrk(value, "*?");
+  if (dash) {
+    *dash = 0;
+    first = lower_bound(entries, nentries, value, 0, 0);
+    last = dash[1] ? lower_bound(entries, nentries, dash + 1,
+                                 strlen(dash + 1), 1) : nentries;
+    *dash = '-';
+  } else if (wildcard) {
+    size_t length = wildcard - value;
+    if (length == 0) return ERROR;
+    first = lower_bound(entries, nentries, value, length, 0);
+    last = lower_bound(entries, nentries, value, length, 1);
+  } else {
+    first = lower_bound(entries, nentries, value, 0, 0);
+    last = lower_bound(entries, nentries, value, 0, 1);
+  }
+  for (uint32_t i = first; i < last; ++i)
+    if (add_candidates(index, query, attribute, entries[i].record,
+                       candidates, &n, &capacity) == ERROR)
+      return ERROR;
+  return n;
+}
+
+static int compare_records(const void *a, const void *b) {
+  uint32_t x = *(uint32_t *) a;
+  uint32_t y = *(uint32_t *) b;
+  return x < y ? -1 : x > y;
+}
+
+// The records of the fewest candidates found by the indexes of the keys, all
+// the records of the level when no key can be answered by an index
+static ssize_t select_candidates(find_index_t *index, query_t *query,
+                                 uint32_t **candidates) {
+  ssize_t best = ERROR;
+  *candidates = NULL;
+  for (size_t i = 0; i < query->nkeys; ++i) {
+    query_key_t *key = &query->keys[i];
+    uint32_t *records;
+    if (key->attribute < 0 || *key->value == 0 || !strcmp(key->value, "*"))
+      continue;
+    ssize_t n = find_candidates(index, query, key, &records);
+    if (n == ERROR || (best != ERROR && n >= best)) {
+      free(records);
+      continue;
+    }
+    free(*candidates);
+    *candidates = records;
+    best = n;
+  }
+  if (best != ERROR) {
+    // Lists of UIDs may repeat records
+    qsort(*candidates, best, sizeof (uint32_t), compare_records);
+    ssize_t n = 0;
+    for (ssize_t i = 0; i < best; ++i)
+      if (n == 0 || (*candidates)[n - 1] != (*candidates)[i])
+        (*candidates)[n++] = (*candidates)[i];
+    return n;
+  }
+  uint32_t nrecords = index->levels[query->level].nrecords;
+  if ((*candidates = malloc(sizeof (uint32_t) * (nrecords + 1))) == NULL) {
+    perror("malloc");
+    return ERROR;
+  }
+  for (uint32_t i = 0; i < nrecords; ++i) (*candidates)[i] = i;
+  return nrecords;
+}
+
+static int32_t get_attribute(uint32_t number, uint8_t level) {
+  for (size_t i = 0; i < NATTRIBUTES; ++i)
+    if (g_attributes[i].number == number)
+      return g_attributes[i].level <= level ? (int32_t) i : -1;
+  return -1;
+}
+
+static int compare_keys(const void *a, const void *b) {
+  uint32_t x = ((query_key_t *) a)->number;
+  uint32_t y = ((query_key_t *) b)->number;
+  return x < y ? -1 : x > y;
+}
+
+static void add_key(query_t *query, uint32_t number, char *vr, char *value) {
+  query_key_t *key = &query->keys[query->nkeys++];
+  key->number = number;
+  key->vr[0] = vr[0];
+  key->vr[1] = vr[1];
+  key->value = value;
+}
+
+// Decode the keys of an identifier, the sequences being skipped, and add
+// the unique keys of the level when missing
+// Cf DICOM standard Part 4 Sect C.4.1.1.3
+static int8_t parse_query(uint8_t *identifier, size_t length,
+                          transfer_syntax_t transfer_syntax, query_t *query) {
+  file_t file;
+  dicom_meta_t dicom_meta;
+  ssize_t offset = 0;
+  char *values = query->values;
+  memset(&file, 0, sizeof (file_t));
+  memset(&dicom_meta, 0, sizeof (dicom_meta_t));
+  file.content = identifier;
+  file.size = length;
+  dicom_meta.transfer_syntax = transfer_syntax;
+  query->nkeys = 0;
+  query->unsupported = 0;
+  while (offset < file.size) {
+    tag_t tag;
+    ssize_t shift = transfer_syntax == IMPLICIT ?
+      decode_implicit_tag(&file, offset, &tag) :
+      decode_explicit_tag(&file, offset, &tag);
+    ssize_t next = skip_tag(&file, offset, &dicom_meta);
+    if (shift <= 0 || next == ERROR || next > file.size) return ERROR;
+    if (tag.datasize != UNDEFINED_LENGTH && !TYPE_OF((&tag), "SQ") &&
+        query->nkeys < FIND_MAX_KEYS - 2) {
+      size_t size = tag.datasize;
+      char *s = (char *) tag.data;
+      while (size && (s[size - 1] == ' ' || s[size - 1] == 0)) --size;
+      while (size && *s == ' ') ++s, --size;
+      if (size >= FIND_MAX_VALUE) size = FIND_MAX_VALUE - 1;
+      memcpy(values, s, size);
+      values[size] = 0;
+      add_key(query, (uint32_t) (tag.group << 16) + tag.element, tag.vr,
+              values);
+      values += size + 1;
+    } else {
+      query->unsupported = 1;
+    }
+    offset = next;
+  }
+  query_key_t *level = NULL;
+  for (size_t i = 0; i < query->nkeys; ++i)
+    if (query->keys[i].number == QUERY_RETRIEVE_LEVEL) level = &query->keys[i];
+  if (level == NULL) return ERROR;
+  if (!strcmp(level->value, "STUDY")) query->level = STUDY_LEVEL;
+  else if (!strcmp(level->value, "SERIES")) query->level = SERIES_LEVEL;
+  else return ERROR;
+  uint8_t study = 0;
+  uint8_t series = query->level != SERIES_LEVEL;
+  for (size_t i = 0; i < query->nkeys; ++i) {
+    query_key_t *key = &query->keys[i];
+    if (key->number == STUDY_INSTANCE_UID) study = 1;
+    if (key->number == SERIES_INSTANCE_UID) series = 1;
+    key->attribute = get_attribute(key->number, query->level);
+    if (key->attribute < 0 && key->number != QUERY_RETRIEVE_LEVEL &&
+        key->number != 0x00080005)
+      query->unsupported = 1;
+  }
+  *values = 0;
+  if (!study) {
+    add_key(query, STUDY_INSTANCE_UID, "UI", values);
+    query->keys[query->nkeys - 1].attribute = STUDY_INSTANCE_UID_ATTRIBUTE;
+  }
+  if (!series) {
+    add_key(query, SERIES_INSTANCE_UID, "UI", values);
+    query->keys[query->nkeys - 1].attribute = SERIES_INSTANCE_UID_ATTRIBUTE;
+  }
+  qsort(query->keys, query->nkeys, sizeof (query_key_t), compare_keys);
+  return 0;
+}
+
+static void put_value(FILE *out, query_key_t *key, char *value,
+                      transfer_syntax_t transfer_syntax) {
+  uint16_t group = key->number >> 16;
+  uint16_t element = key->number;
+  uint32_t length = value ? strlen(value) : 0;
+  uint32_t size = length + (length & 1);
+  fwrite(&group, 2, 1, out);
+  fwrite(&element, 2, 1, out);
+  if (transfer_syntax == IMPLICIT) {
+    fwrite(&size, 4, 1, out);
+  } else if (is_double_length_vr(key->vr)) {
+    uint16_t reserved = 0;
+    fwrite(key->vr, 2, 1, out);
+    fwrite(&reserved, 2, 1, out);
+    fwrite(&size, 4, 1, out);
+  } else {
+    uint16_t short_size = size;
+    fwrite(key->vr, 2, 1, out);
+    fwrite(&short_size, 2, 1, out);
+  }
+  if (length) fwrite(value, length, 1, out);
+  if (length & 1) fputc(strncmp(key->vr, "UI", 2) ? ' ' : 0, out);
+}
+
+// The identifier of a match holds every key of the query, empty for those
+// which are not supported
+static void put_identifier(FILE *out, find_index_t *index, query_t *query,
+                           uint32_t record,
+                           transfer_syntax_t transfer_syntax) {
+  char buffer[16];
+  char *identifier;
+  size_t length;
+  FILE *stream = open_memstream(&identifier, &length);
+  if (stream == NULL) {
+    perror("open_memstream");
+    return;
+  }
+  for (size_t i = 0; i < query->nkeys; ++i) {
+    query_key_t *key = &query->keys[i];
+    char *value = key->attribute >= 0 ?
+      get_value(index, query->level, record, key->attribute, buffer) :
+      key->number == QUERY_RETRIEVE_LEVEL ? key->value : NULL;
+    put_value(stream, key, value, transfer_syntax);
+  }
+  fclose(stream);
+  uint32_t size = length;
+  fwrite(&size, 4, 1, out);
+  fwrite(identifier, length, 1, out);
+  free(identifier);
+}
+
+// Match the identifier of a C-FIND-RQ, of the study or series level, against
+// the index. The identifiers of the matches are written in responses, each
+// preceded by its length, to be sent once the index is released. Return the
+// number of matches, or ERROR with the failure status set.
+// Cf DICOM standard Part 4 Sect C.4.1
+ssize_t find_matches(find_index_t *index, uint8_t *identifier, size_t length,
+                     transfer_syntax_t transfer_syntax, uint8_t **responses,
+                     size_t *responses_length, uint16_t *status) {
+  query_t *query = malloc(sizeof (query_t));
+  uint32_t *candidates = NULL;
+  ssize_t nmatches = 0;
+  *responses = NULL;
+  if (query == NULL || (query->values = malloc(length + FIND_MAX_KEYS)) ==
+      NULL) {
+    perror("malloc");
+    free(query);
+    *status = 0xC000; // Unable to process
+    return ERROR;
+  }
+  if (parse_query(identifier, length, transfer_syntax, query) == ERROR) {
+    *status = 0xA900; // Identifier does not match SOP class
+    free(query->values);
+    free(query);
+    return ERROR;
+  }
+  FILE *out = open_memstream((char **) responses, responses_length);
+  if (out == NULL) perror("open_memstream");
+  pthread_rwlock_rdlock(&index->lock);
+  ssize_t n = out ? select_candidates(index, query, &candidates) : ERROR;
+  for (ssize_t i = 0; i < n; ++i) {
+    if (!match_record(index, query, candidates[i])) continue;
+    put_identifier(out, index, query, candidates[i], transfer_syntax);
+    ++nmatches;
+  }
+  pthread_rwlock_unlock(&index->lock);
+  if (out) fclose(out);
+  free(candidates);
+  free(query->values);
+  *status = query->unsupported ? 0xFF01 : 0xFF00; // Pending
+  free(query);
+  if (n == ERROR) {
+    free(*responses);
+    *responses = NULL;
+    *status = 0xC000;
+    return ERROR;
+  }
+  return nmatches;
+}
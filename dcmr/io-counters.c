@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "dcmr.h"
+
+// Read the I/O accounting of the process, if available. Return the number of
+// bytes read to do so.
+// Cf proc(5) /proc/pid/io
+static size_t get_proc_io(io_counters_t *counters) {
+  char buffer[512];
+  FILE *f = fopen("/proc/self/io", "r");
+  if (f == NULL) return 0;
+  size_t length = fread(buffer, 1, sizeof (buffer) - 1, f);
+  fclose(f);
+  buffer[length] = 0;
+  char *rchar = strstr(buffer, "rchar:");
+  char *read_bytes = strstr(buffer, "read_bytes:");
+  if (rchar) counters->read_bytes = strtoull(rchar + 6, NULL, 10);
+  if (read_bytes)
+    counters->storage_bytes = strtoull(read_bytes + 11, NULL, 10);
+  return length;
+}
+
+static void get_faults(io_counters_t *counters) {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    counters->minor_faults = usage.ru_minflt;
+    counters->major_faults = usage.ru_majflt;
+  }
+}
+
+// Snapshot the counters. Reading them is included in the snapshot so that it
+// does not count in what is measured from it.
+void get_io_counters(io_counters_t *counters) {
+  memset(counters, 0, sizeof (io_counters_t));
+  counters->read_bytes += get_proc_io(counters);
+  get_faults(counters);
+}
+
+// Print the I/O spent on a file since before as an "IO" member of its record
+void output_io_counters(io_counters_t *before) {
+  io_counters_t after;
+  memset(&after, 0, sizeof (io_counters_t));
+  get_faults(&after);
+  get_proc_io(&after);
+  printf(",\"IO\":{\"readBytes\":%llu,\"storageBytes\":%llu,"
+         "\"minorFaults\":%llu,\"majorFaults\":%llu}",
+         (unsigned long long) (after.read_bytes - before->read_bytes),
+         (unsigned long long) (after.storage_bytes - before->storage_bytes),
+         (unsigned long long) (after.minor_faults - before->minor_faults),
+         (unsigned long long) (after.major_faults - before->major_faults));
+}
@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "dicom.h"
+#include "dcm.h"
+#include "dicomdir.h"
+#include "dcmr.h"
+
+#define ERROR -1
+
+// State of the walk of the DICOMDIR files given
+typedef struct media_s {
+  char     directory[PATH_MAX]; // Of the DICOMDIR, file IDs being relative
+  shard_t  *shard;
+  uint32_t verify; // One referenced file out of verify checked, 0 for none
+  char     **records;
+  size_t   nrecords;
+  size_t   capacity;
+  uint64_t verified;
+  uint64_t mismatches;
+} media_t;
+
+// Trimmed value of a string attribute of a record
+static char *get_record_string(file_t *file, dicom_meta_t *dicom_meta,
+                               directory_record_t *record, uint32_t number,
+                               char *value, size_t size) {
+  tag_t tag;
+  if (get_record_attribute(file, dicom_meta, record, number, &tag) == ERROR)
+    return NULL;
+  size_t length = tag.datasize < size ? tag.datasize : size - 1;
+  memcpy(value, tag.data, length);
+  value[length] = 0;
+  return trim(value, NULL);
+}
+
+// Value of an attribute of the closest record holding it, from the record
+// up to the root entity, as the StudyInstanceUID of the study of an image
+static char *get_entity_string(file_t *file, dicom_meta_t *dicom_meta,
+                               directory_record_t *records, size_t depth,
+                               uint32_t number, char *value, size_t size) {
+  for (size_t i = depth; i > 0; --i)
+    if (get_record_string(file, dicom_meta, &records[i - 1], number, value,
+                          size))
+      return value;
+  *value = 0;
+  return NULL;
+}
+
+static uint8_t same_uid(char *uid, char *expected) {
+  return uid != NULL && !strcmp(trim(uid, NULL), expected);
+}
+
+// Check the file referenced by a record against the UIDs of the record
+static void verify_file(media_t *media, char *path, char *sop_instance,
+                        char *study, char *series) {
+  file_t file;
+  dicom_meta_t dicom_meta;
+  tag_t tags[MAX_LOADED_TAG];
+  size_t ntags = 0;
+  uint8_t match = 0;
+  ++media->verified;
+  memset(&file, 0, sizeof (file_t));
+  memset(&dicom_meta, 0, sizeof (dicom_meta_t));
+  memset(&tags, 0, sizeof (tag_t) * MAX_LOADED_TAG);
+  if (load_file(path, &file) == ERROR) {
+    ++media->mismatches;
+    return;
+  }
+  if (is_dicom(&file)) {
+    ssize_t offset = check_preamble(&file, 0);
+    offset = check_header(&file, offset);
+    offset = decode_meta_data(&file, offset, &dicom_meta);
+    if (offset >= 0) {
+      decode_n_tags(&file, offset, &dicom_meta, tags, &ntags, MAX_LOADED_TAG);
+      char *study_uid = (char *) get_tag_data(tags, STUDY_INSTANCE_UID);
+      char *series_uid = (char *) get_tag_data(tags, SERIES_INSTANCE_UID);
+      match = same_uid(dicom_meta.media_storage_sop_instance_uid,
+                       sop_instance) &&
+        same_uid(study_uid, study) && same_uid(series_uid, series);
+      free(study_uid);
+      free(series_uid);
+    }
+  }
+  if (!match) {
+    fprintf(stderr, "error: %s does not match its directory record\n", path);
+    ++media->mismatches;
+  }
+  unmap_file(&file);
+  close_file(&file);
+}
+
+static int8_t add_record(media_t *media, char *record) {
+  if (media->nrecords == media->capacity) {
+    size_t size = media->capacity ? media->capacity * 2 : 256;
+    char **records = realloc(media->records, sizeof (char *) * size);
+    if (records == NULL) {
+      perror("realloc");
+      return ERROR;
+    }
+    media->records = records;
+    media->capacity = size;
+  }
+  if ((media->records[media->nrecords] = strdup(record)) == NULL) {
+    perror("strdup");
+    return ERROR;
+  }
+  ++media->nrecords;
+  return 0;
+}
+
+// Record the file a directory record refers to, IMAGE records for instance.
+// The components of its file ID are the directories down to it.
+// Cf DICOM standard Part 3 Sect F.3.2.2 and Part 10 Sect 8.2
+static int8_t read_record(file_t *file, dicom_meta_t *dicom_meta,
+                          directory_record_t *records, size_t depth,
+                          void *context) {
+  media_t *media = (media_t *) context;
+  char file_id[PATH_MAX];
+  char path[PATH_MAX];
+  char sop_instance[UID_MAX_SIZE + 1];
+  char study[UID_MAX_SIZE + 1];
+  char series[UID_MAX_SIZE + 1];
+  char record[PATH_MAX + 512];
+  if (get_record_string(file, dicom_meta, &records[depth - 1],
+                        REFERENCED_FILE_ID, file_id, PATH_MAX) == NULL ||
+      *file_id == 0)
+    return 0;
+  for (char *c = file_id; *c; ++c)
+    if (*c == '\\') *c = '/';
+  size_t length = strlen(media->directory);
+  if (length + strlen(file_id) >= PATH_MAX) {
+    fprintf(stderr, "error: %s%s: path too long\n", media->directory,
+            file_id);
+    return 0;
+  }
+  memcpy(path, media->directory, length);
+  strcpy(path + length, file_id);
+  if (!in_shard(path, media->shard)) return 0;
+  if (get_record_string(file, dicom_meta, &records[depth - 1],
+                        REFERENCED_SOP_INSTANCE_UID_IN_FILE, sop_instance,
+                        sizeof (sop_instance)) == NULL)
+    *sop_instance = 0;
+  get_entity_string(file, dicom_meta, records, depth, STUDY_INSTANCE_UID,
+                    study, sizeof (study));
+  get_entity_string(file, dicom_meta, records, depth, SERIES_INSTANCE_UID,
+                    series, sizeof (series));
+  // Spread the files checked over the medium
+  if (media->verify && media->nrecords % media->verify == 0)
+    verify_file(media, path, sop_instance, study, series);
+  snprintf(record, sizeof (record),
+           "{\"filename\":\"%s\",\"MediaStorageSOPInstanceUID\":\"%.64s\","
+           "\"StudyInstanceUID\":\"%.64s\",\"SeriesInstanceUID\":\"%.64s\"}",
+           path, sop_instance, study, series);
+  return add_record(media, record);
+}
+
+// The DICOMDIR of a medium given by its root directory or the file itself
+static int8_t read_dicomdir(media_t *media, char *arg) {
+  char path[PATH_MAX];
+  struct stat buf;
+  file_t file;
+  dicom_meta_t dicom_meta;
+  if (stat(arg, &buf)) {
+    perror(arg);
+    return ERROR;
+  }
+  if (S_ISDIR(buf.st_mode))
+    snprintf(path, PATH_MAX, "%s/DICOMDIR", arg);
+  else
+    snprintf(path, PATH_MAX, "%s", arg);
+  char *slash = strrchr(path, '/');
+  snprintf(media->directory, PATH_MAX, "%.*s",
+           slash ? (int) (slash - path + 1) : 0, path);
+  memset(&file, 0, sizeof (file_t));
+  memset(&dicom_meta, 0, sizeof (dicom_meta_t));
+  if (load_file(path, &file) == ERROR) return ERROR;
+  size_t nrecords = media->nrecords;
+  int8_t ret = ERROR;
+  if (!is_dicom(&file)) {
+    fprintf(stderr, "error: %s does not appear to be a dicom file\n", path);
+  } else {
+    ssize_t offset = check_preamble(&file, 0);
+    offset = check_header(&file, offset);
+    offset = decode_meta_data(&file, offset, &dicom_meta);
+    if (offset == ERROR_BIG_ENDIAN)
+      fprintf(stderr, "error: %s: big endian not supported\n", path);
+    else if (offset < 0 || strcmp(dicom_meta.media_storage_sop_class_uid,
+                                  DICOMDIR_SOP_CLASS_UID))
+      fprintf(stderr, "error: %s is not a DICOMDIR\n", path);
+    else if ((ret = walk_dicomdir(&file, offset, &dicom_meta, read_record,
+                                  media)) == ERROR)
+      fprintf(stderr, "error: %s: malformed directory records\n", path);
+  }
+  // The records of a DICOMDIR whose offsets loop are repeated
+  for (; ret == ERROR && media->nrecords > nrecords; --media->nrecords)
+    free(media->records[media->nrecords - 1]);
+  unmap_file(&file);
+  close_file(&file);
+  return ret;
+}
+
+static int compare_records(const void *a, const void *b) {
+  return strcmp(*(char **) a, *(char **) b);
+}
+
+// Write the records of the files referenced by the DICOMDIR of each medium
+// without opening them but for the ones verified
+int32_t read_media(char **args, size_t nargs, shard_t *shard,
+                   options_t *options, uint32_t verify) {
+  media_t media;
+  struct timespec begin, end;
+  int32_t ret = 0;
+  memset(&media, 0, sizeof (media_t));
+  media.shard = shard;
+  media.verify = verify;
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  for (size_t i = 0; i < nargs; ++i)
+    if (read_dicomdir(&media, args[i]) == ERROR) ret = ERROR;
+  // Records start with the filename followed by a quote, as with the paths
+  // sorted for files
+  if (options->lines && media.nrecords)
+    qsort(media.records, media.nrecords, sizeof (char *), compare_records);
+  if (media.nrecords > 1 && !options->lines) printf("[");
+  for (size_t i = 0; i < media.nrecords; ++i) {
+    if (i && !options->lines) printf(",");
+    printf("%s", media.records[i]);
+    if (options->lines) printf("\n");
+    free(media.records[i]);
+  }
+  if (media.nrecords > 1 && !options->lines) printf("]");
+  free(media.records);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  fprintf(stderr, "{\"records\":%zu,\"verified\":%llu,\"mismatches\":%llu,"
+          "\"ms\":%lld}\n", media.nrecords,
+          (unsigned long long) media.verified,
+          (unsigned long long) media.mismatches,
+          (long long) ((end.tv_sec - begin.tv_sec) * 1000 +
+                       (end.tv_nsec - begin.tv_nsec) / 1000000));
+  return media.mismatches ? ERROR : ret;
+}
@@ -0,0 +1,561 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "dicom.h"
+#include "dcm.h"
+#include "dcmr.h"
+
+#define ERROR -1
+// Files kept mapped with their decoded tags, the least recently queried
+// being unmapped first
+#define SERVE_CACHE_SIZE 256
+#define SERVE_BUCKETS 1024
+#define SERVE_MAX_CLIENTS 64
+#define SERVE_LINE_SIZE 65536
+#define SERVE_MAX_TAGS 256
+// Latencies of the last requests kept for the percentiles
+#define SERVE_LATENCIES 65536
+
+typedef struct entry_s {
+  char            *path;
+  uint64_t        hash;
+  struct stat     stat;  // To notice the files changed since they were cached
+  file_t          file;
+  dicom_meta_t    dicom_meta;
+  tag_t           *tags; // Terminated by a zero tag
+  struct entry_s  *prev; // Least recently used list, most recent first
+  struct entry_s  *next;
+  struct entry_s  *chain; // Next entry of the same bucket
+} entry_t;
+
+// The sockets of the clients are non-blocking: the answers a client does not
+// read yet wait in its output, and its requests are not read meanwhile.
+typedef struct client_s {
+  int    fd;
+  size_t length;
+  char   buffer[SERVE_LINE_SIZE];
+  char   *output;
+  size_t output_length;
+  size_t output_size;
+} client_t;
+
+typedef struct server_s {
+  int      fd;
+  entry_t  *buckets[SERVE_BUCKETS];
+  entry_t  *head;
+  entry_t  *tail;
+  size_t   nentries;
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t nrequests;
+  uint64_t latencies[SERVE_LATENCIES];
+  client_t *clients[SERVE_MAX_CLIENTS];
+} server_t;
+
+// A query: the file and the tags to project, or a request for the metrics
+typedef struct request_s {
+  char     path[1024];
+  uint32_t tags[SERVE_MAX_TAGS];
+  size_t   ntags;
+  uint8_t  metrics;
+} request_t;
+
+static volatile sig_atomic_t g_stop = 0;
+
+static void stop(int signal) {
+  (void) signal;
+  g_stop = 1;
+}
+
+static uint64_t get_time(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// FNV-1a
+static uint64_t hash_path(char *path) {
+  uint64_t hash = 0xCBF29CE484222325;
+  for (uint8_t *c = (uint8_t *) path; *c; ++c)
+    hash = (hash ^ *c) * 0x100000001B3;
+  return hash;
+}
+
+static void free_entry(entry_t *entry) {
+  unmap_file(&entry->file);
+  close_file(&entry->file);
+  free(entry->tags);
+  free(entry->path);
+  free(entry);
+}
+
+static void unlink_entry(server_t *server, entry_t *entry) {
+  entry_t **p = &server->buckets[entry->hash % SERVE_BUCKETS];
+  while (*p != entry) p = &(*p)->chain;
+  *p = entry->chain;
+  if (entry->prev) entry->prev->next = entry->next;
+  else server->head = entry->next;
+  if (entry->next) entry->next->prev = entry->prev;
+  else server->tail = entry->prev;
+  --server->nentries;
+}
+
+static void push_entry(server_t *server, entry_t *entry) {
+  entry_t **bucket = &server->buckets[entry->hash % SERVE_BUCKETS];
+  entry->chain = *bucket;
+  *bucket = entry;
+  entry->prev = NULL;
+  entry->next = server->head;
+  if (server->head) server->head->prev = entry;
+  else server->tail = entry;
+  server->head = entry;
+  ++server->nentries;
+}
+
+// Map the file and decode its tags up to the pixel data
+static entry_t *load_entry(char *path, struct stat *buf) {
+  static tag_t tags[MAX_LOADED_TAG];
+  size_t ntags = 0;
+  entry_t *entry = calloc(1, sizeof (entry_t));
+  if (entry == NULL) {
+    perror("calloc");
+    return NULL;
+  }
+  if ((entry->path = strdup(path)) == NULL) {
+    perror("strdup");
+    free(entry);
+    return NULL;
+  }
+  if (load_file(entry->path, &entry->file) == ERROR) {
+    free(entry->path);
+    free(entry);
+    return NULL;
+  }
+  memset(tags, 0, sizeof (tags));
+  if (!is_dicom(&entry->file)) {
+    free_entry(entry);
+    return NULL;
+  }
+  ssize_t offset = check_preamble(&entry->file, 0);
+  offset = check_header(&entry->file, offset);
+  offset = decode_meta_data(&entry->file, offset, &entry->dicom_meta);
+  if (offset < 0 ||
+      decode_n_tags(&entry->file, offset, &entry->dicom_meta, tags, &ntags,
+                    MAX_LOADED_TAG - 1) == ERROR ||
+      (entry->tags = calloc(ntags + 1, sizeof (tag_t))) == NULL) {
+    free_entry(entry);
+    return NULL;
+  }
+  memcpy(entry->tags, tags, sizeof (tag_t) * ntags);
+  entry->hash = hash_path(path);
+  entry->stat = *buf;
+  return entry;
+}
+
+// The cached entry of a file, loaded again if it changed since cached
+static entry_t *get_entry(server_t *server, char *path) {
+  struct stat buf;
+  if (stat(path, &buf)) return NULL;
+  uint64_t hash = hash_path(path);
+  entry_t *entry = server->buckets[hash % SERVE_BUCKETS];
+  for (; entry; entry = entry->chain)
+    if (entry->hash == hash && !strcmp(entry->path, path)) break;
+  if (entry) {
+    unlink_entry(server, entry);
+    if (entry->stat.st_ino == buf.st_ino &&
+        entry->stat.st_size == buf.st_size &&
+        entry->stat.st_mtim.tv_sec == buf.st_mtim.tv_sec &&
+        entry->stat.st_mtim.tv_nsec == buf.st_mtim.tv_nsec) {
+      ++server->hits;
+      push_entry(server, entry);
+      return entry;
+    }
+    free_entry(entry);
+  }
+  ++server->misses;
+  if ((entry = load_entry(path, &buf)) == NULL) return NULL;
+  push_entry(server, entry);
+  if (server->nentries > SERVE_CACHE_SIZE) {
+    entry_t *last = server->tail;
+    unlink_entry(server, last);
+    free_entry(last);
+  }
+  return entry;
+}
+
+static void print_string(FILE *out, char *s, size_t length) {
+  fputc('"', out);
+  for (size_t i = 0; i < length; ++i) {
+    uint8_t c = s[i];
+    if (c == '"' || c == '\\') fprintf(out, "\\%c", c);
+    else if (c < 0x20) fprintf(out, "\\u%04x", c);
+    else fputc(c, out);
+  }
+  fputc('"', out);
+}
+
+// Print the value of a tag as JSON: a string for the string VRs, a number or
+// an array of numbers for the binary numbers, null otherwise
+static void print_value(FILE *out, tag_t *tag) {
+  struct { char vr[3]; uint8_t size; } numbers[] = {
+    { "US", 2 }, { "SS", 2 }, { "UL", 4 }, { "SL", 4 }, { "FL", 4 },
+    { "FD", 8 }
+  };
+  if (is_str_of_char_vr(tag->vr)) {
+    size_t length = tag->datasize;
+    char *s = (char *) tag->data;
+    // Values are padded to an even length with a space or a NULL
+    while (length && (s[length - 1] == ' ' || s[length - 1] == 0)) --length;
+    while (length && *s == ' ') ++s, --length;
+    print_string(out, s, length);
+    return;
+  }
+  for (size_t i = 0; i < sizeof (numbers) / sizeof (numbers[0]); ++i) {
+    if (!TYPE_OF(tag, numbers[i].vr)) continue;
+    size_t n = tag->datasize / numbers[i].size;
+    if (n != 1) fputc('[', out);
+    for (size_t j = 0; j < n; ++j) {
+      uint8_t *p = (uint8_t *) tag->data + j * numbers[i].size;
+      if (j) fputc(',', out);
+      switch (i) {
+      case 0: fprintf(out, "%u", *(uint16_t *) p); break;
+      case 1: fprintf(out, "%d", *(int16_t *) p); break;
+      case 2: fprintf(out, "%u", *(uint32_t *) p); break;
+      case 3: fprintf(out, "%d", *(int32_t *) p); break;
+      case 4: fprintf(out, "%.9g", *(float *) p); break;
+      default: fprintf(out, "%.17g", *(double *) p); break;
+      }
+    }
+    if (n != 1) fputc(']', out);
+    return;
+  }
+  fprintf(out, "null");
+}
+
+static int compare_latencies(const void *a, const void *b) {
+  uint64_t x = *(uint64_t *) a;
+  uint64_t y = *(uint64_t *) b;
+  return x < y ? -1 : x > y;
+}
+
+static void print_metrics(FILE *out, server_t *server) {
+  static uint64_t sorted[SERVE_LATENCIES];
+  size_t n = server->nrequests < SERVE_LATENCIES ? server->nrequests :
+    SERVE_LATENCIES;
+  memcpy(sorted, server->latencies, sizeof (uint64_t) * n);
+  qsort(sorted, n, sizeof (uint64_t), compare_latencies);
+  fprintf(out, "{\"requests\":%llu,\"hits\":%llu,\"misses\":%llu,"
+          "\"entries\":%zu,\"latencyUs\":{\"p50\":%llu,\"p99\":%llu,"
+          "\"max\":%llu}}", (unsigned long long) server->nrequests,
+          (unsigned long long) server->hits,
+          (unsigned long long) server->misses, server->nentries,
+          (unsigned long long) (n ? sorted[n / 2] : 0),
+          (unsigned long long) (n ? sorted[n * 99 / 100] : 0),
+          (unsigned long long) (n ? sorted[n - 1] : 0));
+}
+
+static char *skip_spaces(char *p) {
+  while (isspace((uint8_t) *p)) ++p;
+  return p;
+}
+
+// Parse a JSON string at p into s. Return past its closing quote, NULL if it
+// is malformed or longer than size. Only ASCII \u escapes but NULL are
+// supported.
+static char *parse_string(char *p, char *s, size_t size) {
+  size_t length = 0;
+  if (*p++ != '"') return NULL;
+  for (; *p != '"'; ++p) {
+    char c = *p;
+    if (c == 0 || length + 1 >= size) return NULL;
+    if (c == '\\') {
+      switch (*++p) {
+      case 'n': c = '\n'; break;
+      case 't': c = '\t'; break;
+      case 'r': c = '\r'; break;
+      case 'b': c = '\b'; break;
+      case 'f': c = '\f'; break;
+      case 'u': {
+        unsigned int code;
+        if (sscanf(p + 1, "%4x", &code) != 1 || code == 0 || code > 0x7F)
+          return NULL;
+        c = code;
+        p += 4;
+        break;
+      }
+      case '"': case '\\': case '/': c = *p; break;
+      default: return NULL;
+      }
+    }
+    s[length++] = c;
+  }
+  s[length] = 0;
+  return p + 1;
+}
+
+// Parse a request line: {"path":"FILE","tags":["GGGGEEEE",...]} or
+// {"metrics":true}
+static int8_t parse_request(char *line, request_t *request) {
+  char key[16];
+  char value[16];
+  memset(request, 0, sizeof (request_t));
+  char *p = skip_spaces(line);
+  if (*p++ != '{') return ERROR;
+  for (p = skip_spaces(p); *p != '}'; p = skip_spaces(p)) {
+    if ((p = parse_string(p, key, sizeof (key))) == NULL) return ERROR;
+    p = skip_spaces(p);
+    if (*p++ != ':') return ERROR;
+    p = skip_spaces(p);
+    if (!strcmp(key, "path")) {
+      p = parse_string(p, request->path, sizeof (request->path));
+      if (p == NULL) return ERROR;
+    } else if (!strcmp(key, "tags")) {
+      if (*p++ != '[') return ERROR;
+      for (p = skip_spaces(p); *p != ']'; p = skip_spaces(p)) {
+        char *end;
+        if ((p = parse_string(p, value, sizeof (value))) == NULL ||
+            request->ntags == SERVE_MAX_TAGS)
+          return ERROR;
+        request->tags[request->ntags++] = strtoul(value, &end, 16);
+        if (end - value != 8) return ERROR;
+        p = skip_spaces(p);
+        if (*p == ',') ++p;
+      }
+      ++p;
+    } else if (!strcmp(key, "metrics") && !strncmp(p, "true", 4)) {
+      request->metrics = 1;
+      p += 4;
+    } else {
+      return ERROR;
+    }
+    p = skip_spaces(p);
+    if (*p == ',') ++p;
+  }
+  return request->metrics || request->path[0] ? 0 : ERROR;
+}
+
+// Queue data to send to a client
+static int8_t queue_output(client_t *client, const char *data, size_t length) {
+  if (client->output_length + length > client->output_size) {
+    size_t size = (client->output_length + length) * 2;
+    char *output = realloc(client->output, size);
+    if (output == NULL) {
+      perror("realloc");
+      return ERROR;
+    }
+    client->output = output;
+    client->output_size = size;
+  }
+  memcpy(client->output + client->output_length, data, length);
+  client->output_length += length;
+  return 0;
+}
+
+// Write as much of the output of a client as its socket takes without
+// blocking. Return ERROR when the client is to be closed.
+static int8_t flush_client(client_t *client) {
+  size_t written = 0;
+  while (written < client->output_length) {
+    ssize_t n = write(client->fd, client->output + written,
+                      client->output_length - written);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+    if (n < 0) return ERROR;
+    written += n;
+  }
+  client->output_length -= written;
+  memmove(client->output, client->output + written, client->output_length);
+  return 0;
+}
+
+// Answer a request line with a line
+static int8_t answer(server_t *server, client_t *client, char *line) {
+  request_t request;
+  char *response = NULL;
+  size_t length = 0;
+  FILE *out = open_memstream(&response, &length);
+  if (out == NULL) {
+    perror("open_memstream");
+    return ERROR;
+  }
+  if (parse_request(line, &request) == ERROR) {
+    fprintf(out, "{\"error\":\"malformed request\"}");
+  } else if (request.metrics) {
+    print_metrics(out, server);
+  } else {
+    entry_t *entry = get_entry(server, request.path);
+    fprintf(out, "{\"path\":");
+    print_string(out, request.path, strlen(request.path));
+    if (entry == NULL) {
+      fprintf(out, ",\"error\":\"not a readable DICOM file\"}");
+    } else {
+      fprintf(out, ",\"tags\":{");
+      for (size_t i = 0; i < request.ntags; ++i) {
+        tag_t *tag = get_tag(entry->tags, request.tags[i]);
+        fprintf(out, "%s\"%08X\":", i ? "," : "", request.tags[i]);
+        if (tag) print_value(out, tag);
+        else fprintf(out, "null");
+      }
+      fprintf(out, "}}");
+    }
+  }
+  fputc('\n', out);
+  fclose(out);
+  int8_t ret = queue_output(client, response, length);
+  free(response);
+  return ret;
+}
+
+static void close_client(server_t *server, size_t i) {
+  close(server->clients[i]->fd);
+  free(server->clients[i]->output);
+  free(server->clients[i]);
+  server->clients[i] = NULL;
+}
+
+// Answer the complete lines received from a client. Return ERROR when the
+// client is to be closed.
+static int8_t read_client(server_t *server, client_t *client) {
+  ssize_t n = read(client->fd, client->buffer + client->length,
+                   SERVE_LINE_SIZE - client->length - 1);
+  if (n < 0 && (errno == EINTR || errno == EAGAIN)) return 0;
+  if (n <= 0) return ERROR;
+  client->length += n;
+  client->buffer[client->length] = 0;
+  char *line = client->buffer;
+  char *end;
+  while ((end = strchr(line, '\n')) != NULL) {
+    uint64_t start = get_time();
+    *end = 0;
+    if (answer(server, client, line) == ERROR) return ERROR;
+    server->latencies[server->nrequests++ % SERVE_LATENCIES] =
+      get_time() - start;
+    line = end + 1;
+  }
+  client->length -= line - client->buffer;
+  memmove(client->buffer, line, client->length);
+  // A line which does not fit the buffer is not answered
+  if (client->length + 1 == SERVE_LINE_SIZE) return ERROR;
+  return flush_client(client);
+}
+
+static void accept_client(server_t *server) {
+  int fd = accept(server->fd, NULL, NULL);
+  if (fd < 0) return;
+  // A client not reading its answers must not block the others
+  if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK)) {
+    perror("fcntl");
+    close(fd);
+    return;
+  }
+  for (size_t i = 0; i < SERVE_MAX_CLIENTS; ++i) {
+    if (server->clients[i]) continue;
+    if ((server->clients[i] = calloc(1, sizeof (client_t))) == NULL) break;
+    server->clients[i]->fd = fd;
+    return;
+  }
+  close(fd);
+}
+
+static int32_t serve_loop(server_t *server) {
+  struct pollfd pfds[SERVE_MAX_CLIENTS + 1];
+  size_t indices[SERVE_MAX_CLIENTS + 1];
+  while (!g_stop) {
+    size_t n = 1;
+    pfds[0].fd = server->fd;
+    pfds[0].events = POLLIN;
+    for (size_t i = 0; i < SERVE_MAX_CLIENTS; ++i) {
+      if (server->clients[i] == NULL) continue;
+      pfds[n].fd = server->clients[i]->fd;
+      pfds[n].events = server->clients[i]->output_length ? POLLOUT : POLLIN;
+      indices[n++] = i;
+    }
+    if (poll(pfds, n, -1) < 0) {
+      if (errno == EINTR) continue;
+      perror("poll");
+      return ERROR;
+    }
+    for (size_t i = 1; i < n; ++i) {
+      client_t *client = server->clients[indices[i]];
+      if (pfds[i].revents == 0) continue;
+      if (client->output_length ? flush_client(client) == ERROR :
+          read_client(server, client) == ERROR)
+        close_client(server, indices[i]);
+    }
+    if (pfds[0].revents & POLLIN) accept_client(server);
+  }
+  return 0;
+}
+
+static int listen_socket(char *path) {
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof (struct sockaddr_un));
+  address.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof (address.sun_path)) {
+    fprintf(stderr, "error: %s: socket path too long\n", path);
+    return ERROR;
+  }
+  strcpy(address.sun_path, path);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    perror("socket");
+    return ERROR;
+  }
+  // A socket left by a previous server is replaced
+  unlink(path);
+  if (bind(fd, (struct sockaddr *) &address, sizeof (struct sockaddr_un)) ||
+      listen(fd, SERVE_MAX_CLIENTS)) {
+    perror(path);
+    close(fd);
+    return ERROR;
+  }
+  return fd;
+}
+
+// Answer tag projection queries on the Unix socket at path, one JSON object
+// per line each way, until interrupted. The metrics are printed on stderr
+// when leaving.
+int32_t serve(char *path) {
+  server_t *server = calloc(1, sizeof (server_t));
+  if (server == NULL) {
+    perror("calloc");
+    return ERROR;
+  }
+  if ((server->fd = listen_socket(path)) == ERROR) {
+    free(server);
+    return ERROR;
+  }
+  struct sigaction action;
+  memset(&action, 0, sizeof (struct sigaction));
+  action.sa_handler = stop;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  // Clients leaving before their answer must not stop the server
+  signal(SIGPIPE, SIG_IGN);
+  int32_t ret = serve_loop(server);
+  print_metrics(stderr, server);
+  fputc('\n', stderr);
+  for (size_t i = 0; i < SERVE_MAX_CLIENTS; ++i)
+    if (server->clients[i]) close_client(server, i);
+  while (server->head) {
+    entry_t *entry = server->head;
+    unlink_entry(server, entry);
+    free_entry(entry);
+  }
+  close(server->fd);
+  unlink(path);
+  free(server);
+  return ret;
+}
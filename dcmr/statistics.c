@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "dicom.h"
+#include "dcm.h"
+#include "pixel-data.h"
+#include "parallel.h"
+#include "stats.h"
+#include "dcmr.h"
+
+// Decode the encapsulated frames by batches of one frame per thread and
+// compute their statistics
+static int8_t compute_encapsulated_stats(file_t *file, ssize_t offset,
+                                         dicom_meta_t *dicom_meta,
+                                         pixel_module_t *pixel_module,
+                                         padding_t *padding,
+                                         pixel_stats_t *stats) {
+  // A windowed file is read from one thread
+  uint32_t nthreads = get_number_of_threads(file->window_size ? 1 : 0);
+  size_t size = get_frame_bits(pixel_module) / 8;
+  size_t nsamples = (size_t) pixel_module->rows * pixel_module->columns *
+    pixel_module->samples_per_pixel;
+  frame_index_t index;
+  int8_t ret = 0;
+  if (build_frame_index(file, offset, dicom_meta,
+                        pixel_module->number_of_frames, &index) == ERROR)
+    return ERROR;
+  uint32_t *frames = malloc(sizeof (uint32_t) * nthreads);
+  uint8_t *output = malloc(size * nthreads);
+  if (frames == NULL || output == NULL) {
+    perror("malloc");
+    ret = ERROR;
+  }
+  for (uint32_t i = 0; ret == 0 && i < pixel_module->number_of_frames;
+       i += nthreads) {
+    uint32_t n = pixel_module->number_of_frames - i < nthreads ?
+      pixel_module->number_of_frames - i : nthreads;
+    for (uint32_t j = 0; j < n; ++j) frames[j] = i + j;
+    ret = decode_encapsulated_frames(file, dicom_meta, &index, pixel_module,
+                                     frames, n, output, nthreads);
+    for (uint32_t j = 0; ret == 0 && j < n; ++j)
+      compute_pixel_stats(pixel_module, padding, output + size * j, nsamples,
+                          &stats[i + j]);
+    // The frames are read once, keep the resident set flat
+    release_file_range(file, index.boundaries[i],
+                       index.boundaries[i + n] - index.boundaries[i]);
+  }
+  free(frames);
+  free(output);
+  free_frame_index(&index);
+  return ret;
+}
+
+static void print_stats(pixel_stats_t *stats) {
+  printf("\"count\":%lu,\"min\":%i,\"max\":%i,\"mean\":%.6g,\"stddev\":%.6g",
+         (unsigned long) stats->count, stats->min, stats->max, stats->mean,
+         stats->stddev);
+}
+
+// Print the statistics of the stored values of the dataset as a
+// "PixelStatistics" member of its record: those of the whole dataset with
+// the histogram, then those of each frame
+int8_t output_stats(file_t *file, ssize_t offset, dicom_meta_t *dicom_meta,
+                    tag_t *tags) {
+  pixel_module_t pixel_module;
+  padding_t padding;
+  tag_t pixel_data;
+  pixel_stats_t total;
+  // Read the tags first, decoding the pixel data may move the window of a
+  // windowed file they point to
+  if (decode_pixel_module(tags, &pixel_module) == ERROR) return ERROR;
+  padding_t *p = decode_padding(tags, &pixel_module, &padding) == ERROR ?
+    NULL : &padding;
+  if (find_tag(file, offset, dicom_meta, PIXEL_DATA, &pixel_data) == ERROR)
+    return ERROR;
+  if (pixel_module.bits_allocated != 8 && pixel_module.bits_allocated != 16) {
+    fprintf(stderr, "error: %s: statistics need 8 or 16 bits allocated\n",
+            file->filename);
+    return ERROR;
+  }
+  pixel_stats_t *stats = malloc(sizeof (pixel_stats_t) *
+                                pixel_module.number_of_frames);
+  if (stats == NULL) {
+    perror("malloc");
+    return ERROR;
+  }
+  int8_t ret = pixel_data.datasize == UNDEFINED_LENGTH ?
+    compute_encapsulated_stats(file, offset, dicom_meta, &pixel_module, p,
+                               stats) :
+    compute_frames_stats(file, &pixel_data, &pixel_module, p, stats,
+                         file->window_size ? 1 : 0);
+  if (ret == ERROR) {
+    fprintf(stderr, "error: %s: could not compute the pixel statistics\n",
+            file->filename);
+    free(stats);
+    return ERROR;
+  }
+  merge_pixel_stats(stats, pixel_module.number_of_frames, &total);
+  printf(",\"PixelStatistics\":{");
+  print_stats(&total);
+  printf(",\"first\":%i,\"shift\":%u,\"histogram\":[", total.first,
+         total.shift);
+  for (uint32_t i = 0; i < HISTOGRAM_BINS; ++i)
+    printf(i ? ",%u" : "%u", total.histogram[i]);
+  printf("],\"frames\":[");
+  for (uint32_t i = 0; i < pixel_module.number_of_frames; ++i) {
+    printf(i ? ",{" : "{");
+    print_stats(&stats[i]);
+    printf("}");
+  }
+  printf("]}");
+  free(stats);
+  return 0;
+}
@@ -0,0 +1,799 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "dicom.h"
+#include "dcm.h"
+#include "parallel.h"
+#include "stream.h"
+#include "dcmr.h"
+
+#define ERROR -1
+// Length of the PDUs received, advertised to the peers
+#define STORE_MAX_PDU (1 << 20)
+#define STORE_MAX_COMMAND 4096
+#define STORE_MAX_IDENTIFIER (64 << 10)
+#define STORE_MAX_CONTEXTS 128
+// Seconds without data from a peer before its association is dropped
+#define STORE_TIMEOUT 30
+#define IMPLEMENTATION_CLASS_UID "2.25.279261278195692392104352068939003743078"
+#define IMPLEMENTATION_VERSION_NAME "LIBDCM_0_1"
+#define APPLICATION_CONTEXT_NAME "1.2.840.10008.3.1.1.1"
+
+// Cf DICOM standard Part 8 Sect 9.3
+#define A_ASSOCIATE_RQ 0x01
+#define A_ASSOCIATE_AC 0x02
+#define P_DATA_TF 0x04
+#define A_RELEASE_RQ 0x05
+#define A_RELEASE_RP 0x06
+#define A_ABORT 0x07
+#define APPLICATION_CONTEXT_ITEM 0x10
+#define PRESENTATION_CONTEXT_RQ_ITEM 0x20
+#define PRESENTATION_CONTEXT_AC_ITEM 0x21
+#define TRANSFER_SYNTAX_ITEM 0x40
+#define USER_INFORMATION_ITEM 0x50
+#define MAXIMUM_LENGTH_ITEM 0x51
+#define IMPLEMENTATION_CLASS_UID_ITEM 0x52
+#define IMPLEMENTATION_VERSION_NAME_ITEM 0x55
+// Cf DICOM standard Part 8 Sect 9.3.3.2
+#define TRANSFER_SYNTAXES_NOT_SUPPORTED 4
+// Cf DICOM standard Part 8 Annex E.2
+#define COMMAND_FRAGMENT 0x01
+#define LAST_FRAGMENT 0x02
+
+// Cf DICOM standard Part 7 Sect E.1
+#define AFFECTED_SOP_CLASS_UID 0x0002
+#define COMMAND_FIELD 0x0100
+#define MESSAGE_ID 0x0110
+#define MESSAGE_ID_BEING_RESPONDED_TO 0x0120
+#define COMMAND_DATA_SET_TYPE 0x0800
+#define STATUS 0x0900
+#define AFFECTED_SOP_INSTANCE_UID 0x1000
+#define C_STORE_RQ 0x0001
+#define C_FIND_RQ 0x0020
+#define C_ECHO_RQ 0x0030
+#define C_CANCEL_RQ 0x0FFF
+#define RESPONSE 0x8000
+#define NO_DATA_SET 0x0101
+#define DATA_SET 0x0000 // Any other value than NO_DATA_SET
+// Cf DICOM standard Part 7 Annex C and Part 4 Sect B.2.3
+#define SUCCESS 0x0000
+#define UNRECOGNIZED_OPERATION 0x0211
+#define OUT_OF_RESOURCES 0xA700
+#define CANNOT_UNDERSTAND 0xC000
+
+typedef struct context_s {
+  uint8_t id;
+  uint8_t result; // 0 when accepted
+  char    transfer_syntax[UID_MAX_SIZE + 1];
+} context_t;
+
+// The message being received, its command then its dataset
+typedef struct message_s {
+  uint8_t  context;
+  uint8_t  command[STORE_MAX_COMMAND];
+  size_t   command_length;
+  uint16_t command_field;
+  uint16_t message_id;
+  uint16_t data_set_type;
+  char     sop_class[UID_MAX_SIZE + 1];
+  char     sop_instance[UID_MAX_SIZE + 1];
+  uint8_t  receiving; // The dataset is being received
+  uint8_t  identifier[STORE_MAX_IDENTIFIER]; // Of a C-FIND-RQ
+  size_t   identifier_length;
+  uint16_t status;
+  int      fd; // -1 when the dataset is discarded
+  char     path[1024];
+  char     temporary[1024];
+} message_t;
+
+typedef struct association_s {
+  int       fd;
+  uint8_t   called[16];
+  uint8_t   calling[16];
+  context_t contexts[STORE_MAX_CONTEXTS];
+  size_t    ncontexts;
+  uint32_t  max_pdu; // Of the peer, 0 for no maximum
+  uint8_t   *pdu;
+  uint8_t   *out; // PDUs sent
+  stream_t  *stream;
+  message_t message;
+} association_t;
+
+typedef struct store_s {
+  int             fd;
+  char            *directory;
+  find_index_t    *index;
+  pthread_mutex_t lock; // Records are written by one worker at a time
+  uint64_t        associations;
+  uint64_t        stored;
+  uint64_t        failed;
+  uint64_t        queries;
+} store_t;
+
+static uint16_t get_uint16_be(uint8_t *p) {
+  return (uint16_t) (p[0] << 8 | p[1]);
+}
+
+static uint32_t get_uint32_be(uint8_t *p) {
+  return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 |
+    (uint32_t) p[2] << 8 | p[3];
+}
+
+static uint8_t *put_uint16_be(uint8_t *p, uint16_t value) {
+  p[0] = value >> 8;
+  p[1] = value;
+  return p + 2;
+}
+
+static uint8_t *put_uint32_be(uint8_t *p, uint32_t value) {
+  p[0] = value >> 24;
+  p[1] = value >> 16;
+  p[2] = value >> 8;
+  p[3] = value;
+  return p + 4;
+}
+
+// A sub-item holding a string, the UIDs not being padded
+// Cf DICOM standard Part 8 Sect 9.3.2.2
+static uint8_t *put_item(uint8_t *p, uint8_t type, char *value) {
+  uint16_t length = strlen(value);
+  *p++ = type;
+  *p++ = 0;
+  p = put_uint16_be(p, length);
+  memcpy(p, value, length);
+  return p + length;
+}
+
+// Copy a UID without the padding, a NULL or a space for some peers
+static void copy_uid(char *uid, void *data, size_t length) {
+  if (length > UID_MAX_SIZE) length = UID_MAX_SIZE;
+  memcpy(uid, data, length);
+  uid[length] = 0;
+  while (length && (uid[length - 1] == 0 || uid[length - 1] == ' '))
+    uid[--length] = 0;
+}
+
+// A UID makes the name of the stored file, it has to be one
+// Cf DICOM standard Part 5 Sect 9
+static uint8_t is_uid(char *uid) {
+  if (*uid == 0) return 0;
+  for (; *uid; ++uid)
+    if ((*uid < '0' || *uid > '9') && *uid != '.') return 0;
+  return 1;
+}
+
+static int8_t read_all(int fd, uint8_t *data, size_t length) {
+  while (length) {
+    ssize_t n = read(fd, data, length);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) {
+      perror("read");
+      return ERROR;
+    }
+    if (n == 0) return ERROR;
+    data += n;
+    length -= n;
+  }
+  return 0;
+}
+
+static int8_t read_pdu(association_t *association, uint8_t *type,
+                       uint32_t *length) {
+  uint8_t header[6];
+  if (read_all(association->fd, header, 6) == ERROR) return ERROR;
+  *type = header[0];
+  *length = get_uint32_be(header + 2);
+  if (*length > STORE_MAX_PDU) {
+    fprintf(stderr, "error: PDU of %u bytes over the maximum length\n",
+            *length);
+    return ERROR;
+  }
+  return read_all(association->fd, association->pdu, *length);
+}
+
+// A-RELEASE-RP or A-ABORT, whose source is the service provider
+// Cf DICOM standard Part 8 Sect 9.3.7 and 9.3.8
+static int8_t send_short_pdu(association_t *association, uint8_t type) {
+  uint8_t pdu[10] = { type, 0, 0, 0, 0, 4, 0, 0, type == A_ABORT ? 2 : 0, 0 };
+  return write_all(association->fd, pdu, sizeof (pdu));
+}
+
+// Accept the first transfer syntax proposed that libdcm decodes, for any
+// abstract syntax
+static void accept_context(context_t *context, uint8_t *item, size_t length) {
+  context->id = item[0];
+  context->result = TRANSFER_SYNTAXES_NOT_SUPPORTED;
+  for (size_t i = 4; i + 4 <= length;) {
+    uint8_t type = item[i];
+    size_t size = get_uint16_be(item + i + 2);
+    if (i + 4 + size > length) break;
+    if (type == TRANSFER_SYNTAX_ITEM && context->result) {
+      copy_uid(context->transfer_syntax, item + i + 4, size);
+      if (strcmp(context->transfer_syntax,
+                 TRANSFER_TYPE_EXPLICIT_BIG_ENDIAN) &&
+          strcmp(context->transfer_syntax,
+                 TRANSFER_TYPE_DEFLATED_EXPLICIT_BIG_ENDIAN))
+        context->result = 0;
+    }
+    i += 4 + size;
+  }
+  if (context->result)
+    strcpy(context->transfer_syntax, TRANSFER_TYPE_IMPLICIT);
+}
+
+// Answer an A-ASSOCIATE-RQ with an A-ASSOCIATE-AC, the buffer of the request
+// being reused for the answer
+// Cf DICOM standard Part 8 Sect 9.3.2 and 9.3.3
+static int8_t accept_association(association_t *association,
+                                 uint32_t length) {
+  uint8_t *pdu = association->pdu;
+  if (length < 68) return ERROR;
+  memcpy(association->called, pdu + 4, 16);
+  memcpy(association->calling, pdu + 20, 16);
+  for (size_t i = 68; i + 4 <= length;) {
+    uint8_t type = pdu[i];
+    size_t size = get_uint16_be(pdu + i + 2);
+    if (i + 4 + size > length) return ERROR;
+    if (type == PRESENTATION_CONTEXT_RQ_ITEM && size >= 4 &&
+        association->ncontexts < STORE_MAX_CONTEXTS)
+      accept_context(&association->contexts[association->ncontexts++],
+                     pdu + i + 4, size);
+    if (type == USER_INFORMATION_ITEM)
+      for (size_t j = i + 4; j + 8 <= i + 4 + size;
+           j += 4 + get_uint16_be(pdu + j + 2))
+        if (pdu[j] == MAXIMUM_LENGTH_ITEM)
+          association->max_pdu = get_uint32_be(pdu + j + 4);
+    i += 4 + size;
+  }
+  uint8_t *p = put_uint16_be(pdu + 6, 1);
+  p = put_uint16_be(p, 0);
+  memcpy(p, association->called, 16);
+  memcpy(p + 16, association->calling, 16);
+  memset(p + 32, 0, 32);
+  p = put_item(p + 64, APPLICATION_CONTEXT_ITEM, APPLICATION_CONTEXT_NAME);
+  for (size_t i = 0; i < association->ncontexts; ++i) {
+    context_t *context = &association->contexts[i];
+    *p++ = PRESENTATION_CONTEXT_AC_ITEM;
+    *p++ = 0;
+    p = put_uint16_be(p, 8 + strlen(context->transfer_syntax));
+    *p++ = context->id;
+    *p++ = 0;
+    *p++ = context->result;
+    *p++ = 0;
+    p = put_item(p, TRANSFER_SYNTAX_ITEM, context->transfer_syntax);
+  }
+  *p++ = USER_INFORMATION_ITEM;
+  *p++ = 0;
+  p = put_uint16_be(p, 8 + 4 + strlen(IMPLEMENTATION_CLASS_UID) +
+                    4 + strlen(IMPLEMENTATION_VERSION_NAME));
+  *p++ = MAXIMUM_LENGTH_ITEM;
+  *p++ = 0;
+  p = put_uint16_be(p, 4);
+  p = put_uint32_be(p, STORE_MAX_PDU);
+  p = put_item(p, IMPLEMENTATION_CLASS_UID_ITEM, IMPLEMENTATION_CLASS_UID);
+  p = put_item(p, IMPLEMENTATION_VERSION_NAME_ITEM,
+               IMPLEMENTATION_VERSION_NAME);
+  pdu[0] = A_ASSOCIATE_AC;
+  pdu[1] = 0;
+  put_uint32_be(pdu + 2, p - pdu - 6);
+  return write_all(association->fd, pdu, p - pdu);
+}
+
+static context_t *get_context(association_t *association, uint8_t id) {
+  for (size_t i = 0; i < association->ncontexts; ++i)
+    if (association->contexts[i].id == id)
+      return association->contexts[i].result ? NULL :
+        &association->contexts[i];
+  return NULL;
+}
+
+// Commands are encoded in implicit VR little endian
+// Cf DICOM standard Part 7 Sect 6.3.1
+static int8_t decode_command(message_t *message) {
+  file_t file;
+  tag_t tag;
+  ssize_t shift;
+  memset(&file, 0, sizeof (file_t));
+  file.content = message->command;
+  file.size = message->command_length;
+  message->command_field = 0;
+  message->data_set_type = NO_DATA_SET;
+  message->sop_class[0] = 0;
+  message->sop_instance[0] = 0;
+  for (ssize_t offset = 0;
+       (shift = decode_implicit_tag(&file, offset, &tag)) > 0;
+       offset += shift + tag.datasize) {
+    if (tag.group != 0 || offset + shift + tag.datasize > file.size)
+      return ERROR;
+    uint16_t value = tag.datasize == 2 ? *(uint16_t *) tag.data : 0;
+    switch (tag.element) {
+    case AFFECTED_SOP_CLASS_UID:
+      copy_uid(message->sop_class, tag.data, tag.datasize);
+      break;
+    case AFFECTED_SOP_INSTANCE_UID:
+      copy_uid(message->sop_instance, tag.data, tag.datasize);
+      break;
+    case COMMAND_FIELD:
+      message->command_field = value;
+      break;
+    case MESSAGE_ID:
+      message->message_id = value;
+      break;
+    case COMMAND_DATA_SET_TYPE:
+      message->data_set_type = value;
+      break;
+    default:
+      break;
+    }
+  }
+  return 0;
+}
+
+static uint8_t *put_command_tag(uint8_t *p, uint16_t element, void *data,
+                                uint32_t length) {
+  uint16_t group = 0;
+  uint32_t size = length + (length & 1);
+  memcpy(p, &group, 2);
+  memcpy(p + 2, &element, 2);
+  memcpy(p + 4, &size, 4);
+  memcpy(p + 8, data, length);
+  // UIDs are padded with a NULL
+  if (length & 1) p[8 + length] = 0;
+  return p + 8 + size;
+}
+
+// Send a PDV split in fragments fitting in the PDUs the peer accepts
+// Cf DICOM standard Part 8 Sect 9.3.5
+static int8_t send_pdv(association_t *association, uint8_t control,
+                       uint8_t *data, size_t length) {
+  uint8_t *pdu = association->out;
+  size_t max = association->max_pdu > 6 &&
+    association->max_pdu < STORE_MAX_PDU ? association->max_pdu :
+    STORE_MAX_PDU;
+  do {
+    size_t size = length < max - 6 ? length : max - 6;
+    pdu[0] = P_DATA_TF;
+    pdu[1] = 0;
+    put_uint32_be(pdu + 2, size + 6);
+    put_uint32_be(pdu + 6, size + 2);
+    pdu[10] = association->message.context;
+    pdu[11] = control | (size == length ? LAST_FRAGMENT : 0);
+    memcpy(pdu + 12, data, size);
+    if (write_all(association->fd, pdu, size + 12) == ERROR) return ERROR;
+    data += size;
+    length -= size;
+  } while (length);
+  return 0;
+}
+
+// Send a response to the message, followed by the dataset data if not NULL
+// Cf DICOM standard Part 7 Sect 9.3.1.2, 9.3.2.2 and 9.3.5.2
+static int8_t send_response(association_t *association, uint16_t status,
+                            uint8_t *data, size_t length) {
+  message_t *message = &association->message;
+  uint8_t command[512];
+  uint16_t command_field = message->command_field | RESPONSE;
+  uint16_t data_set_type = data ? DATA_SET : NO_DATA_SET;
+  uint8_t *p = command + 12;
+  if (message->sop_class[0])
+    p = put_command_tag(p, AFFECTED_SOP_CLASS_UID, message->sop_class,
+                        strlen(message->sop_class));
+  p = put_command_tag(p, COMMAND_FIELD, &command_field, 2);
+  p = put_command_tag(p, MESSAGE_ID_BEING_RESPONDED_TO, &message->message_id,
+                      2);
+  p = put_command_tag(p, COMMAND_DATA_SET_TYPE, &data_set_type, 2);
+  p = put_command_tag(p, STATUS, &status, 2);
+  if (message->sop_instance[0])
+    p = put_command_tag(p, AFFECTED_SOP_INSTANCE_UID, message->sop_instance,
+                        strlen(message->sop_instance));
+  uint32_t group_length = p - command - 12;
+  put_command_tag(command, 0x0000, &group_length, 4);
+  if (send_pdv(association, COMMAND_FRAGMENT, command, p - command) == ERROR)
+    return ERROR;
+  return data ? send_pdv(association, 0, data, length) : 0;
+}
+
+static transfer_syntax_t get_transfer_syntax(context_t *context) {
+  return !strcmp(context->transfer_syntax, TRANSFER_TYPE_IMPLICIT) ?
+    IMPLICIT : EXPLICIT_LITTLE_ENDIAN;
+}
+
+static uint8_t *put_meta_tag(uint8_t *p, uint16_t element, char *vr,
+                             void *data, uint16_t length, char padding) {
+  uint16_t group = META_DATA_GROUP;
+  uint16_t size = length + (length & 1);
+  memcpy(p, &group, 2);
+  memcpy(p + 2, &element, 2);
+  memcpy(p + 4, vr, 2);
+  if (is_double_length_vr(vr)) {
+    uint32_t datasize = size;
+    memset(p + 6, 0, 2);
+    memcpy(p + 8, &datasize, 4);
+    p += g_double_length_explicit_tag_size;
+  } else {
+    memcpy(p + 6, &size, 2);
+    p += g_explicit_tag_size;
+  }
+  memcpy(p, data, length);
+  if (length & 1) p[length] = padding;
+  return p + size;
+}
+
+// Write the preamble and the file meta information of the object received
+// Cf DICOM standard Part 10 Sect 7.1
+static int8_t write_meta_data(association_t *association, context_t *context) {
+  message_t *message = &association->message;
+  uint8_t header[PREAMBLE_LENGTH + 4 + 512];
+  char calling[17];
+  uint32_t length;
+  uint16_t size = 16;
+  memcpy(calling, association->calling, 16);
+  while (size && (calling[size - 1] == ' ' || calling[size - 1] == 0)) --size;
+  memset(header, 0, PREAMBLE_LENGTH);
+  memcpy(header + PREAMBLE_LENGTH, MAGIC_WORD, 4);
+  uint8_t *begin = header + PREAMBLE_LENGTH + 4 + 12;
+  uint8_t *p = put_meta_tag(begin, 0x0001, "OB", "\0\1", 2, 0);
+  p = put_meta_tag(p, 0x0002, "UI", message->sop_class,
+                   strlen(message->sop_class), 0);
+  p = put_meta_tag(p, 0x0003, "UI", message->sop_instance,
+                   strlen(message->sop_instance), 0);
+  p = put_meta_tag(p, 0x0010, "UI", context->transfer_syntax,
+                   strlen(context->transfer_syntax), 0);
+  p = put_meta_tag(p, 0x0012, "UI", IMPLEMENTATION_CLASS_UID,
+                   strlen(IMPLEMENTATION_CLASS_UID), 0);
+  p = put_meta_tag(p, 0x0013, "SH", IMPLEMENTATION_VERSION_NAME,
+                   strlen(IMPLEMENTATION_VERSION_NAME), ' ');
+  if (size) p = put_meta_tag(p, 0x0016, "AE", calling, size, ' ');
+  length = p - begin;
+  put_meta_tag(header + PREAMBLE_LENGTH + 4, 0x0000, "UL", &length, 4, 0);
+  return write_all(message->fd, header, p - header);
+}
+
+// Drop the file of the dataset being received
+static void discard_data_set(association_t *association, uint16_t status) {
+  message_t *message = &association->message;
+  if (message->fd >= 0) {
+    close(message->fd);
+    unlink(message->temporary);
+    message->fd = -1;
+  }
+  free_stream(association->stream);
+  message->status = status;
+}
+
+// Create the file of the dataset announced by a C-STORE-RQ, to be written as
+// its fragments come. It is named after its SOP instance UID once received.
+static void begin_data_set(store_t *store, association_t *association,
+                           context_t *context) {
+  message_t *message = &association->message;
+  dicom_meta_t dicom_meta;
+  message->status = SUCCESS;
+  if (!is_uid(message->sop_instance)) {
+    message->status = CANNOT_UNDERSTAND;
+    return;
+  }
+  snprintf(message->path, 1024, "%s/%s.dcm", store->directory,
+           message->sop_instance);
+  snprintf(message->temporary, 1024, "%s/.%s.%d.part", store->directory,
+           message->sop_instance, association->fd);
+  message->fd = open(message->temporary, O_WRONLY | O_CREAT | O_TRUNC |
+                     O_CLOEXEC, 0644);
+  if (message->fd < 0) {
+    perror(message->temporary);
+    message->status = OUT_OF_RESOURCES;
+    return;
+  }
+  if (write_meta_data(association, context) == ERROR) {
+    discard_data_set(association, OUT_OF_RESOURCES);
+    return;
+  }
+  memset(&dicom_meta, 0, sizeof (dicom_meta_t));
+  dicom_meta.transfer_syntax = get_transfer_syntax(context);
+  strcpy(dicom_meta.transfer_syntax_uid, context->transfer_syntax);
+  strcpy(dicom_meta.media_storage_sop_class_uid, message->sop_class);
+  strcpy(dicom_meta.media_storage_sop_instance_uid, message->sop_instance);
+  open_stream(&dicom_meta, message->path, association->stream);
+}
+
+static void output_record(store_t *store, stream_t *stream, ssize_t offset) {
+  options_t options;
+  memset(&options, 0, sizeof (options_t));
+  options.lines = 1;
+  pthread_mutex_lock(&store->lock);
+  output(&stream->file, offset, &stream->dicom_meta, stream->tags, &options,
+         NULL);
+  printf("\n");
+  fflush(stdout);
+  pthread_mutex_unlock(&store->lock);
+}
+
+// Answer a C-FIND-RQ with a pending response per match, then a final one.
+// The identifiers of the matches are gathered before being sent so that a
+// slow peer does not hold the index.
+// Cf DICOM standard Part 4 Sect C.4.1.2
+static int8_t answer_find(store_t *store, association_t *association) {
+  message_t *message = &association->message;
+  context_t *context = get_context(association, message->context);
+  uint8_t *responses;
+  size_t length;
+  uint16_t status;
+  __atomic_fetch_add(&store->queries, 1, __ATOMIC_RELAXED);
+  ssize_t n = find_matches(store->index, message->identifier,
+                           message->identifier_length,
+                           get_transfer_syntax(context), &responses, &length,
+                           &status);
+  if (n == ERROR) return send_response(association, status, NULL, 0);
+  int8_t ret = 0;
+  for (size_t offset = 0; ret == 0 && offset < length;) {
+    uint32_t size;
+    memcpy(&size, responses + offset, 4);
+    ret = send_response(association, status, responses + offset + 4, size);
+    offset += 4 + size;
+  }
+  free(responses);
+  return ret == ERROR ? ERROR : send_response(association, SUCCESS, NULL, 0);
+}
+
+// The last fragment of the dataset was received, its tags decoded already.
+// The file is renamed before being closed so that a follow mode watching the
+// directory sees it under its final name only.
+static int8_t end_data_set(store_t *store, association_t *association) {
+  message_t *message = &association->message;
+  message->receiving = 0;
+  if (message->command_field == C_FIND_RQ && message->status == SUCCESS)
+    return answer_find(store, association);
+  if (message->fd >= 0) {
+    ssize_t offset = close_stream(association->stream);
+    if (offset == ERROR) {
+      fprintf(stderr, "error: %s: dataset ends in the middle of a tag\n",
+              message->path);
+      discard_data_set(association, CANNOT_UNDERSTAND);
+    } else if (rename(message->temporary, message->path)) {
+      perror(message->path);
+      discard_data_set(association, OUT_OF_RESOURCES);
+    } else {
+      close(message->fd);
+      message->fd = -1;
+      output_record(store, association->stream, offset);
+      index_object(store->index, association->stream->tags);
+      free_stream(association->stream);
+    }
+  }
+  if (message->command_field == C_STORE_RQ)
+    __atomic_fetch_add(message->status == SUCCESS ? &store->stored :
+                       &store->failed, 1, __ATOMIC_RELAXED);
+  return send_response(association, message->status, NULL, 0);
+}
+
+static int8_t handle_command(store_t *store, association_t *association) {
+  message_t *message = &association->message;
+  context_t *context = get_context(association, message->context);
+  if (context == NULL || decode_command(message) == ERROR) return ERROR;
+  uint16_t command_field = message->command_field;
+  message->command_length = 0;
+  message->identifier_length = 0;
+  message->fd = -1;
+  // The responses of a C-FIND are all sent before its cancel is read
+  if (command_field == C_CANCEL_RQ) return 0;
+  if (command_field == C_ECHO_RQ)
+    return send_response(association, SUCCESS, NULL, 0);
+  if (command_field != C_STORE_RQ && command_field != C_FIND_RQ)
+    message->status = UNRECOGNIZED_OPERATION;
+  else if (message->data_set_type == NO_DATA_SET)
+    message->status = CANNOT_UNDERSTAND;
+  else if (command_field == C_STORE_RQ)
+    begin_data_set(store, association, context);
+  else
+    message->status = SUCCESS;
+  // The dataset of a failed message is received and discarded
+  if (message->data_set_type == NO_DATA_SET)
+    return end_data_set(store, association);
+  message->receiving = 1;
+  return 0;
+}
+
+// The fragments of the dataset are written and decoded as they come, the
+// file is not read again
+static int8_t receive_fragment(store_t *store, association_t *association,
+                               uint8_t context, uint8_t control,
+                               uint8_t *data, size_t length) {
+  message_t *message = &association->message;
+  if (control & COMMAND_FRAGMENT) {
+    if (message->receiving ||
+        message->command_length + length > STORE_MAX_COMMAND)
+      return ERROR;
+    memcpy(message->command + message->command_length, data, length);
+    message->command_length += length;
+    message->context = context;
+    return control & LAST_FRAGMENT ? handle_command(store, association) : 0;
+  }
+  if (!message->receiving || context != message->context) return ERROR;
+  if (message->command_field == C_FIND_RQ) {
+    if (message->identifier_length + length > STORE_MAX_IDENTIFIER) {
+      message->status = CANNOT_UNDERSTAND;
+    } else {
+      memcpy(message->identifier + message->identifier_length, data, length);
+      message->identifier_length += length;
+    }
+  } else if (message->fd >= 0 &&
+      (write_all(message->fd, data, length) == ERROR ||
+       feed_stream(association->stream, data, length) == ERROR))
+    discard_data_set(association, OUT_OF_RESOURCES);
+  return control & LAST_FRAGMENT ? end_data_set(store, association) : 0;
+}
+
+// Cf DICOM standard Part 8 Sect 9.3.5
+static int8_t receive_data(store_t *store, association_t *association,
+                           uint32_t length) {
+  uint8_t *pdu = association->pdu;
+  for (uint32_t i = 0; i + 6 <= length;) {
+    uint32_t size = get_uint32_be(pdu + i);
+    if (size < 2 || size > length - i - 4) return ERROR;
+    if (receive_fragment(store, association, pdu[i + 4], pdu[i + 5],
+                         pdu + i + 6, size - 2) == ERROR)
+      return ERROR;
+    i += 4 + size;
+  }
+  return 0;
+}
+
+static void handle_association(store_t *store, association_t *association) {
+  struct timeval timeout = { STORE_TIMEOUT, 0 };
+  int nodelay = 1;
+  uint8_t type;
+  uint32_t length;
+  setsockopt(association->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+             sizeof (struct timeval));
+  // Responses are sent as a command PDU then a dataset PDU
+  setsockopt(association->fd, IPPROTO_TCP, TCP_NODELAY, &nodelay,
+             sizeof (int));
+  if (read_pdu(association, &type, &length) == ERROR ||
+      type != A_ASSOCIATE_RQ ||
+      accept_association(association, length) == ERROR)
+    return;
+  __atomic_fetch_add(&store->associations, 1, __ATOMIC_RELAXED);
+  while (read_pdu(association, &type, &length) == 0) {
+    if (type == P_DATA_TF && receive_data(store, association, length) == 0)
+      continue;
+    if (type == A_RELEASE_RQ && !association->message.receiving)
+      send_short_pdu(association, A_RELEASE_RP);
+    else if (type != A_ABORT)
+      send_short_pdu(association, A_ABORT);
+    break;
+  }
+  if (association->message.receiving) {
+    discard_data_set(association, OUT_OF_RESOURCES);
+    __atomic_fetch_add(&store->failed, 1, __ATOMIC_RELAXED);
+  }
+}
+
+// Workers accept the associations in turn, the next ones waiting in the
+// backlog of the listening socket until one is free
+static void *store_worker(void *arg) {
+  store_t *store = (store_t *) arg;
+  association_t *association = malloc(sizeof (association_t));
+  uint8_t *pdu = malloc(STORE_MAX_PDU);
+  uint8_t *out = malloc(STORE_MAX_PDU + 6);
+  stream_t *stream = calloc(1, sizeof (stream_t));
+  if (association == NULL || pdu == NULL || out == NULL || stream == NULL) {
+    perror("malloc");
+    free(association);
+    free(pdu);
+    free(out);
+    free(stream);
+    return NULL;
+  }
+  while (1) {
+    int fd = accept(store->fd, NULL, NULL);
+    if (fd < 0 && (errno == EINTR || errno == ECONNABORTED)) continue;
+    // Shut down
+    if (fd < 0) break;
+    memset(association, 0, sizeof (association_t));
+    association->fd = fd;
+    association->pdu = pdu;
+    association->out = out;
+    association->stream = stream;
+    association->message.fd = -1;
+    handle_association(store, association);
+    close(fd);
+  }
+  free(association);
+  free(pdu);
+  free(out);
+  free(stream);
+  return NULL;
+}
+
+static int listen_port(char *port) {
+  struct sockaddr_in address;
+  char *end;
+  unsigned long number = strtoul(port, &end, 10);
+  if (*end || number == 0 || number > 65535) {
+    fprintf(stderr, "error: %s: invalid port\n", port);
+    return ERROR;
+  }
+  memset(&address, 0, sizeof (struct sockaddr_in));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(number);
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    perror("socket");
+    return ERROR;
+  }
+  int reuse = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof (int));
+  if (bind(fd, (struct sockaddr *) &address, sizeof (struct sockaddr_in)) ||
+      listen(fd, SOMAXCONN)) {
+    perror(port);
+    close(fd);
+    return ERROR;
+  }
+  return fd;
+}
+
+// Receive the objects sent with C-STORE on the TCP port into directory and
+// write their record, one per line, until interrupted. An association is
+// handled by one of a worker per processor. The counts of associations and
+// of objects stored or failed are printed on stderr when leaving.
+// Cf DICOM standard Part 4 Annex B
+int32_t store(char *port, char *directory) {
+  store_t store;
+  sigset_t signals;
+  int signal_number;
+  memset(&store, 0, sizeof (store_t));
+  store.directory = directory;
+  if ((store.fd = listen_port(port)) == ERROR) return ERROR;
+  // The objects already stored are queried along with those received
+  if ((store.index = create_find_index()) == NULL ||
+      index_directory(store.index, directory) == ERROR) {
+    free_find_index(store.index);
+    close(store.fd);
+    return ERROR;
+  }
+  pthread_mutex_init(&store.lock, NULL);
+  // Peers leaving before their answer must not stop the server
+  signal(SIGPIPE, SIG_IGN);
+  // Signals are waited for by this thread only
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+  uint32_t nthreads = get_number_of_threads(0);
+  pthread_t *threads = malloc(sizeof (pthread_t) * nthreads);
+  uint32_t nstarted = 0;
+  if (threads == NULL) perror("malloc");
+  for (; threads != NULL && nstarted < nthreads; ++nstarted) {
+    int ret = pthread_create(&threads[nstarted], NULL, store_worker, &store);
+    if (ret) {
+      fprintf(stderr, "pthread_create: %s\n", strerror(ret));
+      break;
+    }
+  }
+  if (nstarted) sigwait(&signals, &signal_number);
+  // Wake the workers up from accept, the associations going on are finished
+  shutdown(store.fd, SHUT_RDWR);
+  for (uint32_t i = 0; i < nstarted; ++i) pthread_join(threads[i], NULL);
+  free(threads);
+  close(store.fd);
+  pthread_mutex_destroy(&store.lock);
+  free_find_index(store.index);
+  fprintf(stderr, "{\"associations\":%llu,\"stored\":%llu,\"failed\":%llu,"
+          "\"queries\":%llu}\n",
+          (unsigned long long) store.associations,
+          (unsigned long long) store.stored,
+          (unsigned long long) store.failed,
+          (unsigned long long) store.queries);
+  return nstarted ? 0 : ERROR;
+}
@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "dicom.h"
+#include "dcm.h"
+#include "dcmr.h"
+
+#define ERROR -1
+// Files waiting to be parsed. A full queue is parsed before reading more
+// events, which are then held by the kernel.
+#define WATCH_QUEUE_SIZE 1024
+// Delay to gather the files of a burst into one batch, in milliseconds
+#define WATCH_BATCH_DELAY 50
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE)
+
+typedef struct pending_s {
+  char     *path;
+  uint64_t closed; // Change time of the file, in microseconds
+} pending_t;
+
+typedef struct watch_s {
+  int       fd;
+  char      **directories; // Indexed by watch descriptor
+  size_t    ndirectories;
+  shard_t   *shard;
+  options_t *options;
+  pending_t queue[WATCH_QUEUE_SIZE];
+  size_t    npending;
+  uint64_t  first; // When the oldest pending file was queued
+} watch_t;
+
+static volatile sig_atomic_t g_stop = 0;
+
+static void stop(int signal) {
+  (void) signal;
+  g_stop = 1;
+}
+
+static uint64_t get_time(clockid_t clock) {
+  struct timespec now;
+  clock_gettime(clock, &now);
+  return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// Parse the pending files as one batch, flush their records and report the
+// latency from the close of the files to their records being written
+static void parse_batch(watch_t *watch) {
+  path_t batch[WATCH_QUEUE_SIZE];
+  if (watch->npending == 0) return;
+  for (size_t i = 0; i < watch->npending; ++i) {
+    batch[i].path = watch->queue[i].path;
+    batch[i].next = i + 1 < watch->npending ? &batch[i + 1] : NULL;
+  }
+  parse_files(watch->npending, batch, watch->options);
+  fflush(stdout);
+  uint64_t now = get_time(CLOCK_REALTIME);
+  uint64_t min = UINT64_MAX;
+  uint64_t max = 0;
+  uint64_t sum = 0;
+  for (size_t i = 0; i < watch->npending; ++i) {
+    uint64_t latency = now > watch->queue[i].closed ?
+      now - watch->queue[i].closed : 0;
+    if (latency < min) min = latency;
+    if (latency > max) max = latency;
+    sum += latency;
+    free(watch->queue[i].path);
+  }
+  fprintf(stderr, "{\"files\":%zu,\"latencyUs\":{\"min\":%llu,\"mean\":%llu,"
+          "\"max\":%llu}}\n", watch->npending, (unsigned long long) min,
+          (unsigned long long) (sum / watch->npending),
+          (unsigned long long) max);
+  watch->npending = 0;
+}
+
+// Queue a regular file of the shard. Its change time, set by the kernel on
+// the last write or on its move in the directory, stands for when it was
+// closed, as the events are not timestamped.
+static void queue_file(watch_t *watch, char *path) {
+  struct stat buf;
+  if (!in_shard(path, watch->shard)) return;
+  if (stat(path, &buf) || !S_ISREG(buf.st_mode)) return;
+  // Found by the walk of a new directory and closed once watched
+  for (size_t i = 0; i < watch->npending; ++i)
+    if (!strcmp(watch->queue[i].path, path)) return;
+  if (watch->npending == WATCH_QUEUE_SIZE) parse_batch(watch);
+  char *copy = strdup(path);
+  if (copy == NULL) {
+    perror("strdup");
+    return;
+  }
+  if (watch->npending == 0) watch->first = get_time(CLOCK_MONOTONIC);
+  watch->queue[watch->npending].path = copy;
+  watch->queue[watch->npending].closed =
+    (uint64_t) buf.st_ctim.tv_sec * 1000000 + buf.st_ctim.tv_nsec / 1000;
+  ++watch->npending;
+}
+
+// Whether an entry of a directory is a directory. Its type is left unknown
+// by some filesystems, it is then looked up as generate_path does.
+static uint8_t is_directory(struct dirent *entry, char *path) {
+  struct stat buf;
+  if (entry->d_type != DT_UNKNOWN) return entry->d_type == DT_DIR;
+  return !stat(path, &buf) && S_ISDIR(buf.st_mode);
+}
+
+// Watch a directory and its subdirectories. The files of directories created
+// after the watch started may have been written before their watch was
+// added, they are queued when queue is set.
+static int8_t add_watch(watch_t *watch, char *path, uint8_t queue) {
+  int wd = inotify_add_watch(watch->fd, path, WATCH_EVENTS | IN_ONLYDIR);
+  if (wd < 0) {
+    perror(path);
+    return ERROR;
+  }
+  if ((size_t) wd >= watch->ndirectories) {
+    size_t size = wd * 2 + 16;
+    char **directories = realloc(watch->directories, sizeof (char *) * size);
+    if (directories == NULL) {
+      perror("realloc");
+      return ERROR;
+    }
+    memset(directories + watch->ndirectories, 0,
+           sizeof (char *) * (size - watch->ndirectories));
+    watch->directories = directories;
+    watch->ndirectories = size;
+  }
+  free(watch->directories[wd]);
+  if ((watch->directories[wd] = strdup(path)) == NULL) {
+    perror("strdup");
+    return ERROR;
+  }
+  DIR *dir = opendir(path);
+  if (dir == NULL) {
+    perror(path);
+    return ERROR;
+  }
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+      continue;
+    char child[1024];
+    snprintf(child, 1024, "%s/%s", path, entry->d_name);
+    if (is_directory(entry, child)) add_watch(watch, child, queue);
+    else if (queue) queue_file(watch, child);
+  }
+  closedir(dir);
+  return 0;
+}
+
+static void handle_event(watch_t *watch, struct inotify_event *event) {
+  if (event->mask & IN_Q_OVERFLOW) {
+    fprintf(stderr, "warning: events were lost, the watch queue overflowed\n");
+    return;
+  }
+  if (event->mask & IN_IGNORED) {
+    free(watch->directories[event->wd]);
+    watch->directories[event->wd] = NULL;
+    return;
+  }
+  if ((size_t) event->wd >= watch->ndirectories ||
+      watch->directories[event->wd] == NULL || event->len == 0)
+    return;
+  char path[1024];
+  snprintf(path, 1024, "%s/%s", watch->directories[event->wd], event->name);
+  if (event->mask & IN_ISDIR) {
+    if (event->mask & (IN_CREATE | IN_MOVED_TO)) add_watch(watch, path, 1);
+  } else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+    queue_file(watch, path);
+  }
+}
+
+static int8_t read_events(watch_t *watch) {
+  char buffer[65536]
+    __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  ssize_t length = read(watch->fd, buffer, sizeof (buffer));
+  if (length < 0) {
+    if (errno == EINTR || errno == EAGAIN) return 0;
+    perror("read");
+    return ERROR;
+  }
+  for (char *p = buffer; p < buffer + length;) {
+    struct inotify_event *event = (struct inotify_event *) p;
+    handle_event(watch, event);
+    p += sizeof (struct inotify_event) + event->len;
+  }
+  return 0;
+}
+
+static int32_t watch_loop(watch_t *watch) {
+  while (!g_stop) {
+    int timeout = -1;
+    if (watch->npending) {
+      uint64_t elapsed = (get_time(CLOCK_MONOTONIC) - watch->first) / 1000;
+      timeout = elapsed < WATCH_BATCH_DELAY ? WATCH_BATCH_DELAY - elapsed : 0;
+    }
+    struct pollfd pfd = { watch->fd, POLLIN, 0 };
+    int ret = poll(&pfd, 1, timeout);
+    if (ret < 0 && errno != EINTR) {
+      perror("poll");
+      return ERROR;
+    }
+    if (ret > 0 && read_events(watch) == ERROR) return ERROR;
+    if (watch->npending &&
+        (get_time(CLOCK_MONOTONIC) - watch->first) / 1000 >= WATCH_BATCH_DELAY)
+      parse_batch(watch);
+  }
+  parse_batch(watch);
+  return 0;
+}
+
+// Watch the directories and write the record of each file written or moved
+// into them, one per line, until interrupted
+int32_t follow(char **directories, size_t ndirectories, shard_t *shard,
+               options_t *options) {
+  watch_t *watch = calloc(1, sizeof (watch_t));
+  if (watch == NULL) {
+    perror("calloc");
+    return ERROR;
+  }
+  watch->shard = shard;
+  watch->options = options;
+  if ((watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+    perror("inotify_init1");
+    free(watch);
+    return ERROR;
+  }
+  int32_t ret = 0;
+  for (size_t i = 0; ret == 0 && i < ndirectories; ++i)
+    ret = add_watch(watch, directories[i], 0);
+  if (ret == 0) {
+    struct sigaction action;
+    memset(&action, 0, sizeof (struct sigaction));
+    action.sa_handler = stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    ret = watch_loop(watch);
+  }
+  for (size_t i = 0; i < watch->ndirectories; ++i)
+    free(watch->directories[i]);
+  free(watch->directories);
+  close(watch->fd);
+  free(watch);
+  return ret;
+}
@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "dicom.h"
+#include "dcm.h"
+#include "pixel-data.h"
+#include "parallel.h"
+#include "simd.h"
+#include "bits.h"
+
+// Pixel cells of BitsAllocated 1 and 12 are packed in a little endian bit
+// stream, the first pixel in the least significant bits of the first byte.
+// Cf DICOM standard Part 5 Sect 8.1.1 and Annex D
+
+// Spread the 8 bits of a byte, least significant first, to 8 bytes of 0 or 1
+SIMD_INLINE uint64_t spread_bits(uint8_t byte) {
+  uint64_t bits = (byte * 0x0101010101010101ULL) & 0x8040201008040201ULL;
+  return ((bits + 0x7F7F7F7F7F7F7F7FULL) >> 7) & 0x0101010101010101ULL;
+}
+
+// Gather a bit per non zero byte, the first byte in the least significant bit
+SIMD_INLINE uint8_t gather_bits(uint64_t bytes) {
+  uint64_t high = (((bytes & 0x7F7F7F7F7F7F7F7FULL) + 0x7F7F7F7F7F7F7F7FULL) |
+                   bytes) & 0x8080808080808080ULL;
+  return (uint8_t) (((high >> 7) * 0x0102040810204080ULL) >> 56);
+}
+
+// Unpack n bits starting at bit_offset of input to bytes of 0 or value.
+// Bytes are expanded 8 pixels at once in a 64-bit word.
+SIMD_KERNEL void unpack_bits(const uint8_t *input, uint8_t bit_offset,
+                             size_t n, uint8_t value, uint8_t *output) {
+  size_t groups = n / 8;
+  uint64_t word;
+  if (bit_offset == 0) {
+    for (size_t j = 0; j < groups; ++j) {
+      word = spread_bits(input[j]) * value;
+      memcpy(&output[8 * j], &word, sizeof (word));
+    }
+  } else {
+    for (size_t j = 0; j < groups; ++j) {
+      uint8_t byte = input[j] >> bit_offset | input[j + 1] << (8 - bit_offset);
+      word = spread_bits(byte) * value;
+      memcpy(&output[8 * j], &word, sizeof (word));
+    }
+  }
+  for (size_t i = groups * 8; i < n; ++i)
+    output[i] = (input[(i + bit_offset) / 8] >> (i + bit_offset) % 8 & 1) *
+      value;
+}
+
+// Pack n bytes to bits, set when the byte is not zero. The unused bits of
+// the last byte are cleared.
+SIMD_KERNEL void pack_bits(const uint8_t *input, size_t n, uint8_t *output) {
+  size_t groups = n / 8;
+  uint64_t word;
+  for (size_t j = 0; j < groups; ++j) {
+    memcpy(&word, &input[8 * j], sizeof (word));
+    output[j] = gather_bits(word);
+  }
+  if (n % 8) {
+    word = 0;
+    memcpy(&word, &input[groups * 8], n % 8);
+    output[groups] = gather_bits(word);
+  }
+}
+
+// Unpack n 12-bit cells starting at bit_offset, 0 or 4, of input. Two cells
+// take three bytes.
+SIMD_KERNEL void unpack_12_bits(const uint8_t *restrict input,
+                                uint8_t bit_offset, size_t n,
+                                uint16_t *restrict output) {
+  if (n && bit_offset) {
+    *output++ = input[0] >> 4 | input[1] << 4;
+    input += 2;
+    --n;
+  }
+  for (size_t i = 0; i < n / 2; ++i) {
+    uint16_t b0 = input[3 * i];
+    uint16_t b1 = input[3 * i + 1];
+    uint16_t b2 = input[3 * i + 2];
+    output[2 * i] = b0 | (b1 & 0x0F) << 8;
+    output[2 * i + 1] = b1 >> 4 | b2 << 4;
+  }
+  if (n % 2)
+    output[n - 1] = input[3 * (n / 2)] | (input[3 * (n / 2) + 1] & 0x0F) << 8;
+}
+
+// Pack n cells to 12 bits, the inverse of unpack_12_bits with a bit_offset
+// of 0
+SIMD_KERNEL void pack_12_bits(const uint16_t *restrict input, size_t n,
+                              uint8_t *restrict output) {
+  for (size_t i = 0; i < n / 2; ++i) {
+    uint16_t a = input[2 * i] & 0x0FFF;
+    uint16_t b = input[2 * i + 1] & 0x0FFF;
+    output[3 * i] = a;
+    output[3 * i + 1] = a >> 8 | (b & 0x0F) << 4;
+    output[3 * i + 2] = b >> 4;
+  }
+  if (n % 2) {
+    output[3 * (n / 2)] = input[n - 1];
+    output[3 * (n / 2) + 1] = (input[n - 1] >> 8) & 0x0F;
+  }
+}
+
+SIMD_INLINE void mask_8(const uint8_t *input, uint8_t left,
+                        uint8_t right, uint8_t is_signed,
+                        uint8_t *output, size_t n) {
+  for (size_t i = 0; i < n; ++i)
+    output[i] = load_stored_value(input, i, 1, left, right, is_signed);
+}
+
+SIMD_INLINE void mask_16(const uint8_t *input, uint8_t left,
+                         uint8_t right, uint8_t is_signed,
+                         uint16_t *output, size_t n) {
+  for (size_t i = 0; i < n; ++i)
+    output[i] = load_stored_value(input, i, 2, left, right, is_signed);
+}
+
+// Keep the BitsStored bits ending at HighBit of n cells of 8 or 16 bits,
+// shifted down and sign extended to the width of the cell. Cells of 12 bits
+// must be unpacked to 16 bits first. Masking may be done in place.
+// Cf DICOM standard Part 3 Sect C.7.6.3.1.4
+SIMD_KERNEL void mask_stored_values(pixel_module_t *pixel_module,
+                                    const uint8_t *input, uint8_t *output,
+                                    size_t n) {
+  uint8_t left = 15 - pixel_module->high_bit;
+  uint8_t right = 16 - pixel_module->bits_stored;
+  uint8_t is_signed = pixel_module->pixel_representation == 1;
+  if (pixel_module->bits_allocated <= 8)
+    mask_8(input, left, right, is_signed, output, n);
+  else
+    mask_16(input, left, right, is_signed, (uint16_t *) output, n);
+}
+
+// Unpacked frames have a byte per sample up to 8 bits allocated, two above
+size_t get_unpacked_frame_size(pixel_module_t *pixel_module) {
+  size_t nsamples = (size_t) pixel_module->rows * pixel_module->columns *
+    pixel_module->samples_per_pixel;
+  return nsamples * (pixel_module->bits_allocated <= 8 ? 1 : 2);
+}
+
+// Unpack a frame of native pixel data to a byte or 16-bit word per sample
+// holding the stored value. Frames of BitsAllocated 1 become masks of 0 or 1.
+int8_t unpack_frame(pixel_module_t *pixel_module, frame_view_t *view,
+                    uint8_t *output) {
+  size_t nsamples = (size_t) pixel_module->rows * pixel_module->columns *
+    pixel_module->samples_per_pixel;
+  switch (pixel_module->bits_allocated) {
+  case 1:
+    unpack_bits(view->data, view->bit_offset, nsamples, 1, output);
+    return 0;
+  case 12:
+    unpack_12_bits(view->data, view->bit_offset, nsamples,
+                   (uint16_t *) output);
+    mask_stored_values(pixel_module, output, output, nsamples);
+    return 0;
+  case 8:
+  case 16:
+    mask_stored_values(pixel_module, view->data, output, nsamples);
+    return 0;
+  default:
+    return ERROR;
+  }
+}
+
+typedef struct unpack_frames_s {
+  file_t         *file;
+  tag_t          *pixel_data;
+  pixel_module_t *pixel_module;
+  uint32_t       *frames;
+  uint8_t        *output;
+} unpack_frames_t;
+
+static int8_t unpack_one_frame(void *context, size_t i) {
+  unpack_frames_t *u = (unpack_frames_t *) context;
+  frame_view_t view;
+  size_t size = get_unpacked_frame_size(u->pixel_module);
+  if (get_native_frame(u->file, u->pixel_data, u->pixel_module, u->frames[i],
+                       0, &view) == ERROR)
+    return ERROR;
+  return unpack_frame(u->pixel_module, &view, u->output + size * i);
+}
+
+// Unpack the requested frames of native pixel data one after the other in
+// output, spread over nthreads threads
+int8_t unpack_frames(file_t *file, tag_t *pixel_data,
+                     pixel_module_t *pixel_module, uint32_t *frames,
+                     size_t nframes, uint8_t *output, uint32_t nthreads) {
+  unpack_frames_t u = { file, pixel_data, pixel_module, frames, output };
+  return parallel_for(nframes, nthreads, unpack_one_frame, &u);
+}
+
+// Pack consecutive unpacked frames of BitsAllocated 1 or 12 into a native
+// pixel data stream of (get_frame_bits * nframes + 7) / 8 bytes. Frames
+// follow each other without padding, as they do in the pixel data element.
+int8_t pack_frames(pixel_module_t *pixel_module, const uint8_t *input,
+                   uint32_t nframes, uint8_t *output) {
+  size_t nsamples = (size_t) pixel_module->rows * pixel_module->columns *
+    pixel_module->samples_per_pixel * nframes;
+  switch (pixel_module->bits_allocated) {
+  case 1:
+    pack_bits(input, nsamples, output);
+    return 0;
+  case 12:
+    pack_12_bits((const uint16_t *) input, nsamples, output);
+    return 0;
+  default:
+    return ERROR;
+  }
+}
@@ -0,0 +1,27 @@
+#ifndef __BITS_H__
+#define __BITS_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "dcm.h"
+#include "pixel-data.h"
+
+void unpack_bits(const uint8_t *input, uint8_t bit_offset, size_t n,
+                 uint8_t value, uint8_t *output);
+void pack_bits(const uint8_t *input, size_t n, uint8_t *output);
+void unpack_12_bits(const uint8_t *input, uint8_t bit_offset, size_t n,
+                    uint16_t *output);
+void pack_12_bits(const uint16_t *input, size_t n, uint8_t *output);
+void mask_stored_values(pixel_module_t *pixel_module, const uint8_t *input,
+                        uint8_t *output, size_t n);
+size_t get_unpacked_frame_size(pixel_module_t *pixel_module);
+int8_t unpack_frame(pixel_module_t *pixel_module, frame_view_t *view,
+                    uint8_t *output);
+int8_t unpack_frames(file_t *file, tag_t *pixel_data,
+                     pixel_module_t *pixel_module, uint32_t *frames,
+                     size_t nframes, uint8_t *output, uint32_t nthreads);
+int8_t pack_frames(pixel_module_t *pixel_module, const uint8_t *input,
+                   uint32_t nframes, uint8_t *output);
+
+#endif // __BITS_H__
@@ -0,0 +1,278 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "dicom.h"
+#include "dcm.h"
+#include "pixel-data.h"
+#include "parallel.h"
+#include "simd.h"
+#include "planar.h"
+#include "color.h"
+
+// Read the entries of a palette color lookup table as 8 bits values. 16-bit
+// entries keep their most significant byte, 8-bit ones may be stored in
+// bytes or in the low byte of words.
+static int8_t read_palette_lut(tag_t *tags, uint32_t number,
+                               palette_t *palette, uint16_t bits,
+                               uint8_t *lut) {
+  tag_t *tag = get_tag(tags, number);
+  uint32_t n = palette->number_of_entries;
+  if (tag == NULL || tag->datasize == UNDEFINED_LENGTH) return ERROR;
+  if (bits == 8 && tag->datasize == n) {
+    memcpy(lut, tag->data, n);
+    return 0;
+  }
+  if (tag->datasize < (size_t) n * sizeof (uint16_t)) return ERROR;
+  const uint16_t *data = (const uint16_t *) tag->data;
+  for (uint32_t i = 0; i < n; ++i)
+    lut[i] = bits == 8 ? data[i] & 0xFF : data[i] >> 8;
+  return 0;
+}
+
+// Merge the red, green and blue palette color lookup tables. Segmented
+// palettes are not supported.
+// Cf DICOM standard Part 3 Sect C.7.6.3.1.5 and C.7.9
+int8_t decode_palette(tag_t *tags, pixel_module_t *pixel_module,
+                      palette_t *palette) {
+  const uint32_t descriptors[3] = { RED_PALETTE_COLOR_LOOKUP_TABLE_DESCRIPTOR,
+                                    GREEN_PALETTE_COLOR_LOOKUP_TABLE_DESCRIPTOR,
+                                    BLUE_PALETTE_COLOR_LOOKUP_TABLE_DESCRIPTOR };
+  const uint32_t data[3] = { RED_PALETTE_COLOR_LOOKUP_TABLE_DATA,
+                             GREEN_PALETTE_COLOR_LOOKUP_TABLE_DATA,
+                             BLUE_PALETTE_COLOR_LOOKUP_TABLE_DATA };
+  uint16_t descriptor[3][3];
+  memset(palette, 0, sizeof (palette_t));
+  for (uint8_t c = 0; c < 3; ++c) {
+    tag_t *tag = get_tag(tags, descriptors[c]);
+    if (tag == NULL || tag->datasize != sizeof (descriptor[c])) return ERROR;
+    memcpy(descriptor[c], tag->data, sizeof (descriptor[c]));
+    if (descriptor[c][0] != descriptor[0][0] ||
+        descriptor[c][1] != descriptor[0][1] ||
+        (descriptor[c][2] != 8 && descriptor[c][2] != 16))
+      return ERROR;
+  }
+  // 0 entries means 2^16, the first mapped value follows the pixel
+  // representation
+  palette->number_of_entries = descriptor[0][0] ? descriptor[0][0] : 1 << 16;
+  palette->first_mapped = pixel_module->pixel_representation ?
+    (int16_t) descriptor[0][1] : descriptor[0][1];
+  uint32_t n = palette->number_of_entries;
+  uint8_t *luts = malloc(n * 3);
+  palette->table = malloc(n * sizeof (uint32_t));
+  if (luts == NULL || palette->table == NULL) {
+    perror("malloc");
+    free(luts);
+    free_palette(palette);
+    return ERROR;
+  }
+  for (uint8_t c = 0; c < 3; ++c) {
+    if (read_palette_lut(tags, data[c], palette, descriptor[c][2],
+                         luts + n * c) == ERROR) {
+      free(luts);
+      free_palette(palette);
+      return ERROR;
+    }
+  }
+  for (uint32_t i = 0; i < n; ++i)
+    palette->table[i] = luts[i] | luts[n + i] << 8 |
+      (uint32_t) luts[2 * n + i] << 16;
+  free(luts);
+  return 0;
+}
+
+void free_palette(palette_t *palette) {
+  free(palette->table);
+  palette->table = NULL;
+}
+
+SIMD_INLINE uint8_t clamp_uint8(int32_t value) {
+  value = value < 0 ? 0 : value;
+  return value > 255 ? 255 : value;
+}
+
+// Cf DICOM standard Part 3 Sect C.7.6.3.1.2, the coefficients are scaled by
+// 2^16 and rounded
+typedef struct chroma_s {
+  int32_t r;
+  int32_t g;
+  int32_t b;
+} chroma_t;
+
+SIMD_INLINE chroma_t get_chroma(int32_t cb, int32_t cr) {
+  chroma_t chroma;
+  cb -= 128;
+  cr -= 128;
+  chroma.r = (91881 * cr + 32768) >> 16;
+  chroma.g = -((22554 * cb + 46802 * cr + 32768) >> 16);
+  chroma.b = (116130 * cb + 32768) >> 16;
+  return chroma;
+}
+
+SIMD_INLINE void add_chroma(int32_t y, chroma_t chroma,
+                            uint8_t *restrict rgb) {
+  rgb[0] = clamp_uint8(y + chroma.r);
+  rgb[1] = clamp_uint8(y + chroma.g);
+  rgb[2] = clamp_uint8(y + chroma.b);
+}
+
+SIMD_INLINE void ybr_pixel_to_rgb(int32_t y, int32_t cb, int32_t cr,
+                                  uint8_t *restrict rgb) {
+  add_chroma(y, get_chroma(cb, cr), rgb);
+}
+
+SIMD_INLINE void ybr_interleaved_to_rgb(const uint8_t *restrict input,
+                                        uint8_t *restrict output, size_t n) {
+  for (size_t i = 0; i < n; ++i)
+    ybr_pixel_to_rgb(input[3 * i], input[3 * i + 1], input[3 * i + 2],
+                     &output[3 * i]);
+}
+
+SIMD_INLINE void ybr_planar_to_rgb(const uint8_t *restrict y,
+                                   const uint8_t *restrict cb,
+                                   const uint8_t *restrict cr,
+                                   uint8_t *restrict output, size_t n) {
+  for (size_t i = 0; i < n; ++i)
+    ybr_pixel_to_rgb(y[i], cb[i], cr[i], &output[3 * i]);
+}
+
+// Convert 8-bit YBR_FULL pixels to interleaved RGB8
+SIMD_KERNEL void ybr_full_to_rgb(const uint8_t *input, uint8_t planar,
+                                 uint8_t *output, size_t npixels) {
+  if (planar)
+    ybr_planar_to_rgb(input, input + npixels, input + 2 * npixels, output,
+                      npixels);
+  else
+    ybr_interleaved_to_rgb(input, output, npixels);
+}
+
+// Replicate the chrominance of pairs of YBR_FULL_422 pixels into YBR_FULL
+// pixels
+SIMD_INLINE void upsample_422(const uint8_t *restrict input,
+                              uint8_t *restrict output, size_t npairs) {
+  for (size_t i = 0; i < npairs; ++i) {
+    output[6 * i] = input[4 * i];
+    output[6 * i + 1] = input[4 * i + 2];
+    output[6 * i + 2] = input[4 * i + 3];
+    output[6 * i + 3] = input[4 * i + 1];
+    output[6 * i + 4] = input[4 * i + 2];
+    output[6 * i + 5] = input[4 * i + 3];
+  }
+}
+
+#define YBR_422_BLOCK 1024 // Pixels upsampled at once, kept in L1
+
+// Convert 8-bit YBR_FULL_422 pixels, Y1 Y2 Cb Cr for each pair of pixels, to
+// interleaved RGB8. The chrominance of a pair is replicated on both pixels.
+// Blocks are upsampled to YBR_FULL first, the compiler not vectorizing the
+// conversion of pairs in one loop. npixels must be even.
+SIMD_KERNEL void ybr_full_422_to_rgb(const uint8_t *restrict input,
+                                     uint8_t *restrict output,
+                                     size_t npixels) {
+  uint8_t block[YBR_422_BLOCK * 3];
+  for (size_t i = 0; i < npixels; i += YBR_422_BLOCK) {
+    size_t n = npixels - i < YBR_422_BLOCK ? npixels - i : YBR_422_BLOCK;
+    upsample_422(input + i * 2, block, n / 2);
+    ybr_interleaved_to_rgb(block, output + i * 3, n);
+  }
+}
+
+SIMD_INLINE uint32_t lookup_palette(const uint32_t *table, int32_t last,
+                                    int32_t value) {
+  value = value < 0 ? 0 : value;
+  return table[value > last ? last : value];
+}
+
+// Map stored values of 8 or 16 bits through the palette to interleaved RGB8.
+// Values out of the palette take its first or last entry. Entries are stored
+// 4 bytes at a time, each store overwriting the unused byte of the previous
+// one.
+SIMD_KERNEL void palette_to_rgb(palette_t *palette,
+                                pixel_module_t *pixel_module,
+                                const uint8_t *input, uint8_t *output,
+                                size_t npixels) {
+  const uint32_t *table = palette->table;
+  int32_t first = palette->first_mapped;
+  int32_t last = palette->number_of_entries - 1;
+  uint8_t bytes = pixel_module->bits_allocated / 8;
+  uint8_t left = 15 - pixel_module->high_bit;
+  uint8_t right = 16 - pixel_module->bits_stored;
+  uint8_t is_signed = pixel_module->pixel_representation == 1;
+  uint32_t rgb;
+  if (npixels == 0) return;
+  for (size_t i = 0; i < npixels - 1; ++i) {
+    rgb = lookup_palette(table, last, load_stored_value(
+      input, i, bytes, left, right, is_signed) - first);
+    memcpy(&output[3 * i], &rgb, sizeof (rgb));
+  }
+  rgb = lookup_palette(table, last, load_stored_value(
+    input, npixels - 1, bytes, left, right, is_signed) - first);
+  memcpy(&output[3 * (npixels - 1)], &rgb, 3);
+}
+
+// Convert a frame of native pixel data to interleaved RGB8. palette is only
+// needed for PALETTE COLOR.
+// Cf DICOM standard Part 3 Sect C.7.6.3.1.2
+int8_t convert_to_rgb(pixel_module_t *pixel_module, palette_t *palette,
+                      const uint8_t *input, uint8_t *output) {
+  char *photometric_interpretation = pixel_module->photometric_interpretation;
+  size_t npixels = (size_t) pixel_module->rows * pixel_module->columns;
+  if (!strcmp(photometric_interpretation, "PALETTE COLOR")) {
+    if (palette == NULL || palette->table == NULL ||
+        pixel_module->samples_per_pixel != 1 ||
+        (pixel_module->bits_allocated != 8 &&
+         pixel_module->bits_allocated != 16))
+      return ERROR;
+    palette_to_rgb(palette, pixel_module, input, output, npixels);
+    return 0;
+  }
+  if (pixel_module->samples_per_pixel != 3 ||
+      pixel_module->bits_allocated != 8)
+    return ERROR;
+  if (!strcmp(photometric_interpretation, "YBR_FULL")) {
+    ybr_full_to_rgb(input, pixel_module->planar_configuration, output,
+                    npixels);
+  } else if (!strcmp(photometric_interpretation, "YBR_FULL_422")) {
+    if (pixel_module->columns % 2 || pixel_module->planar_configuration)
+      return ERROR;
+    ybr_full_422_to_rgb(input, output, npixels);
+  } else if (!strcmp(photometric_interpretation, "RGB")) {
+    if (pixel_module->planar_configuration)
+      return planar_to_interleaved(input, output, npixels, 1);
+    memcpy(output, input, npixels * 3);
+  } else {
+    return ERROR;
+  }
+  return 0;
+}
+
+typedef struct convert_frames_s {
+  file_t         *file;
+  tag_t          *pixel_data;
+  pixel_module_t *pixel_module;
+  palette_t      *palette;
+  uint8_t        *output;
+} convert_frames_t;
+
+static int8_t convert_frame(void *context, size_t frame) {
+  convert_frames_t *c = (convert_frames_t *) context;
+  frame_view_t view;
+  size_t size = (size_t) c->pixel_module->rows * c->pixel_module->columns * 3;
+  if (get_native_frame(c->file, c->pixel_data, c->pixel_module, frame, 0,
+                       &view) == ERROR)
+    return ERROR;
+  return convert_to_rgb(c->pixel_module, c->palette, view.data,
+                        c->output + size * frame);
+}
+
+// Convert all the frames of native pixel data to interleaved RGB8 into
+// output, frame after frame
+int8_t convert_frames_to_rgb(file_t *file, tag_t *pixel_data,
+                             pixel_module_t *pixel_module, palette_t *palette,
+                             uint8_t *output, uint32_t nthreads) {
+  convert_frames_t c = { file, pixel_data, pixel_module, palette, output };
+  return parallel_for(pixel_module->number_of_frames, nthreads, convert_frame,
+                      &c);
+}
@@ -0,0 +1,34 @@
+#ifndef __COLOR_H__
+#define __COLOR_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "dcm.h"
+#include "pixel-data.h"
+
+// The three palette color lookup tables merged in a table of RGB8 entries,
+// red in the least significant byte
+// Cf DICOM standard Part 3 Sect C.7.6.3.1.5
+typedef struct palette_s {
+  uint32_t number_of_entries;
+  int32_t  first_mapped;
+  uint32_t *table;
+} palette_t;
+
+int8_t decode_palette(tag_t *tags, pixel_module_t *pixel_module,
+                      palette_t *palette);
+void free_palette(palette_t *palette);
+void ybr_full_to_rgb(const uint8_t *input, uint8_t planar, uint8_t *output,
+                     size_t npixels);
+void ybr_full_422_to_rgb(const uint8_t *input, uint8_t *output,
+                         size_t npixels);
+void palette_to_rgb(palette_t *palette, pixel_module_t *pixel_module,
+                    const uint8_t *input, uint8_t *output, size_t npixels);
+int8_t convert_to_rgb(pixel_module_t *pixel_module, palette_t *palette,
+                      const uint8_t *input, uint8_t *output);
+int8_t convert_frames_to_rgb(file_t *file, tag_t *pixel_data,
+                             pixel_module_t *pixel_module, palette_t *palette,
+                             uint8_t *output, uint32_t nthreads);
+
+#endif // __COLOR_H__
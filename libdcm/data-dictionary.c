@@ -2147,9 +2147,11 @@ const tag_definition_t g_tag_definitions[] = {
   { 0x0048, 0x0202, "US", "2", "BottomRightHandCornerOfLocalizerArea" },
   { 0x0048, 0x0207, "SQ", "1", "OpticalPathIdentificationSequence" },
   { 0x0048, 0x021A, "SQ", "1", "PlanePositionSlideSequence" },
-  { 0x0048, 0x021E, "SL", "1", "RowPositionInTotalImagePixelMatrix" },
-  { 0x0048, 0x021F, "SL", "1", "ColumnPositionInTotalImagePixelMatrix" },
+  { 0x0048, 0x021E, "SL", "1", "ColumnPositionInTotalImagePixelMatrix" },
+  { 0x0048, 0x021F, "SL", "1", "RowPositionInTotalImagePixelMatrix" },
   { 0x0048, 0x0301, "CS", "1", "PixelOriginInterpretation" },
+  { 0x0048, 0x0302, "UL", "1", "NumberOfOpticalPaths" },
+  { 0x0048, 0x0303, "UL", "1", "TotalPixelMatrixFocalPlanes" },
   { 0x0050, 0x0004, "CS", "1", "CalibrationImage" },
   { 0x0050, 0x0010, "SQ", "1", "DeviceSequence" },
   { 0x0050, 0x0012, "SQ", "1", "ContainerComponentTypeCodeSequence" },
@@ -3554,32 +3556,33 @@ const tag_definition_t g_tag_definitions[] = {
   { 0x4010, 0x1069, "FL", "1", "TotalProcessingTime" },
   { 0x4010, 0x106C, "OB", "1", "DetectorCalibrationData" },
   { 0x4FFE, 0x0001, "SQ", "1", "MACParametersSequence" },
-  // { 0x50xx, 0x0005, "US", "1", "CurveDimensions" },
-  // { 0x50xx, 0x0010, "US", "1", "NumberOfPoints" },
-  // { 0x50xx, 0x0020, "CS", "1", "TypeOfData" },
-  // { 0x50xx, 0x0022, "LO", "1", "CurveDescription" },
-  // { 0x50xx, 0x0030, "SH", "1-n", "AxisUnits" },
-  // { 0x50xx, 0x0040, "SH", "1-n", "AxisLabels" },
-  // { 0x50xx, 0x0103, "US", "1", "DataValueRepresentation" },
-  // { 0x50xx, 0x0104, "US", "1-n", "MinimumCoordinateValue" },
-  // { 0x50xx, 0x0105, "US", "1-n", "MaximumCoordinateValue" },
-  // { 0x50xx, 0x0106, "SH", "1-n", "CurveRange" },
-  // { 0x50xx, 0x0110, "US", "1-n", "CurveDataDescriptor" },
-  // { 0x50xx, 0x0112, "US", "1-n", "CoordinateStartValue" },
-  // { 0x50xx, 0x0114, "US", "1-n", "CoordinateStepValue" },
-  // { 0x50xx, 0x1001, "CS", "1", "CurveActivationLayer" },
-  // { 0x50xx, 0x2000, "US", "1", "AudioType" },
-  // { 0x50xx, 0x2002, "US", "1", "AudioSampleFormat" },
-  // { 0x50xx, 0x2004, "US", "1", "NumberOfChannels" },
-  // { 0x50xx, 0x2006, "UL", "1", "NumberOfSamples" },
-  // { 0x50xx, 0x2008, "UL", "1", "SampleRate" },
-  // { 0x50xx, 0x200A, "UL", "1", "TotalTime" },
-  // { 0x50xx, 0x200C, "OW|OB", "1", "AudioSampleData" },
-  // { 0x50xx, 0x200E, "LT", "1 ", "AudioComments" },
-  // { 0x50xx, 0x2500, "LO", "1", "CurveLabel" },
-  // { 0x50xx, 0x2600, "SQ", "1", "CurveReferencedOverlaySequence" },
-  // { 0x50xx, 0x2610, "US", "1", "CurveReferencedOverlayGroup" },
-  // { 0x50xx, 0x3000, "OW|OB", "1", "CurveData" },
+  // Repeating groups are listed under their first group, cf get_vr
+  { 0x5000, 0x0005, "US", "1", "CurveDimensions" },
+  { 0x5000, 0x0010, "US", "1", "NumberOfPoints" },
+  { 0x5000, 0x0020, "CS", "1", "TypeOfData" },
+  { 0x5000, 0x0022, "LO", "1", "CurveDescription" },
+  { 0x5000, 0x0030, "SH", "1-n", "AxisUnits" },
+  { 0x5000, 0x0040, "SH", "1-n", "AxisLabels" },
+  { 0x5000, 0x0103, "US", "1", "DataValueRepresentation" },
+  { 0x5000, 0x0104, "US", "1-n", "MinimumCoordinateValue" },
+  { 0x5000, 0x0105, "US", "1-n", "MaximumCoordinateValue" },
+  { 0x5000, 0x0106, "SH", "1-n", "CurveRange" },
+  { 0x5000, 0x0110, "US", "1-n", "CurveDataDescriptor" },
+  { 0x5000, 0x0112, "US", "1-n", "CoordinateStartValue" },
+  { 0x5000, 0x0114, "US", "1-n", "CoordinateStepValue" },
+  { 0x5000, 0x1001, "CS", "1", "CurveActivationLayer" },
+  { 0x5000, 0x2000, "US", "1", "AudioType" },
+  { 0x5000, 0x2002, "US", "1", "AudioSampleFormat" },
+  { 0x5000, 0x2004, "US", "1", "NumberOfChannels" },
+  { 0x5000, 0x2006, "UL", "1", "NumberOfSamples" },
+  { 0x5000, 0x2008, "UL", "1", "SampleRate" },
+  { 0x5000, 0x200A, "UL", "1", "TotalTime" },
+  { 0x5000, 0x200C, "OW|OB", "1", "AudioSampleData" },
+  { 0x5000, 0x200E, "LT", "1 ", "AudioComments" },
+  { 0x5000, 0x2500, "LO", "1", "CurveLabel" },
+  { 0x5000, 0x2600, "SQ", "1", "CurveReferencedOverlaySequence" },
+  { 0x5000, 0x2610, "US", "1", "CurveReferencedOverlayGroup" },
+  { 0x5000, 0x3000, "OW|OB", "1", "CurveData" },
   { 0x5200, 0x9229, "SQ", "1", "SharedFunctionalGroupsSequence" },
   { 0x5200, 0x9230, "SQ", "1", "PerFrameFunctionalGroupsSequence" },
   { 0x5400, 0x0100, "SQ", "1", "WaveformSequence" },
@@ -3591,46 +3594,48 @@ const tag_definition_t g_tag_definitions[] = {
   { 0x5400, 0x1010, "OB|OW", "1", "WaveformData" },
   { 0x5600, 0x0010, "OF", "1", "FirstOrderPhaseCorrectionAngle" },
   { 0x5600, 0x0020, "OF", "1", "SpectroscopyData" },
-  // { 0x60xx, 0x0010, "US", "1", "OverlayRows" },
-  // { 0x60xx, 0x0011, "US", "1", "OverlayColumns" },
-  // { 0x60xx, 0x0012, "US", "1", "OverlayPlanes" },
-  // { 0x60xx, 0x0015, "IS", "1", "NumberOfFramesInOverlay" },
-  // { 0x60xx, 0x0022, "LO", "1", "OverlayDescription" },
-  // { 0x60xx, 0x0040, "CS", "1", "OverlayType" },
-  // { 0x60xx, 0x0045, "LO", "1", "OverlaySubtype" },
-  // { 0x60xx, 0x0050, "SS", "2", "OverlayOrigin" },
-  // { 0x60xx, 0x0051, "US", "1", "ImageFrameOrigin" },
-  // { 0x60xx, 0x0052, "US", "1", "OverlayPlaneOrigin" },
-  // { 0x60xx, 0x0060, "CS", "1", "OverlayCompressionCode" },
-  // { 0x60xx, 0x0061, "SH", "1", "OverlayCompressionOriginator" },
-  // { 0x60xx, 0x0062, "SH", "1", "OverlayCompressionLabel" },
-  // { 0x60xx, 0x0063, "CS", "1", "OverlayCompressionDescription" },
-  // { 0x60xx, 0x0066, "AT", "1-n", "OverlayCompressionStepPointers" },
-  // { 0x60xx, 0x0068, "US", "1", "OverlayRepeatInterval" },
-  // { 0x60xx, 0x0069, "US", "1", "OverlayBitsGrouped" },
-  // { 0x60xx, 0x0100, "US", "1", "OverlayBitsAllocated" },
-  // { 0x60xx, 0x0102, "US", "1", "OverlayBitPosition" },
-  // { 0x60xx, 0x0110, "CS", "1", "OverlayFormat" },
-  // { 0x60xx, 0x0200, "US", "1", "OverlayLocation" },
-  // { 0x60xx, 0x0800, "CS", "1-n", "OverlayCodeLabel" },
-  // { 0x60xx, 0x0802, "US", "1", "OverlayNumberOfTables" },
-  // { 0x60xx, 0x0803, "AT", "1-n", "OverlayCodeTableLocation" },
-  // { 0x60xx, 0x0804, "US", "1", "OverlayBitsForCodeWord" },
-  // { 0x60xx, 0x1001, "CS", "1", "OverlayActivationLayer" },
-  // { 0x60xx, 0x1100, "US", "1", "OverlayDescriptorGray" },
-  // { 0x60xx, 0x1101, "US", "1", "OverlayDescriptorRed" },
-  // { 0x60xx, 0x1102, "US", "1", "OverlayDescriptorGreen" },
-  // { 0x60xx, 0x1103, "US", "1", "OverlayDescriptorBlue" },
-  // { 0x60xx, 0x1200, "US", "1-n", "OverlaysGray" },
-  // { 0x60xx, 0x1201, "US", "1-n", "OverlaysRed" },
-  // { 0x60xx, 0x1202, "US", "1-n", "OverlaysGreen" },
-  // { 0x60xx, 0x1203, "US", "1-n", "OverlaysBlue" },
-  // { 0x60xx, 0x1301, "IS", "1", "ROIArea" },
-  // { 0x60xx, 0x1302, "DS", "1", "ROIMean" },
-  // { 0x60xx, 0x1303, "DS", "1", "ROIStandardDeviation" },
-  // { 0x60xx, 0x1500, "LO", "1", "OverlayLabel" },
-  // { 0x60xx, 0x3000, "OB|OW", "1", "OverlayData" },
-  // { 0x60xx, 0x4000, "LT", "1", "OverlayComments" },
+  { 0x6000, 0x0010, "US", "1", "OverlayRows" },
+  { 0x6000, 0x0011, "US", "1", "OverlayColumns" },
+  { 0x6000, 0x0012, "US", "1", "OverlayPlanes" },
+  { 0x6000, 0x0015, "IS", "1", "NumberOfFramesInOverlay" },
+  { 0x6000, 0x0022, "LO", "1", "OverlayDescription" },
+  { 0x6000, 0x0040, "CS", "1", "OverlayType" },
+  { 0x6000, 0x0045, "LO", "1", "OverlaySubtype" },
+  { 0x6000, 0x0050, "SS", "2", "OverlayOrigin" },
+  { 0x6000, 0x0051, "US", "1", "ImageFrameOrigin" },
+  { 0x6000, 0x0052, "US", "1", "OverlayPlaneOrigin" },
+  { 0x6000, 0x0060, "CS", "1", "OverlayCompressionCode" },
+  { 0x6000, 0x0061, "SH", "1", "OverlayCompressionOriginator" },
+  { 0x6000, 0x0062, "SH", "1", "OverlayCompressionLabel" },
+  { 0x6000, 0x0063, "CS", "1", "OverlayCompressionDescription" },
+  { 0x6000, 0x0066, "AT", "1-n", "OverlayCompressionStepPointers" },
+  { 0x6000, 0x0068, "US", "1", "OverlayRepeatInterval" },
+  { 0x6000, 0x0069, "US", "1", "OverlayBitsGrouped" },
+  { 0x6000, 0x0100, "US", "1", "OverlayBitsAllocated" },
+  { 0x6000, 0x0102, "US", "1", "OverlayBitPosition" },
+  { 0x6000, 0x0110, "CS", "1", "OverlayFormat" },
+  { 0x6000, 0x0200, "US", "1", "OverlayLocation" },
+  { 0x6000, 0x0800, "CS", "1-n", "OverlayCodeLabel" },
+  { 0x6000, 0x0802, "US", "1", "OverlayNumberOfTables" },
+  { 0x6000, 0x0803, "AT", "1-n", "OverlayCodeTableLocation" },
+  { 0x6000, 0x0804, "US", "1", "OverlayBitsForCodeWord" },
+  { 0x6000, 0x1001, "CS", "1", "OverlayActivationLayer" },
+  { 0x6000, 0x1100, "US", "1", "OverlayDescriptorGray" },
+  { 0x6000, 0x1101, "US", "1", "OverlayDescriptorRed" },
+  { 0x6000, 0x1102, "US", "1", "OverlayDescriptorGreen" },
+  { 0x6000, 0x1103, "US", "1", "OverlayDescriptorBlue" },
+  { 0x6000, 0x1200, "US", "1-n", "OverlaysGray" },
+  { 0x6000, 0x1201, "US", "1-n", "OverlaysRed" },
+  { 0x6000, 0x1202, "US", "1-n", "OverlaysGreen" },
+  { 0x6000, 0x1203, "US", "1-n", "OverlaysBlue" },
+  { 0x6000, 0x1301, "IS", "1", "ROIArea" },
+  { 0x6000, 0x1302, "DS", "1", "ROIMean" },
+  { 0x6000, 0x1303, "DS", "1", "ROIStandardDeviation" },
+  { 0x6000, 0x1500, "LO", "1", "OverlayLabel" },
+  { 0x6000, 0x3000, "OB|OW", "1", "OverlayData" },
+  { 0x6000, 0x4000, "LT", "1", "OverlayComments" },
+  { 0x7FE0, 0x0001, "OV", "1", "ExtendedOffsetTable" },
+  { 0x7FE0, 0x0002, "OV", "1", "ExtendedOffsetTableLengths" },
   { 0x7FE0, 0x0010, "OW|OB", "1", "PixelData" },
   { 0x7FE0, 0x0020, "OW", "1", "CoefficientsSDVN" },
   { 0x7FE0, 0x0030, "OW", "1", "CoefficientsSDHN" },
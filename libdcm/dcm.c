@@ -1,7 +1,9 @@
+#define _GNU_SOURCE // O_DIRECT
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -19,7 +21,7 @@ const uint8_t g_explicit_tag_size = sizeof (uint16_t) * 3 + sizeof (char) * 2;
 const uint8_t g_double_length_explicit_tag_size =
   sizeof (uint16_t) * 3 + sizeof (char) * 2 + sizeof (uint32_t);
 
-int8_t load_file(char *filename, file_t *file) {
+static int8_t open_file(char *filename, file_t *file) {
   // Open the file
   file->fd = open(filename, O_RDONLY);
   if (file->fd < 0) {
@@ -35,22 +37,223 @@ int8_t load_file(char *filename, file_t *file) {
   }
   // Be kind, rewind
   lseek(file->fd, 0, SEEK_SET);
+  file->filename = filename;
+  return 0;
+}
+
+int8_t load_file(char *filename, file_t *file) {
+  if (open_file(filename, file) == ERROR) return ERROR;
   // Load the file
   file->content = mmap(NULL, file->size, PROT_READ, MAP_SHARED, file->fd, 0);
-  if (file == NULL) {
+  if (file->content == MAP_FAILED) {
     perror("mmap");
+    close(file->fd);
+    file->content = NULL;
+    return ERROR;
+  }
+  file->window_size = 0;
+  file->window_offset = 0;
+  file->window_length = file->size;
+  file->direct = 0;
+  return 0;
+}
+
+// Map the file by windows of window_size bytes instead of as a whole, so that
+// reading multi-gigabyte files holds a bounded address space and a flat
+// resident set. The decoders slide the window on demand: pointers into the
+// file, such as tag data or frame views, stay valid until the next access
+// outside of the window, and a windowed file is to be read from one thread.
+// The window grows over tags decoded in a row instead, so that the tags of
+// a header larger than the window, as returned by decode_n_tags, stay valid.
+// Release it with unmap_file.
+int8_t load_file_window(char *filename, size_t window_size, file_t *file) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  if (open_file(filename, file) == ERROR) return ERROR;
+  file->content = NULL;
+  file->window_size = (window_size + page - 1) & ~(page - 1);
+  if (file->window_size == 0) file->window_size = page;
+  file->window_offset = 0;
+  file->window_length = 0;
+  file->direct = 0;
+  if (map_file_window(file, 0, 0) == NULL) {
     close(file->fd);
     return ERROR;
   }
+  return 0;
+}
+
+static ssize_t read_header(file_t *file, size_t length) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t size = 0;
+  length = (length + page - 1) & ~(page - 1);
+  int ret = posix_memalign((void **) &(file->content), page, length);
+  if (ret) {
+    errno = ret;
+    perror("posix_memalign");
+    file->content = NULL;
+    return ERROR;
+  }
+  // Direct reads come in whole blocks until the end of the file
+  while (size < length) {
+    ssize_t n = pread(file->fd, file->content + size, length - size, size);
+    if (n < 0) {
+      perror(file->filename);
+      free(file->content);
+      file->content = NULL;
+      return ERROR;
+    }
+    if (n == 0) break;
+    size += n;
+  }
+  return size;
+}
+
+// Read the first length bytes of the file with O_DIRECT, bypassing the page
+// cache, for scans which only decode the header. The file is then truncated
+// to what was read, and released with unmap_file. It is read through the
+// page cache on the filesystems without O_DIRECT.
+int8_t load_file_header(char *filename, size_t length, file_t *file) {
+  file->fd = open(filename, O_RDONLY | O_DIRECT);
+  if (file->fd < 0 && errno == EINVAL) file->fd = open(filename, O_RDONLY);
+  if (file->fd < 0) {
+    perror(filename);
+    return ERROR;
+  }
   file->filename = filename;
+  if ((file->size = read_header(file, length)) == ERROR) {
+    close(file->fd);
+    return ERROR;
+  }
+  file->window_size = 0;
+  file->window_offset = 0;
+  file->window_length = file->size;
+  file->direct = 1;
   return 0;
 }
 
+// Make the bytes [offset, offset + length) of the file accessible, sliding
+// the window of a windowed file over them if needed. Return a pointer to
+// offset, NULL if the range is out of the file or cannot be mapped.
+uint8_t *map_file_window(file_t *file, ssize_t offset, size_t length) {
+  if (offset < 0 || offset + (ssize_t) length > file->size) return NULL;
+  if (!file->window_size ||
+      (file->content && offset >= file->window_offset &&
+       offset + (ssize_t) length <=
+       file->window_offset + (ssize_t) file->window_length))
+    return &(file->content[offset]);
+  ssize_t page = sysconf(_SC_PAGESIZE);
+  ssize_t begin = offset & ~(page - 1);
+  size_t size = offset + length - begin;
+  if (size < file->window_size) size = file->window_size;
+  if (begin + (ssize_t) size > file->size) size = file->size - begin;
+  unmap_file(file);
+  uint8_t *window = mmap(NULL, size, PROT_READ, MAP_SHARED, file->fd, begin);
+  if (window == MAP_FAILED) {
+    perror("mmap");
+    file->content = NULL;
+    return NULL;
+  }
+  // Windows are slid forward by scans, read ahead aggressively
+  madvise(window, size, MADV_SEQUENTIAL);
+  file->content = window - begin;
+  file->window_offset = begin;
+  file->window_length = size;
+  return window + (offset - begin);
+}
+
+// Grow the window of a windowed file up to offset + length when offset lies
+// in it or right past its end, as the tags of a header decoded one after the
+// other do. Slide it otherwise. Growing may move the window in memory.
+static uint8_t *extend_file_window(file_t *file, ssize_t offset,
+                                   size_t length) {
+  ssize_t end = file->window_offset + file->window_length;
+  if (!file->window_size || file->content == NULL ||
+      offset < file->window_offset || offset > end ||
+      offset + (ssize_t) length <= end)
+    return map_file_window(file, offset, length);
+  if (offset + (ssize_t) length > file->size) return NULL;
+  // By whole windows, to remap once every window_size bytes at most
+  size_t size = offset + length - file->window_offset;
+  size = (size + file->window_size - 1) / file->window_size *
+    file->window_size;
+  if (file->window_offset + (ssize_t) size > file->size)
+    size = file->size - file->window_offset;
+  uint8_t *window = mremap(&(file->content[file->window_offset]),
+                           file->window_length, size, MREMAP_MAYMOVE);
+  if (window == MAP_FAILED) {
+    perror("mremap");
+    return NULL;
+  }
+  file->content = window - file->window_offset;
+  file->window_length = size;
+  return &(file->content[offset]);
+}
+
+// Let the kernel drop the mapped pages of a range which will not be read
+// again, so that a scan over a whole mapping keeps a flat resident set. Only
+// the pages entirely inside the range are released.
+void release_file_range(file_t *file, ssize_t offset, size_t length) {
+  uintptr_t page = sysconf(_SC_PAGESIZE);
+  ssize_t first = file->window_offset;
+  ssize_t last = file->window_offset + file->window_length;
+  ssize_t end = offset + length;
+  if (file->content == NULL) return;
+  if (offset < first) offset = first;
+  if (end > last) end = last;
+  if (end <= offset) return;
+  uintptr_t begin = ((uintptr_t) &(file->content[offset]) + page - 1) &
+    ~(page - 1);
+  uintptr_t stop = (uintptr_t) &(file->content[end]) & ~(page - 1);
+  // Advice only, failing to release is not an error
+  if (stop > begin) madvise((void *) begin, stop - begin, MADV_DONTNEED);
+}
+
+// Page cache hints for scans reading each file once: the header is read
+// ahead and the rest of the file sequentially
+void advise_file(file_t *file, size_t header_length) {
+  // Advice only, failing to advise is not an error
+  posix_fadvise(file->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  posix_fadvise(file->fd, 0, header_length, POSIX_FADV_WILLNEED);
+}
+
+// Drop the pages of a processed file from the page cache, so that scanning an
+// archive does not evict the working set of the other processes. Mapped pages
+// are kept, the file is to be unmapped first.
+void drop_file_cache(file_t *file) {
+  posix_fadvise(file->fd, 0, 0, POSIX_FADV_DONTNEED);
+}
+
+// Unmap the file or the current window of a windowed file, or free the
+// header read by load_file_header
+void unmap_file(file_t *file) {
+  if (file->direct)
+    free(file->content);
+  else if (file->content && file->window_length)
+    munmap(&(file->content[file->window_offset]), file->window_length);
+  file->content = NULL;
+  file->window_length = 0;
+}
+
 int8_t close_file(file_t *file) {
   close(file->fd);
   return 0;
 }
 
+// Write length bytes, retrying on short writes
+int8_t write_all(int fd, const void *data, size_t length) {
+  const uint8_t *p = data;
+  while (length) {
+    ssize_t written = write(fd, p, length);
+    if (written < 0) {
+      perror("write");
+      return ERROR;
+    }
+    p += written;
+    length -= written;
+  }
+  return 0;
+}
+
 ssize_t check_preamble(file_t *file, ssize_t offset) {
   // Check presence of preamble
   explicit_tag_t *tag;
@@ -96,17 +299,26 @@ char *tag_data_to_string(tag_t *tag, void *data, size_t *length) {
   return STR_REPR_BINARY;
 }
 
+// Map the even groups of the repeating groups 50xx and 60xx to the first one
+// Cf DICOM standard Part 5 Sect 7.6
+uint16_t get_repeating_group(uint16_t group) {
+  if ((group & 0xFFE1) == 0x5000 || (group & 0xFFE1) == 0x6000)
+    return group & 0xFF00;
+  return group;
+}
+
 // TODO: Make it faster
 void get_vr(implicit_tag_t *implicit_tag, char vr[2]) {
   if (implicit_tag->element == 0) {
     vr[0] = 'U'; vr[1] = 'L';
     return;
   }
+  uint16_t group = get_repeating_group(implicit_tag->group);
   for (uint16_t i = 0; g_tag_definitions[i].group != 0xFFFE; ++i) {
     // printf("(%04X, %04X) (%04X, %04X)\n",
     // implicit_tag->group, implicit_tag->element,
     // g_tag_definitions[i].group, g_tag_definitions[i].element);
-    if (g_tag_definitions[i].group == implicit_tag->group &&
+    if (g_tag_definitions[i].group == group &&
         g_tag_definitions[i].element == implicit_tag->element) {
       vr[0] = g_tag_definitions[i].vr[0];
       vr[1] = g_tag_definitions[i].vr[1];
@@ -116,37 +328,58 @@ void get_vr(implicit_tag_t *implicit_tag, char vr[2]) {
   vr[0] = 'U'; vr[1] = 'N';
 }
 
+// Extend the window of a windowed file over the value of a decoded tag and
+// rebase its data on it, unless the value follows the header and is larger
+// than the window, as pixel data usually are.
+static ssize_t map_tag_value(file_t *file, ssize_t offset, ssize_t shift,
+                             tag_t *tag) {
+  if (!file->window_size || tag->datasize == UNDEFINED_LENGTH ||
+      (tag->group > 0x4FFE && tag->datasize > file->window_size) ||
+      offset + shift + tag->datasize > file->size)
+    return shift;
+  uint8_t *header = extend_file_window(file, offset, shift + tag->datasize);
+  if (header == NULL) return ERROR;
+  tag->data = (void *) (header + shift);
+  return shift;
+}
+
 ssize_t decode_explicit_tag(file_t *file, ssize_t offset, tag_t *tag) {
   if (offset + g_explicit_tag_size > file->size) return 0;
   explicit_tag_t *explicit_tag;
-  explicit_tag = (explicit_tag_t *) &(file->content[offset]);
+  explicit_tag = (explicit_tag_t *)
+    extend_file_window(file, offset, g_explicit_tag_size);
+  if (explicit_tag == NULL) return ERROR;
   tag->group = explicit_tag->group;
   tag->element = explicit_tag->element;
   tag->vr[0] = explicit_tag->vr[0]; tag->vr[1] = explicit_tag->vr[1];
   if (is_double_length_vr(tag->vr)) {
     double_length_explicit_tag_t *dl_explicit_tag;
-    dl_explicit_tag = (double_length_explicit_tag_t *) &(file->content[offset]);
+    dl_explicit_tag = (double_length_explicit_tag_t *)
+      extend_file_window(file, offset, g_double_length_explicit_tag_size);
+    if (dl_explicit_tag == NULL) return ERROR;
     tag->datasize = dl_explicit_tag->datasize;
     tag->data =
       (void *) &(file->content[offset + g_double_length_explicit_tag_size]);
-    return g_double_length_explicit_tag_size;
+    return map_tag_value(file, offset, g_double_length_explicit_tag_size, tag);
   }
   tag->datasize = explicit_tag->datasize;
   tag->data = (void *) &(file->content[offset + g_explicit_tag_size]);
-  return g_explicit_tag_size;
+  return map_tag_value(file, offset, g_explicit_tag_size, tag);
 }
 
 ssize_t decode_implicit_tag(file_t *file, ssize_t offset, tag_t *tag)
 {
   if (offset + g_implicit_tag_size > file->size) return 0;
   implicit_tag_t *implicit_tag;
-  implicit_tag = (implicit_tag_t *) &(file->content[offset]);
+  implicit_tag = (implicit_tag_t *)
+    extend_file_window(file, offset, g_implicit_tag_size);
+  if (implicit_tag == NULL) return ERROR;
   tag->group = implicit_tag->group;
   tag->element = implicit_tag->element;
   get_vr(implicit_tag, tag->vr);
   tag->datasize = implicit_tag->datasize;
   tag->data = (void *) &(file->content[offset + g_implicit_tag_size]);
-  return g_implicit_tag_size;
+  return map_tag_value(file, offset, g_implicit_tag_size, tag);
 }
 
 ssize_t decode_meta_data(file_t *file, ssize_t offset, dicom_meta_t *dicom_meta)
@@ -165,6 +398,13 @@ ssize_t decode_meta_data(file_t *file, ssize_t offset, dicom_meta_t *dicom_meta)
     if (tag.group != META_DATA_GROUP) break;
     switch (tag.element) {
     case 0x0010:
+      // Keep the UID to select the codec of encapsulated pixel data
+      if (tag.datasize <= UID_MAX_SIZE) {
+        memcpy(dicom_meta->transfer_syntax_uid, (char *) tag.data,
+               tag.datasize);
+        dicom_meta->transfer_syntax_uid[tag.datasize] = 0;
+        trim(dicom_meta->transfer_syntax_uid, NULL);
+      }
       if (!strncmp(TRANSFER_TYPE_IMPLICIT, (char *) tag.data, tag.datasize))
         dicom_meta->transfer_syntax = IMPLICIT;
       else if (!strncmp(TRANSFER_TYPE_EXPLICIT_LITTLE_ENDIAN,
@@ -184,10 +424,22 @@ ssize_t decode_meta_data(file_t *file, ssize_t offset, dicom_meta_t *dicom_meta)
         dicom_meta->transfer_syntax = EXPLICIT_LITTLE_ENDIAN;
       }
       break;
+    case 0x0002:
+      // Tells a DICOMDIR apart from the files it refers to
+      if (tag.datasize <= UID_MAX_SIZE) {
+        memcpy(dicom_meta->media_storage_sop_class_uid, (char *) tag.data,
+               tag.datasize);
+        dicom_meta->media_storage_sop_class_uid[tag.datasize] = 0;
+        trim(dicom_meta->media_storage_sop_class_uid, NULL);
+      }
+      break;
     case 0x0003:
-      memcpy(&(dicom_meta->media_storage_sop_instance_uid), (char *) tag.data,
-             tag.datasize);
-      dicom_meta->media_storage_sop_instance_uid[tag.datasize] = 0;
+      if (tag.datasize <= UID_MAX_SIZE) {
+        memcpy(dicom_meta->media_storage_sop_instance_uid, (char *) tag.data,
+               tag.datasize);
+        dicom_meta->media_storage_sop_instance_uid[tag.datasize] = 0;
+      }
+      break;
     default:
       break;
     }
@@ -203,7 +455,9 @@ ssize_t decode_sequence_tag(file_t *file, ssize_t offset, dicom_meta_t *dicom_me
   if (dicom_meta->transfer_syntax == IMPLICIT) {
     // If implicit, check the size
     implicit_tag_t *implicit_tag;
-    implicit_tag = (implicit_tag_t *) &(file->content[offset]);
+    implicit_tag = (implicit_tag_t *)
+      extend_file_window(file, offset, g_implicit_tag_size);
+    if (implicit_tag == NULL) return ERROR;
     // TODO: Manage implicit sequences with defined length
     // If the size is not 0xFFFFFFFF, seek by the size
     if (implicit_tag->datasize != 0xFFFFFFFF) {
@@ -219,7 +473,9 @@ ssize_t decode_sequence_tag(file_t *file, ssize_t offset, dicom_meta_t *dicom_me
   while (1) {
     // Check first item
     implicit_tag_t *implicit_tag;
-    implicit_tag = (implicit_tag_t *) &(file->content[offset]);
+    implicit_tag = (implicit_tag_t *)
+      extend_file_window(file, offset, g_implicit_tag_size);
+    if (implicit_tag == NULL) return ERROR;
     // If sequence delimiter tag found, stop
     if (implicit_tag->group == (SEQUENCE_DELIMITATION_TAG >> 16) &&
         implicit_tag->element == (SEQUENCE_DELIMITATION_TAG & 0x0000FFFF)) {
@@ -235,25 +491,46 @@ ssize_t decode_sequence_tag(file_t *file, ssize_t offset, dicom_meta_t *dicom_me
     offset = decode_n_tags(file, offset, dicom_meta, tags, tag_offset,
                            maxtags);
     if (offset == ERROR) return ERROR;
-    implicit_tag = (implicit_tag_t *) &(file->content[offset]);
+    implicit_tag = (implicit_tag_t *)
+      extend_file_window(file, offset, g_implicit_tag_size);
+    if (implicit_tag == NULL) return ERROR;
     // If item delimiter tag found, skip it
     if (implicit_tag->group == (ITEM_DELIMITATION_TAG >> 16) &&
         implicit_tag->element == (ITEM_DELIMITATION_TAG & 0x0000FFFF))
       offset += g_implicit_tag_size;
-    implicit_tag = (implicit_tag_t *) &(file->content[offset]);
   }
   return offset;
 }
 
+// Point the data of tags decoded before the window of a windowed file grew
+// and moved from content to the window in its new place
+static void rebase_tags(file_t *file, uint8_t *content, tag_t *tags,
+                        size_t first, size_t last) {
+  if (file->content == content) return;
+  for (size_t i = first; i < last; ++i)
+    if (tags[i].data != NULL)
+      tags[i].data = (void *) ((uintptr_t) tags[i].data -
+                               (uintptr_t) content +
+                               (uintptr_t) file->content);
+}
+
 ssize_t decode_n_tags(file_t *file, ssize_t offset, dicom_meta_t *dicom_meta,
                      tag_t *tags, size_t *tag_offset, size_t maxtags)
 {
+  size_t first = *tag_offset;
   while (offset <= file->size && *tag_offset < maxtags) {
     ssize_t shift = 0;
+    uint8_t *content = file->content;
     if ((shift = dicom_meta->transfer_syntax == IMPLICIT ?
         decode_implicit_tag(file, offset, &tags[*tag_offset]) :
         decode_explicit_tag(file, offset, &tags[*tag_offset])) == -1)
       return ERROR;
+    rebase_tags(file, content, tags, first, *tag_offset);
+    // Nothing left to decode, the slot may still hold an empty sequence
+    if (shift == 0) {
+      memset(&tags[*tag_offset], 0, sizeof (tag_t));
+      break;
+    }
     // PRINT_TAG(stdout, tags[*tag_offset]);
     // TODO: Manage PixelData and other type of payloads
     if (tags[*tag_offset].group > 0x4FFE) break;
@@ -261,10 +538,20 @@ ssize_t decode_n_tags(file_t *file, ssize_t offset, dicom_meta_t *dicom_meta,
     if (tags[*tag_offset].group == 0xFFFE) break;
     // Sequence tag are managed by a special function
     if (tags[*tag_offset].vr[0] == 'S' && tags[*tag_offset].vr[1] == 'Q') {
+      size_t item = *tag_offset;
+      content = file->content;
       offset = decode_sequence_tag(file, offset, dicom_meta, tags, tag_offset,
                                    maxtags);
       if (offset == ERROR) return ERROR;
+      // The tags of the items are rebased by the nested decode_n_tags
+      rebase_tags(file, content, tags, first, item);
     } else {
+      // Stop at a value cut by the end of the file, or of the header read
+      if (shift == 0 ||
+          offset + shift + tags[*tag_offset].datasize > file->size) {
+        memset(&tags[*tag_offset], 0, sizeof (tag_t));
+        break;
+      }
       offset += shift + tags[*tag_offset].datasize;
       (*tag_offset)++;
     }
@@ -272,6 +559,79 @@ ssize_t decode_n_tags(file_t *file, ssize_t offset, dicom_meta_t *dicom_meta,
   return offset;
 }
 
+// Decode the meta data and the tags of a loaded file up to the pixel data.
+// Return the offset following the last decoded tag or an error code.
+ssize_t decode_dataset(file_t *file, dicom_meta_t *dicom_meta, tag_t *tags,
+                       size_t maxtags) {
+  size_t tag_offset = 0;
+  ssize_t offset;
+  if (!is_dicom(file)) return ERROR;
+  offset = check_preamble(file, 0);
+  offset = check_header(file, offset);
+  offset = decode_meta_data(file, offset, dicom_meta);
+  if (offset < 0) return offset;
+  memset(tags, 0, sizeof (tag_t) * maxtags);
+  return decode_n_tags(file, offset, dicom_meta, tags, &tag_offset, maxtags);
+}
+
+// Return the offset following the tag at offset. Tags of undefined length
+// (sequences, encapsulated pixel data) are walked item by item until their
+// sequence delimitation item.
+// Cf DICOM standard Part 5 Sect 7.5
+ssize_t skip_tag(file_t *file, ssize_t offset, dicom_meta_t *dicom_meta) {
+  tag_t tag;
+  ssize_t shift = dicom_meta->transfer_syntax == IMPLICIT ?
+    decode_implicit_tag(file, offset, &tag) :
+    decode_explicit_tag(file, offset, &tag);
+  if (shift <= 0) return ERROR;
+  if (tag.datasize != UNDEFINED_LENGTH) return offset + shift + tag.datasize;
+  offset += shift;
+  while (offset + g_implicit_tag_size <= file->size) {
+    implicit_tag_t *item = (implicit_tag_t *)
+      map_file_window(file, offset, g_implicit_tag_size);
+    if (item == NULL) return ERROR;
+    uint32_t number = (uint32_t) (item->group << 16) + item->element;
+    offset += g_implicit_tag_size;
+    if (number == SEQUENCE_DELIMITATION_TAG) return offset;
+    if (number != ITEM_TAG) return ERROR;
+    if (item->datasize != UNDEFINED_LENGTH) {
+      offset += item->datasize;
+      continue;
+    }
+    // Item of undefined length, walk its tags until the item delimiter
+    while (offset + g_implicit_tag_size <= file->size) {
+      item = (implicit_tag_t *)
+        map_file_window(file, offset, g_implicit_tag_size);
+      if (item == NULL) return ERROR;
+      if ((uint32_t) (item->group << 16) + item->element ==
+          ITEM_DELIMITATION_TAG) {
+        offset += g_implicit_tag_size;
+        break;
+      }
+      if ((offset = skip_tag(file, offset, dicom_meta)) == ERROR) return ERROR;
+    }
+  }
+  return ERROR;
+}
+
+// Walk the top-level tags starting at offset until the tag number is found
+// and decode it in tag. As tags are sorted by number in a data set, stop as
+// soon as a greater tag is met. Return the offset of the tag or ERROR.
+ssize_t find_tag(file_t *file, ssize_t offset, dicom_meta_t *dicom_meta,
+                 uint32_t number, tag_t *tag) {
+  while (offset < file->size) {
+    ssize_t shift = dicom_meta->transfer_syntax == IMPLICIT ?
+      decode_implicit_tag(file, offset, tag) :
+      decode_explicit_tag(file, offset, tag);
+    if (shift <= 0) return ERROR;
+    uint32_t current = (uint32_t) (tag->group << 16) + tag->element;
+    if (current == number) return offset;
+    if (current > number) return ERROR;
+    if ((offset = skip_tag(file, offset, dicom_meta)) == ERROR) return ERROR;
+  }
+  return ERROR;
+}
+
 uint8_t is_double_length_vr(char *s) {
   for (uint8_t i = 0; i < NUMBER_OF_VR; ++i)
     if (!strncmp(s, g_valid_vrs[i].name, 2))
@@ -343,6 +703,49 @@ void *get_tag_data(tag_t *tags, uint32_t number) {
   return data;
 }
 
+int8_t get_tag_uint16(tag_t *tags, uint32_t number, uint16_t *value) {
+  tag_t *tag = get_tag(tags, number);
+  if (tag == NULL || tag->datasize < sizeof (uint16_t)) return ERROR;
+  *value = *(uint16_t *) tag->data;
+  return 0;
+}
+
+int8_t get_tag_uint32(tag_t *tags, uint32_t number, uint32_t *value) {
+  tag_t *tag = get_tag(tags, number);
+  if (tag == NULL || tag->datasize < sizeof (uint32_t)) return ERROR;
+  *value = *(uint32_t *) tag->data;
+  return 0;
+}
+
+// Decode the values of a multi-valued DS or IS tag in values. Return the
+// number of values decoded or ERROR.
+// Cf DICOM standard Part 5 Sect 6.2 and 6.4
+ssize_t get_tag_numbers(tag_t *tags, uint32_t number, double *values,
+                        size_t maxvalues) {
+  tag_t *tag = get_tag(tags, number);
+  if (tag == NULL) return ERROR;
+  return decode_numbers(tag, values, maxvalues);
+}
+
+ssize_t decode_numbers(tag_t *tag, double *values, size_t maxvalues) {
+  char value[MAX_NUMBER_STR_SIZE];
+  size_t nvalues = 0;
+  uint32_t i = 0;
+  char *data = (char *) tag->data;
+  while (i < tag->datasize && nvalues < maxvalues) {
+    size_t length = 0;
+    for (; i < tag->datasize && data[i] != '\\'; ++i)
+      if (length < MAX_NUMBER_STR_SIZE - 1) value[length++] = data[i];
+    value[length] = 0;
+    ++i; // Skip the backslash
+    char *end;
+    values[nvalues] = strtod(value, &end);
+    if (end == value) break;
+    ++nvalues;
+  }
+  return nvalues;
+}
+
 char *trim(char *s, char *output) {
   if (*s == 0) return s;
   char *beg = s;
@@ -29,6 +29,13 @@ typedef struct file_s {
   ssize_t size;
   uint8_t *content;
   char    *filename;
+  // Bytes mapped at once, 0 when the whole file is mapped. The mapped range
+  // starts at window_offset and content is biased so that content[offset]
+  // stays the byte at offset as long as it lies in that range.
+  size_t  window_size;
+  ssize_t window_offset;
+  size_t  window_length;
+  uint8_t direct; // Header read in a buffer by load_file_header
 } file_t;
 
 typedef struct implicit_tag_s {
@@ -67,9 +74,10 @@ typedef double_length_explicit_tag_t tag_t;
 typedef struct dicom_meta_s {
   size_t file_meta_information_group_length;
   char *file_meta_information_version;
-  char media_storage_sop_class_uid[UID_MAX_SIZE];
-  char media_storage_sop_instance_uid[UID_MAX_SIZE];
+  char media_storage_sop_class_uid[UID_MAX_SIZE + 1];
+  char media_storage_sop_instance_uid[UID_MAX_SIZE + 1];
   transfer_syntax_t transfer_syntax;
+  char transfer_syntax_uid[UID_MAX_SIZE + 1];
   char implementation_class_uid[UID_MAX_SIZE];
   char implementation_version_name[MAX_SHORT_STR_SIZE];
   char source_application_entity_title[MAX_SHORT_STR_SIZE];
@@ -80,21 +88,41 @@ typedef struct dicom_meta_s {
 } dicom_meta_t;
 
 int8_t load_file(char *filename, file_t *file);
+int8_t load_file_window(char *filename, size_t window_size, file_t *file);
+int8_t load_file_header(char *filename, size_t length, file_t *file);
+uint8_t *map_file_window(file_t *file, ssize_t offset, size_t length);
+void advise_file(file_t *file, size_t header_length);
+void drop_file_cache(file_t *file);
+void release_file_range(file_t *file, ssize_t offset, size_t length);
+void unmap_file(file_t *file);
 int8_t close_file(file_t *file);
+int8_t write_all(int fd, const void *data, size_t length);
 ssize_t check_preamble(file_t *file, ssize_t offset);
 ssize_t check_header(file_t *file, ssize_t offset);
 char *tag_data_to_string(tag_t *tag, void *data, size_t *length);
+uint16_t get_repeating_group(uint16_t group);
 void get_vr(implicit_tag_t *implicit_tag, char vr[2]);
 ssize_t decode_explicit_tag(file_t *file, ssize_t offset, tag_t *tag);
 ssize_t decode_implicit_tag(file_t *file, ssize_t offset, tag_t *tag);
 ssize_t decode_meta_data(file_t *file, ssize_t offset, dicom_meta_t *dicom_meta);
 ssize_t decode_n_tags(file_t *file, ssize_t offset, dicom_meta_t *dicom_meta,
                       tag_t *tags, size_t *tag_offset, size_t maxtags);
+ssize_t decode_dataset(file_t *file, dicom_meta_t *dicom_meta, tag_t *tags,
+                       size_t maxtags);
+ssize_t skip_tag(file_t *file, ssize_t offset, dicom_meta_t *dicom_meta);
+ssize_t find_tag(file_t *file, ssize_t offset, dicom_meta_t *dicom_meta,
+                 uint32_t number, tag_t *tag);
 uint8_t is_double_length_vr(char *s);
+uint8_t is_str_of_char_vr(char *s);
 uint8_t is_valid_vr(char *s);
 uint8_t is_dicom(file_t *file);
 tag_t *get_tag(tag_t *tags, uint32_t number);
 void *get_tag_data(tag_t *tags, uint32_t number);
+int8_t get_tag_uint16(tag_t *tags, uint32_t number, uint16_t *value);
+int8_t get_tag_uint32(tag_t *tags, uint32_t number, uint32_t *value);
+ssize_t get_tag_numbers(tag_t *tags, uint32_t number, double *values,
+                        size_t maxvalues);
+ssize_t decode_numbers(tag_t *tag, double *values, size_t maxvalues);
 char *trim(char *s, char *output);
 
 #endif // __DICM_H__
\ No newline at end of file
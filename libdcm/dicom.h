@@ -8,6 +8,8 @@
 
 #define UID_MAX_SIZE 64  // Cf DICOM Standard Part 5 Sect 6.2
 #define MAX_SHORT_STR_SIZE 17 // Cf DICOM Standard Part 5 Sect 6.2
+#define MAX_CODE_STR_SIZE 17 // Cf DICOM Standard Part 5 Sect 6.2
+#define MAX_NUMBER_STR_SIZE 17 // Cf DICOM Standard Part 5 Sect 6.2 (DS)
 
 // Cf DICOM standard Part 6 Chapt A
 typedef enum transfer_syntax_e {
@@ -17,7 +19,7 @@ typedef enum transfer_syntax_e {
   DEFLATED_EXPLICIT_BIG_ENDIAN, // 1.2.840.10008.1.2.​1.​99
 } transfer_syntax_t;
 
-#define NUMBER_OF_VR 31 // Cf DICOM standard Part 6 Sect 6.2
+#define NUMBER_OF_VR 34 // Cf DICOM standard Part 6 Sect 6.2
 
 typedef struct vr_s {
   char name[3];
@@ -44,6 +46,7 @@ static const vr_t g_valid_vrs[NUMBER_OF_VR] = {
   { "OD", 1, 0 },
   { "OF", 1, 0 },
   { "OL", 1, 0 },
+  { "OV", 1, 0 },
   { "OW", 1, 0 },
   { "PN", 0, 1 },
   { "SH", 0, 1 },
@@ -51,6 +54,7 @@ static const vr_t g_valid_vrs[NUMBER_OF_VR] = {
   { "SQ", 1, 0 },
   { "SS", 0, 0 },
   { "ST", 0, 1 },
+  { "SV", 1, 0 },
   { "TM", 0, 1 },
   { "UC", 0, 0 },
   { "UI", 0, 1 },
@@ -59,20 +63,95 @@ static const vr_t g_valid_vrs[NUMBER_OF_VR] = {
   { "UR", 0, 1 },
   { "US", 0, 0 },
   { "UT", 0, 1 },
+  { "UV", 1, 0 },
 };
 
 #define TRANSFER_TYPE_IMPLICIT "1.2.840.10008.1.2"
 #define TRANSFER_TYPE_EXPLICIT_LITTLE_ENDIAN "1.2.840.10008.1.2.1"
 #define TRANSFER_TYPE_EXPLICIT_BIG_ENDIAN "1.2.840.10008.1.2.2"
 #define TRANSFER_TYPE_DEFLATED_EXPLICIT_BIG_ENDIAN "1.2.840.10008.1.2.1.99"
+#define TRANSFER_TYPE_RLE_LOSSLESS "1.2.840.10008.1.2.5"
+#define TRANSFER_TYPE_JPEG_LOSSLESS "1.2.840.10008.1.2.4.57"
+#define TRANSFER_TYPE_JPEG_LOSSLESS_SV1 "1.2.840.10008.1.2.4.70"
 
 #define META_DATA_GROUP 0x0002 // Cf DICOM standard Part 6 Chapt 7
 
+// Cf DICOM standard Part 3 Sect F.3.2
+#define OFFSET_OF_FIRST_ROOT_RECORD 0x00041200
+#define DIRECTORY_RECORD_SEQUENCE 0x00041220
+#define OFFSET_OF_NEXT_RECORD 0x00041400
+#define RECORD_IN_USE_FLAG 0x00041410
+#define OFFSET_OF_LOWER_LEVEL_ENTITY 0x00041420
+#define DIRECTORY_RECORD_TYPE 0x00041430
+#define REFERENCED_FILE_ID 0x00041500
+#define REFERENCED_SOP_CLASS_UID_IN_FILE 0x00041510
+#define REFERENCED_SOP_INSTANCE_UID_IN_FILE 0x00041511
+#define REFERENCED_TRANSFER_SYNTAX_UID_IN_FILE 0x00041512
+#define IMAGE_TYPE 0x00080008
 #define SOP_INSTANCE_UID 0x00080018
+#define PYRAMID_UID 0x00080019
 #define STUDY_INSTANCE_UID 0x0020000D
 #define SERIES_INSTANCE_UID 0x0020000E
+#define IMAGE_POSITION_PATIENT 0x00200032
+#define IMAGE_ORIENTATION_PATIENT 0x00200037
+#define PLANE_POSITION_SEQUENCE 0x00209113
+#define DIMENSION_ORGANIZATION_TYPE 0x00209311
+#define SAMPLES_PER_PIXEL 0x00280002
+#define PHOTOMETRIC_INTERPRETATION 0x00280004
+#define PLANAR_CONFIGURATION 0x00280006
+#define NUMBER_OF_FRAMES 0x00280008
+#define ROWS 0x00280010
+#define COLUMNS 0x00280011
+#define PIXEL_SPACING 0x00280030
+#define BITS_ALLOCATED 0x00280100
+#define BITS_STORED 0x00280101
+#define HIGH_BIT 0x00280102
+#define PIXEL_REPRESENTATION 0x00280103
+#define PIXEL_PADDING_VALUE 0x00280120
+#define PIXEL_PADDING_RANGE_LIMIT 0x00280121
+#define WINDOW_CENTER 0x00281050
+#define WINDOW_WIDTH 0x00281051
+#define RESCALE_INTERCEPT 0x00281052
+#define RESCALE_SLOPE 0x00281053
+#define VOI_LUT_FUNCTION 0x00281056
+#define RED_PALETTE_COLOR_LOOKUP_TABLE_DESCRIPTOR 0x00281101
+#define GREEN_PALETTE_COLOR_LOOKUP_TABLE_DESCRIPTOR 0x00281102
+#define BLUE_PALETTE_COLOR_LOOKUP_TABLE_DESCRIPTOR 0x00281103
+#define RED_PALETTE_COLOR_LOOKUP_TABLE_DATA 0x00281201
+#define GREEN_PALETTE_COLOR_LOOKUP_TABLE_DATA 0x00281202
+#define BLUE_PALETTE_COLOR_LOOKUP_TABLE_DATA 0x00281203
+#define Z_OFFSET_IN_SLIDE_COORDINATE_SYSTEM 0x0040074A
+#define TOTAL_PIXEL_MATRIX_COLUMNS 0x00480006
+#define TOTAL_PIXEL_MATRIX_ROWS 0x00480007
+#define OPTICAL_PATH_IDENTIFIER 0x00480106
+#define OPTICAL_PATH_IDENTIFICATION_SEQUENCE 0x00480207
+#define PLANE_POSITION_SLIDE_SEQUENCE 0x0048021A
+#define COLUMN_POSITION_IN_TOTAL_IMAGE_PIXEL_MATRIX 0x0048021E
+#define ROW_POSITION_IN_TOTAL_IMAGE_PIXEL_MATRIX 0x0048021F
+#define NUMBER_OF_OPTICAL_PATHS 0x00480302
+#define TOTAL_PIXEL_MATRIX_FOCAL_PLANES 0x00480303
+#define SHARED_FUNCTIONAL_GROUPS_SEQUENCE 0x52009229
+#define PER_FRAME_FUNCTIONAL_GROUPS_SEQUENCE 0x52009230
+// Overlay tags are given for the first group, add (n * 2) << 16 for the others
+// Cf DICOM standard Part 3 Sect C.9.2
+#define OVERLAY_GROUP 0x6000
+#define LAST_OVERLAY_GROUP 0x601E
+#define OVERLAY_ROWS 0x60000010
+#define OVERLAY_COLUMNS 0x60000011
+#define NUMBER_OF_FRAMES_IN_OVERLAY 0x60000015
+#define OVERLAY_TYPE 0x60000040
+#define OVERLAY_ORIGIN 0x60000050
+#define IMAGE_FRAME_ORIGIN 0x60000051
+#define OVERLAY_BITS_ALLOCATED 0x60000100
+#define OVERLAY_BIT_POSITION 0x60000102
+#define OVERLAY_DATA 0x60003000
+#define EXTENDED_OFFSET_TABLE 0x7FE00001
+#define EXTENDED_OFFSET_TABLE_LENGTHS 0x7FE00002
+#define PIXEL_DATA 0x7FE00010
 #define ITEM_TAG 0xFFFEE000
 #define ITEM_DELIMITATION_TAG 0xFFFEE00D
 #define SEQUENCE_DELIMITATION_TAG 0xFFFEE0DD
 
+#define UNDEFINED_LENGTH 0xFFFFFFFF // Cf DICOM standard Part 5 Sect 7.1.1
+
 #endif // __DICOM_H__
\ No newline at end of file
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "dicom.h"
+#include "dcm.h"
+#include "dicomdir.h"
+
+static ssize_t decode_tag(file_t *file, ssize_t offset,
+                          dicom_meta_t *dicom_meta, tag_t *tag) {
+  return dicom_meta->transfer_syntax == IMPLICIT ?
+    decode_implicit_tag(file, offset, tag) :
+    decode_explicit_tag(file, offset, tag);
+}
+
+static uint32_t get_uint32(tag_t *tag) {
+  uint32_t value = 0;
+  if (tag->datasize >= 4) memcpy(&value, tag->data, 4);
+  return value;
+}
+
+// Decode the record whose item starts at offset, the offsets of the record
+// and of those it refers to being counted from the beginning of the file
+// Cf DICOM standard Part 3 Sect F.3.2.2 and Part 5 Sect 7.5
+static int8_t decode_record(file_t *file, ssize_t offset,
+                            dicom_meta_t *dicom_meta,
+                            directory_record_t *record) {
+  if (offset + g_implicit_tag_size > file->size) return ERROR;
+  implicit_tag_t *header = (implicit_tag_t *)
+    map_file_window(file, offset, g_implicit_tag_size);
+  if (header == NULL ||
+      ((uint32_t) header->group << 16) + header->element != ITEM_TAG)
+    return ERROR;
+  uint8_t undefined = header->datasize == UNDEFINED_LENGTH;
+  memset(record, 0, sizeof (directory_record_t));
+  record->in_use = 1;
+  record->begin = offset + g_implicit_tag_size;
+  record->end = undefined ? file->size : record->begin + header->datasize;
+  if (record->end > file->size) return ERROR;
+  offset = record->begin;
+  while (offset + g_implicit_tag_size <= record->end) {
+    tag_t tag;
+    header = (implicit_tag_t *)
+      map_file_window(file, offset, g_implicit_tag_size);
+    if (header == NULL) return ERROR;
+    if (((uint32_t) header->group << 16) + header->element ==
+        ITEM_DELIMITATION_TAG) {
+      record->end = offset;
+      return 0;
+    }
+    if (decode_tag(file, offset, dicom_meta, &tag) <= 0) return ERROR;
+    switch (((uint32_t) tag.group << 16) + tag.element) {
+    case OFFSET_OF_NEXT_RECORD:
+      record->next = get_uint32(&tag);
+      break;
+    case RECORD_IN_USE_FLAG:
+      // 0x0000 for an inactive record, retired since
+      record->in_use = tag.datasize < 2 || ((uint8_t *) tag.data)[0] ||
+        ((uint8_t *) tag.data)[1];
+      break;
+    case OFFSET_OF_LOWER_LEVEL_ENTITY:
+      record->lower = get_uint32(&tag);
+      break;
+    case DIRECTORY_RECORD_TYPE: {
+      size_t length = tag.datasize < sizeof (record->type) ?
+        tag.datasize : sizeof (record->type) - 1;
+      memcpy(record->type, tag.data, length);
+      record->type[length] = 0;
+      trim(record->type, NULL);
+      break;
+    }
+    }
+    if ((offset = skip_tag(file, offset, dicom_meta)) == ERROR) return ERROR;
+  }
+  // An item of undefined length must end with its delimiter
+  return undefined ? ERROR : 0;
+}
+
+// Walk the records of the DICOMDIR whose dataset starts at offset, following
+// the offsets of the records rather than the order of the items in the
+// directory record sequence, so that only the records are read
+// Cf DICOM standard Part 3 Sect F.3.2.1 and Part 10 Sect 8.5
+int8_t walk_dicomdir(file_t *file, ssize_t offset, dicom_meta_t *dicom_meta,
+                     directory_callback_t callback, void *context) {
+  directory_record_t records[DICOMDIR_MAX_DEPTH];
+  size_t depth = 0;
+  tag_t tag;
+  // A record takes an item header at least, which bounds the records walked
+  // when the offsets loop
+  ssize_t budget = file->size / g_implicit_tag_size;
+  if (find_tag(file, offset, dicom_meta, OFFSET_OF_FIRST_ROOT_RECORD,
+               &tag) == ERROR)
+    return ERROR;
+  uint32_t next = get_uint32(&tag);
+  while (1) {
+    if (next == 0) {
+      // Back to the entity above, past the record referring to this one
+      if (depth == 0) return 0;
+      next = records[--depth].next;
+      continue;
+    }
+    if (depth == DICOMDIR_MAX_DEPTH || budget-- == 0 ||
+        decode_record(file, next, dicom_meta, &records[depth]) == ERROR)
+      return ERROR;
+    directory_record_t *record = &records[depth];
+    // The lower-level entity of an inactive record is inactive as well
+    if (!record->in_use) {
+      next = record->next;
+      continue;
+    }
+    if (callback(file, dicom_meta, records, depth + 1, context) == ERROR)
+      return ERROR;
+    if (record->lower) {
+      next = record->lower;
+      ++depth;
+    } else {
+      next = record->next;
+    }
+  }
+}
+
+// Decode the attribute number of a record in tag. Return its offset or ERROR
+// if the record does not hold it.
+ssize_t get_record_attribute(file_t *file, dicom_meta_t *dicom_meta,
+                             directory_record_t *record, uint32_t number,
+                             tag_t *tag) {
+  ssize_t offset = record->begin;
+  while (offset < record->end) {
+    if (decode_tag(file, offset, dicom_meta, tag) <= 0) return ERROR;
+    uint32_t current = ((uint32_t) tag->group << 16) + tag->element;
+    if (current == number) return offset;
+    if (current > number) return ERROR;
+    if ((offset = skip_tag(file, offset, dicom_meta)) == ERROR) return ERROR;
+  }
+  return ERROR;
+}
@@ -0,0 +1,38 @@
+#ifndef __DICOMDIR_H__
+#define __DICOMDIR_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "dcm.h"
+
+// Levels of directory entities walked down, PATIENT, STUDY, SERIES and IMAGE
+// being the usual ones
+#define DICOMDIR_MAX_DEPTH 16
+#define DICOMDIR_SOP_CLASS_UID "1.2.840.10008.1.3.10"
+
+// A directory record of a DICOMDIR, read in place
+// Cf DICOM standard Part 3 Sect F.3.2.2
+typedef struct directory_record_s {
+  ssize_t  begin;  // Offsets of the first element of the item and past its
+  ssize_t  end;    // last element
+  uint32_t next;   // Offset of the next record of the entity, 0 for none
+  uint32_t lower;  // Offset of the first record of the lower-level entity
+  uint8_t  in_use;
+  char     type[17]; // DirectoryRecordType, PATIENT or IMAGE for instance
+} directory_record_t;
+
+// Called on each record in use, depth first. records holds the records from
+// the root directory entity down to the current one, records[depth - 1].
+// Returning ERROR stops the walk.
+typedef int8_t (*directory_callback_t)(file_t *file, dicom_meta_t *dicom_meta,
+                                       directory_record_t *records,
+                                       size_t depth, void *context);
+
+int8_t walk_dicomdir(file_t *file, ssize_t offset, dicom_meta_t *dicom_meta,
+                     directory_callback_t callback, void *context);
+ssize_t get_record_attribute(file_t *file, dicom_meta_t *dicom_meta,
+                             directory_record_t *record, uint32_t number,
+                             tag_t *tag);
+
+#endif // __DICOMDIR_H__
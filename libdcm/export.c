@@ -0,0 +1,281 @@
+#define _GNU_SOURCE // copy_file_range
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "dicom.h"
+#include "dcm.h"
+#include "pixel-data.h"
+#include "lut.h"
+#include "volume.h"
+#include "export.h"
+
+// Cf NIfTI-1 nifti1.h
+#define NIFTI_TYPE_UINT8 2
+#define NIFTI_TYPE_INT16 4
+#define NIFTI_TYPE_FLOAT32 16
+#define NIFTI_TYPE_INT8 256
+#define NIFTI_TYPE_UINT16 512
+#define NIFTI_XFORM_SCANNER_ANAT 1
+#define NIFTI_UNITS_MM 2
+#define NIFTI_HEADER_SIZE 348
+#define NIFTI_VOX_OFFSET 352 // The header and an empty extension flag
+
+// Whether the stored values of the volume can be written as is: the slices
+// share their layout and no bit has to be masked
+int8_t can_export_stored(volume_t *volume) {
+  pixel_module_t *pixel_module = &volume->pixel_module;
+  if (!volume->same_layout ||
+      (pixel_module->bits_allocated != 8 &&
+       pixel_module->bits_allocated != 16) ||
+      pixel_module->bits_stored != pixel_module->bits_allocated ||
+      pixel_module->high_bit != pixel_module->bits_stored - 1)
+    return ERROR;
+  return 0;
+}
+
+// Affine from the column, row and slice indices to the patient coordinates
+// in millimeters, x to the left, y to the back, z to the head
+// Cf DICOM standard Part 3 Sect C.7.6.2.1.1
+void get_volume_affine(volume_t *volume, double affine[3][4]) {
+  double spacing = volume->nslices > 1 ? volume->spacing : 1.0;
+  for (uint8_t i = 0; i < 3; ++i) {
+    affine[i][0] = volume->orientation[i] * volume->pixel_spacing[1];
+    affine[i][1] = volume->orientation[3 + i] * volume->pixel_spacing[0];
+    affine[i][2] = volume->normal[i] * spacing;
+    affine[i][3] = volume->origin[i];
+  }
+}
+
+static size_t get_value_size(volume_t *volume, export_type_t type) {
+  if (type == EXPORT_STORED) return volume->pixel_module.bits_allocated / 8;
+  return type == EXPORT_FLOAT ? sizeof (float) : sizeof (int16_t);
+}
+
+// Copy a range of a file to fd, in the kernel when the file systems allow
+// it, from the mapping otherwise (pipes, older kernels)
+static int8_t copy_range(int fd, file_t *file, off_t offset, size_t length) {
+  while (length) {
+    ssize_t copied = copy_file_range(file->fd, &offset, fd, NULL, length, 0);
+    if (copied <= 0) break;
+    length -= copied;
+  }
+  return length ? write_all(fd, file->content + offset, length) : 0;
+}
+
+static int8_t copy_slice(int fd, volume_t *volume, file_t *file) {
+  dicom_meta_t dicom_meta;
+  tag_t tags[MAX_LOADED_TAG];
+  tag_t pixel_data;
+  pixel_module_t pixel_module;
+  frame_view_t view;
+  ssize_t offset = decode_dataset(file, &dicom_meta, tags, MAX_LOADED_TAG);
+  if (offset < 0 || decode_pixel_module(tags, &pixel_module) == ERROR ||
+      pixel_module.rows != volume->pixel_module.rows ||
+      pixel_module.columns != volume->pixel_module.columns ||
+      find_tag(file, offset, &dicom_meta, PIXEL_DATA, &pixel_data) == ERROR ||
+      get_native_frame(file, &pixel_data, &pixel_module, 0, 0,
+                       &view) == ERROR)
+    return ERROR;
+  return copy_range(fd, file, view.data - file->content, view.length);
+}
+
+// Copy the stored values of the slices one after the other
+static int8_t write_stored(int fd, volume_t *volume) {
+  for (size_t i = 0; i < volume->nslices; ++i) {
+    file_t file;
+    if (load_file(volume->slices[i].path, &file) == ERROR) return ERROR;
+    int8_t ret = copy_slice(fd, volume, &file);
+    munmap(file.content, file.size);
+    close_file(&file);
+    if (ret == ERROR) return ERROR;
+  }
+  return 0;
+}
+
+// Rescale the slices by batches filling EXPORT_BUFFER_SIZE and write them,
+// so that the volume is never held in memory as a whole
+static int8_t write_rescaled(int fd, volume_t *volume, export_type_t type,
+                             uint32_t nthreads) {
+  size_t size = (size_t) volume->pixel_module.rows *
+    volume->pixel_module.columns * get_value_size(volume, type);
+  size_t batch = EXPORT_BUFFER_SIZE / size ? EXPORT_BUFFER_SIZE / size : 1;
+  batch = batch < volume->nslices ? batch : volume->nslices;
+  uint8_t *buffer = malloc(size * batch);
+  int8_t ret = 0;
+  if (buffer == NULL) {
+    perror("malloc");
+    return ERROR;
+  }
+  for (size_t i = 0; ret == 0 && i < volume->nslices; i += batch) {
+    size_t n = volume->nslices - i < batch ? volume->nslices - i : batch;
+    ret = type == EXPORT_FLOAT ?
+      load_slices_to_float(volume, i, n, (float *) buffer, nthreads) :
+      load_slices_to_int16(volume, i, n, (int16_t *) buffer, nthreads);
+    if (ret == 0) ret = write_all(fd, buffer, size * n);
+  }
+  free(buffer);
+  return ret;
+}
+
+static int8_t write_voxels(int fd, volume_t *volume, export_type_t type,
+                           uint32_t nthreads) {
+  if (type == EXPORT_STORED) return write_stored(fd, volume);
+  return write_rescaled(fd, volume, type, nthreads);
+}
+
+// Quaternion of the rotation part of the affine, whose columns are
+// orthonormal with a positive determinant
+// Cf NIfTI-1 nifti1_io.c nifti_mat44_to_quatern
+static void get_quaternion(double r[3][3], float *b, float *c, float *d) {
+  double qa, qb, qc, qd;
+  double a = r[0][0] + r[1][1] + r[2][2] + 1;
+  if (a > 0.5) {
+    qa = 0.5 * sqrt(a);
+    qb = 0.25 * (r[2][1] - r[1][2]) / qa;
+    qc = 0.25 * (r[0][2] - r[2][0]) / qa;
+    qd = 0.25 * (r[1][0] - r[0][1]) / qa;
+  } else if (1 + r[0][0] - (r[1][1] + r[2][2]) > 1) {
+    qb = 0.5 * sqrt(1 + r[0][0] - (r[1][1] + r[2][2]));
+    qc = 0.25 * (r[0][1] + r[1][0]) / qb;
+    qd = 0.25 * (r[0][2] + r[2][0]) / qb;
+    qa = 0.25 * (r[2][1] - r[1][2]) / qb;
+  } else if (1 + r[1][1] - (r[0][0] + r[2][2]) > 1) {
+    qc = 0.5 * sqrt(1 + r[1][1] - (r[0][0] + r[2][2]));
+    qb = 0.25 * (r[0][1] + r[1][0]) / qc;
+    qd = 0.25 * (r[1][2] + r[2][1]) / qc;
+    qa = 0.25 * (r[0][2] - r[2][0]) / qc;
+  } else {
+    qd = 0.5 * sqrt(1 + r[2][2] - (r[0][0] + r[1][1]));
+    qb = 0.25 * (r[0][2] + r[2][0]) / qd;
+    qc = 0.25 * (r[1][2] + r[2][1]) / qd;
+    qa = 0.25 * (r[1][0] - r[0][1]) / qd;
+  }
+  // The first component is implied positive
+  if (qa < 0) {
+    qb = -qb;
+    qc = -qc;
+    qd = -qd;
+  }
+  *b = qb;
+  *c = qc;
+  *d = qd;
+}
+
+static int16_t get_nifti_datatype(volume_t *volume, export_type_t type) {
+  if (type == EXPORT_FLOAT) return NIFTI_TYPE_FLOAT32;
+  if (type == EXPORT_INT16) return NIFTI_TYPE_INT16;
+  if (volume->pixel_module.bits_allocated == 8)
+    return volume->pixel_module.pixel_representation ? NIFTI_TYPE_INT8 :
+      NIFTI_TYPE_UINT8;
+  return volume->pixel_module.pixel_representation ? NIFTI_TYPE_INT16 :
+    NIFTI_TYPE_UINT16;
+}
+
+// Write the volume as a single file NIfTI-1 image. NIfTI being in RAS
+// coordinates, the x and y rows of the affine are negated. Stored values
+// carry the modality LUT in scl_slope and scl_inter.
+int8_t write_nifti(int fd, volume_t *volume, export_type_t type,
+                   uint32_t nthreads) {
+  nifti1_header_t header;
+  double affine[3][4];
+  double rotation[3][3];
+  uint8_t extension[4] = { 0 };
+  if (type == EXPORT_STORED && can_export_stored(volume) == ERROR)
+    return ERROR;
+  memset(&header, 0, sizeof (nifti1_header_t));
+  get_volume_affine(volume, affine);
+  for (uint8_t i = 0; i < 2; ++i)
+    for (uint8_t j = 0; j < 4; ++j)
+      affine[i][j] = -affine[i][j];
+  double spacing[3] = { volume->pixel_spacing[1], volume->pixel_spacing[0],
+                        volume->nslices > 1 ? volume->spacing : 1.0 };
+  for (uint8_t i = 0; i < 3; ++i)
+    for (uint8_t j = 0; j < 3; ++j)
+      rotation[i][j] = affine[i][j] / spacing[j];
+  header.sizeof_hdr = NIFTI_HEADER_SIZE;
+  header.regular = 'r';
+  header.dim[0] = 3;
+  header.dim[1] = volume->pixel_module.columns;
+  header.dim[2] = volume->pixel_module.rows;
+  header.dim[3] = volume->nslices;
+  header.dim[4] = header.dim[5] = header.dim[6] = header.dim[7] = 1;
+  header.datatype = get_nifti_datatype(volume, type);
+  header.bitpix = get_value_size(volume, type) * 8;
+  header.pixdim[0] = 1; // qfac, the slices following the normal
+  for (uint8_t i = 0; i < 3; ++i) header.pixdim[i + 1] = spacing[i];
+  header.vox_offset = NIFTI_VOX_OFFSET;
+  header.scl_slope = type == EXPORT_STORED ?
+    volume->modality_lut.rescale_slope : 1;
+  header.scl_inter = type == EXPORT_STORED ?
+    volume->modality_lut.rescale_intercept : 0;
+  header.xyzt_units = NIFTI_UNITS_MM;
+  snprintf(header.descrip, sizeof (header.descrip), "%s",
+           volume->series_instance_uid);
+  header.qform_code = header.sform_code = NIFTI_XFORM_SCANNER_ANAT;
+  get_quaternion(rotation, &header.quatern_b, &header.quatern_c,
+                 &header.quatern_d);
+  header.qoffset_x = affine[0][3];
+  header.qoffset_y = affine[1][3];
+  header.qoffset_z = affine[2][3];
+  for (uint8_t j = 0; j < 4; ++j) {
+    header.srow_x[j] = affine[0][j];
+    header.srow_y[j] = affine[1][j];
+    header.srow_z[j] = affine[2][j];
+  }
+  memcpy(header.magic, "n+1", 4);
+  if (write_all(fd, &header, NIFTI_HEADER_SIZE) == ERROR ||
+      write_all(fd, extension, sizeof (extension)) == ERROR)
+    return ERROR;
+  return write_voxels(fd, volume, type, nthreads);
+}
+
+static const char *get_nrrd_type(volume_t *volume, export_type_t type) {
+  if (type == EXPORT_FLOAT) return "float";
+  if (type == EXPORT_INT16) return "int16";
+  if (volume->pixel_module.bits_allocated == 8)
+    return volume->pixel_module.pixel_representation ? "int8" : "uint8";
+  return volume->pixel_module.pixel_representation ? "int16" : "uint16";
+}
+
+// Write the volume as an attached header NRRD in the patient coordinates.
+// NRRD having no rescale, stored values are only written when the modality
+// LUT is the identity.
+// Cf NRRD file format specification version 4
+int8_t write_nrrd(int fd, volume_t *volume, export_type_t type,
+                  uint32_t nthreads) {
+  double a[3][4];
+  if (type == EXPORT_STORED &&
+      (can_export_stored(volume) == ERROR ||
+       volume->modality_lut.rescale_slope != 1.0 ||
+       volume->modality_lut.rescale_intercept != 0.0))
+    return ERROR;
+  get_volume_affine(volume, a);
+  if (dprintf(fd, "NRRD0004\n"
+              "# SeriesInstanceUID %s\n"
+              "type: %s\n"
+              "dimension: 3\n"
+              "space: left-posterior-superior\n"
+              "sizes: %u %u %zu\n"
+              "space directions: (%.10g,%.10g,%.10g) (%.10g,%.10g,%.10g) "
+              "(%.10g,%.10g,%.10g)\n"
+              "kinds: domain domain domain\n"
+              "endian: little\n"
+              "encoding: raw\n"
+              "space origin: (%.10g,%.10g,%.10g)\n\n",
+              volume->series_instance_uid, get_nrrd_type(volume, type),
+              volume->pixel_module.columns, volume->pixel_module.rows,
+              volume->nslices, a[0][0], a[1][0], a[2][0], a[0][1], a[1][1],
+              a[2][1], a[0][2], a[1][2], a[2][2], a[0][3], a[1][3],
+              a[2][3]) < 0) {
+    perror("dprintf");
+    return ERROR;
+  }
+  return write_voxels(fd, volume, type, nthreads);
+}
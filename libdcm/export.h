@@ -0,0 +1,71 @@
+#ifndef __EXPORT_H__
+#define __EXPORT_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "volume.h"
+
+#define EXPORT_BUFFER_SIZE (32 << 20) // Bytes of rescaled slices per write
+
+typedef enum export_type_e {
+  EXPORT_STORED, // Stored values copied as is, the rescale in the header
+  EXPORT_INT16,  // Rescaled values
+  EXPORT_FLOAT,
+} export_type_t;
+
+// Cf NIfTI-1 nifti1.h
+typedef struct nifti1_header_s {
+  int32_t sizeof_hdr;
+  char    data_type[10];
+  char    db_name[18];
+  int32_t extents;
+  int16_t session_error;
+  char    regular;
+  char    dim_info;
+  int16_t dim[8];
+  float   intent_p1;
+  float   intent_p2;
+  float   intent_p3;
+  int16_t intent_code;
+  int16_t datatype;
+  int16_t bitpix;
+  int16_t slice_start;
+  float   pixdim[8];
+  float   vox_offset;
+  float   scl_slope;
+  float   scl_inter;
+  int16_t slice_end;
+  char    slice_code;
+  char    xyzt_units;
+  float   cal_max;
+  float   cal_min;
+  float   slice_duration;
+  float   toffset;
+  int32_t glmax;
+  int32_t glmin;
+  char    descrip[80];
+  char    aux_file[24];
+  int16_t qform_code;
+  int16_t sform_code;
+  float   quatern_b;
+  float   quatern_c;
+  float   quatern_d;
+  float   qoffset_x;
+  float   qoffset_y;
+  float   qoffset_z;
+  float   srow_x[4];
+  float   srow_y[4];
+  float   srow_z[4];
+  char    intent_name[16];
+  char    magic[4];
+} nifti1_header_t;
+
+int8_t can_export_stored(volume_t *volume);
+void get_volume_affine(volume_t *volume, double affine[3][4]);
+int8_t write_nifti(int fd, volume_t *volume, export_type_t type,
+                   uint32_t nthreads);
+int8_t write_nrrd(int fd, volume_t *volume, export_type_t type,
+                  uint32_t nthreads);
+
+#endif // __EXPORT_H__
@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "dicom.h"
+#include "dcm.h"
+#include "functional-groups.h"
+
+static ssize_t decode_tag(file_t *file, ssize_t offset,
+                          dicom_meta_t *dicom_meta, tag_t *tag) {
+  return dicom_meta->transfer_syntax == IMPLICIT ?
+    decode_implicit_tag(file, offset, tag) :
+    decode_explicit_tag(file, offset, tag);
+}
+
+// Decode the item at offset in a sequence ending at end. Return the offset of
+// the next item, 0 when the sequence delimitation item or end is reached,
+// ERROR if the item is malformed.
+// Cf DICOM standard Part 5 Sect 7.5
+static ssize_t decode_item(file_t *file, ssize_t offset, ssize_t end,
+                           dicom_meta_t *dicom_meta,
+                           functional_group_t *item) {
+  if (offset + g_implicit_tag_size > end) return 0;
+  implicit_tag_t *header = (implicit_tag_t *)
+    map_file_window(file, offset, g_implicit_tag_size);
+  if (header == NULL) return ERROR;
+  uint32_t number = (uint32_t) (header->group << 16) + header->element;
+  if (number == SEQUENCE_DELIMITATION_TAG) return 0;
+  if (number != ITEM_TAG) return ERROR;
+  offset += g_implicit_tag_size;
+  item->begin = offset;
+  if (header->datasize != UNDEFINED_LENGTH) {
+    item->end = offset + header->datasize;
+    return item->end <= end ? item->end : ERROR;
+  }
+  // Item of undefined length, walk its tags until the item delimiter
+  while (offset + g_implicit_tag_size <= end) {
+    header = (implicit_tag_t *)
+      map_file_window(file, offset, g_implicit_tag_size);
+    if (header == NULL) return ERROR;
+    if ((uint32_t) (header->group << 16) + header->element ==
+        ITEM_DELIMITATION_TAG) {
+      item->end = offset;
+      return offset + g_implicit_tag_size;
+    }
+    if ((offset = skip_tag(file, offset, dicom_meta)) == ERROR) return ERROR;
+  }
+  return ERROR;
+}
+
+// Offset of the first item of the sequence at offset. Set end to the end of
+// the sequence, the end of the file for undefined lengths.
+static ssize_t open_sequence(file_t *file, ssize_t offset,
+                             dicom_meta_t *dicom_meta, ssize_t *end) {
+  tag_t tag;
+  ssize_t shift = decode_tag(file, offset, dicom_meta, &tag);
+  if (shift <= 0) return ERROR;
+  *end = tag.datasize == UNDEFINED_LENGTH ? file->size :
+    offset + shift + tag.datasize;
+  return *end <= file->size ? offset + shift : ERROR;
+}
+
+static int8_t add_group(functional_groups_t *index, uint32_t *count,
+                        uint32_t *capacity, functional_group_t *group) {
+  if (*count == *capacity) {
+    uint32_t size = *capacity ? *capacity * 2 : 64;
+    functional_group_t *groups = realloc(index->groups,
+                                         sizeof (functional_group_t) * size);
+    if (groups == NULL) {
+      perror("realloc");
+      return ERROR;
+    }
+    index->groups = groups;
+    *capacity = size;
+  }
+  index->groups[(*count)++] = *group;
+  return 0;
+}
+
+// Add the first item of each functional group sequence of an item
+static int8_t index_groups(file_t *file, functional_group_t *item,
+                           dicom_meta_t *dicom_meta,
+                           functional_groups_t *index, uint32_t *count,
+                           uint32_t *capacity) {
+  ssize_t offset = item->begin;
+  while (offset < item->end) {
+    tag_t tag;
+    functional_group_t group;
+    ssize_t end;
+    if (decode_tag(file, offset, dicom_meta, &tag) <= 0) return ERROR;
+    if (TYPE_OF((&tag), "SQ") || tag.datasize == UNDEFINED_LENGTH) {
+      ssize_t first = open_sequence(file, offset, dicom_meta, &end);
+      ssize_t next = first == ERROR ? ERROR :
+        decode_item(file, first, end, dicom_meta, &group);
+      if (next == ERROR) return ERROR;
+      group.sequence = (uint32_t) (tag.group << 16) + tag.element;
+      if (next && add_group(index, count, capacity, &group) == ERROR)
+        return ERROR;
+    }
+    if ((offset = skip_tag(file, offset, dicom_meta)) == ERROR) return ERROR;
+  }
+  return 0;
+}
+
+// Index the groups of the first nitems items of the sequence at offset,
+// recording in first where the groups of each item start when not NULL.
+// Return the number of items indexed.
+static ssize_t index_items(file_t *file, ssize_t offset,
+                           dicom_meta_t *dicom_meta,
+                           functional_groups_t *index, uint32_t nitems,
+                           uint32_t *first, uint32_t *count,
+                           uint32_t *capacity) {
+  ssize_t end;
+  uint32_t i = 0;
+  if ((offset = open_sequence(file, offset, dicom_meta, &end)) == ERROR)
+    return ERROR;
+  while (i < nitems) {
+    functional_group_t item;
+    ssize_t next = decode_item(file, offset, end, dicom_meta, &item);
+    if (next == ERROR) return ERROR;
+    if (next == 0) break;
+    if (first) first[i] = *count;
+    if (index_groups(file, &item, dicom_meta, index, count,
+                     capacity) == ERROR)
+      return ERROR;
+    offset = next;
+    ++i;
+  }
+  return i;
+}
+
+static int8_t index_functional_groups(file_t *file, ssize_t offset,
+                                      dicom_meta_t *dicom_meta,
+                                      functional_groups_t *index) {
+  tag_t tag;
+  uint32_t count = 0;
+  uint32_t capacity = 0;
+  ssize_t shared = find_tag(file, offset, dicom_meta,
+                            SHARED_FUNCTIONAL_GROUPS_SEQUENCE, &tag);
+  if (shared != ERROR &&
+      index_items(file, shared, dicom_meta, index, 1, NULL, &count,
+                  &capacity) == ERROR)
+    return ERROR;
+  index->nshared = count;
+  ssize_t per_frame = find_tag(file, shared != ERROR ? shared : offset,
+                               dicom_meta,
+                               PER_FRAME_FUNCTIONAL_GROUPS_SEQUENCE, &tag);
+  if (per_frame == ERROR) {
+    // Without per-frame groups, every frame has the shared ones only
+    for (uint32_t i = 0; i <= index->number_of_frames; ++i)
+      index->first[i] = count;
+    return shared != ERROR ? 0 : ERROR;
+  }
+  if (index_items(file, per_frame, dicom_meta, index,
+                  index->number_of_frames, index->first, &count,
+                  &capacity) != index->number_of_frames)
+    return ERROR;
+  index->first[index->number_of_frames] = count;
+  return 0;
+}
+
+// Index the items of the functional group sequences of every frame and of
+// the shared functional groups in one pass, offset being where the decoding
+// of the dataset stopped. Return ERROR if there is no functional group or if
+// the per-frame sequence does not hold number_of_frames items.
+// Cf DICOM standard Part 3 Sect C.7.6.16
+int8_t build_functional_groups(file_t *file, ssize_t offset,
+                               dicom_meta_t *dicom_meta,
+                               uint32_t number_of_frames,
+                               functional_groups_t *index) {
+  memset(index, 0, sizeof (functional_groups_t));
+  index->number_of_frames = number_of_frames;
+  index->first = malloc(sizeof (uint32_t) * (number_of_frames + 1));
+  if (index->first == NULL) {
+    perror("malloc");
+    return ERROR;
+  }
+  if (index_functional_groups(file, offset, dicom_meta, index) == ERROR) {
+    free_functional_groups(index);
+    return ERROR;
+  }
+  return 0;
+}
+
+void free_functional_groups(functional_groups_t *index) {
+  free(index->first);
+  free(index->groups);
+  index->first = NULL;
+  index->groups = NULL;
+}
+
+// The item of a functional group sequence for a frame, from its per-frame
+// groups or else from the shared ones. NULL if the frame has none.
+functional_group_t *get_frame_group(functional_groups_t *index,
+                                    uint32_t frame, uint32_t sequence) {
+  if (frame >= index->number_of_frames) return NULL;
+  for (uint32_t i = index->first[frame]; i < index->first[frame + 1]; ++i)
+    if (index->groups[i].sequence == sequence) return &index->groups[i];
+  for (uint32_t i = 0; i < index->nshared; ++i)
+    if (index->groups[i].sequence == sequence) return &index->groups[i];
+  return NULL;
+}
+
+// Decode the tag number of the item of the functional group sequence of a
+// frame. Return its offset or ERROR if it is absent.
+ssize_t get_frame_attribute(file_t *file, dicom_meta_t *dicom_meta,
+                            functional_groups_t *index, uint32_t frame,
+                            uint32_t sequence, uint32_t number, tag_t *tag) {
+  functional_group_t *group = get_frame_group(index, frame, sequence);
+  if (group == NULL) return ERROR;
+  ssize_t offset = group->begin;
+  while (offset < group->end) {
+    if (decode_tag(file, offset, dicom_meta, tag) <= 0) return ERROR;
+    uint32_t current = (uint32_t) (tag->group << 16) + tag->element;
+    if (current == number) return offset;
+    if (current > number) return ERROR;
+    if ((offset = skip_tag(file, offset, dicom_meta)) == ERROR) return ERROR;
+  }
+  return ERROR;
+}
+
+// ImagePositionPatient of a frame
+// Cf DICOM standard Part 3 Sect C.7.6.16.2.3
+int8_t get_frame_position(file_t *file, dicom_meta_t *dicom_meta,
+                          functional_groups_t *index, uint32_t frame,
+                          double position[3]) {
+  tag_t tag;
+  if (get_frame_attribute(file, dicom_meta, index, frame,
+                          PLANE_POSITION_SEQUENCE, IMAGE_POSITION_PATIENT,
+                          &tag) == ERROR ||
+      decode_numbers(&tag, position, 3) != 3)
+    return ERROR;
+  return 0;
+}
@@ -0,0 +1,42 @@
+#ifndef __FUNCTIONAL_GROUPS_H__
+#define __FUNCTIONAL_GROUPS_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "dcm.h"
+
+// The item of a functional group sequence
+typedef struct functional_group_s {
+  uint32_t sequence; // Tag of the functional group sequence
+  ssize_t  begin;    // Offsets of the first element of the item and past its
+  ssize_t  end;      // last element
+} functional_group_t;
+
+// Functional groups of an enhanced multi-frame image. The shared groups come
+// first in groups, then the groups of each frame.
+// Cf DICOM standard Part 3 Sect C.7.6.16
+typedef struct functional_groups_s {
+  uint32_t           number_of_frames;
+  uint32_t           nshared;
+  // number_of_frames + 1 indices in groups of the first group of each frame.
+  // The last one bounds the last frame.
+  uint32_t           *first;
+  functional_group_t *groups;
+} functional_groups_t;
+
+int8_t build_functional_groups(file_t *file, ssize_t offset,
+                               dicom_meta_t *dicom_meta,
+                               uint32_t number_of_frames,
+                               functional_groups_t *index);
+void free_functional_groups(functional_groups_t *index);
+functional_group_t *get_frame_group(functional_groups_t *index,
+                                    uint32_t frame, uint32_t sequence);
+ssize_t get_frame_attribute(file_t *file, dicom_meta_t *dicom_meta,
+                            functional_groups_t *index, uint32_t frame,
+                            uint32_t sequence, uint32_t number, tag_t *tag);
+int8_t get_frame_position(file_t *file, dicom_meta_t *dicom_meta,
+                          functional_groups_t *index, uint32_t frame,
+                          double position[3]);
+
+#endif // __FUNCTIONAL_GROUPS_H__
@@ -0,0 +1,394 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "dicom.h"
+#include "dcm.h"
+#include "pixel-data.h"
+#include "parallel.h"
+#include "jpeg-lossless.h"
+
+// Cf ISO/IEC 10918-1 Table B.1
+#define MARKER_SOF3 0xC3
+#define MARKER_DHT 0xC4
+#define MARKER_SOI 0xD8
+#define MARKER_EOI 0xD9
+#define MARKER_SOS 0xDA
+#define MARKER_DRI 0xDD
+
+// Entropy coded data reader, bits are kept most significant first in buffer
+typedef struct bit_reader_s {
+  const uint8_t *data;
+  size_t        length;
+  size_t        position;
+  uint64_t      buffer;
+  uint8_t       bits;
+  uint8_t       marker; // A marker stops the data, zeros are read past it
+} bit_reader_t;
+
+static inline uint16_t read_uint16(const uint8_t *data) {
+  return (uint16_t) (data[0] << 8 | data[1]);
+}
+
+// Cf ISO/IEC 10918-1 Annex F.2.2.5, stuffed zero bytes are removed
+static inline void fill_bits(bit_reader_t *reader) {
+  while (reader->bits <= 56) {
+    uint8_t byte = 0;
+    if (!reader->marker && reader->position < reader->length) {
+      byte = reader->data[reader->position];
+      if (byte != 0xFF) {
+        ++reader->position;
+      } else if (reader->position + 1 < reader->length &&
+                 reader->data[reader->position + 1] == 0x00) {
+        reader->position += 2;
+      } else {
+        reader->marker = 1;
+        byte = 0;
+      }
+    }
+    reader->buffer |= (uint64_t) byte << (56 - reader->bits);
+    reader->bits += 8;
+  }
+}
+
+static inline uint32_t peek_bits(bit_reader_t *reader, uint8_t n) {
+  return (uint32_t) (reader->buffer >> (64 - n));
+}
+
+static inline void skip_bits(bit_reader_t *reader, uint8_t n) {
+  reader->buffer <<= n;
+  reader->bits -= n;
+}
+
+// Cf ISO/IEC 10918-1 Annex C and F.2.2.3
+static int8_t build_huffman_table(const uint8_t *counts, const uint8_t *values,
+                                  huffman_table_t *table) {
+  uint8_t sizes[257];
+  uint16_t codes[256];
+  uint16_t n = 0;
+  memset(table, 0, sizeof (huffman_table_t));
+  for (uint8_t l = 1; l <= 16; ++l)
+    for (uint8_t i = 0; i < counts[l - 1]; ++i) {
+      if (n == 256) return ERROR;
+      sizes[n++] = l;
+    }
+  sizes[n] = 0;
+  memcpy(table->values, values, n);
+  uint32_t code = 0;
+  uint8_t size = sizes[0];
+  for (uint16_t k = 0; sizes[k];) {
+    while (sizes[k] == size) codes[k++] = code++;
+    if (code > (1U << size)) return ERROR;
+    code <<= 1;
+    ++size;
+  }
+  uint16_t j = 0;
+  for (uint8_t l = 1; l <= 16; ++l) {
+    if (counts[l - 1]) {
+      table->valptr[l] = j;
+      table->mincode[l] = codes[j];
+      j += counts[l - 1];
+      table->maxcode[l] = codes[j - 1];
+    } else {
+      table->maxcode[l] = -1;
+    }
+  }
+  table->maxcode[17] = INT32_MAX;
+  for (uint16_t k = 0; k < n && sizes[k] <= HUFFMAN_LOOKUP_BITS; ++k) {
+    uint8_t shift = HUFFMAN_LOOKUP_BITS - sizes[k];
+    for (uint32_t i = 0; i < (1U << shift); ++i)
+      table->lookup[(codes[k] << shift) | i] = sizes[k] << 8 | values[k];
+  }
+  table->defined = 1;
+  return 0;
+}
+
+// Decode a difference, the bit buffer holding at least 32 bits
+// Cf ISO/IEC 10918-1 Annex H.1.2.2 and F.2.2.1
+static inline int32_t decode_difference(bit_reader_t *reader,
+                                        huffman_table_t *table) {
+  uint16_t entry = table->lookup[peek_bits(reader, HUFFMAN_LOOKUP_BITS)];
+  uint8_t ssss;
+  if (entry) {
+    skip_bits(reader, entry >> 8);
+    ssss = entry & 0xFF;
+  } else {
+    uint8_t l = HUFFMAN_LOOKUP_BITS + 1;
+    int32_t code;
+    while ((code = peek_bits(reader, l)) > table->maxcode[l]) ++l;
+    if (l > 16) return INT32_MIN;
+    skip_bits(reader, l);
+    ssss = table->values[table->valptr[l] + code - table->mincode[l]];
+  }
+  if (ssss == 0) return 0;
+  if (ssss == 16) return 32768;
+  if (ssss > 16) return INT32_MIN;
+  int32_t value = peek_bits(reader, ssss);
+  skip_bits(reader, ssss);
+  return value < (1 << (ssss - 1)) ? value - (1 << ssss) + 1 : value;
+}
+
+// Cf ISO/IEC 10918-1 Table H.1
+static inline int32_t predict(uint8_t predictor, int32_t ra, int32_t rb,
+                              int32_t rc) {
+  switch (predictor) {
+  case 1: return ra;
+  case 2: return rb;
+  case 3: return rc;
+  case 4: return ra + rb - rc;
+  case 5: return ra + ((rb - rc) >> 1);
+  case 6: return rb + ((ra - rc) >> 1);
+  default: return (ra + rb) >> 1;
+  }
+}
+
+// Start a restart interval after its RSTn marker
+// Cf ISO/IEC 10918-1 Annex E.2.4
+static void restart(bit_reader_t *reader) {
+  while (reader->position + 1 < reader->length &&
+         !(reader->data[reader->position] == 0xFF &&
+           (reader->data[reader->position + 1] & 0xF8) == 0xD0))
+    ++reader->position;
+  reader->position += 2;
+  reader->buffer = 0;
+  reader->bits = 0;
+  reader->marker = 0;
+}
+
+// Store a decoded line in the native layout of the pixel module
+static void store_line(jpeg_lossless_t *jpeg, pixel_module_t *pixel_module,
+                       uint16_t *line, uint16_t y, uint8_t *output) {
+  size_t width = jpeg->samples_per_line;
+  size_t npixels = width * jpeg->lines;
+  uint8_t nc = jpeg->ncomponents;
+  uint8_t pt = jpeg->point_transform;
+  uint8_t planar = nc > 1 && pixel_module->planar_configuration == 1;
+  for (uint8_t c = 0; c < nc; ++c) {
+    // Index of the first sample of the line and distance between samples
+    size_t first = planar ? c * npixels + y * width : y * width * nc + c;
+    size_t step = planar ? 1 : nc;
+    if (pixel_module->bits_allocated == 8) {
+      for (size_t x = 0; x < width; ++x)
+        output[first + x * step] = line[x * nc + c] << pt;
+    } else {
+      uint16_t *output16 = (uint16_t *) output;
+      for (size_t x = 0; x < width; ++x)
+        output16[first + x * step] = line[x * nc + c] << pt;
+    }
+  }
+}
+
+// Cf ISO/IEC 10918-1 Annex H.2
+static int8_t decode_scan(jpeg_lossless_t *jpeg, pixel_module_t *pixel_module,
+                          bit_reader_t *reader, uint8_t *output) {
+  uint8_t nc = jpeg->ncomponents;
+  size_t width = (size_t) jpeg->samples_per_line * nc;
+  uint16_t *lines = malloc(sizeof (uint16_t) * width * 2);
+  if (lines == NULL) {
+    perror("malloc");
+    return ERROR;
+  }
+  huffman_table_t *tables[JPEG_MAX_COMPONENTS];
+  for (uint8_t c = 0; c < nc; ++c)
+    tables[c] = &jpeg->tables[jpeg->component_tables[c]];
+  uint16_t *previous = lines;
+  uint16_t *current = lines + width;
+  int32_t initial = 1 << (jpeg->precision - jpeg->point_transform - 1);
+  uint32_t mcus = 0; // MCUs decoded in the current restart interval
+  uint8_t first_line = 1;
+  uint8_t first_mcu = 1;
+  int8_t ret = 0;
+  for (uint16_t y = 0; y < jpeg->lines && ret == 0; ++y) {
+    for (size_t x = 0; x < jpeg->samples_per_line; ++x) {
+      if (jpeg->restart_interval && mcus == jpeg->restart_interval) {
+        restart(reader);
+        mcus = 0;
+        // Prediction starts over as at the beginning of the scan
+        first_line = 1;
+        first_mcu = 1;
+      }
+      ++mcus;
+      for (uint8_t c = 0; c < nc; ++c) {
+        size_t i = x * nc + c;
+        int32_t prediction;
+        if (reader->bits < 32) fill_bits(reader);
+        int32_t difference = decode_difference(reader, tables[c]);
+        if (difference == INT32_MIN) {
+          ret = ERROR;
+          break;
+        }
+        if (first_mcu)
+          prediction = initial;
+        else if (first_line)
+          prediction = current[i - nc];
+        else if (x == 0)
+          prediction = previous[i];
+        else
+          prediction = predict(jpeg->predictor, current[i - nc], previous[i],
+                               previous[i - nc]);
+        // Modulo 2^16 arithmetic
+        current[i] = (uint16_t) (prediction + difference);
+      }
+      first_mcu = 0;
+    }
+    first_line = 0;
+    store_line(jpeg, pixel_module, current, y, output);
+    uint16_t *tmp = previous;
+    previous = current;
+    current = tmp;
+  }
+  free(lines);
+  return ret;
+}
+
+static int8_t decode_sof3(jpeg_lossless_t *jpeg, const uint8_t *segment,
+                          uint16_t length) {
+  if (length < 6) return ERROR;
+  jpeg->precision = segment[0];
+  jpeg->lines = read_uint16(&segment[1]);
+  jpeg->samples_per_line = read_uint16(&segment[3]);
+  jpeg->ncomponents = segment[5];
+  if (jpeg->ncomponents == 0 || jpeg->ncomponents > JPEG_MAX_COMPONENTS ||
+      length < 6 + 3 * jpeg->ncomponents || jpeg->precision < 2 ||
+      jpeg->precision > 16)
+    return ERROR;
+  for (uint8_t c = 0; c < jpeg->ncomponents; ++c) {
+    jpeg->component_ids[c] = segment[6 + 3 * c];
+    // Subsampled components are not used by DICOM
+    if (segment[6 + 3 * c + 1] != 0x11) return ERROR;
+  }
+  return 0;
+}
+
+static int8_t decode_dht(jpeg_lossless_t *jpeg, const uint8_t *segment,
+                         uint16_t length) {
+  uint16_t i = 0;
+  while (i + 17 <= length) {
+    uint8_t id = segment[i] & 0x0F;
+    uint16_t nvalues = 0;
+    for (uint8_t l = 0; l < 16; ++l) nvalues += segment[i + 1 + l];
+    if (id >= JPEG_MAX_TABLES || i + 17 + nvalues > length ||
+        build_huffman_table(&segment[i + 1], &segment[i + 17],
+                            &jpeg->tables[id]) == ERROR)
+      return ERROR;
+    i += 17 + nvalues;
+  }
+  return 0;
+}
+
+static int8_t decode_sos(jpeg_lossless_t *jpeg, const uint8_t *segment,
+                         uint16_t length) {
+  if (length < 1 || segment[0] != jpeg->ncomponents ||
+      length < 1 + 2 * jpeg->ncomponents + 3)
+    return ERROR;
+  // Only interleaved scans of all the components are supported
+  for (uint8_t c = 0; c < jpeg->ncomponents; ++c) {
+    if (segment[1 + 2 * c] != jpeg->component_ids[c]) return ERROR;
+    jpeg->component_tables[c] = segment[1 + 2 * c + 1] >> 4;
+    if (jpeg->component_tables[c] >= JPEG_MAX_TABLES ||
+        !jpeg->tables[jpeg->component_tables[c]].defined)
+      return ERROR;
+  }
+  const uint8_t *parameters = &segment[1 + 2 * jpeg->ncomponents];
+  jpeg->predictor = parameters[0];
+  jpeg->point_transform = parameters[2] & 0x0F;
+  if (jpeg->predictor < 1 || jpeg->predictor > 7 ||
+      jpeg->point_transform >= jpeg->precision)
+    return ERROR;
+  return 0;
+}
+
+// Decode a lossless JPEG frame in the native layout of the pixel module
+// Cf ISO/IEC 10918-1 Annex B and H, DICOM standard Part 5 Sect A.4.1
+int8_t decode_jpeg_lossless_frame(const uint8_t *data, size_t length,
+                                  pixel_module_t *pixel_module,
+                                  uint8_t *output) {
+  jpeg_lossless_t jpeg;
+  size_t position = 2;
+  memset(&jpeg, 0, sizeof (jpeg_lossless_t));
+  if (length < 4 || data[0] != 0xFF || data[1] != MARKER_SOI) return ERROR;
+  while (position + 4 <= length) {
+    if (data[position] != 0xFF) return ERROR;
+    uint8_t marker = data[position + 1];
+    // Fill bytes may precede a marker
+    if (marker == 0xFF) {
+      ++position;
+      continue;
+    }
+    if (marker == MARKER_EOI) break;
+    uint16_t size = read_uint16(&data[position + 2]);
+    const uint8_t *segment = &data[position + 4];
+    if (size < 2 || position + 2 + size > length) return ERROR;
+    position += 2 + size;
+    size -= 2;
+    int8_t ret = 0;
+    switch (marker) {
+    case MARKER_SOF3:
+      ret = decode_sof3(&jpeg, segment, size);
+      if (ret == 0 &&
+          (jpeg.lines != pixel_module->rows ||
+           jpeg.samples_per_line != pixel_module->columns ||
+           jpeg.ncomponents != pixel_module->samples_per_pixel ||
+           jpeg.precision > pixel_module->bits_allocated))
+        ret = ERROR;
+      break;
+    case MARKER_DHT:
+      ret = decode_dht(&jpeg, segment, size);
+      break;
+    case MARKER_DRI:
+      jpeg.restart_interval = size >= 2 ? read_uint16(segment) : 0;
+      break;
+    case MARKER_SOS: {
+      if (jpeg.ncomponents == 0 ||
+          decode_sos(&jpeg, segment, size) == ERROR)
+        return ERROR;
+      bit_reader_t reader = { data, length, position, 0, 0, 0 };
+      return decode_scan(&jpeg, pixel_module, &reader, output);
+    }
+    default:
+      // Other frame types are not lossless Huffman coded
+      if (marker >= 0xC0 && marker <= 0xCF && marker != MARKER_DHT &&
+          marker != 0xC8 && marker != 0xCC)
+        ret = ERROR;
+      break;
+    }
+    if (ret == ERROR) return ERROR;
+  }
+  return ERROR;
+}
+
+typedef struct jpeg_frames_s {
+  file_t         *file;
+  frame_index_t  *index;
+  pixel_module_t *pixel_module;
+  uint32_t       *frames;
+  uint8_t        *output;
+} jpeg_frames_t;
+
+static int8_t decode_frame(void *context, size_t i) {
+  jpeg_frames_t *j = (jpeg_frames_t *) context;
+  uint8_t *buffer;
+  size_t length;
+  size_t size = get_frame_bits(j->pixel_module) / 8;
+  uint8_t *data = get_encapsulated_frame(j->file, j->index, j->frames[i],
+                                         &length, &buffer);
+  if (data == NULL) return ERROR;
+  int8_t ret = decode_jpeg_lossless_frame(data, length, j->pixel_module,
+                                          j->output + size * i);
+  free(buffer);
+  return ret;
+}
+
+// Decode the requested frames one after the other in output, the frames
+// being spread over the threads
+int8_t decode_jpeg_lossless_frames(file_t *file, frame_index_t *index,
+                                   pixel_module_t *pixel_module,
+                                   uint32_t *frames, size_t nframes,
+                                   uint8_t *output, uint32_t nthreads) {
+  jpeg_frames_t j = { file, index, pixel_module, frames, output };
+  if (pixel_module->bits_allocated != 8 && pixel_module->bits_allocated != 16)
+    return ERROR;
+  return parallel_for(nframes, nthreads, decode_frame, &j);
+}
@@ -0,0 +1,47 @@
+#ifndef __JPEG_LOSSLESS_H__
+#define __JPEG_LOSSLESS_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "dcm.h"
+#include "pixel-data.h"
+
+#define HUFFMAN_LOOKUP_BITS 9
+#define JPEG_MAX_COMPONENTS 4
+#define JPEG_MAX_TABLES 4
+
+// Decoding tables of Cf ISO/IEC 10918-1 Annex F.2.2.3, plus a lookup table
+// resolving the codes of up to HUFFMAN_LOOKUP_BITS bits in one access
+typedef struct huffman_table_s {
+  uint16_t lookup[1 << HUFFMAN_LOOKUP_BITS]; // length << 8 | value, 0 if longer
+  int32_t  maxcode[18];
+  int32_t  valptr[17];
+  int32_t  mincode[17];
+  uint8_t  values[256];
+  uint8_t  defined;
+} huffman_table_t;
+
+// Cf ISO/IEC 10918-1 Annex H
+typedef struct jpeg_lossless_s {
+  uint8_t         precision;
+  uint16_t        lines;
+  uint16_t        samples_per_line;
+  uint8_t         ncomponents;
+  uint8_t         component_ids[JPEG_MAX_COMPONENTS];
+  uint8_t         component_tables[JPEG_MAX_COMPONENTS];
+  uint8_t         predictor;
+  uint8_t         point_transform;
+  uint16_t        restart_interval;
+  huffman_table_t tables[JPEG_MAX_TABLES];
+} jpeg_lossless_t;
+
+int8_t decode_jpeg_lossless_frame(const uint8_t *data, size_t length,
+                                  pixel_module_t *pixel_module,
+                                  uint8_t *output);
+int8_t decode_jpeg_lossless_frames(file_t *file, frame_index_t *index,
+                                   pixel_module_t *pixel_module,
+                                   uint32_t *frames, size_t nframes,
+                                   uint8_t *output, uint32_t nthreads);
+
+#endif // __JPEG_LOSSLESS_H__
@@ -0,0 +1,436 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <sys/types.h>
+
+#include "dicom.h"
+#include "dcm.h"
+#include "pixel-data.h"
+#include "parallel.h"
+#include "simd.h"
+#include "lut.h"
+
+static int8_t get_stored_value_layout(pixel_module_t *pixel_module,
+                                      stored_value_t *layout) {
+  if ((pixel_module->bits_allocated != 8 &&
+       pixel_module->bits_allocated != 16) ||
+      pixel_module->high_bit + 1 < pixel_module->bits_stored)
+    return ERROR;
+  layout->bytes = pixel_module->bits_allocated / 8;
+  layout->left = 15 - pixel_module->high_bit;
+  layout->right = 16 - pixel_module->bits_stored;
+  layout->is_signed = pixel_module->pixel_representation == 1;
+  return 0;
+}
+
+// Cf DICOM standard Part 3 Sect C.11.1.1.2
+int8_t decode_modality_lut(tag_t *tags, modality_lut_t *modality_lut) {
+  modality_lut->rescale_slope = 1.0;
+  modality_lut->rescale_intercept = 0.0;
+  get_tag_numbers(tags, RESCALE_SLOPE, &modality_lut->rescale_slope, 1);
+  get_tag_numbers(tags, RESCALE_INTERCEPT, &modality_lut->rescale_intercept, 1);
+  return 0;
+}
+
+// Rescale with integers only when the slope is 1 and the intercept an
+// integer, which is the case of most CT
+static uint8_t is_integer_rescale(modality_lut_t *modality_lut) {
+  return modality_lut->rescale_slope == 1.0 &&
+    modality_lut->rescale_intercept == floor(modality_lut->rescale_intercept) &&
+    fabs(modality_lut->rescale_intercept) < 65536.0;
+}
+
+// The scalar references follow the standard formula in double precision
+// Cf DICOM standard Part 3 Sect C.11.1.1.2
+int8_t rescale_to_int16_scalar(modality_lut_t *modality_lut,
+                               pixel_module_t *pixel_module,
+                               const uint8_t *input, int16_t *output,
+                               size_t npixels) {
+  stored_value_t l;
+  if (get_stored_value_layout(pixel_module, &l) == ERROR) return ERROR;
+  for (size_t i = 0; i < npixels; ++i) {
+    double value = floor(load_stored_value(input, i, l.bytes, l.left, l.right,
+                                           l.is_signed) *
+                         modality_lut->rescale_slope +
+                         modality_lut->rescale_intercept + 0.5);
+    output[i] = value < INT16_MIN ? INT16_MIN :
+      value > INT16_MAX ? INT16_MAX : (int16_t) value;
+  }
+  return 0;
+}
+
+int8_t rescale_to_float_scalar(modality_lut_t *modality_lut,
+                               pixel_module_t *pixel_module,
+                               const uint8_t *input, float *output,
+                               size_t npixels) {
+  stored_value_t l;
+  if (get_stored_value_layout(pixel_module, &l) == ERROR) return ERROR;
+  for (size_t i = 0; i < npixels; ++i)
+    output[i] = load_stored_value(input, i, l.bytes, l.left, l.right,
+                                  l.is_signed) *
+      modality_lut->rescale_slope + modality_lut->rescale_intercept;
+  return 0;
+}
+
+SIMD_INLINE void rescale_int16_loop(const uint8_t *restrict input,
+                                    int16_t *restrict output, size_t npixels,
+                                    uint8_t bytes, uint8_t left, uint8_t right,
+                                    uint8_t is_signed, uint8_t integer,
+                                    float slope, float intercept) {
+  if (integer) {
+    int32_t offset = (int32_t) intercept;
+    for (size_t i = 0; i < npixels; ++i) {
+      int32_t value = load_stored_value(input, i, bytes, left, right,
+                                        is_signed) + offset;
+      value = value < INT16_MIN ? INT16_MIN : value;
+      output[i] = value > INT16_MAX ? INT16_MAX : value;
+    }
+  } else {
+    for (size_t i = 0; i < npixels; ++i)
+      output[i] = round_clamp(load_stored_value(input, i, bytes, left, right,
+                                                is_signed) * slope + intercept,
+                              INT16_MIN, INT16_MAX);
+  }
+}
+
+SIMD_KERNEL static void rescale_int16_kernel(const uint8_t *input,
+                                             int16_t *output, size_t npixels,
+                                             stored_value_t *l,
+                                             uint8_t integer, float slope,
+                                             float intercept) {
+  // Specialize the loop for each layout so that the tests leave the loop
+  if (l->bytes == 1 && l->is_signed)
+    rescale_int16_loop(input, output, npixels, 1, l->left, l->right, 1,
+                       integer, slope, intercept);
+  else if (l->bytes == 1)
+    rescale_int16_loop(input, output, npixels, 1, l->left, l->right, 0,
+                       integer, slope, intercept);
+  else if (l->is_signed)
+    rescale_int16_loop(input, output, npixels, 2, l->left, l->right, 1,
+                       integer, slope, intercept);
+  else
+    rescale_int16_loop(input, output, npixels, 2, l->left, l->right, 0,
+                       integer, slope, intercept);
+}
+
+SIMD_INLINE void rescale_float_loop(const uint8_t *restrict input,
+                                    float *restrict output, size_t npixels,
+                                    uint8_t bytes, uint8_t left, uint8_t right,
+                                    uint8_t is_signed, float slope,
+                                    float intercept) {
+  for (size_t i = 0; i < npixels; ++i)
+    output[i] = load_stored_value(input, i, bytes, left, right, is_signed) *
+      slope + intercept;
+}
+
+SIMD_KERNEL static void rescale_float_kernel(const uint8_t *input,
+                                             float *output, size_t npixels,
+                                             stored_value_t *l, float slope,
+                                             float intercept) {
+  if (l->bytes == 1 && l->is_signed)
+    rescale_float_loop(input, output, npixels, 1, l->left, l->right, 1,
+                       slope, intercept);
+  else if (l->bytes == 1)
+    rescale_float_loop(input, output, npixels, 1, l->left, l->right, 0,
+                       slope, intercept);
+  else if (l->is_signed)
+    rescale_float_loop(input, output, npixels, 2, l->left, l->right, 1,
+                       slope, intercept);
+  else
+    rescale_float_loop(input, output, npixels, 2, l->left, l->right, 0,
+                       slope, intercept);
+}
+
+// Apply the rescale slope and intercept to npixels stored values of 8 or 16
+// bits allocated, computing in single precision
+int8_t rescale_to_int16(modality_lut_t *modality_lut,
+                        pixel_module_t *pixel_module, const uint8_t *input,
+                        int16_t *output, size_t npixels) {
+  stored_value_t l;
+  if (get_stored_value_layout(pixel_module, &l) == ERROR) return ERROR;
+  rescale_int16_kernel(input, output, npixels, &l,
+                       is_integer_rescale(modality_lut),
+                       modality_lut->rescale_slope,
+                       modality_lut->rescale_intercept);
+  return 0;
+}
+
+int8_t rescale_to_float(modality_lut_t *modality_lut,
+                        pixel_module_t *pixel_module, const uint8_t *input,
+                        float *output, size_t npixels) {
+  stored_value_t l;
+  if (get_stored_value_layout(pixel_module, &l) == ERROR) return ERROR;
+  rescale_float_kernel(input, output, npixels, &l,
+                       modality_lut->rescale_slope,
+                       modality_lut->rescale_intercept);
+  return 0;
+}
+
+typedef struct rescale_frames_s {
+  file_t         *file;
+  tag_t          *pixel_data;
+  pixel_module_t *pixel_module;
+  modality_lut_t *modality_lut;
+  void           *output;
+  uint8_t        is_float;
+} rescale_frames_t;
+
+static int8_t rescale_frame(void *context, size_t frame) {
+  rescale_frames_t *r = (rescale_frames_t *) context;
+  frame_view_t view;
+  size_t npixels = (size_t) r->pixel_module->rows * r->pixel_module->columns;
+  if (get_native_frame(r->file, r->pixel_data, r->pixel_module, frame, 0,
+                       &view) == ERROR)
+    return ERROR;
+  if (r->is_float)
+    return rescale_to_float(r->modality_lut, r->pixel_module, view.data,
+                            (float *) r->output + npixels * frame, npixels);
+  return rescale_to_int16(r->modality_lut, r->pixel_module, view.data,
+                          (int16_t *) r->output + npixels * frame, npixels);
+}
+
+static int8_t rescale_frames(rescale_frames_t *r, uint32_t nthreads) {
+  // The modality LUT only applies to grayscale images
+  if (r->pixel_module->samples_per_pixel != 1) return ERROR;
+  return parallel_for(r->pixel_module->number_of_frames, nthreads,
+                      rescale_frame, r);
+}
+
+// Rescale all the frames of native pixel data into output, frame after frame,
+// the frames being spread over nthreads threads (0 for one per processor)
+int8_t rescale_frames_to_int16(file_t *file, tag_t *pixel_data,
+                               pixel_module_t *pixel_module,
+                               modality_lut_t *modality_lut, int16_t *output,
+                               uint32_t nthreads) {
+  rescale_frames_t r = { file, pixel_data, pixel_module, modality_lut, output,
+                         0 };
+  return rescale_frames(&r, nthreads);
+}
+
+int8_t rescale_frames_to_float(file_t *file, tag_t *pixel_data,
+                               pixel_module_t *pixel_module,
+                               modality_lut_t *modality_lut, float *output,
+                               uint32_t nthreads) {
+  rescale_frames_t r = { file, pixel_data, pixel_module, modality_lut, output,
+                         1 };
+  return rescale_frames(&r, nthreads);
+}
+
+// Cf DICOM standard Part 3 Sect C.11.2.1.2
+int8_t decode_voi_lut(tag_t *tags, voi_lut_t *voi_lut) {
+  memset(voi_lut, 0, sizeof (voi_lut_t));
+  // Only the first window is used when several are proposed
+  if (get_tag_numbers(tags, WINDOW_CENTER, &voi_lut->window_center, 1) != 1 ||
+      get_tag_numbers(tags, WINDOW_WIDTH, &voi_lut->window_width, 1) != 1)
+    return ERROR;
+  voi_lut->function = VOI_LINEAR;
+  tag_t *tag = get_tag(tags, VOI_LUT_FUNCTION);
+  if (tag != NULL) {
+    // A CS value is padded to an even length with a space, or with a NUL by
+    // some writers, which is not part of the function name
+    char function[MAX_CODE_STR_SIZE];
+    size_t length = tag->datasize < MAX_CODE_STR_SIZE ? tag->datasize :
+      MAX_CODE_STR_SIZE - 1;
+    memcpy(function, tag->data, length);
+    while (length && (function[length - 1] == ' ' || function[length - 1] == 0))
+      --length;
+    function[length] = 0;
+    if (!strcmp(function, "LINEAR_EXACT"))
+      voi_lut->function = VOI_LINEAR_EXACT;
+    else if (!strcmp(function, "SIGMOID"))
+      voi_lut->function = VOI_SIGMOID;
+  }
+  if (voi_lut->window_width <= 0.0 ||
+      (voi_lut->function == VOI_LINEAR && voi_lut->window_width < 1.0))
+    return ERROR;
+  return 0;
+}
+
+// Display value of a modality value x, in double precision
+// Cf DICOM standard Part 3 Sect C.11.2.1.2 and C.11.2.1.3
+static uint8_t window_value(voi_lut_t *voi_lut, double x, uint8_t invert) {
+  double c = voi_lut->window_center;
+  double w = voi_lut->window_width;
+  double y;
+  switch (voi_lut->function) {
+  case VOI_LINEAR:
+    if (x <= c - 0.5 - (w - 1) / 2) y = 0;
+    else if (x > c - 0.5 + (w - 1) / 2) y = 255;
+    else y = floor(((x - (c - 0.5)) / (w - 1) + 0.5) * 255 + 0.5);
+    break;
+  case VOI_LINEAR_EXACT:
+    if (x <= c - w / 2) y = 0;
+    else if (x > c + w / 2) y = 255;
+    else y = floor(((x - c) / w + 0.5) * 255 + 0.5);
+    break;
+  default:
+    y = floor(255 / (1 + exp(-4 * (x - c) / w)) + 0.5);
+    break;
+  }
+  if (y < 0) y = 0;
+  if (y > 255) y = 255;
+  return invert ? 255 - (uint8_t) y : (uint8_t) y;
+}
+
+int8_t build_display_lut(pixel_module_t *pixel_module,
+                         modality_lut_t *modality_lut, voi_lut_t *voi_lut,
+                         display_lut_t *display_lut) {
+  memset(display_lut, 0, sizeof (display_lut_t));
+  if (pixel_module->samples_per_pixel != 1 ||
+      get_stored_value_layout(pixel_module, &display_lut->layout) == ERROR)
+    return ERROR;
+  display_lut->modality_lut = *modality_lut;
+  display_lut->voi_lut = *voi_lut;
+  display_lut->invert =
+    !strcmp(pixel_module->photometric_interpretation, "MONOCHROME1");
+  double c = voi_lut->window_center;
+  double w = voi_lut->window_width;
+  double scale;
+  double offset;
+  // y = ((x - c') / w' + 0.5) * 255 with x = v * slope + intercept is folded
+  // in y = v * scale + offset
+  switch (voi_lut->function) {
+  case VOI_LINEAR:
+    if (w > 1) {
+      scale = 255 / (w - 1);
+      offset = (0.5 - (c - 0.5) / (w - 1)) * 255;
+      break;
+    }
+    // A width of 1 is a threshold, tabulated
+    // fall through
+  case VOI_SIGMOID: {
+    stored_value_t *l = &display_lut->layout;
+    int32_t min = l->is_signed ? -(1 << (15 - l->right)) : 0;
+    size_t size = (size_t) 1 << (16 - l->right);
+    display_lut->table = malloc(size);
+    if (display_lut->table == NULL) {
+      perror("malloc");
+      return ERROR;
+    }
+    display_lut->table_min = min;
+    for (size_t i = 0; i < size; ++i)
+      display_lut->table[i] =
+        window_value(voi_lut, ((int32_t) i + min) * modality_lut->rescale_slope +
+                     modality_lut->rescale_intercept, display_lut->invert);
+    return 0;
+  }
+  default:
+    scale = 255 / w;
+    offset = (0.5 - c / w) * 255;
+    break;
+  }
+  if (display_lut->invert) {
+    scale = -scale;
+    offset = 255 - offset;
+  }
+  display_lut->scale = modality_lut->rescale_slope * scale;
+  display_lut->offset = modality_lut->rescale_intercept * scale + offset;
+  return 0;
+}
+
+void free_display_lut(display_lut_t *display_lut) {
+  free(display_lut->table);
+  display_lut->table = NULL;
+}
+
+void render_to_uint8_scalar(display_lut_t *display_lut, const uint8_t *input,
+                            uint8_t *output, size_t npixels) {
+  stored_value_t *l = &display_lut->layout;
+  modality_lut_t *modality_lut = &display_lut->modality_lut;
+  for (size_t i = 0; i < npixels; ++i)
+    output[i] = window_value(&display_lut->voi_lut,
+                             load_stored_value(input, i, l->bytes, l->left,
+                                               l->right, l->is_signed) *
+                             modality_lut->rescale_slope +
+                             modality_lut->rescale_intercept,
+                             display_lut->invert);
+}
+
+SIMD_INLINE void render_linear_loop(const uint8_t *restrict input,
+                                    uint8_t *restrict output, size_t npixels,
+                                    uint8_t bytes, uint8_t left, uint8_t right,
+                                    uint8_t is_signed, float scale,
+                                    float offset) {
+  for (size_t i = 0; i < npixels; ++i)
+    output[i] = round_clamp(load_stored_value(input, i, bytes, left, right,
+                                              is_signed) * scale + offset,
+                            0, 255);
+}
+
+SIMD_INLINE void render_table_loop(const uint8_t *restrict input,
+                                   uint8_t *restrict output, size_t npixels,
+                                   uint8_t bytes, uint8_t left, uint8_t right,
+                                   uint8_t is_signed,
+                                   const uint8_t *restrict table) {
+  for (size_t i = 0; i < npixels; ++i)
+    output[i] = table[load_stored_value(input, i, bytes, left, right,
+                                        is_signed)];
+}
+
+SIMD_KERNEL static void render_linear_kernel(const uint8_t *input,
+                                             uint8_t *output, size_t npixels,
+                                             stored_value_t *l, float scale,
+                                             float offset) {
+  if (l->bytes == 1 && l->is_signed)
+    render_linear_loop(input, output, npixels, 1, l->left, l->right, 1,
+                       scale, offset);
+  else if (l->bytes == 1)
+    render_linear_loop(input, output, npixels, 1, l->left, l->right, 0,
+                       scale, offset);
+  else if (l->is_signed)
+    render_linear_loop(input, output, npixels, 2, l->left, l->right, 1,
+                       scale, offset);
+  else
+    render_linear_loop(input, output, npixels, 2, l->left, l->right, 0,
+                       scale, offset);
+}
+
+// Render npixels stored values to display values in a single pass, without
+// intermediate modality values
+void render_to_uint8(display_lut_t *display_lut, const uint8_t *input,
+                     uint8_t *output, size_t npixels) {
+  stored_value_t *l = &display_lut->layout;
+  if (display_lut->table == NULL) {
+    render_linear_kernel(input, output, npixels, l, display_lut->scale,
+                         display_lut->offset);
+  } else if (l->is_signed) {
+    // Signed values index the table from its middle
+    render_table_loop(input, output, npixels, l->bytes, l->left, l->right, 1,
+                      display_lut->table - display_lut->table_min);
+  } else {
+    render_table_loop(input, output, npixels, l->bytes, l->left, l->right, 0,
+                      display_lut->table);
+  }
+}
+
+typedef struct render_frames_s {
+  file_t         *file;
+  tag_t          *pixel_data;
+  pixel_module_t *pixel_module;
+  display_lut_t  *display_lut;
+  uint8_t        *output;
+} render_frames_t;
+
+static int8_t render_frame(void *context, size_t frame) {
+  render_frames_t *r = (render_frames_t *) context;
+  frame_view_t view;
+  size_t npixels = (size_t) r->pixel_module->rows * r->pixel_module->columns;
+  if (get_native_frame(r->file, r->pixel_data, r->pixel_module, frame, 0,
+                       &view) == ERROR)
+    return ERROR;
+  render_to_uint8(r->display_lut, view.data, r->output + npixels * frame,
+                  npixels);
+  return 0;
+}
+
+// Render all the frames of native pixel data into output, frame after frame
+int8_t render_frames_to_uint8(file_t *file, tag_t *pixel_data,
+                              pixel_module_t *pixel_module,
+                              display_lut_t *display_lut, uint8_t *output,
+                              uint32_t nthreads) {
+  render_frames_t r = { file, pixel_data, pixel_module, display_lut, output };
+  return parallel_for(pixel_module->number_of_frames, nthreads, render_frame,
+                      &r);
+}
@@ -0,0 +1,89 @@
+#ifndef __LUT_H__
+#define __LUT_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "dcm.h"
+#include "pixel-data.h"
+
+// Cf DICOM standard Part 3 Sect C.11.1
+typedef struct modality_lut_s {
+  double rescale_slope;
+  double rescale_intercept;
+} modality_lut_t;
+
+typedef enum voi_function_e {
+  VOI_LINEAR,
+  VOI_LINEAR_EXACT,
+  VOI_SIGMOID,
+} voi_function_t;
+
+// Cf DICOM standard Part 3 Sect C.11.2
+typedef struct voi_lut_s {
+  double         window_center;
+  double         window_width;
+  voi_function_t function;
+} voi_lut_t;
+
+// How to extract the stored values of a pixel module
+// Cf DICOM standard Part 3 Sect C.7.6.3.1.4
+typedef struct stored_value_s {
+  uint8_t bytes;
+  uint8_t left;
+  uint8_t right;
+  uint8_t is_signed;
+} stored_value_t;
+
+// The modality and VOI LUTs combined from stored values to 8 bits display
+// values. Linear functions fold into a single scale and offset, others are
+// tabulated for every stored value.
+typedef struct display_lut_s {
+  modality_lut_t modality_lut;
+  voi_lut_t      voi_lut;
+  uint8_t        invert; // MONOCHROME1
+  stored_value_t layout;
+  float          scale;
+  float          offset;
+  uint8_t        *table;
+  int32_t        table_min;
+} display_lut_t;
+
+int8_t decode_modality_lut(tag_t *tags, modality_lut_t *modality_lut);
+int8_t rescale_to_int16(modality_lut_t *modality_lut,
+                        pixel_module_t *pixel_module, const uint8_t *input,
+                        int16_t *output, size_t npixels);
+int8_t rescale_to_float(modality_lut_t *modality_lut,
+                        pixel_module_t *pixel_module, const uint8_t *input,
+                        float *output, size_t npixels);
+int8_t rescale_to_int16_scalar(modality_lut_t *modality_lut,
+                               pixel_module_t *pixel_module,
+                               const uint8_t *input, int16_t *output,
+                               size_t npixels);
+int8_t rescale_to_float_scalar(modality_lut_t *modality_lut,
+                               pixel_module_t *pixel_module,
+                               const uint8_t *input, float *output,
+                               size_t npixels);
+int8_t rescale_frames_to_int16(file_t *file, tag_t *pixel_data,
+                               pixel_module_t *pixel_module,
+                               modality_lut_t *modality_lut, int16_t *output,
+                               uint32_t nthreads);
+int8_t rescale_frames_to_float(file_t *file, tag_t *pixel_data,
+                               pixel_module_t *pixel_module,
+                               modality_lut_t *modality_lut, float *output,
+                               uint32_t nthreads);
+int8_t decode_voi_lut(tag_t *tags, voi_lut_t *voi_lut);
+int8_t build_display_lut(pixel_module_t *pixel_module,
+                         modality_lut_t *modality_lut, voi_lut_t *voi_lut,
+                         display_lut_t *display_lut);
+void free_display_lut(display_lut_t *display_lut);
+void render_to_uint8(display_lut_t *display_lut, const uint8_t *input,
+                     uint8_t *output, size_t npixels);
+void render_to_uint8_scalar(display_lut_t *display_lut, const uint8_t *input,
+                            uint8_t *output, size_t npixels);
+int8_t render_frames_to_uint8(file_t *file, tag_t *pixel_data,
+                              pixel_module_t *pixel_module,
+                              display_lut_t *display_lut, uint8_t *output,
+                              uint32_t nthreads);
+
+#endif // __LUT_H__
@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "dicom.h"
+#include "dcm.h"
+#include "simd.h"
+#include "bits.h"
+#include "overlay.h"
+
+static uint16_t get_uint16(tag_t *tag) {
+  return tag->datasize >= sizeof (uint16_t) ? *(uint16_t *) tag->data : 0;
+}
+
+// Decode the overlay planes from the tags of the 60xx groups. offset is
+// where to look for them, usually the one returned by decode_n_tags. Return
+// the number of overlays or ERROR.
+// Cf DICOM standard Part 3 Sect C.9.2
+ssize_t decode_overlays(file_t *file, ssize_t offset, dicom_meta_t *dicom_meta,
+                        overlay_t *overlays, size_t maxoverlays) {
+  tag_t tag;
+  double number;
+  size_t noverlays = 0;
+  overlay_t *overlay = NULL;
+  while (offset < file->size) {
+    ssize_t shift = dicom_meta->transfer_syntax == IMPLICIT ?
+      decode_implicit_tag(file, offset, &tag) :
+      decode_explicit_tag(file, offset, &tag);
+    if (shift <= 0 || tag.group > LAST_OVERLAY_GROUP) break;
+    if (get_repeating_group(tag.group) == OVERLAY_GROUP) {
+      if (overlay == NULL || overlay->group != tag.group) {
+        if (noverlays == maxoverlays) break;
+        overlay = &overlays[noverlays++];
+        memset(overlay, 0, sizeof (overlay_t));
+        overlay->group = tag.group;
+        overlay->number_of_frames = 1;
+        overlay->image_frame_origin = 1;
+        overlay->bits_allocated = 1;
+        overlay->origin[0] = overlay->origin[1] = 1;
+      }
+      switch ((uint32_t) (OVERLAY_GROUP << 16) + tag.element) {
+      case OVERLAY_ROWS:
+        overlay->rows = get_uint16(&tag);
+        break;
+      case OVERLAY_COLUMNS:
+        overlay->columns = get_uint16(&tag);
+        break;
+      case NUMBER_OF_FRAMES_IN_OVERLAY:
+        if (decode_numbers(&tag, &number, 1) == 1 && number >= 1)
+          overlay->number_of_frames = (uint32_t) number;
+        break;
+      case OVERLAY_TYPE:
+        if (tag.datasize) overlay->type = *(char *) tag.data;
+        break;
+      case OVERLAY_ORIGIN:
+        if (tag.datasize >= 2 * sizeof (int16_t))
+          memcpy(overlay->origin, tag.data, 2 * sizeof (int16_t));
+        break;
+      case IMAGE_FRAME_ORIGIN:
+        overlay->image_frame_origin = get_uint16(&tag);
+        break;
+      case OVERLAY_BITS_ALLOCATED:
+        overlay->bits_allocated = get_uint16(&tag);
+        break;
+      case OVERLAY_BIT_POSITION:
+        overlay->bit_position = get_uint16(&tag);
+        break;
+      case OVERLAY_DATA:
+        if (tag.datasize == UNDEFINED_LENGTH) return ERROR;
+        overlay->data = tag.data;
+        overlay->length = tag.datasize;
+        break;
+      }
+    }
+    if ((offset = skip_tag(file, offset, dicom_meta)) == ERROR) return ERROR;
+  }
+  return noverlays;
+}
+
+// Return the overlay frame covering an image frame, from 0, or ERROR if the
+// overlay does not apply to it
+// Cf DICOM standard Part 3 Sect C.9.3.1.1
+ssize_t get_overlay_frame(overlay_t *overlay, uint32_t frame) {
+  int64_t overlay_frame = (int64_t) frame + 1 - overlay->image_frame_origin;
+  if (overlay_frame < 0 || overlay_frame >= overlay->number_of_frames)
+    return ERROR;
+  return overlay_frame;
+}
+
+// Check that the overlay bits are in OverlayData and that it holds the frame
+static int8_t check_overlay(overlay_t *overlay, uint32_t frame) {
+  size_t bits = (size_t) overlay->rows * overlay->columns;
+  if (overlay->data == NULL || overlay->bits_allocated != 1 ||
+      frame >= overlay->number_of_frames ||
+      (bits * (frame + 1) + 7) / 8 > overlay->length)
+    return ERROR;
+  return 0;
+}
+
+// Unpack an overlay frame in mask, OverlayRows x OverlayColumns bytes of 0
+// or 1. Overlays embedded in the unused bits of pixel data are not
+// supported.
+int8_t get_overlay_mask(overlay_t *overlay, uint32_t frame, uint8_t *mask) {
+  size_t bits = (size_t) overlay->rows * overlay->columns;
+  if (check_overlay(overlay, frame) == ERROR) return ERROR;
+  size_t first = bits * frame;
+  unpack_bits(overlay->data + first / 8, first % 8, bits, 1, mask);
+  return 0;
+}
+
+SIMD_KERNEL static void blend_mask(const uint8_t *restrict mask, uint8_t value,
+                                   uint8_t *restrict output, size_t n) {
+  for (size_t i = 0; i < n; ++i)
+    output[i] = (output[i] & ~mask[i]) | (value & mask[i]);
+}
+
+// Set the pixels of a rendered frame of rows x columns bytes to value where
+// the overlay covering the image frame is set. The overlay is clipped to the
+// frame. Nothing is done if the overlay does not cover the frame.
+int8_t burn_overlay(overlay_t *overlay, uint32_t frame, uint8_t *output,
+                    uint16_t rows, uint16_t columns, uint8_t value) {
+  ssize_t overlay_frame = get_overlay_frame(overlay, frame);
+  if (overlay_frame == ERROR) return 0;
+  if (check_overlay(overlay, overlay_frame) == ERROR) return ERROR;
+  // Overlay rows and columns covering the frame
+  int32_t top = overlay->origin[0] - 1;
+  int32_t left = overlay->origin[1] - 1;
+  int32_t first_row = top < 0 ? -top : 0;
+  int32_t first_column = left < 0 ? -left : 0;
+  int32_t last_row = rows - top < overlay->rows ? rows - top : overlay->rows;
+  int32_t last_column = columns - left < overlay->columns ?
+    columns - left : overlay->columns;
+  if (first_row >= last_row || first_column >= last_column) return 0;
+  size_t width = last_column - first_column;
+  uint8_t *mask = malloc(width);
+  if (mask == NULL) {
+    perror("malloc");
+    return ERROR;
+  }
+  size_t base = (size_t) overlay->rows * overlay->columns * overlay_frame;
+  for (int32_t row = first_row; row < last_row; ++row) {
+    size_t first = base + (size_t) row * overlay->columns + first_column;
+    unpack_bits(overlay->data + first / 8, first % 8, width, 0xFF, mask);
+    blend_mask(mask, value, output + (size_t) (top + row) * columns + left +
+               first_column, width);
+  }
+  free(mask);
+  return 0;
+}
+
+int8_t burn_overlays(overlay_t *overlays, size_t noverlays, uint32_t frame,
+                     uint8_t *output, uint16_t rows, uint16_t columns,
+                     uint8_t value) {
+  for (size_t i = 0; i < noverlays; ++i)
+    if (burn_overlay(&overlays[i], frame, output, rows, columns,
+                     value) == ERROR)
+      return ERROR;
+  return 0;
+}
@@ -0,0 +1,36 @@
+#ifndef __OVERLAY_H__
+#define __OVERLAY_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "dcm.h"
+
+#define MAX_OVERLAYS 16 // Groups 6000 to 601E
+
+// Cf DICOM standard Part 3 Sect C.9.2
+typedef struct overlay_s {
+  uint16_t group;
+  uint16_t rows;
+  uint16_t columns;
+  char     type;               // G for graphics, R for ROI
+  int16_t  origin[2];          // Row and column of the first pixel, from 1
+  uint32_t number_of_frames;
+  uint16_t image_frame_origin; // First image frame covered, from 1
+  uint16_t bits_allocated;
+  uint16_t bit_position;
+  uint8_t  *data;              // OverlayData, NULL if embedded in pixel data
+  size_t   length;
+} overlay_t;
+
+ssize_t decode_overlays(file_t *file, ssize_t offset, dicom_meta_t *dicom_meta,
+                        overlay_t *overlays, size_t maxoverlays);
+ssize_t get_overlay_frame(overlay_t *overlay, uint32_t frame);
+int8_t get_overlay_mask(overlay_t *overlay, uint32_t frame, uint8_t *mask);
+int8_t burn_overlay(overlay_t *overlay, uint32_t frame, uint8_t *output,
+                    uint16_t rows, uint16_t columns, uint8_t value);
+int8_t burn_overlays(overlay_t *overlays, size_t noverlays, uint32_t frame,
+                     uint8_t *output, uint16_t rows, uint16_t columns,
+                     uint8_t value);
+
+#endif // __OVERLAY_H__
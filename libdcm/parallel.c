@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "dcm.h"
+#include "parallel.h"
+
+typedef struct parallel_s {
+  size_t          count;
+  size_t          next; // Next index to process, shared by the workers
+  int8_t          status;
+  parallel_task_t task;
+  void            *context;
+} parallel_t;
+
+// 0 means one thread per online processor
+uint32_t get_number_of_threads(uint32_t nthreads) {
+  if (nthreads) return nthreads;
+  long nprocessors = sysconf(_SC_NPROCESSORS_ONLN);
+  return nprocessors > 0 ? (uint32_t) nprocessors : 1;
+}
+
+static void *parallel_worker(void *arg) {
+  parallel_t *parallel = (parallel_t *) arg;
+  size_t index;
+  // Indexes are handed one at a time so that uneven tasks (frames of
+  // different compressed sizes) balance across the workers
+  while ((index = __atomic_fetch_add(&parallel->next, 1, __ATOMIC_RELAXED)) <
+         parallel->count) {
+    if (parallel->task(parallel->context, index) == ERROR)
+      __atomic_store_n(&parallel->status, ERROR, __ATOMIC_RELAXED);
+  }
+  return NULL;
+}
+
+// Call task on every index of [0, count) from nthreads threads, the calling
+// thread being one of them. Return ERROR if any of the tasks failed.
+int8_t parallel_for(size_t count, uint32_t nthreads, parallel_task_t task,
+                    void *context) {
+  parallel_t parallel = { count, 0, 0, task, context };
+  nthreads = get_number_of_threads(nthreads);
+  if (nthreads > count) nthreads = count;
+  pthread_t *threads = NULL;
+  uint32_t nstarted = 0;
+  if (nthreads > 1) {
+    threads = malloc(sizeof (pthread_t) * (nthreads - 1));
+    if (threads == NULL) perror("malloc");
+  }
+  for (; threads != NULL && nstarted < nthreads - 1; ++nstarted) {
+    int ret = pthread_create(&threads[nstarted], NULL, parallel_worker,
+                             &parallel);
+    if (ret) {
+      // Carry on with the threads we have
+      fprintf(stderr, "pthread_create: %s\n", strerror(ret));
+      break;
+    }
+  }
+  parallel_worker(&parallel);
+  for (uint32_t i = 0; i < nstarted; ++i) pthread_join(threads[i], NULL);
+  free(threads);
+  return parallel.status;
+}
@@ -0,0 +1,13 @@
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef int8_t (*parallel_task_t)(void *context, size_t index);
+
+uint32_t get_number_of_threads(uint32_t nthreads);
+int8_t parallel_for(size_t count, uint32_t nthreads, parallel_task_t task,
+                    void *context);
+
+#endif // __PARALLEL_H__
@@ -0,0 +1,341 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "dicom.h"
+#include "dcm.h"
+#include "pixel-data.h"
+#include "rle.h"
+#include "jpeg-lossless.h"
+
+// Cf DICOM standard Part 3 Sect C.7.6.3.1
+int8_t decode_pixel_module(tag_t *tags, pixel_module_t *pixel_module) {
+  double number_of_frames;
+  memset(pixel_module, 0, sizeof (pixel_module_t));
+  if (get_tag_uint16(tags, ROWS, &pixel_module->rows) == ERROR ||
+      get_tag_uint16(tags, COLUMNS, &pixel_module->columns) == ERROR ||
+      get_tag_uint16(tags, BITS_ALLOCATED,
+                     &pixel_module->bits_allocated) == ERROR)
+    return ERROR;
+  if (get_tag_uint16(tags, SAMPLES_PER_PIXEL,
+                     &pixel_module->samples_per_pixel) == ERROR)
+    pixel_module->samples_per_pixel = 1;
+  if (get_tag_uint16(tags, BITS_STORED, &pixel_module->bits_stored) == ERROR)
+    pixel_module->bits_stored = pixel_module->bits_allocated;
+  if (get_tag_uint16(tags, HIGH_BIT, &pixel_module->high_bit) == ERROR)
+    pixel_module->high_bit = pixel_module->bits_stored - 1;
+  get_tag_uint16(tags, PIXEL_REPRESENTATION,
+                 &pixel_module->pixel_representation);
+  get_tag_uint16(tags, PLANAR_CONFIGURATION,
+                 &pixel_module->planar_configuration);
+  // NumberOfFrames is only present in multi-frame objects
+  pixel_module->number_of_frames = 1;
+  if (get_tag_numbers(tags, NUMBER_OF_FRAMES, &number_of_frames, 1) == 1 &&
+      number_of_frames >= 1)
+    pixel_module->number_of_frames = (uint32_t) number_of_frames;
+  tag_t *tag = get_tag(tags, PHOTOMETRIC_INTERPRETATION);
+  if (tag != NULL) {
+    size_t length = tag->datasize < MAX_CODE_STR_SIZE - 1 ?
+      tag->datasize : MAX_CODE_STR_SIZE - 1;
+    memcpy(pixel_module->photometric_interpretation, tag->data, length);
+    trim(pixel_module->photometric_interpretation, NULL);
+  }
+  if (pixel_module->bits_allocated == 0 || pixel_module->bits_stored == 0 ||
+      pixel_module->bits_stored > pixel_module->bits_allocated ||
+      pixel_module->high_bit >= pixel_module->bits_allocated)
+    return ERROR;
+  return 0;
+}
+
+// Size of a frame in bits. Frames of BitsAllocated 1 are not byte aligned.
+// YBR_FULL_422 pixel data only hold 2 samples per pixel, the chrominance
+// being shared by pairs of pixels.
+// Cf DICOM standard Part 5 Sect 8.1.1 and Part 3 Sect C.7.6.3.1.2
+size_t get_frame_bits(pixel_module_t *pixel_module) {
+  uint16_t samples = pixel_module->samples_per_pixel;
+  if (!strcmp(pixel_module->photometric_interpretation, "YBR_FULL_422"))
+    samples = 2;
+  return (size_t) pixel_module->rows * pixel_module->columns * samples *
+    pixel_module->bits_allocated;
+}
+
+// Point view at a frame of native pixel data without copying it. The next
+// prefetch frames are advised to the kernel so that sequential playback does
+// not wait on page faults.
+int8_t get_native_frame(file_t *file, tag_t *pixel_data,
+                        pixel_module_t *pixel_module, uint32_t frame,
+                        uint32_t prefetch, frame_view_t *view) {
+  if (pixel_data->datasize == UNDEFINED_LENGTH ||
+      frame >= pixel_module->number_of_frames)
+    return ERROR;
+  size_t bits = get_frame_bits(pixel_module);
+  size_t first = bits * frame;
+  size_t length = (first % 8 + bits + 7) / 8;
+  if (first / 8 + length > pixel_data->datasize) return ERROR;
+  if (file->window_size) {
+    // Slide the window over the frame and rebase the pixel data on it
+    ssize_t data = (uint8_t *) pixel_data->data - file->content;
+    if (map_file_window(file, data + first / 8, length) == NULL)
+      return ERROR;
+    pixel_data->data = (void *) &(file->content[data]);
+  }
+  view->data = (uint8_t *) pixel_data->data + first / 8;
+  if (view->data + length > file->content + file->size) return ERROR;
+  view->length = length;
+  view->bit_offset = first % 8;
+  if (prefetch) {
+    uint32_t last = frame + prefetch < pixel_module->number_of_frames ?
+      frame + prefetch : pixel_module->number_of_frames - 1;
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t begin = (uintptr_t) view->data + length;
+    uintptr_t end = (uintptr_t) pixel_data->data + (bits * (last + 1) + 7) / 8;
+    uintptr_t mapped = (uintptr_t)
+      &(file->content[file->window_offset + file->window_length]);
+    begin &= ~(page - 1);
+    if (end > mapped) end = mapped;
+    // Advice only, failing to prefetch is not an error
+    if (end > begin) madvise((void *) begin, end - begin, MADV_WILLNEED);
+  }
+  return 0;
+}
+
+// Decode the fragment item at offset. Return the offset of the next item, 0
+// when the sequence delimitation item or end is reached, ERROR if the item is
+// malformed.
+// Cf DICOM standard Part 5 Sect A.4
+ssize_t decode_fragment(file_t *file, ssize_t offset, ssize_t end,
+                        fragment_t *fragment) {
+  if (end > file->size) end = file->size;
+  if (offset + g_implicit_tag_size > end) return 0;
+  implicit_tag_t *item = (implicit_tag_t *)
+    map_file_window(file, offset, g_implicit_tag_size);
+  if (item == NULL) return ERROR;
+  uint32_t number = (uint32_t) (item->group << 16) + item->element;
+  if (number == SEQUENCE_DELIMITATION_TAG) return 0;
+  if (number != ITEM_TAG || item->datasize == UNDEFINED_LENGTH ||
+      offset + g_implicit_tag_size + item->datasize > file->size)
+    return ERROR;
+  fragment->offset = offset + g_implicit_tag_size;
+  fragment->length = item->datasize;
+  // The payload of a windowed file is read right after its item
+  if (map_file_window(file, fragment->offset, fragment->length) == NULL)
+    return ERROR;
+  return fragment->offset + fragment->length;
+}
+
+// A fragment starting with a JPEG SOI or a JPEG 2000 SOC marker starts a frame
+// Cf ISO/IEC 10918-1 Annex B and ISO/IEC 15444-1 Annex A
+static uint8_t is_frame_start(file_t *file, fragment_t *fragment) {
+  if (fragment->length < 2) return 0;
+  uint8_t *data = &(file->content[fragment->offset]);
+  return data[0] == 0xFF && (data[1] == 0xD8 || data[1] == 0x4F);
+}
+
+// Walk the fragment items without touching their payload, to be used when
+// neither the basic nor the extended offset table is filled.
+static int8_t scan_fragments(file_t *file, ssize_t offset,
+                             uint32_t number_of_frames, frame_index_t *index) {
+  size_t nfragments = 0;
+  size_t capacity = 64;
+  ssize_t *items = malloc(sizeof (ssize_t) * capacity);
+  if (items == NULL) {
+    perror("malloc");
+    return ERROR;
+  }
+  fragment_t fragment;
+  ssize_t next;
+  while ((next = decode_fragment(file, offset, file->size, &fragment)) > 0) {
+    if (nfragments == capacity) {
+      capacity *= 2;
+      ssize_t *tmp = realloc(items, sizeof (ssize_t) * capacity);
+      if (tmp == NULL) {
+        perror("realloc");
+        free(items);
+        return ERROR;
+      }
+      items = tmp;
+    }
+    items[nfragments++] = offset;
+    offset = next;
+  }
+  if (next == ERROR || nfragments == 0) {
+    free(items);
+    return ERROR;
+  }
+  // items is reused as the boundaries: frames are a subset of the fragments
+  // and there is at least one more slot than frames to write the end offset.
+  if (number_of_frames == 1) {
+    items[1] = offset;
+    index->number_of_frames = 1;
+  } else if (number_of_frames == nfragments) {
+    index->number_of_frames = nfragments;
+  } else {
+    // Several fragments per frame, rely on the codec markers
+    uint32_t nframes = 0;
+    for (size_t i = 0; i < nfragments; ++i) {
+      if (decode_fragment(file, items[i], file->size, &fragment) <= 0) break;
+      if (i == 0 || is_frame_start(file, &fragment))
+        items[nframes++] = items[i];
+    }
+    if (number_of_frames != 0 && nframes != number_of_frames) {
+      free(items);
+      return ERROR;
+    }
+    index->number_of_frames = nframes;
+  }
+  if (index->number_of_frames == nfragments) {
+    ssize_t *tmp = realloc(items, sizeof (ssize_t) * (nfragments + 1));
+    if (tmp == NULL) {
+      perror("realloc");
+      free(items);
+      return ERROR;
+    }
+    items = tmp;
+  }
+  items[index->number_of_frames] = offset;
+  index->boundaries = items;
+  return 0;
+}
+
+// Build the frame index of encapsulated pixel data from the extended offset
+// table, the basic offset table or, when both are empty, a scan of the
+// fragment items. offset is where to look for the pixel data, usually the one
+// returned by decode_n_tags. number_of_frames may be 0 if unknown.
+// Cf DICOM standard Part 5 Sect A.4 and Part 3 Sect C.7.6.3.1.8
+int8_t build_frame_index(file_t *file, ssize_t offset, dicom_meta_t *dicom_meta,
+                         uint32_t number_of_frames, frame_index_t *index) {
+  tag_t tag;
+  tag_t eot;
+  ssize_t shift;
+  ssize_t table;
+  memset(index, 0, sizeof (frame_index_t));
+  memset(&eot, 0, sizeof (tag_t));
+  // The extended offset table, if any, precedes the pixel data
+  table = find_tag(file, offset, dicom_meta, EXTENDED_OFFSET_TABLE, &eot);
+  if (table == ERROR) eot.datasize = 0;
+  if ((offset = find_tag(file, offset, dicom_meta, PIXEL_DATA, &tag)) == ERROR)
+    return ERROR;
+  // Native pixel data are not indexed
+  if (tag.datasize != UNDEFINED_LENGTH) return ERROR;
+  shift = (uint8_t *) tag.data - &(file->content[offset]);
+  offset += shift;
+  // First item is the basic offset table
+  fragment_t bot;
+  ssize_t first;
+  if ((first = decode_fragment(file, offset, file->size, &bot)) <= 0)
+    return ERROR;
+  uint32_t nframes = eot.datasize ? eot.datasize / sizeof (uint64_t)
+                                  : bot.length / sizeof (uint32_t);
+  if (nframes == 0 || (number_of_frames && nframes != number_of_frames))
+    return scan_fragments(file, first, number_of_frames, index);
+  // Decoding the pixel data may have slid the window of a windowed file past
+  // the extended offset table, decode it again
+  if (eot.datasize && file->window_size &&
+      (dicom_meta->transfer_syntax == IMPLICIT ?
+       decode_implicit_tag(file, table, &eot) :
+       decode_explicit_tag(file, table, &eot)) <= 0)
+    return ERROR;
+  index->boundaries = malloc(sizeof (ssize_t) * (nframes + 1));
+  if (index->boundaries == NULL) {
+    perror("malloc");
+    return ERROR;
+  }
+  // Offsets are relative to the first byte of the first fragment item
+  for (uint32_t i = 0; i < nframes; ++i) {
+    uint64_t relative = eot.datasize ?
+      ((uint64_t *) eot.data)[i] :
+      ((uint32_t *) &(file->content[bot.offset]))[i];
+    index->boundaries[i] = first + relative;
+    // Offset tables must be increasing and point inside the file, otherwise
+    // do not trust them
+    if (index->boundaries[i] + g_implicit_tag_size > file->size ||
+        (i > 0 && index->boundaries[i] <= index->boundaries[i - 1])) {
+      free_frame_index(index);
+      return scan_fragments(file, first, number_of_frames, index);
+    }
+  }
+  // The end of the last frame is the sequence delimitation item
+  index->boundaries[nframes] = file->size;
+  index->number_of_frames = nframes;
+  return 0;
+}
+
+void free_frame_index(frame_index_t *index) {
+  free(index->boundaries);
+  memset(index, 0, sizeof (frame_index_t));
+}
+
+// Fill fragments with the payload ranges of a frame. Only the items of the
+// requested frame are read. Return the number of fragments or ERROR.
+ssize_t get_frame_fragments(file_t *file, frame_index_t *index, uint32_t frame,
+                            fragment_t *fragments, size_t maxfragments) {
+  if (frame >= index->number_of_frames) return ERROR;
+  ssize_t offset = index->boundaries[frame];
+  ssize_t end = index->boundaries[frame + 1];
+  size_t nfragments = 0;
+  while (nfragments < maxfragments && offset < end) {
+    offset = decode_fragment(file, offset, end, &fragments[nfragments]);
+    if (offset == ERROR) return ERROR;
+    if (offset == 0) break;
+    ++nfragments;
+  }
+  return nfragments;
+}
+
+// Return the contiguous bytes of an encapsulated frame. A frame made of a
+// single fragment is not copied, otherwise its fragments are concatenated in
+// *buffer which the caller has to free.
+uint8_t *get_encapsulated_frame(file_t *file, frame_index_t *index,
+                                uint32_t frame, size_t *length,
+                                uint8_t **buffer) {
+  fragment_t fragment;
+  size_t nfragments = 0;
+  ssize_t offset;
+  ssize_t end;
+  *buffer = NULL;
+  *length = 0;
+  if (frame >= index->number_of_frames) return NULL;
+  end = index->boundaries[frame + 1];
+  for (offset = index->boundaries[frame];
+       (offset = decode_fragment(file, offset, end, &fragment)) > 0;
+       ++nfragments)
+    *length += fragment.length;
+  if (offset == ERROR || nfragments == 0) return NULL;
+  decode_fragment(file, index->boundaries[frame], end, &fragment);
+  if (nfragments == 1) return &(file->content[fragment.offset]);
+  if ((*buffer = malloc(*length)) == NULL) {
+    perror("malloc");
+    return NULL;
+  }
+  size_t copied = 0;
+  for (offset = index->boundaries[frame];
+       (offset = decode_fragment(file, offset, end, &fragment)) > 0;
+       copied += fragment.length)
+    memcpy(*buffer + copied, &(file->content[fragment.offset]),
+           fragment.length);
+  return *buffer;
+}
+
+// Decode the requested frames of encapsulated pixel data one after the other
+// in output, with the codec of the transfer syntax
+int8_t decode_encapsulated_frames(file_t *file, dicom_meta_t *dicom_meta,
+                                  frame_index_t *index,
+                                  pixel_module_t *pixel_module,
+                                  uint32_t *frames, size_t nframes,
+                                  uint8_t *output, uint32_t nthreads) {
+  char *uid = dicom_meta->transfer_syntax_uid;
+  // A windowed file is read from one thread
+  if (file->window_size) nthreads = 1;
+  if (!strcmp(uid, TRANSFER_TYPE_RLE_LOSSLESS))
+    return decode_rle_frames(file, index, pixel_module, frames, nframes,
+                             output, nthreads);
+  if (!strcmp(uid, TRANSFER_TYPE_JPEG_LOSSLESS) ||
+      !strcmp(uid, TRANSFER_TYPE_JPEG_LOSSLESS_SV1))
+    return decode_jpeg_lossless_frames(file, index, pixel_module, frames,
+                                       nframes, output, nthreads);
+  return ERROR;
+}
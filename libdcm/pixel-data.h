@@ -0,0 +1,64 @@
+#ifndef __PIXEL_DATA_H__
+#define __PIXEL_DATA_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "dcm.h"
+
+// Cf DICOM standard Part 3 Sect C.7.6.3
+typedef struct pixel_module_s {
+  uint16_t samples_per_pixel;
+  char     photometric_interpretation[MAX_CODE_STR_SIZE];
+  uint16_t planar_configuration;
+  uint32_t number_of_frames;
+  uint16_t rows;
+  uint16_t columns;
+  uint16_t bits_allocated;
+  uint16_t bits_stored;
+  uint16_t high_bit;
+  uint16_t pixel_representation;
+} pixel_module_t;
+
+// A frame of native pixel data, pointing inside the file mapping
+typedef struct frame_view_s {
+  uint8_t *data;
+  size_t  length;
+  uint8_t bit_offset; // First bit of the frame in data[0] for BitsAllocated 1
+} frame_view_t;
+
+// Cf DICOM standard Part 5 Sect A.4
+typedef struct fragment_s {
+  ssize_t  offset; // Offset of the fragment payload in the file
+  uint32_t length;
+} fragment_t;
+
+typedef struct frame_index_s {
+  uint32_t number_of_frames;
+  // number_of_frames + 1 offsets of the first fragment item of each frame.
+  // The last one bounds the last frame.
+  ssize_t  *boundaries;
+} frame_index_t;
+
+int8_t decode_pixel_module(tag_t *tags, pixel_module_t *pixel_module);
+size_t get_frame_bits(pixel_module_t *pixel_module);
+int8_t get_native_frame(file_t *file, tag_t *pixel_data,
+                        pixel_module_t *pixel_module, uint32_t frame,
+                        uint32_t prefetch, frame_view_t *view);
+int8_t build_frame_index(file_t *file, ssize_t offset, dicom_meta_t *dicom_meta,
+                         uint32_t number_of_frames, frame_index_t *index);
+void free_frame_index(frame_index_t *index);
+ssize_t decode_fragment(file_t *file, ssize_t offset, ssize_t end,
+                        fragment_t *fragment);
+ssize_t get_frame_fragments(file_t *file, frame_index_t *index, uint32_t frame,
+                            fragment_t *fragments, size_t maxfragments);
+uint8_t *get_encapsulated_frame(file_t *file, frame_index_t *index,
+                                uint32_t frame, size_t *length,
+                                uint8_t **buffer);
+int8_t decode_encapsulated_frames(file_t *file, dicom_meta_t *dicom_meta,
+                                  frame_index_t *index,
+                                  pixel_module_t *pixel_module,
+                                  uint32_t *frames, size_t nframes,
+                                  uint8_t *output, uint32_t nthreads);
+
+#endif // __PIXEL_DATA_H__
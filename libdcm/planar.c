@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "dicom.h"
+#include "pixel-data.h"
+#include "simd.h"
+#include "planar.h"
+
+// Transpositions between 3 planes of samples and interleaved pixels. Every
+// stream is read and written sequentially, so the loops need no tiling, the
+// compiler turning them into shuffles.
+// Cf DICOM standard Part 3 Sect C.7.6.3.1.3
+
+SIMD_INLINE void interleave_8(const uint8_t *restrict p0,
+                              const uint8_t *restrict p1,
+                              const uint8_t *restrict p2, size_t n,
+                              uint8_t *restrict output) {
+  for (size_t i = 0; i < n; ++i) {
+    output[3 * i] = p0[i];
+    output[3 * i + 1] = p1[i];
+    output[3 * i + 2] = p2[i];
+  }
+}
+
+SIMD_INLINE void interleave_16(const uint16_t *restrict p0,
+                               const uint16_t *restrict p1,
+                               const uint16_t *restrict p2, size_t n,
+                               uint16_t *restrict output) {
+  for (size_t i = 0; i < n; ++i) {
+    output[3 * i] = p0[i];
+    output[3 * i + 1] = p1[i];
+    output[3 * i + 2] = p2[i];
+  }
+}
+
+SIMD_INLINE void deinterleave_8(const uint8_t *restrict input, size_t n,
+                                uint8_t *restrict p0, uint8_t *restrict p1,
+                                uint8_t *restrict p2) {
+  for (size_t i = 0; i < n; ++i) {
+    p0[i] = input[3 * i];
+    p1[i] = input[3 * i + 1];
+    p2[i] = input[3 * i + 2];
+  }
+}
+
+SIMD_INLINE void deinterleave_16(const uint16_t *restrict input, size_t n,
+                                 uint16_t *restrict p0, uint16_t *restrict p1,
+                                 uint16_t *restrict p2) {
+  for (size_t i = 0; i < n; ++i) {
+    p0[i] = input[3 * i];
+    p1[i] = input[3 * i + 1];
+    p2[i] = input[3 * i + 2];
+  }
+}
+
+SIMD_KERNEL static void transpose(const uint8_t *input, uint8_t *output,
+                                  size_t npixels, uint8_t bytes,
+                                  uint8_t to_planar) {
+  size_t plane = npixels * bytes;
+  if (bytes == 1 && to_planar)
+    deinterleave_8(input, npixels, output, output + plane,
+                   output + 2 * plane);
+  else if (bytes == 1)
+    interleave_8(input, input + plane, input + 2 * plane, npixels, output);
+  else if (to_planar)
+    deinterleave_16((const uint16_t *) input, npixels, (uint16_t *) output,
+                    (uint16_t *) (output + plane),
+                    (uint16_t *) (output + 2 * plane));
+  else
+    interleave_16((const uint16_t *) input,
+                  (const uint16_t *) (input + plane),
+                  (const uint16_t *) (input + 2 * plane), npixels,
+                  (uint16_t *) output);
+}
+
+#define TRANSPOSE_BLOCK 4096 // Pixels per block of an in place transposition
+
+// Index of block i once moved, between planes of nblocks blocks and groups
+// of 3 blocks, one per plane
+static size_t get_block_destination(size_t i, size_t nblocks,
+                                    uint8_t to_planar) {
+  return to_planar ? (i % 3) * nblocks + i / 3 : (i % nblocks) * 3 + i / nblocks;
+}
+
+// Move the 3 * nblocks blocks of size bytes to their destination, following
+// the cycles of the permutation with the carry and swap buffers
+static int8_t move_blocks(uint8_t *data, size_t nblocks, size_t size,
+                          uint8_t to_planar, uint8_t *carry, uint8_t *swap) {
+  size_t n = 3 * nblocks;
+  uint8_t *moved = calloc((n + 7) / 8, 1);
+  if (moved == NULL) {
+    perror("calloc");
+    return ERROR;
+  }
+  for (size_t start = 0; start < n; ++start) {
+    if (moved[start / 8] & 1 << start % 8) continue;
+    moved[start / 8] |= 1 << start % 8;
+    size_t i = start;
+    memcpy(carry, data + size * start, size);
+    do {
+      i = get_block_destination(i, nblocks, to_planar);
+      memcpy(swap, data + size * i, size);
+      memcpy(data + size * i, carry, size);
+      uint8_t *tmp = carry;
+      carry = swap;
+      swap = tmp;
+      moved[i / 8] |= 1 << i % 8;
+    } while (i != start);
+  }
+  free(moved);
+  return 0;
+}
+
+// Transpose in place by blocks of pixels. The blocks of the planes are moved
+// to groups of 3 blocks, one per plane, which are then transposed in a buffer
+// small enough to stay in cache, or the other way around.
+static int8_t transpose_in_place(uint8_t *data, size_t npixels, uint8_t bytes,
+                                 uint8_t to_planar) {
+  // Largest block dividing the planes
+  size_t block = npixels < TRANSPOSE_BLOCK ? npixels : TRANSPOSE_BLOCK;
+  while (npixels % block) --block;
+  size_t nblocks = npixels / block;
+  size_t size = block * bytes;
+  uint8_t *buffer = malloc(3 * size);
+  if (buffer == NULL) {
+    perror("malloc");
+    return ERROR;
+  }
+  int8_t ret = 0;
+  if (!to_planar)
+    ret = move_blocks(data, nblocks, size, to_planar, buffer, buffer + size);
+  for (size_t j = 0; ret == 0 && j < nblocks; ++j) {
+    uint8_t *group = data + 3 * size * j;
+    transpose(group, buffer, block, bytes, to_planar);
+    memcpy(group, buffer, 3 * size);
+  }
+  if (ret == 0 && to_planar)
+    ret = move_blocks(data, nblocks, size, to_planar, buffer, buffer + size);
+  free(buffer);
+  return ret;
+}
+
+// Transpose 3 samples of 1 or 2 bytes per pixel, in place if output is input
+static int8_t transpose_samples(const uint8_t *input, uint8_t *output,
+                                size_t npixels, uint8_t bytes,
+                                uint8_t to_planar) {
+  if (input == output)
+    return transpose_in_place(output, npixels, bytes, to_planar);
+  transpose(input, output, npixels, bytes, to_planar);
+  return 0;
+}
+
+// Convert 3 planes of npixels samples of 1 or 2 bytes to interleaved pixels.
+// output may be input.
+int8_t planar_to_interleaved(const uint8_t *input, uint8_t *output,
+                             size_t npixels, uint8_t bytes) {
+  return transpose_samples(input, output, npixels, bytes, 0);
+}
+
+// Convert npixels interleaved pixels of 3 samples of 1 or 2 bytes to planes.
+// output may be input.
+int8_t interleaved_to_planar(const uint8_t *input, uint8_t *output,
+                             size_t npixels, uint8_t bytes) {
+  return transpose_samples(input, output, npixels, bytes, 1);
+}
+
+// Transpose a frame of 3 samples per pixel to the other planar
+// configuration. The pixel module is left untouched.
+int8_t transpose_frame(pixel_module_t *pixel_module, const uint8_t *input,
+                       uint8_t *output) {
+  size_t npixels = (size_t) pixel_module->rows * pixel_module->columns;
+  if (pixel_module->samples_per_pixel != 3 ||
+      (pixel_module->bits_allocated != 8 &&
+       pixel_module->bits_allocated != 16))
+    return ERROR;
+  return transpose_samples(input, output, npixels,
+                           pixel_module->bits_allocated / 8,
+                           pixel_module->planar_configuration == 0);
+}
@@ -0,0 +1,16 @@
+#ifndef __PLANAR_H__
+#define __PLANAR_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "pixel-data.h"
+
+int8_t planar_to_interleaved(const uint8_t *input, uint8_t *output,
+                             size_t npixels, uint8_t bytes);
+int8_t interleaved_to_planar(const uint8_t *input, uint8_t *output,
+                             size_t npixels, uint8_t bytes);
+int8_t transpose_frame(pixel_module_t *pixel_module, const uint8_t *input,
+                       uint8_t *output);
+
+#endif // __PLANAR_H__
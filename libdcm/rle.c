@@ -0,0 +1,477 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "dicom.h"
+#include "dcm.h"
+#include "pixel-data.h"
+#include "parallel.h"
+#include "simd.h"
+#include "rle.h"
+
+// Decode a PackBits segment in output. Return the number of bytes decoded or
+// ERROR if the segment overflows the output.
+// Cf DICOM standard Part 5 Sect G.3.2
+ssize_t decode_rle_segment(const uint8_t *input, size_t length,
+                           uint8_t *output, size_t size) {
+  size_t in = 0;
+  size_t out = 0;
+  while (in < length && out < size) {
+    int8_t n = (int8_t) input[in++];
+    if (n >= 0) {
+      // Literal run of n + 1 bytes
+      size_t count = (size_t) n + 1;
+      if (in + count > length || out + count > size) return ERROR;
+      memcpy(&output[out], &input[in], count);
+      in += count;
+      out += count;
+    } else if (n != -128) {
+      // Replicate run of -n + 1 bytes
+      size_t count = (size_t) -n + 1;
+      if (in >= length || out + count > size) return ERROR;
+      memset(&output[out], input[in++], count);
+      out += count;
+    }
+  }
+  return out;
+}
+
+// Interleave byte planes, planes[k] giving byte k of each output group of
+// nplanes bytes. The common layouts are specialized so that the loops
+// vectorize into byte shuffles.
+SIMD_INLINE void interleave_2(const uint8_t *restrict p0,
+                              const uint8_t *restrict p1, size_t n,
+                              uint8_t *restrict output) {
+  for (size_t i = 0; i < n; ++i) {
+    output[2 * i] = p0[i];
+    output[2 * i + 1] = p1[i];
+  }
+}
+
+SIMD_INLINE void interleave_3(const uint8_t *restrict p0,
+                              const uint8_t *restrict p1,
+                              const uint8_t *restrict p2, size_t n,
+                              uint8_t *restrict output) {
+  for (size_t i = 0; i < n; ++i) {
+    output[3 * i] = p0[i];
+    output[3 * i + 1] = p1[i];
+    output[3 * i + 2] = p2[i];
+  }
+}
+
+SIMD_INLINE void interleave_4(const uint8_t *restrict p0,
+                              const uint8_t *restrict p1,
+                              const uint8_t *restrict p2,
+                              const uint8_t *restrict p3, size_t n,
+                              uint8_t *restrict output) {
+  for (size_t i = 0; i < n; ++i) {
+    output[4 * i] = p0[i];
+    output[4 * i + 1] = p1[i];
+    output[4 * i + 2] = p2[i];
+    output[4 * i + 3] = p3[i];
+  }
+}
+
+SIMD_KERNEL static void interleave_planes(uint8_t **planes, uint8_t nplanes,
+                                          size_t n, uint8_t *output) {
+  switch (nplanes) {
+  case 2:
+    interleave_2(planes[0], planes[1], n, output);
+    break;
+  case 3:
+    interleave_3(planes[0], planes[1], planes[2], n, output);
+    break;
+  case 4:
+    interleave_4(planes[0], planes[1], planes[2], planes[3], n, output);
+    break;
+  default:
+    for (size_t i = 0; i < n; ++i)
+      for (uint8_t k = 0; k < nplanes; ++k)
+        output[i * nplanes + k] = planes[k][i];
+    break;
+  }
+}
+
+typedef struct rle_segments_s {
+  const uint8_t *data;
+  size_t        length;
+  rle_header_t  *header;
+  uint8_t       *planes[RLE_MAX_SEGMENTS];
+  size_t        size; // Bytes per plane
+} rle_segments_t;
+
+static int8_t decode_segment(void *context, size_t segment) {
+  rle_segments_t *s = (rle_segments_t *) context;
+  size_t begin = s->header->offsets[segment];
+  size_t end = segment + 1 < s->header->number_of_segments ?
+    s->header->offsets[segment + 1] : s->length;
+  if (begin < RLE_HEADER_SIZE || begin > end || end > s->length) return ERROR;
+  if (decode_rle_segment(&s->data[begin], end - begin, s->planes[segment],
+                         s->size) != (ssize_t) s->size)
+    return ERROR;
+  return 0;
+}
+
+// Decode an RLE frame in the native layout of the pixel module. A segment
+// holds one byte, most significant first, of one sample of all the pixels.
+// Segments are decoded by nthreads threads.
+// Cf DICOM standard Part 5 Sect G.2
+int8_t decode_rle_frame(const uint8_t *data, size_t length,
+                        pixel_module_t *pixel_module, uint8_t *output,
+                        uint32_t nthreads) {
+  rle_segments_t s;
+  rle_header_t header;
+  uint8_t bytes = pixel_module->bits_allocated / 8;
+  uint8_t samples = pixel_module->samples_per_pixel;
+  uint8_t nsegments = samples * bytes;
+  size_t npixels = (size_t) pixel_module->rows * pixel_module->columns;
+  if (pixel_module->bits_allocated % 8 || nsegments == 0 ||
+      nsegments > RLE_MAX_SEGMENTS || length < RLE_HEADER_SIZE)
+    return ERROR;
+  memcpy(&header, data, sizeof (rle_header_t));
+  if (header.number_of_segments != nsegments) return ERROR;
+  s.data = data;
+  s.length = length;
+  s.header = &header;
+  s.size = npixels;
+  // Planes of single byte samples are decoded in place, others need to be
+  // interleaved
+  uint8_t in_place = bytes == 1 &&
+    (samples == 1 || pixel_module->planar_configuration == 1);
+  uint8_t *buffer = NULL;
+  if (!in_place && (buffer = malloc(npixels * nsegments)) == NULL) {
+    perror("malloc");
+    return ERROR;
+  }
+  for (uint8_t k = 0; k < nsegments; ++k)
+    s.planes[k] = (in_place ? output : buffer) + npixels * k;
+  int8_t ret = parallel_for(nsegments, nthreads, decode_segment, &s);
+  if (ret == 0 && !in_place) {
+    uint8_t *planes[RLE_MAX_SEGMENTS];
+    // Segments are most significant byte first, native layout little endian
+    if (pixel_module->planar_configuration == 1) {
+      for (uint8_t sample = 0; sample < samples; ++sample) {
+        for (uint8_t k = 0; k < bytes; ++k)
+          planes[k] = s.planes[sample * bytes + bytes - 1 - k];
+        interleave_planes(planes, bytes, npixels,
+                          output + npixels * bytes * sample);
+      }
+    } else {
+      for (uint8_t k = 0; k < nsegments; ++k)
+        planes[k] = s.planes[k / bytes * bytes + bytes - 1 - k % bytes];
+      interleave_planes(planes, nsegments, npixels, output);
+    }
+  }
+  free(buffer);
+  return ret;
+}
+
+typedef struct rle_frames_s {
+  file_t         *file;
+  frame_index_t  *index;
+  pixel_module_t *pixel_module;
+  uint32_t       *frames;
+  uint8_t        *output;
+  uint32_t       nthreads; // Threads per frame
+} rle_frames_t;
+
+static int8_t decode_frame(void *context, size_t i) {
+  rle_frames_t *r = (rle_frames_t *) context;
+  uint8_t *buffer;
+  size_t length;
+  size_t size = get_frame_bits(r->pixel_module) / 8;
+  uint8_t *data = get_encapsulated_frame(r->file, r->index, r->frames[i],
+                                         &length, &buffer);
+  if (data == NULL) return ERROR;
+  int8_t ret = decode_rle_frame(data, length, r->pixel_module,
+                                r->output + size * i, r->nthreads);
+  free(buffer);
+  return ret;
+}
+
+// Decode the requested frames one after the other in output. Frames are
+// spread over the threads, unless a single frame is requested in which case
+// its segments are.
+int8_t decode_rle_frames(file_t *file, frame_index_t *index,
+                         pixel_module_t *pixel_module, uint32_t *frames,
+                         size_t nframes, uint8_t *output, uint32_t nthreads) {
+  rle_frames_t r = { file, index, pixel_module, frames, output,
+                     nframes == 1 ? nthreads : 1 };
+  return parallel_for(nframes, nframes == 1 ? 1 : nthreads, decode_frame, &r);
+}
+
+// Encode a segment with PackBits in output, which must hold
+// get_rle_segment_bound(size) bytes. Runs of 3 equal bytes or more are
+// replicated, the rest is copied literally: a replicated run of 2 bytes takes
+// as much as the bytes themselves and would split the literal run around it.
+// Return the encoded length, padded to an even number of bytes.
+// Cf DICOM standard Part 5 Sect G.3.1
+ssize_t encode_rle_segment(const uint8_t *input, size_t size,
+                           uint8_t *output) {
+  size_t in = 0;
+  size_t out = 0;
+  while (in < size) {
+    size_t run = 1;
+    while (in + run < size && run < 128 && input[in + run] == input[in]) ++run;
+    if (run >= 3) {
+      output[out++] = (uint8_t) (1 - (int16_t) run);
+      output[out++] = input[in];
+      in += run;
+      continue;
+    }
+    // Literal run up to the next 3 equal bytes
+    size_t begin = in;
+    while (in < size && in - begin < 128 &&
+           !(in + 2 < size && input[in] == input[in + 1] &&
+             input[in] == input[in + 2]))
+      ++in;
+    output[out++] = (uint8_t) (in - begin - 1);
+    memcpy(&output[out], &input[begin], in - begin);
+    out += in - begin;
+  }
+  if (out % 2) output[out++] = 0;
+  return out;
+}
+
+// Worst case, literal runs of 128 bytes plus padding
+size_t get_rle_segment_bound(size_t size) {
+  return size + (size + 127) / 128 + 1;
+}
+
+size_t get_rle_frame_bound(pixel_module_t *pixel_module) {
+  size_t npixels = (size_t) pixel_module->rows * pixel_module->columns;
+  size_t nsegments = pixel_module->samples_per_pixel *
+    (pixel_module->bits_allocated / 8);
+  return RLE_HEADER_SIZE + nsegments * get_rle_segment_bound(npixels);
+}
+
+// Split groups of nplanes bytes into byte planes, the inverse of
+// interleave_planes
+SIMD_INLINE void deinterleave_2(const uint8_t *restrict input, size_t n,
+                                uint8_t *restrict p0, uint8_t *restrict p1) {
+  for (size_t i = 0; i < n; ++i) {
+    p0[i] = input[2 * i];
+    p1[i] = input[2 * i + 1];
+  }
+}
+
+SIMD_INLINE void deinterleave_3(const uint8_t *restrict input, size_t n,
+                                uint8_t *restrict p0, uint8_t *restrict p1,
+                                uint8_t *restrict p2) {
+  for (size_t i = 0; i < n; ++i) {
+    p0[i] = input[3 * i];
+    p1[i] = input[3 * i + 1];
+    p2[i] = input[3 * i + 2];
+  }
+}
+
+SIMD_INLINE void deinterleave_4(const uint8_t *restrict input, size_t n,
+                                uint8_t *restrict p0, uint8_t *restrict p1,
+                                uint8_t *restrict p2, uint8_t *restrict p3) {
+  for (size_t i = 0; i < n; ++i) {
+    p0[i] = input[4 * i];
+    p1[i] = input[4 * i + 1];
+    p2[i] = input[4 * i + 2];
+    p3[i] = input[4 * i + 3];
+  }
+}
+
+SIMD_KERNEL static void deinterleave_planes(const uint8_t *input, size_t n,
+                                            uint8_t **planes,
+                                            uint8_t nplanes) {
+  switch (nplanes) {
+  case 2:
+    deinterleave_2(input, n, planes[0], planes[1]);
+    break;
+  case 3:
+    deinterleave_3(input, n, planes[0], planes[1], planes[2]);
+    break;
+  case 4:
+    deinterleave_4(input, n, planes[0], planes[1], planes[2], planes[3]);
+    break;
+  default:
+    for (size_t i = 0; i < n; ++i)
+      for (uint8_t k = 0; k < nplanes; ++k)
+        planes[k][i] = input[i * nplanes + k];
+    break;
+  }
+}
+
+typedef struct rle_encoder_s {
+  const uint8_t *planes[RLE_MAX_SEGMENTS];
+  size_t        size;  // Bytes per plane
+  uint8_t       *output;
+  size_t        bound; // Room for each segment in output
+  size_t        lengths[RLE_MAX_SEGMENTS];
+} rle_encoder_t;
+
+static int8_t encode_segment(void *context, size_t segment) {
+  rle_encoder_t *e = (rle_encoder_t *) context;
+  e->lengths[segment] = encode_rle_segment(
+    e->planes[segment], e->size,
+    e->output + RLE_HEADER_SIZE + e->bound * segment);
+  return 0;
+}
+
+// Encode a frame in the native layout of the pixel module in output, which
+// must hold get_rle_frame_bound bytes. Segments are encoded by nthreads
+// threads. Return the length of the encoded frame.
+// Cf DICOM standard Part 5 Sect G.2
+ssize_t encode_rle_frame(const uint8_t *frame, pixel_module_t *pixel_module,
+                         uint8_t *output, uint32_t nthreads) {
+  rle_encoder_t e;
+  rle_header_t header;
+  uint8_t bytes = pixel_module->bits_allocated / 8;
+  uint8_t samples = pixel_module->samples_per_pixel;
+  uint8_t nsegments = samples * bytes;
+  size_t npixels = (size_t) pixel_module->rows * pixel_module->columns;
+  if (pixel_module->bits_allocated % 8 || nsegments == 0 ||
+      nsegments > RLE_MAX_SEGMENTS)
+    return ERROR;
+  e.size = npixels;
+  e.output = output;
+  e.bound = get_rle_segment_bound(npixels);
+  // Planes of single byte samples are encoded in place, others need to be
+  // split first
+  uint8_t in_place = bytes == 1 &&
+    (samples == 1 || pixel_module->planar_configuration == 1);
+  uint8_t *buffer = NULL;
+  if (!in_place && (buffer = malloc(npixels * nsegments)) == NULL) {
+    perror("malloc");
+    return ERROR;
+  }
+  uint8_t *planes[RLE_MAX_SEGMENTS];
+  for (uint8_t k = 0; k < nsegments; ++k)
+    e.planes[k] = (in_place ? frame : buffer) + npixels * k;
+  if (!in_place) {
+    // Segments are most significant byte first, native layout little endian
+    if (pixel_module->planar_configuration == 1) {
+      for (uint8_t sample = 0; sample < samples; ++sample) {
+        for (uint8_t k = 0; k < bytes; ++k)
+          planes[k] = buffer + npixels * (sample * bytes + bytes - 1 - k);
+        deinterleave_planes(frame + npixels * bytes * sample, npixels, planes,
+                            bytes);
+      }
+    } else {
+      for (uint8_t k = 0; k < nsegments; ++k)
+        planes[k] = buffer + npixels * (k / bytes * bytes + bytes - 1 -
+                                        k % bytes);
+      deinterleave_planes(frame, npixels, planes, nsegments);
+    }
+  }
+  int8_t ret = parallel_for(nsegments, nthreads, encode_segment, &e);
+  free(buffer);
+  if (ret == ERROR) return ERROR;
+  // Pack the segments behind the header
+  memset(&header, 0, sizeof (rle_header_t));
+  header.number_of_segments = nsegments;
+  size_t length = RLE_HEADER_SIZE;
+  for (uint8_t k = 0; k < nsegments; ++k) {
+    header.offsets[k] = length;
+    memmove(output + length, output + RLE_HEADER_SIZE + e.bound * k,
+            e.lengths[k]);
+    length += e.lengths[k];
+  }
+  memcpy(output, &header, sizeof (rle_header_t));
+  return length;
+}
+
+static int8_t write_item(int fd, uint32_t number, uint32_t length) {
+  uint16_t item[4] = { number >> 16, number & 0xFFFF, length & 0xFFFF,
+                       length >> 16 };
+  return write_all(fd, item, sizeof (item));
+}
+
+typedef struct rle_writer_s {
+  file_t         *file;
+  tag_t          *pixel_data;
+  pixel_module_t *pixel_module;
+  uint32_t       first;    // First frame of the batch
+  uint32_t       batch;    // Frames per batch
+  uint8_t        *output;  // One bound per frame of the batch
+  size_t         bound;
+  ssize_t        *lengths;
+  uint32_t       nthreads; // Threads per frame
+} rle_writer_t;
+
+static int8_t encode_frame(void *context, size_t i) {
+  rle_writer_t *w = (rle_writer_t *) context;
+  frame_view_t view;
+  // Read ahead the next batch while encoding this one
+  if (get_native_frame(w->file, w->pixel_data, w->pixel_module, w->first + i,
+                       i == 0 ? w->batch : 0, &view) == ERROR)
+    return ERROR;
+  w->lengths[i] = encode_rle_frame(view.data, w->pixel_module,
+                                   w->output + w->bound * i, w->nthreads);
+  return w->lengths[i] == ERROR ? ERROR : 0;
+}
+
+// Encode and write the frames as items by batches, recording their offsets
+// for the Basic Offset Table
+static int8_t write_frames(int fd, rle_writer_t *w, uint32_t *offsets,
+                           uint32_t nthreads) {
+  uint32_t nframes = w->pixel_module->number_of_frames;
+  size_t offset = 0;
+  for (w->first = 0; w->first < nframes; w->first += w->batch) {
+    uint32_t count = nframes - w->first < w->batch ?
+      nframes - w->first : w->batch;
+    if (parallel_for(count, nthreads, encode_frame, w) == ERROR) return ERROR;
+    for (uint32_t i = 0; i < count; ++i) {
+      offsets[w->first + i] = offset;
+      if (write_item(fd, ITEM_TAG, w->lengths[i]) == ERROR ||
+          write_all(fd, w->output + w->bound * i, w->lengths[i]) == ERROR)
+        return ERROR;
+      offset += 8 + w->lengths[i];
+    }
+  }
+  return write_item(fd, SEQUENCE_DELIMITATION_TAG, 0);
+}
+
+// Write the native pixel data element as an encapsulated RLE Lossless
+// (7FE0,0010) element at the current position of fd, in Explicit VR Little
+// Endian. Frames are encoded by batches of one frame per thread so that
+// memory stays bounded. The Basic Offset Table is filled once all the frames
+// are written, it is left empty if fd is not seekable or if the offsets may
+// not fit in 32 bits.
+// Cf DICOM standard Part 5 Sect A.4
+int8_t write_rle_pixel_data(int fd, file_t *file, tag_t *pixel_data,
+                            pixel_module_t *pixel_module, uint32_t nthreads) {
+  const uint8_t element[12] = { 0xE0, 0x7F, 0x10, 0x00, 'O', 'B', 0, 0,
+                                0xFF, 0xFF, 0xFF, 0xFF };
+  uint32_t nframes = pixel_module->number_of_frames;
+  rle_writer_t w = { file, pixel_data, pixel_module, 0, 0, NULL,
+                     get_rle_frame_bound(pixel_module), NULL, 1 };
+  if (pixel_data->datasize == UNDEFINED_LENGTH || nframes == 0) return ERROR;
+  nthreads = get_number_of_threads(nthreads);
+  w.batch = nthreads < nframes ? nthreads : nframes;
+  if (w.batch == 1) w.nthreads = nthreads;
+  off_t table = lseek(fd, 0, SEEK_CUR);
+  uint32_t table_length = table != ERROR &&
+    (double) nframes * (w.bound + 8) < UINT32_MAX ?
+    nframes * sizeof (uint32_t) : 0;
+  table += sizeof (element) + 8;
+  uint32_t *offsets = calloc(nframes, sizeof (uint32_t));
+  w.output = malloc(w.bound * w.batch);
+  w.lengths = malloc(sizeof (ssize_t) * w.batch);
+  int8_t ret = ERROR;
+  if (offsets == NULL || w.output == NULL || w.lengths == NULL) {
+    perror("malloc");
+  } else if (write_all(fd, element, sizeof (element)) == 0 &&
+             write_item(fd, ITEM_TAG, table_length) == 0 &&
+             write_all(fd, offsets, table_length) == 0 &&
+             write_frames(fd, &w, offsets, nthreads) == 0) {
+    ret = 0;
+    if (table_length &&
+        pwrite(fd, offsets, table_length, table) != (ssize_t) table_length) {
+      perror("pwrite");
+      ret = ERROR;
+    }
+  }
+  free(offsets);
+  free(w.output);
+  free(w.lengths);
+  return ret;
+}
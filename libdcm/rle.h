@@ -0,0 +1,36 @@
+#ifndef __RLE_H__
+#define __RLE_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "dcm.h"
+#include "pixel-data.h"
+
+// Cf DICOM standard Part 5 Sect G.5
+#define RLE_HEADER_SIZE 64
+#define RLE_MAX_SEGMENTS 15
+
+typedef struct rle_header_s {
+  uint32_t number_of_segments;
+  uint32_t offsets[RLE_MAX_SEGMENTS];
+} rle_header_t;
+
+ssize_t decode_rle_segment(const uint8_t *input, size_t length,
+                           uint8_t *output, size_t size);
+int8_t decode_rle_frame(const uint8_t *data, size_t length,
+                        pixel_module_t *pixel_module, uint8_t *output,
+                        uint32_t nthreads);
+int8_t decode_rle_frames(file_t *file, frame_index_t *index,
+                         pixel_module_t *pixel_module, uint32_t *frames,
+                         size_t nframes, uint8_t *output, uint32_t nthreads);
+ssize_t encode_rle_segment(const uint8_t *input, size_t size,
+                           uint8_t *output);
+size_t get_rle_segment_bound(size_t size);
+size_t get_rle_frame_bound(pixel_module_t *pixel_module);
+ssize_t encode_rle_frame(const uint8_t *frame, pixel_module_t *pixel_module,
+                         uint8_t *output, uint32_t nthreads);
+int8_t write_rle_pixel_data(int fd, file_t *file, tag_t *pixel_data,
+                            pixel_module_t *pixel_module, uint32_t nthreads);
+
+#endif // __RLE_H__
@@ -0,0 +1,43 @@
+#ifndef __SIMD_H__
+#define __SIMD_H__
+
+#include <stdint.h>
+
+// Pixel kernels are plain loops over restrict pointers, without branches nor
+// function calls in their body, so that the compiler vectorizes them for the
+// target (SSE2, AVX2, NEON). Per sample helpers must be always inlined.
+#define SIMD_INLINE static inline __attribute__((always_inline))
+
+// On x86-64, kernels get an AVX2 clone selected at load time, the default
+// one being limited to SSE2
+#if defined(__x86_64__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define SIMD_KERNEL __attribute__((target_clones("avx2", "default")))
+#endif
+#endif
+#ifndef SIMD_KERNEL
+#define SIMD_KERNEL
+#endif
+
+// Load a stored value of 8 or 16 bits allocated. Shifting the high bit to
+// the top of 16 bits and back masks the bits which are not stored and sign
+// extends the value if needed.
+// Cf DICOM standard Part 5 Sect 8.1.1
+SIMD_INLINE int32_t load_stored_value(const uint8_t *input, size_t index,
+                                      uint8_t bytes, uint8_t left,
+                                      uint8_t right, uint8_t is_signed) {
+  uint16_t raw = bytes == 1 ? input[index] : ((const uint16_t *) input)[index];
+  raw <<= left;
+  return is_signed ? (int16_t) raw >> right : raw >> right;
+}
+
+// Round to the nearest integer in [low, high], half up. Clamping first keeps
+// the biased value positive so that the truncating conversion is a floor,
+// which the compiler vectorizes where floorf would not.
+SIMD_INLINE int32_t round_clamp(float value, int32_t low, int32_t high) {
+  value = value < low ? low : value;
+  value = value > high ? high : value;
+  return (int32_t) (value - (float) low + 0.5f) + low;
+}
+
+#endif // __SIMD_H__
@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <sys/types.h>
+
+#include "dicom.h"
+#include "dcm.h"
+#include "pixel-data.h"
+#include "parallel.h"
+#include "simd.h"
+#include "lut.h"
+#include "stats.h"
+
+#define STATS_BLOCK 4096 // Samples per block, their bins staying in L1
+#define AUTO_VOI_SAMPLES 65536 // Samples of a frame the window is fitted on
+#define AUTO_VOI_LOW 0.01 // Percentiles of the stored values the window spans
+#define AUTO_VOI_HIGH 0.99
+
+// Decode PixelPaddingValue and PixelPaddingRangeLimit. Return ERROR if there
+// is no padding.
+// Cf DICOM standard Part 3 Sect C.7.5.1.1.2
+int8_t decode_padding(tag_t *tags, pixel_module_t *pixel_module,
+                      padding_t *padding) {
+  uint16_t value;
+  uint16_t limit;
+  if (get_tag_uint16(tags, PIXEL_PADDING_VALUE, &value) == ERROR)
+    return ERROR;
+  if (get_tag_uint16(tags, PIXEL_PADDING_RANGE_LIMIT, &limit) == ERROR)
+    limit = value;
+  padding->low = pixel_module->pixel_representation ? (int16_t) value : value;
+  padding->high = pixel_module->pixel_representation ? (int16_t) limit : limit;
+  if (padding->low > padding->high) {
+    int32_t tmp = padding->low;
+    padding->low = padding->high;
+    padding->high = tmp;
+  }
+  return 0;
+}
+
+typedef struct stats_block_s {
+  int32_t  min;
+  int32_t  max;
+  int64_t  sum;
+  int64_t  sum_of_squares;
+  uint32_t count;
+} stats_block_t;
+
+// Reduce a block of samples and compute their bins, padding going to the
+// extra bin HISTOGRAM_BINS. Padding is excluded with masks rather than
+// conditions so that the loop vectorizes. mask is 0 if there is no padding.
+SIMD_INLINE void reduce_block(const uint8_t *restrict input, size_t first,
+                              size_t n, uint8_t bytes, uint8_t left,
+                              uint8_t right, uint8_t is_signed, int32_t low,
+                              uint32_t width, int32_t mask, int32_t origin,
+                              uint8_t shift, uint16_t *restrict bins,
+                              stats_block_t *restrict block) {
+  int32_t min = INT32_MAX;
+  int32_t max = INT32_MIN;
+  int64_t sum = 0;
+  int64_t sum_of_squares = 0;
+  uint32_t count = 0;
+  for (size_t i = 0; i < n; ++i) {
+    int32_t value = load_stored_value(input, first + i, bytes, left, right,
+                                      is_signed);
+    // All ones for padding
+    int32_t padding = -(int32_t) ((uint32_t) (value - low) <= width) & mask;
+    int32_t kept = value & ~padding;
+    int32_t kept_min = value ^ ((value ^ INT32_MAX) & padding);
+    int32_t kept_max = value ^ ((value ^ INT32_MIN) & padding);
+    int32_t bin = (value - origin) >> shift;
+    min = kept_min < min ? kept_min : min;
+    max = kept_max > max ? kept_max : max;
+    sum += kept;
+    sum_of_squares += (int64_t) kept * kept;
+    count += 1 + padding;
+    bins[i] = bin ^ ((bin ^ HISTOGRAM_BINS) & padding);
+  }
+  block->min = min;
+  block->max = max;
+  block->sum = sum;
+  block->sum_of_squares = sum_of_squares;
+  block->count = count;
+}
+
+// Compute the statistics of nsamples stored values of 8 or 16 bits in a
+// single pass over memory. Each block of samples is reduced by a vectorized
+// loop, then its bins, still in cache, are counted. The histogram covers the
+// range of the stored values, 2^shift values per bin. padding may be NULL.
+SIMD_KERNEL void compute_pixel_stats(pixel_module_t *pixel_module,
+                                     padding_t *padding, const uint8_t *input,
+                                     size_t nsamples, pixel_stats_t *stats) {
+  uint8_t bytes = pixel_module->bits_allocated / 8;
+  uint8_t left = 15 - pixel_module->high_bit;
+  uint8_t right = 16 - pixel_module->bits_stored;
+  uint8_t is_signed = pixel_module->pixel_representation == 1;
+  int32_t low = padding ? padding->low : 0;
+  uint32_t width = padding ? (uint32_t) (padding->high - padding->low) : 0;
+  int32_t mask = padding ? -1 : 0;
+  uint16_t bins[STATS_BLOCK];
+  // Two histograms so that runs of equal values do not serialize on one bin
+  uint32_t histogram[2][HISTOGRAM_BINS + 1];
+  int64_t sum = 0;
+  double sum_of_squares = 0;
+  stats_block_t block;
+  memset(stats, 0, sizeof (pixel_stats_t));
+  memset(histogram, 0, sizeof (histogram));
+  stats->shift = pixel_module->bits_stored > 12 ?
+    pixel_module->bits_stored - 12 : 0;
+  stats->first = is_signed ? -(1 << (pixel_module->bits_stored - 1)) : 0;
+  stats->min = INT32_MAX;
+  stats->max = INT32_MIN;
+  for (size_t i = 0; i < nsamples; i += STATS_BLOCK) {
+    size_t n = nsamples - i < STATS_BLOCK ? nsamples - i : STATS_BLOCK;
+    reduce_block(input, i, n, bytes, left, right, is_signed, low, width,
+                 mask, stats->first, stats->shift, bins, &block);
+    for (size_t j = 0; j + 1 < n; j += 2) {
+      ++histogram[0][bins[j]];
+      ++histogram[1][bins[j + 1]];
+    }
+    if (n & 1) ++histogram[0][bins[n - 1]];
+    stats->min = block.min < stats->min ? block.min : stats->min;
+    stats->max = block.max > stats->max ? block.max : stats->max;
+    stats->count += block.count;
+    sum += block.sum;
+    sum_of_squares += block.sum_of_squares;
+  }
+  for (uint32_t i = 0; i < HISTOGRAM_BINS; ++i)
+    stats->histogram[i] = histogram[0][i] + histogram[1][i];
+  if (stats->count == 0) {
+    stats->min = stats->max = 0;
+    return;
+  }
+  stats->mean = (double) sum / stats->count;
+  double variance = sum_of_squares / stats->count - stats->mean * stats->mean;
+  stats->stddev = variance > 0 ? sqrt(variance) : 0;
+}
+
+typedef struct stats_frames_s {
+  file_t         *file;
+  tag_t          *pixel_data;
+  pixel_module_t *pixel_module;
+  padding_t      *padding;
+  pixel_stats_t  *stats;
+} stats_frames_t;
+
+static int8_t compute_frame_stats(void *context, size_t frame) {
+  stats_frames_t *s = (stats_frames_t *) context;
+  frame_view_t view;
+  size_t nsamples = (size_t) s->pixel_module->rows * s->pixel_module->columns *
+    s->pixel_module->samples_per_pixel;
+  if (get_native_frame(s->file, s->pixel_data, s->pixel_module, frame, 0,
+                       &view) == ERROR)
+    return ERROR;
+  compute_pixel_stats(s->pixel_module, s->padding, view.data, nsamples,
+                      &s->stats[frame]);
+  return 0;
+}
+
+// Compute the statistics of every frame of native pixel data in stats, an
+// array of NumberOfFrames statistics
+int8_t compute_frames_stats(file_t *file, tag_t *pixel_data,
+                            pixel_module_t *pixel_module, padding_t *padding,
+                            pixel_stats_t *stats, uint32_t nthreads) {
+  stats_frames_t s = { file, pixel_data, pixel_module, padding, stats };
+  if (pixel_module->bits_allocated != 8 && pixel_module->bits_allocated != 16)
+    return ERROR;
+  return parallel_for(pixel_module->number_of_frames, nthreads,
+                      compute_frame_stats, &s);
+}
+
+// Merge the statistics of n frames
+void merge_pixel_stats(pixel_stats_t *stats, size_t n, pixel_stats_t *total) {
+  double sum = 0;
+  double sum_of_squares = 0;
+  memset(total, 0, sizeof (pixel_stats_t));
+  if (n == 0) return;
+  total->first = stats[0].first;
+  total->shift = stats[0].shift;
+  total->min = INT32_MAX;
+  total->max = INT32_MIN;
+  for (size_t i = 0; i < n; ++i) {
+    if (stats[i].count) {
+      total->min = stats[i].min < total->min ? stats[i].min : total->min;
+      total->max = stats[i].max > total->max ? stats[i].max : total->max;
+    }
+    total->count += stats[i].count;
+    sum += stats[i].mean * stats[i].count;
+    sum_of_squares += (stats[i].stddev * stats[i].stddev +
+                       stats[i].mean * stats[i].mean) * stats[i].count;
+    for (uint32_t j = 0; j < HISTOGRAM_BINS; ++j)
+      total->histogram[j] += stats[i].histogram[j];
+  }
+  if (total->count == 0) {
+    total->min = total->max = 0;
+    return;
+  }
+  total->mean = sum / total->count;
+  double variance = sum_of_squares / total->count - total->mean * total->mean;
+  total->stddev = variance > 0 ? sqrt(variance) : 0;
+}
+
+// Histogram of one sample every stride samples, padding excluded. Return the
+// number of samples counted.
+static uint64_t sample_histogram(pixel_module_t *pixel_module,
+                                 padding_t *padding, const uint8_t *input,
+                                 size_t nsamples, size_t stride, int32_t first,
+                                 uint8_t shift, uint32_t *histogram) {
+  uint8_t bytes = pixel_module->bits_allocated / 8;
+  uint8_t left = 15 - pixel_module->high_bit;
+  uint8_t right = 16 - pixel_module->bits_stored;
+  uint8_t is_signed = pixel_module->pixel_representation == 1;
+  uint64_t count = 0;
+  memset(histogram, 0, sizeof (uint32_t) * HISTOGRAM_BINS);
+  for (size_t i = 0; i < nsamples; i += stride) {
+    int32_t value = load_stored_value(input, i, bytes, left, right,
+                                      is_signed);
+    if (padding && value >= padding->low && value <= padding->high) continue;
+    ++histogram[(value - first) >> shift];
+    ++count;
+  }
+  return count;
+}
+
+// Bin holding the given fraction of the count
+static uint32_t get_percentile_bin(uint32_t *histogram, uint64_t count,
+                                   double fraction) {
+  uint64_t rank = (uint64_t) (fraction * (count - 1));
+  uint64_t cumulated = 0;
+  for (uint32_t i = 0; i < HISTOGRAM_BINS; ++i) {
+    cumulated += histogram[i];
+    if (cumulated > rank) return i;
+  }
+  return HISTOGRAM_BINS - 1;
+}
+
+// Compute a linear VOI spanning the 1st to the 99th percentile of the stored
+// values of a frame, for datasets without a window. The percentiles are
+// approximated on a strided subsample of about AUTO_VOI_SAMPLES samples. The
+// stride is odd so that it does not keep aligning on the same columns of
+// frames of even width. Return ERROR if the frame only holds padding.
+// Cf DICOM standard Part 3 Sect C.11.2.1.2
+int8_t compute_auto_voi_lut(pixel_module_t *pixel_module,
+                            modality_lut_t *modality_lut, padding_t *padding,
+                            const uint8_t *input, size_t nsamples,
+                            voi_lut_t *voi_lut) {
+  uint32_t histogram[HISTOGRAM_BINS];
+  uint8_t shift = pixel_module->bits_stored > 12 ?
+    pixel_module->bits_stored - 12 : 0;
+  int32_t first = pixel_module->pixel_representation ?
+    -(1 << (pixel_module->bits_stored - 1)) : 0;
+  size_t stride = (nsamples / AUTO_VOI_SAMPLES) | 1;
+  if (pixel_module->bits_allocated != 8 && pixel_module->bits_allocated != 16)
+    return ERROR;
+  uint64_t count = sample_histogram(pixel_module, padding, input, nsamples,
+                                    stride, first, shift, histogram);
+  if (count == 0) return ERROR;
+  int32_t low = first +
+    (get_percentile_bin(histogram, count, AUTO_VOI_LOW) << shift);
+  int32_t high = first +
+    ((get_percentile_bin(histogram, count, AUTO_VOI_HIGH) + 1) << shift) - 1;
+  double a = low * modality_lut->rescale_slope +
+    modality_lut->rescale_intercept;
+  double b = high * modality_lut->rescale_slope +
+    modality_lut->rescale_intercept;
+  double low_value = a < b ? a : b;
+  double high_value = a < b ? b : a;
+  // Values up to low_value are black and from high_value white
+  voi_lut->function = VOI_LINEAR;
+  voi_lut->window_width = high_value - low_value + 1;
+  voi_lut->window_center = (low_value + high_value + 1) / 2;
+  return 0;
+}
@@ -0,0 +1,47 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "dcm.h"
+#include "pixel-data.h"
+#include "lut.h"
+
+#define HISTOGRAM_BINS 4096
+
+// Range of stored values excluded from the statistics
+// Cf DICOM standard Part 3 Sect C.7.5.1.1.2
+typedef struct padding_s {
+  int32_t low;
+  int32_t high;
+} padding_t;
+
+// Statistics of stored values. Bin i of the histogram counts the values
+// from first + (i << shift) to first + ((i + 1) << shift) - 1.
+typedef struct pixel_stats_s {
+  uint64_t count; // Samples which are not padding
+  int32_t  min;
+  int32_t  max;
+  double   mean;
+  double   stddev;
+  int32_t  first;
+  uint8_t  shift;
+  uint32_t histogram[HISTOGRAM_BINS];
+} pixel_stats_t;
+
+int8_t decode_padding(tag_t *tags, pixel_module_t *pixel_module,
+                      padding_t *padding);
+void compute_pixel_stats(pixel_module_t *pixel_module, padding_t *padding,
+                         const uint8_t *input, size_t nsamples,
+                         pixel_stats_t *stats);
+int8_t compute_frames_stats(file_t *file, tag_t *pixel_data,
+                            pixel_module_t *pixel_module, padding_t *padding,
+                            pixel_stats_t *stats, uint32_t nthreads);
+void merge_pixel_stats(pixel_stats_t *stats, size_t n, pixel_stats_t *total);
+int8_t compute_auto_voi_lut(pixel_module_t *pixel_module,
+                            modality_lut_t *modality_lut, padding_t *padding,
+                            const uint8_t *input, size_t nsamples,
+                            voi_lut_t *voi_lut);
+
+#endif // __STATS_H__
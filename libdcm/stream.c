@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "dicom.h"
+#include "dcm.h"
+#include "stream.h"
+
+// Zeroed bytes kept after the data, decode_sequence_tag reading the header
+// following a sequence unchecked
+#define STREAM_PADDING 16
+#define STREAM_MIN_CAPACITY (64 << 10)
+
+static ssize_t decode_tag(file_t *file, ssize_t offset,
+                          dicom_meta_t *dicom_meta, tag_t *tag) {
+  return dicom_meta->transfer_syntax == IMPLICIT ?
+    decode_implicit_tag(file, offset, tag) :
+    decode_explicit_tag(file, offset, tag);
+}
+
+// The tags point in the data, move them with it
+static int8_t grow_stream(stream_t *stream, size_t size) {
+  if (size + STREAM_PADDING <= stream->capacity) return 0;
+  size_t capacity = stream->capacity ? stream->capacity : STREAM_MIN_CAPACITY;
+  while (capacity < size + STREAM_PADDING) capacity *= 2;
+  uint8_t *content = malloc(capacity);
+  if (content == NULL) {
+    perror("malloc");
+    return ERROR;
+  }
+  if (stream->file.content) {
+    memcpy(content, stream->file.content, stream->file.size);
+    for (size_t i = 0; i < stream->ntags; ++i)
+      stream->tags[i].data = content +
+        ((uint8_t *) stream->tags[i].data - stream->file.content);
+    free(stream->file.content);
+  }
+  stream->file.content = content;
+  stream->capacity = capacity;
+  return 0;
+}
+
+// End of the top-level tags fed entirely from offset. Set complete when the
+// pixel data is met, whose tags are not decoded.
+static ssize_t find_end(stream_t *stream, ssize_t offset) {
+  file_t *file = &stream->file;
+  tag_t tag;
+  while (1) {
+    ssize_t shift = decode_tag(file, offset, &stream->dicom_meta, &tag);
+    if (shift <= 0) return offset;
+    if (tag.group > 0x4FFE) {
+      stream->complete = 1;
+      return offset;
+    }
+    if (tag.datasize == UNDEFINED_LENGTH) {
+      // Walked again on every chunk until its delimiter is fed, sequences
+      // of undefined length being small
+      ssize_t end = skip_tag(file, offset, &stream->dicom_meta);
+      if (end == ERROR) return offset;
+      offset = end;
+    } else if (offset + shift + tag.datasize <= file->size) {
+      offset += shift + tag.datasize;
+    } else {
+      return offset;
+    }
+  }
+}
+
+// Decode the dataset, without file meta information, encoded in the transfer
+// syntax of dicom_meta. filename names it in the decoded file.
+// Cf DICOM standard Part 5 Sect 7
+void open_stream(dicom_meta_t *dicom_meta, char *filename, stream_t *stream) {
+  memset(stream, 0, sizeof (stream_t));
+  stream->dicom_meta = *dicom_meta;
+  stream->file.fd = -1;
+  stream->file.filename = filename;
+}
+
+int8_t feed_stream(stream_t *stream, const void *data, size_t length) {
+  file_t *file = &stream->file;
+  stream->length += length;
+  if (stream->complete || length == 0) return 0;
+  if (grow_stream(stream, file->size + length) == ERROR) return ERROR;
+  memcpy(&(file->content[file->size]), data, length);
+  file->size += length;
+  memset(&(file->content[file->size]), 0, STREAM_PADDING);
+  ssize_t end = find_end(stream, stream->offset);
+  if (end == stream->offset) return 0;
+  // Decode the tags fed only, as decode_n_tags stops at the end of the file
+  ssize_t size = file->size;
+  file->size = end;
+  ssize_t offset = decode_n_tags(file, stream->offset, &stream->dicom_meta,
+                                 stream->tags, &stream->ntags,
+                                 MAX_LOADED_TAG - 1);
+  file->size = size;
+  // As for a file, the tags decoded until then are kept
+  if (offset != end) stream->complete = 1;
+  stream->offset = end;
+  return 0;
+}
+
+// Return the offset following the last tag decoded, ERROR if the dataset fed
+// ends in the middle of a tag
+ssize_t close_stream(stream_t *stream) {
+  if (!stream->complete && stream->offset != stream->file.size) return ERROR;
+  return stream->offset;
+}
+
+void free_stream(stream_t *stream) {
+  free(stream->file.content);
+  stream->file.content = NULL;
+  stream->capacity = 0;
+}
@@ -0,0 +1,29 @@
+#ifndef __STREAM_H__
+#define __STREAM_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "dcm.h"
+
+// Incremental decoding of a dataset received in chunks, from a network
+// association for instance. A top-level tag is decoded as soon as its value,
+// and those of the items it holds, have been fed. The bytes up to the pixel
+// data are kept in file, the following ones are only counted.
+typedef struct stream_s {
+  file_t       file; // size being the number of bytes kept
+  size_t       capacity;
+  dicom_meta_t dicom_meta;
+  tag_t        tags[MAX_LOADED_TAG];
+  size_t       ntags;
+  ssize_t      offset; // Next top-level tag to decode
+  uint64_t     length; // Bytes fed
+  uint8_t      complete; // The pixel data or the last decodable tag reached
+} stream_t;
+
+void open_stream(dicom_meta_t *dicom_meta, char *filename, stream_t *stream);
+int8_t feed_stream(stream_t *stream, const void *data, size_t length);
+ssize_t close_stream(stream_t *stream);
+void free_stream(stream_t *stream);
+
+#endif // __STREAM_H__
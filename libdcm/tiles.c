@@ -0,0 +1,374 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#include "dicom.h"
+#include "dcm.h"
+#include "pixel-data.h"
+#include "functional-groups.h"
+#include "tiles.h"
+
+#define OPTICAL_PATH_IDENTIFIER_SIZE 16 // SH
+
+// Position of a TILED_SPARSE frame, its focal plane being resolved once all
+// the offsets are known
+typedef struct sparse_tile_s {
+  uint32_t column;
+  uint32_t row;
+  double   z;
+  uint32_t optical_path;
+} sparse_tile_t;
+
+typedef struct optical_paths_s {
+  uint32_t count;
+  char     identifiers[MAX_OPTICAL_PATHS][OPTICAL_PATH_IDENTIFIER_SIZE + 1];
+} optical_paths_t;
+
+static size_t get_tile_count(tile_level_t *level) {
+  return (size_t) level->tiles_across * level->tiles_down *
+    level->focal_planes * level->optical_paths;
+}
+
+// Index of a tile in the TILED_FULL order: columns first, then rows, focal
+// planes and optical paths
+// Cf DICOM standard Part 3 Sect C.7.6.17.3
+static size_t get_tile_index(tile_level_t *level, uint32_t column,
+                             uint32_t row, uint32_t focal_plane,
+                             uint32_t optical_path) {
+  return (((size_t) optical_path * level->focal_planes + focal_plane) *
+          level->tiles_down + row) * level->tiles_across + column;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+  double da = *(const double *) a;
+  double db = *(const double *) b;
+  return (da > db) - (da < db);
+}
+
+// Index of an optical path identifier, added if new
+static int32_t get_optical_path(optical_paths_t *paths, tag_t *tag) {
+  char identifier[OPTICAL_PATH_IDENTIFIER_SIZE + 1];
+  size_t length = tag->datasize < OPTICAL_PATH_IDENTIFIER_SIZE ?
+    tag->datasize : OPTICAL_PATH_IDENTIFIER_SIZE;
+  memcpy(identifier, tag->data, length);
+  identifier[length] = 0;
+  trim(identifier, NULL);
+  for (uint32_t i = 0; i < paths->count; ++i)
+    if (!strcmp(paths->identifiers[i], identifier)) return i;
+  if (paths->count == MAX_OPTICAL_PATHS) return ERROR;
+  strcpy(paths->identifiers[paths->count], identifier);
+  return paths->count++;
+}
+
+// Number the optical paths in the order of the OpticalPathSequence
+// Cf DICOM standard Part 3 Sect C.8.12.5
+static void decode_optical_paths(tag_t *tags, optical_paths_t *paths) {
+  paths->count = 0;
+  for (size_t i = 0; i < MAX_LOADED_TAG &&
+         (tags[i].group != 0x0000 || tags[i].element != 0x0000); ++i)
+    if ((uint32_t) (tags[i].group << 16) + tags[i].element ==
+        OPTICAL_PATH_IDENTIFIER)
+      get_optical_path(paths, &tags[i]);
+}
+
+// Decode the position of a frame from its PlanePositionSlideSequence, whose
+// positions are 1-based pixels of the total pixel matrix
+// Cf DICOM standard Part 3 Sect C.8.12.6.1
+static int8_t decode_sparse_tile(tile_level_t *level,
+                                 functional_groups_t *groups, uint32_t frame,
+                                 optical_paths_t *paths,
+                                 sparse_tile_t *tile) {
+  tag_t column;
+  tag_t row;
+  tag_t tag;
+  if (get_frame_attribute(&level->file, &level->dicom_meta, groups, frame,
+                          PLANE_POSITION_SLIDE_SEQUENCE,
+                          COLUMN_POSITION_IN_TOTAL_IMAGE_PIXEL_MATRIX,
+                          &column) == ERROR ||
+      get_frame_attribute(&level->file, &level->dicom_meta, groups, frame,
+                          PLANE_POSITION_SLIDE_SEQUENCE,
+                          ROW_POSITION_IN_TOTAL_IMAGE_PIXEL_MATRIX,
+                          &row) == ERROR ||
+      column.datasize < sizeof (int32_t) || row.datasize < sizeof (int32_t) ||
+      *(int32_t *) column.data < 1 || *(int32_t *) row.data < 1)
+    return ERROR;
+  tile->column = (*(int32_t *) column.data - 1) / level->pixel_module.columns;
+  tile->row = (*(int32_t *) row.data - 1) / level->pixel_module.rows;
+  if (tile->column >= level->tiles_across || tile->row >= level->tiles_down)
+    return ERROR;
+  tile->z = 0;
+  if (get_frame_attribute(&level->file, &level->dicom_meta, groups, frame,
+                          PLANE_POSITION_SLIDE_SEQUENCE,
+                          Z_OFFSET_IN_SLIDE_COORDINATE_SYSTEM,
+                          &tag) != ERROR)
+    decode_numbers(&tag, &tile->z, 1);
+  int32_t path = 0;
+  if (get_frame_attribute(&level->file, &level->dicom_meta, groups, frame,
+                          OPTICAL_PATH_IDENTIFICATION_SEQUENCE,
+                          OPTICAL_PATH_IDENTIFIER, &tag) != ERROR &&
+      (path = get_optical_path(paths, &tag)) == ERROR)
+    return ERROR;
+  tile->optical_path = path;
+  return 0;
+}
+
+// Sort the distinct z offsets of the tiles in planes. Return their number.
+static uint32_t get_focal_planes(sparse_tile_t *tiles, uint32_t ntiles,
+                                 double *planes) {
+  uint32_t nplanes = 0;
+  for (uint32_t i = 0; i < ntiles; ++i) planes[i] = tiles[i].z;
+  qsort(planes, ntiles, sizeof (double), compare_doubles);
+  for (uint32_t i = 0; i < ntiles; ++i)
+    if (i == 0 || planes[i] != planes[nplanes - 1])
+      planes[nplanes++] = planes[i];
+  return nplanes;
+}
+
+// Fill the frame of every tile from the positions of the frames
+static int8_t place_sparse_tiles(tile_level_t *level, sparse_tile_t *tiles,
+                                 double *planes) {
+  uint32_t nframes = level->pixel_module.number_of_frames;
+  uint32_t nplanes = get_focal_planes(tiles, nframes, planes);
+  if (nplanes > level->focal_planes) level->focal_planes = nplanes;
+  for (uint32_t i = 0; i < nframes; ++i)
+    if (tiles[i].optical_path >= level->optical_paths)
+      level->optical_paths = tiles[i].optical_path + 1;
+  size_t count = get_tile_count(level);
+  if ((level->frames = malloc(sizeof (int32_t) * count)) == NULL) {
+    perror("malloc");
+    return ERROR;
+  }
+  memset(level->frames, 0xFF, sizeof (int32_t) * count);
+  for (uint32_t i = 0; i < nframes; ++i) {
+    double *plane = bsearch(&tiles[i].z, planes, nplanes, sizeof (double),
+                            compare_doubles);
+    level->frames[get_tile_index(level, tiles[i].column, tiles[i].row,
+                                 plane - planes, tiles[i].optical_path)] = i;
+  }
+  return 0;
+}
+
+// Locate the TILED_SPARSE frames through the per-frame functional groups
+static int8_t index_sparse_tiles(tile_level_t *level, tag_t *tags,
+                                 ssize_t offset) {
+  functional_groups_t groups;
+  optical_paths_t paths;
+  uint32_t nframes = level->pixel_module.number_of_frames;
+  int8_t ret = 0;
+  decode_optical_paths(tags, &paths);
+  if (build_functional_groups(&level->file, offset, &level->dicom_meta,
+                              nframes, &groups) == ERROR)
+    return ERROR;
+  sparse_tile_t *tiles = malloc(sizeof (sparse_tile_t) * nframes);
+  double *planes = malloc(sizeof (double) * nframes);
+  if (tiles == NULL || planes == NULL) {
+    perror("malloc");
+    ret = ERROR;
+  }
+  for (uint32_t i = 0; ret == 0 && i < nframes; ++i)
+    ret = decode_sparse_tile(level, &groups, i, &paths, &tiles[i]);
+  if (ret == 0) ret = place_sparse_tiles(level, tiles, planes);
+  free(tiles);
+  free(planes);
+  free_functional_groups(&groups);
+  return ret;
+}
+
+// Copy the value index of a string attribute trimmed, empty if absent
+// Cf DICOM standard Part 5 Sect 6.4
+static void copy_string_value(tag_t *tags, uint32_t number, uint8_t index,
+                             char *value, size_t size) {
+  tag_t *tag = get_tag(tags, number);
+  size_t length = 0;
+  value[0] = 0;
+  if (tag == NULL) return;
+  const char *beg = (const char *) tag->data;
+  const char *end = beg + tag->datasize;
+  for (; index && beg < end; ++beg)
+    if (*beg == '\\') --index;
+  if (index) return;
+  while (beg + length < end && beg[length] != '\\') ++length;
+  if (length > size) length = size;
+  memcpy(value, beg, length);
+  value[length] = 0;
+  trim(value, NULL);
+}
+
+static int8_t decode_tile_level(tile_level_t *level) {
+  tag_t tags[MAX_LOADED_TAG];
+  ssize_t offset = decode_dataset(&level->file, &level->dicom_meta, tags,
+                                  MAX_LOADED_TAG);
+  if (offset < 0 || decode_pixel_module(tags, &level->pixel_module) == ERROR ||
+      level->pixel_module.rows == 0 || level->pixel_module.columns == 0 ||
+      get_tag_uint32(tags, TOTAL_PIXEL_MATRIX_COLUMNS,
+                     &level->total_columns) == ERROR ||
+      get_tag_uint32(tags, TOTAL_PIXEL_MATRIX_ROWS,
+                     &level->total_rows) == ERROR ||
+      find_tag(&level->file, offset, &level->dicom_meta, PIXEL_DATA,
+               &level->pixel_data) == ERROR)
+    return ERROR;
+  // Cf DICOM standard Part 3 Sect C.8.12.4.1.1
+  copy_string_value(tags, IMAGE_TYPE, 2, level->image_flavor,
+                    IMAGE_FLAVOR_SIZE);
+  copy_string_value(tags, SERIES_INSTANCE_UID, 0, level->series_instance_uid,
+                    UID_MAX_SIZE);
+  copy_string_value(tags, PYRAMID_UID, 0, level->pyramid_uid, UID_MAX_SIZE);
+  if (get_tag_uint32(tags, TOTAL_PIXEL_MATRIX_FOCAL_PLANES,
+                     &level->focal_planes) == ERROR ||
+      level->focal_planes == 0)
+    level->focal_planes = 1;
+  if (get_tag_uint32(tags, NUMBER_OF_OPTICAL_PATHS,
+                     &level->optical_paths) == ERROR ||
+      level->optical_paths == 0)
+    level->optical_paths = 1;
+  level->tiles_across = (level->total_columns + level->pixel_module.columns -
+                         1) / level->pixel_module.columns;
+  level->tiles_down = (level->total_rows + level->pixel_module.rows - 1) /
+    level->pixel_module.rows;
+  if (level->pixel_data.datasize == UNDEFINED_LENGTH &&
+      build_frame_index(&level->file, offset, &level->dicom_meta,
+                        level->pixel_module.number_of_frames,
+                        &level->frame_index) == ERROR)
+    return ERROR;
+  tag_t *type = get_tag(tags, DIMENSION_ORGANIZATION_TYPE);
+  if (type != NULL && type->datasize >= 10 &&
+      !strncmp((char *) type->data, "TILED_FULL", 10))
+    return 0;
+  return index_sparse_tiles(level, tags, offset);
+}
+
+// Load a level of a whole slide image and index its tiles. The file stays
+// mapped until free_tile_level.
+int8_t load_tile_level(char *path, tile_level_t *level) {
+  memset(level, 0, sizeof (tile_level_t));
+  if (load_file(path, &level->file) == ERROR) return ERROR;
+  if (decode_tile_level(level) == ERROR) {
+    free_tile_level(level);
+    return ERROR;
+  }
+  return 0;
+}
+
+void free_tile_level(tile_level_t *level) {
+  free_frame_index(&level->frame_index);
+  free(level->frames);
+  level->frames = NULL;
+  if (level->file.content) {
+    munmap(level->file.content, level->file.size);
+    close_file(&level->file);
+    level->file.content = NULL;
+  }
+}
+
+static int compare_levels(const void *a, const void *b) {
+  uint32_t ca = ((const tile_level_t *) a)->total_columns;
+  uint32_t cb = ((const tile_level_t *) b)->total_columns;
+  return (ca < cb) - (ca > cb);
+}
+
+// Levels of the same pyramid share its PyramidUID, or their series without
+// one
+// Cf DICOM standard Part 3 Sect C.8.12.4
+static uint8_t is_same_pyramid(tile_level_t *base, tile_level_t *level) {
+  if (base->pyramid_uid[0])
+    return !strcmp(base->pyramid_uid, level->pyramid_uid);
+  return !level->pyramid_uid[0] &&
+    !strcmp(base->series_instance_uid, level->series_instance_uid);
+}
+
+// Keep the VOLUME levels of the pyramid of the largest one, and a THUMBNAIL
+// smaller than all of them as the last level. The levels are sorted from the
+// largest, the others are freed.
+static void select_pyramid_levels(tile_pyramid_t *pyramid) {
+  uint8_t thumbnail = 0;
+  size_t n = 0;
+  for (size_t i = 0; i < pyramid->nlevels; ++i) {
+    tile_level_t *level = &pyramid->levels[i];
+    uint8_t volume = !strcmp(level->image_flavor, "VOLUME");
+    if (n == 0 ? !volume :
+        !is_same_pyramid(&pyramid->levels[0], level) ||
+        (!volume && (thumbnail ||
+                     strcmp(level->image_flavor, "THUMBNAIL")))) {
+      free_tile_level(level);
+      continue;
+    }
+    // A VOLUME level smaller than the THUMBNAIL replaces it
+    if (thumbnail && volume) free_tile_level(&pyramid->levels[--n]);
+    thumbnail = !volume;
+    pyramid->levels[n++] = *level;
+  }
+  pyramid->nlevels = n;
+}
+
+// Load the VOLUME levels of the pyramid of the largest one among paths, the
+// other files being skipped, and sort them from the base level
+int8_t load_tile_pyramid(char **paths, size_t npaths,
+                         tile_pyramid_t *pyramid) {
+  pyramid->nlevels = 0;
+  pyramid->levels = malloc(sizeof (tile_level_t) * npaths);
+  if (pyramid->levels == NULL) {
+    perror("malloc");
+    return ERROR;
+  }
+  for (size_t i = 0; i < npaths; ++i)
+    if (load_tile_level(paths[i], &pyramid->levels[pyramid->nlevels]) == 0)
+      ++pyramid->nlevels;
+  qsort(pyramid->levels, pyramid->nlevels, sizeof (tile_level_t),
+        compare_levels);
+  select_pyramid_levels(pyramid);
+  if (pyramid->nlevels == 0) {
+    free_tile_pyramid(pyramid);
+    return ERROR;
+  }
+  return 0;
+}
+
+void free_tile_pyramid(tile_pyramid_t *pyramid) {
+  for (size_t i = 0; i < pyramid->nlevels; ++i)
+    free_tile_level(&pyramid->levels[i]);
+  free(pyramid->levels);
+  pyramid->levels = NULL;
+  pyramid->nlevels = 0;
+}
+
+// Frame of a tile, ERROR if the tile is outside of the level or absent
+int64_t get_tile_frame(tile_level_t *level, uint32_t column, uint32_t row,
+                       uint32_t focal_plane, uint32_t optical_path) {
+  if (column >= level->tiles_across || row >= level->tiles_down ||
+      focal_plane >= level->focal_planes ||
+      optical_path >= level->optical_paths)
+    return ERROR;
+  size_t index = get_tile_index(level, column, row, focal_plane,
+                                optical_path);
+  if (level->frames) return level->frames[index] < 0 ? ERROR :
+    level->frames[index];
+  return index < level->pixel_module.number_of_frames ? (int64_t) index :
+    ERROR;
+}
+
+// Fill fragments with the byte ranges of a tile in the file of its level:
+// the fragments of encapsulated pixel data, or the frame itself for native
+// pixel data. Return the number of ranges or ERROR if there is no such tile.
+ssize_t get_tile_fragments(tile_pyramid_t *pyramid, size_t level,
+                           uint32_t column, uint32_t row,
+                           uint32_t focal_plane, uint32_t optical_path,
+                           fragment_t *fragments, size_t maxfragments) {
+  if (level >= pyramid->nlevels) return ERROR;
+  tile_level_t *l = &pyramid->levels[level];
+  frame_view_t view;
+  int64_t frame = get_tile_frame(l, column, row, focal_plane, optical_path);
+  if (frame == ERROR) return ERROR;
+  if (l->pixel_data.datasize == UNDEFINED_LENGTH)
+    return get_frame_fragments(&l->file, &l->frame_index, frame, fragments,
+                               maxfragments);
+  if (get_native_frame(&l->file, &l->pixel_data, &l->pixel_module, frame, 0,
+                       &view) == ERROR)
+    return ERROR;
+  if (maxfragments == 0) return 0;
+  fragments[0].offset = view.data - l->file.content;
+  fragments[0].length = view.length;
+  return 1;
+}
@@ -0,0 +1,56 @@
+#ifndef __TILES_H__
+#define __TILES_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "dcm.h"
+#include "pixel-data.h"
+
+#define MAX_OPTICAL_PATHS 64
+#define IMAGE_FLAVOR_SIZE 16 // CS
+
+// One level of a whole slide image pyramid, whose file stays mapped. Tiles
+// are addressed by column and row in the grid of tiles, focal plane and
+// optical path. The frame of each tile follows from the TILED_FULL order, or
+// is looked up in frames for TILED_SPARSE.
+// Cf DICOM standard Part 3 Sect C.8.12.4
+typedef struct tile_level_s {
+  file_t         file;
+  dicom_meta_t   dicom_meta;
+  pixel_module_t pixel_module;
+  tag_t          pixel_data;
+  frame_index_t  frame_index; // Encapsulated pixel data only
+  uint32_t       total_columns;
+  uint32_t       total_rows;
+  uint32_t       tiles_across;
+  uint32_t       tiles_down;
+  uint32_t       focal_planes;
+  uint32_t       optical_paths;
+  int32_t        *frames; // TILED_SPARSE only, -1 for the absent tiles
+  // Value 3 of the ImageType, VOLUME for the levels of a pyramid
+  char           image_flavor[IMAGE_FLAVOR_SIZE + 1];
+  char           series_instance_uid[UID_MAX_SIZE + 1];
+  char           pyramid_uid[UID_MAX_SIZE + 1]; // Empty if absent
+} tile_level_t;
+
+// VOLUME levels of a single pyramid sorted from the largest total pixel
+// matrix, followed by its THUMBNAIL if any
+typedef struct tile_pyramid_s {
+  size_t       nlevels;
+  tile_level_t *levels;
+} tile_pyramid_t;
+
+int8_t load_tile_level(char *path, tile_level_t *level);
+void free_tile_level(tile_level_t *level);
+int8_t load_tile_pyramid(char **paths, size_t npaths,
+                         tile_pyramid_t *pyramid);
+void free_tile_pyramid(tile_pyramid_t *pyramid);
+int64_t get_tile_frame(tile_level_t *level, uint32_t column, uint32_t row,
+                       uint32_t focal_plane, uint32_t optical_path);
+ssize_t get_tile_fragments(tile_pyramid_t *pyramid, size_t level,
+                           uint32_t column, uint32_t row,
+                           uint32_t focal_plane, uint32_t optical_path,
+                           fragment_t *fragments, size_t maxfragments);
+
+#endif // __TILES_H__
@@ -0,0 +1,334 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "dicom.h"
+#include "dcm.h"
+#include "pixel-data.h"
+#include "parallel.h"
+#include "lut.h"
+#include "volume.h"
+
+#define ORIENTATION_TOLERANCE 1e-4 // On the direction cosines
+
+// What the assembly needs from the header of a file
+typedef struct slice_header_s {
+  uint8_t        valid;
+  char           series_instance_uid[UID_MAX_SIZE + 1];
+  pixel_module_t pixel_module;
+  modality_lut_t modality_lut;
+  uint8_t        is_native;
+  double         position[3];
+  double         orientation[6];
+  double         pixel_spacing[2];
+} slice_header_t;
+
+typedef struct scan_headers_s {
+  char           **paths;
+  slice_header_t *headers;
+} scan_headers_t;
+
+// Copy a UID without its padding
+static void copy_uid(tag_t *tags, uint32_t number,
+                     char uid[UID_MAX_SIZE + 1]) {
+  tag_t *tag = get_tag(tags, number);
+  size_t length = tag == NULL ? 0 :
+    tag->datasize < UID_MAX_SIZE ? tag->datasize : UID_MAX_SIZE;
+  if (length) memcpy(uid, tag->data, length);
+  while (length && (uid[length - 1] == 0 || uid[length - 1] == ' '))
+    --length;
+  uid[length] = 0;
+}
+
+// Decode the header of a file. Files which are not single frame images with
+// a position and an orientation are left invalid rather than failing the
+// scan.
+static int8_t scan_header(void *context, size_t i) {
+  scan_headers_t *s = (scan_headers_t *) context;
+  slice_header_t *header = &s->headers[i];
+  file_t file;
+  dicom_meta_t dicom_meta;
+  tag_t tags[MAX_LOADED_TAG];
+  tag_t pixel_data;
+  ssize_t offset;
+  memset(header, 0, sizeof (slice_header_t));
+  if (load_file(s->paths[i], &file) == ERROR) return 0;
+  if ((offset = decode_dataset(&file, &dicom_meta, tags,
+                               MAX_LOADED_TAG)) >= 0 &&
+      find_tag(&file, offset, &dicom_meta, PIXEL_DATA, &pixel_data) != ERROR &&
+      decode_pixel_module(tags, &header->pixel_module) != ERROR &&
+      header->pixel_module.number_of_frames == 1 &&
+      header->pixel_module.samples_per_pixel == 1 &&
+      get_tag_numbers(tags, IMAGE_POSITION_PATIENT, header->position,
+                      3) == 3 &&
+      get_tag_numbers(tags, IMAGE_ORIENTATION_PATIENT, header->orientation,
+                      6) == 6) {
+    copy_uid(tags, SERIES_INSTANCE_UID, header->series_instance_uid);
+    decode_modality_lut(tags, &header->modality_lut);
+    header->is_native = pixel_data.datasize != UNDEFINED_LENGTH;
+    if (get_tag_numbers(tags, PIXEL_SPACING, header->pixel_spacing, 2) != 2)
+      header->pixel_spacing[0] = header->pixel_spacing[1] = 1.0;
+    header->valid = 1;
+  }
+  munmap(file.content, file.size);
+  close_file(&file);
+  return 0;
+}
+
+static int compare_slices(const void *a, const void *b) {
+  double pa = ((const slice_t *) a)->position;
+  double pb = ((const slice_t *) b)->position;
+  return (pa > pb) - (pa < pb);
+}
+
+// Whether a slice can be stacked on the first one
+static uint8_t is_stackable(slice_header_t *first, slice_header_t *header) {
+  if (header->pixel_module.rows != first->pixel_module.rows ||
+      header->pixel_module.columns != first->pixel_module.columns)
+    return 0;
+  for (uint8_t i = 0; i < 6; ++i)
+    if (fabs(header->orientation[i] - first->orientation[i]) >
+        ORIENTATION_TOLERANCE)
+      return 0;
+  return 1;
+}
+
+// The normal is the cross product of the row and column directions
+static void set_orientation(volume_t *volume, double orientation[6]) {
+  memcpy(volume->orientation, orientation, sizeof (double) * 6);
+  for (uint8_t i = 0; i < 3; ++i)
+    volume->normal[i] =
+      orientation[(i + 1) % 3] * orientation[3 + (i + 2) % 3] -
+      orientation[(i + 2) % 3] * orientation[3 + (i + 1) % 3];
+}
+
+// Whether the stored values of a slice have the meaning of those of the first
+static uint8_t has_same_layout(slice_header_t *first, slice_header_t *header) {
+  return header->is_native &&
+    header->pixel_module.bits_allocated == first->pixel_module.bits_allocated &&
+    header->pixel_module.bits_stored == first->pixel_module.bits_stored &&
+    header->pixel_module.high_bit == first->pixel_module.high_bit &&
+    header->pixel_module.pixel_representation ==
+    first->pixel_module.pixel_representation &&
+    header->modality_lut.rescale_slope == first->modality_lut.rescale_slope &&
+    header->modality_lut.rescale_intercept ==
+    first->modality_lut.rescale_intercept;
+}
+
+// Sort the slices along the normal, compute the spacing and check its
+// uniformity. Return ERROR if two slices are at the same position.
+static int8_t sort_slices(volume_t *volume) {
+  qsort(volume->slices, volume->nslices, sizeof (slice_t), compare_slices);
+  if (volume->nslices < 2) {
+    volume->spacing = 0;
+    volume->uniform = 1;
+    return 0;
+  }
+  volume->spacing = (volume->slices[volume->nslices - 1].position -
+                     volume->slices[0].position) / (volume->nslices - 1);
+  if (volume->spacing == 0) return ERROR;
+  volume->uniform = 1;
+  for (size_t i = 1; i < volume->nslices; ++i) {
+    double d = volume->slices[i].position - volume->slices[i - 1].position;
+    if (d == 0) return ERROR;
+    if (fabs(d - volume->spacing) > SPACING_TOLERANCE * volume->spacing)
+      volume->uniform = 0;
+  }
+  return 0;
+}
+
+// Gather the files of a series into a volume. The headers are decoded in
+// parallel, then the slices are sorted by their ImagePositionPatient
+// projected on the normal of ImageOrientationPatient. When
+// series_instance_uid is NULL, the series of the first valid file is used.
+// Return ERROR if no file belongs to the series or if its slices do not
+// share their orientation and size.
+// Cf DICOM standard Part 3 Sect C.7.6.2.1.1
+int8_t build_volume(char **paths, size_t npaths, char *series_instance_uid,
+                    uint32_t nthreads, volume_t *volume) {
+  slice_header_t *first = NULL;
+  memset(volume, 0, sizeof (volume_t));
+  slice_header_t *headers = malloc(sizeof (slice_header_t) * npaths);
+  volume->slices = malloc(sizeof (slice_t) * npaths);
+  if (headers == NULL || volume->slices == NULL) {
+    perror("malloc");
+    free(headers);
+    free_volume(volume);
+    return ERROR;
+  }
+  scan_headers_t s = { paths, headers };
+  if (parallel_for(npaths, nthreads, scan_header, &s) == ERROR) {
+    free(headers);
+    free_volume(volume);
+    return ERROR;
+  }
+  for (size_t i = 0; i < npaths; ++i) {
+    if (!headers[i].valid ||
+        (first == NULL && series_instance_uid != NULL &&
+         strcmp(headers[i].series_instance_uid, series_instance_uid)) ||
+        (first != NULL && strcmp(headers[i].series_instance_uid,
+                                 first->series_instance_uid)))
+      continue;
+    if (first == NULL) {
+      first = &headers[i];
+      set_orientation(volume, first->orientation);
+      volume->same_layout = 1;
+    }
+    if (!is_stackable(first, &headers[i])) {
+      free(headers);
+      free_volume(volume);
+      return ERROR;
+    }
+    volume->same_layout &= has_same_layout(first, &headers[i]);
+    slice_t *slice = &volume->slices[volume->nslices++];
+    slice->path = paths[i];
+    memcpy(slice->image_position, headers[i].position, sizeof (double) * 3);
+    slice->position = 0;
+    for (uint8_t j = 0; j < 3; ++j)
+      slice->position += slice->image_position[j] * volume->normal[j];
+  }
+  if (first == NULL) {
+    free(headers);
+    free_volume(volume);
+    return ERROR;
+  }
+  strcpy(volume->series_instance_uid, first->series_instance_uid);
+  volume->pixel_module = first->pixel_module;
+  volume->modality_lut = first->modality_lut;
+  memcpy(volume->pixel_spacing, first->pixel_spacing, sizeof (double) * 2);
+  free(headers);
+  if (sort_slices(volume) == ERROR) {
+    free_volume(volume);
+    return ERROR;
+  }
+  memcpy(volume->origin, volume->slices[0].image_position,
+         sizeof (double) * 3);
+  return 0;
+}
+
+void free_volume(volume_t *volume) {
+  free(volume->slices);
+  volume->slices = NULL;
+  volume->nslices = 0;
+}
+
+// Number of voxels of the volume
+size_t get_volume_size(volume_t *volume) {
+  return (size_t) volume->pixel_module.rows * volume->pixel_module.columns *
+    volume->nslices;
+}
+
+typedef struct load_volume_s {
+  volume_t *volume;
+  size_t   first; // Slice at the start of output
+  void     *output;
+  uint8_t  is_float;
+} load_volume_t;
+
+static int8_t rescale_slice(load_volume_t *l, modality_lut_t *modality_lut,
+                            pixel_module_t *pixel_module,
+                            const uint8_t *input, size_t slice) {
+  size_t npixels = (size_t) pixel_module->rows * pixel_module->columns;
+  if (l->is_float)
+    return rescale_to_float(modality_lut, pixel_module, input,
+                            (float *) l->output + npixels * slice, npixels);
+  return rescale_to_int16(modality_lut, pixel_module, input,
+                          (int16_t *) l->output + npixels * slice, npixels);
+}
+
+// Decode the frame of encapsulated pixel data in a buffer before rescaling it
+static int8_t rescale_encapsulated_slice(load_volume_t *l, file_t *file,
+                                         ssize_t offset,
+                                         dicom_meta_t *dicom_meta,
+                                         modality_lut_t *modality_lut,
+                                         pixel_module_t *pixel_module,
+                                         size_t slice) {
+  frame_index_t index;
+  uint32_t frame = 0;
+  if (build_frame_index(file, offset, dicom_meta, 1, &index) == ERROR)
+    return ERROR;
+  uint8_t *buffer = malloc(get_frame_bits(pixel_module) / 8);
+  int8_t ret = ERROR;
+  if (buffer == NULL)
+    perror("malloc");
+  else if (decode_encapsulated_frames(file, dicom_meta, &index, pixel_module,
+                                      &frame, 1, buffer, 1) != ERROR)
+    ret = rescale_slice(l, modality_lut, pixel_module, buffer, slice);
+  free(buffer);
+  free_frame_index(&index);
+  return ret;
+}
+
+static int8_t decode_slice(load_volume_t *l, file_t *file, size_t slice) {
+  dicom_meta_t dicom_meta;
+  tag_t tags[MAX_LOADED_TAG];
+  tag_t pixel_data;
+  pixel_module_t pixel_module;
+  modality_lut_t modality_lut;
+  frame_view_t view;
+  ssize_t offset = decode_dataset(file, &dicom_meta, tags, MAX_LOADED_TAG);
+  if (offset < 0 || decode_pixel_module(tags, &pixel_module) == ERROR ||
+      pixel_module.rows != l->volume->pixel_module.rows ||
+      pixel_module.columns != l->volume->pixel_module.columns ||
+      pixel_module.number_of_frames != 1 ||
+      find_tag(file, offset, &dicom_meta, PIXEL_DATA, &pixel_data) == ERROR)
+    return ERROR;
+  decode_modality_lut(tags, &modality_lut);
+  if (pixel_data.datasize == UNDEFINED_LENGTH)
+    return rescale_encapsulated_slice(l, file, offset, &dicom_meta,
+                                      &modality_lut, &pixel_module, slice);
+  if (get_native_frame(file, &pixel_data, &pixel_module, 0, 0,
+                       &view) == ERROR)
+    return ERROR;
+  // Read the whole frame ahead rather than faulting it page by page
+  uintptr_t page = sysconf(_SC_PAGESIZE);
+  uintptr_t begin = (uintptr_t) view.data & ~(page - 1);
+  madvise((void *) begin, (uintptr_t) view.data + view.length - begin,
+          MADV_WILLNEED);
+  return rescale_slice(l, &modality_lut, &pixel_module, view.data, slice);
+}
+
+static int8_t load_slice(void *context, size_t slice) {
+  load_volume_t *l = (load_volume_t *) context;
+  file_t file;
+  if (load_file(l->volume->slices[l->first + slice].path, &file) == ERROR)
+    return ERROR;
+  int8_t ret = decode_slice(l, &file, slice);
+  munmap(file.content, file.size);
+  close_file(&file);
+  return ret;
+}
+
+// Rescale nslices slices of the volume from first into output, slice after
+// slice. Each slice goes to its own offset so that the files are read by
+// nthreads threads at once (0 for one per processor), which keeps several
+// requests in flight on the disk.
+int8_t load_slices_to_int16(volume_t *volume, size_t first, size_t nslices,
+                            int16_t *output, uint32_t nthreads) {
+  load_volume_t l = { volume, first, output, 0 };
+  if (first + nslices > volume->nslices) return ERROR;
+  return parallel_for(nslices, nthreads, load_slice, &l);
+}
+
+int8_t load_slices_to_float(volume_t *volume, size_t first, size_t nslices,
+                            float *output, uint32_t nthreads) {
+  load_volume_t l = { volume, first, output, 1 };
+  if (first + nslices > volume->nslices) return ERROR;
+  return parallel_for(nslices, nthreads, load_slice, &l);
+}
+
+// Rescale the whole volume into output, get_volume_size values
+int8_t load_volume_to_int16(volume_t *volume, int16_t *output,
+                            uint32_t nthreads) {
+  return load_slices_to_int16(volume, 0, volume->nslices, output, nthreads);
+}
+
+int8_t load_volume_to_float(volume_t *volume, float *output,
+                            uint32_t nthreads) {
+  return load_slices_to_float(volume, 0, volume->nslices, output, nthreads);
+}
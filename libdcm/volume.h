@@ -0,0 +1,55 @@
+#ifndef __VOLUME_H__
+#define __VOLUME_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "dcm.h"
+#include "pixel-data.h"
+#include "lut.h"
+
+// Largest relative deviation of the distance between two consecutive slices
+// from the mean spacing for the spacing to be uniform
+#define SPACING_TOLERANCE 0.01
+
+typedef struct slice_s {
+  char   *path;
+  double image_position[3]; // ImagePositionPatient
+  double position; // ImagePositionPatient projected on the normal
+} slice_t;
+
+// The single frame images of a series sorted along the normal of their
+// common orientation
+// Cf DICOM standard Part 3 Sect C.7.6.2
+typedef struct volume_s {
+  char           series_instance_uid[UID_MAX_SIZE + 1];
+  pixel_module_t pixel_module; // Of the first slice
+  modality_lut_t modality_lut; // Of the first slice
+  // Whether all the slices are native pixel data with the pixel module and
+  // the modality LUT of the first one, their stored values then being
+  // interchangeable
+  uint8_t        same_layout;
+  double         orientation[6]; // Row then column direction cosines
+  double         normal[3];
+  double         origin[3]; // ImagePositionPatient of the first slice
+  double         pixel_spacing[2]; // Between rows, then between columns
+  double         spacing; // Mean distance between slices
+  uint8_t        uniform; // Whether the spacing is within SPACING_TOLERANCE
+  size_t         nslices;
+  slice_t        *slices;
+} volume_t;
+
+int8_t build_volume(char **paths, size_t npaths, char *series_instance_uid,
+                    uint32_t nthreads, volume_t *volume);
+void free_volume(volume_t *volume);
+size_t get_volume_size(volume_t *volume);
+int8_t load_slices_to_int16(volume_t *volume, size_t first, size_t nslices,
+                            int16_t *output, uint32_t nthreads);
+int8_t load_slices_to_float(volume_t *volume, size_t first, size_t nslices,
+                            float *output, uint32_t nthreads);
+int8_t load_volume_to_int16(volume_t *volume, int16_t *output,
+                            uint32_t nthreads);
+int8_t load_volume_to_float(volume_t *volume, float *output,
+                            uint32_t nthreads);
+
+#endif // __VOLUME_H__
@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "dicom.h"
+#include "dcm.h"
+#include "pixel-data.h"
+#include "bits.h"
+
+#define ERROR -1
+#define MAX_SAMPLES 200
+
+// Bit i of a little endian bit stream, the reference the kernels are checked
+// against
+// Cf DICOM standard Part 5 Sect 8.1.1
+static uint8_t get_bit(const uint8_t *stream, size_t i) {
+  return stream[i / 8] >> i % 8 & 1;
+}
+
+static uint16_t get_cell(const uint8_t *stream, size_t first, uint8_t bits) {
+  uint16_t value = 0;
+  for (uint8_t k = 0; k < bits; ++k) value |= get_bit(stream, first + k) << k;
+  return value;
+}
+
+// Every bit offset and length, with the 8 pixels groups and the tail
+static int8_t check_unpack_bits(void) {
+  uint8_t stream[MAX_SAMPLES / 8 + 2];
+  uint8_t output[MAX_SAMPLES];
+  for (size_t i = 0; i < sizeof (stream); ++i) stream[i] = rand();
+  for (uint8_t offset = 0; offset < 8; ++offset)
+    for (size_t n = 0; n <= MAX_SAMPLES; ++n)
+      for (uint8_t value = 1; value; value = value == 1 ? 255 : 0) {
+        memset(output, 0xAB, sizeof (output));
+        unpack_bits(stream, offset, n, value, output);
+        for (size_t i = 0; i < n; ++i)
+          if (output[i] != get_bit(stream, offset + i) * value) {
+            fprintf(stderr, "error: bit %zu of %zu at offset %u unpacked to "
+                    "%u\n", i, n, offset, output[i]);
+            return ERROR;
+          }
+        if (n < MAX_SAMPLES && output[n] != 0xAB) {
+          fprintf(stderr, "error: %zu bits unpacked past their end\n", n);
+          return ERROR;
+        }
+      }
+  return 0;
+}
+
+// Every bit offset of 1 and 12 bits frames, packed one after the other then
+// unpacked one by one as views of the pixel data
+static int8_t check_frames(uint8_t bits_allocated, uint16_t rows,
+                           uint16_t columns, uint8_t pixel_representation) {
+  pixel_module_t pixel_module;
+  uint32_t nframes = 8;
+  memset(&pixel_module, 0, sizeof (pixel_module_t));
+  pixel_module.rows = rows;
+  pixel_module.columns = columns;
+  pixel_module.samples_per_pixel = 1;
+  pixel_module.bits_allocated = bits_allocated;
+  pixel_module.bits_stored = bits_allocated;
+  pixel_module.high_bit = bits_allocated - 1;
+  pixel_module.pixel_representation = pixel_representation;
+  pixel_module.number_of_frames = nframes;
+  size_t nsamples = (size_t) rows * columns;
+  size_t size = get_unpacked_frame_size(&pixel_module);
+  size_t bits = get_frame_bits(&pixel_module);
+  uint8_t *input = malloc(size * nframes);
+  uint8_t *packed = malloc((bits * nframes + 7) / 8);
+  uint8_t *output = malloc(size);
+  int8_t ret = 0;
+  if (input == NULL || packed == NULL || output == NULL) {
+    perror("malloc");
+    free(input);
+    free(packed);
+    free(output);
+    return ERROR;
+  }
+  for (size_t i = 0; i < nsamples * nframes; ++i)
+    if (bits_allocated == 1)
+      input[i] = rand() & 1;
+    else
+      ((uint16_t *) input)[i] = rand() & 0x0FFF;
+  if (pack_frames(&pixel_module, input, nframes, packed) == ERROR)
+    ret = ERROR;
+  for (size_t i = 0; i < nsamples * nframes && ret == 0; ++i)
+    if (get_cell(packed, i * bits_allocated, bits_allocated) !=
+        (bits_allocated == 1 ? input[i] : ((uint16_t *) input)[i])) {
+      fprintf(stderr, "error: sample %zu packed wrong\n", i);
+      ret = ERROR;
+    }
+  for (uint32_t frame = 0; frame < nframes && ret == 0; ++frame) {
+    size_t first = bits * frame;
+    frame_view_t view = { packed + first / 8, (first % 8 + bits + 7) / 8,
+                          first % 8 };
+    if (unpack_frame(&pixel_module, &view, output) == ERROR) {
+      ret = ERROR;
+      break;
+    }
+    for (size_t i = 0; i < nsamples && ret == 0; ++i) {
+      uint16_t expected = bits_allocated == 1 ? input[frame * nsamples + i] :
+        ((uint16_t *) input)[frame * nsamples + i];
+      // Signed 12 bits stored values are sign extended to 16 bits
+      if (pixel_representation && expected & 0x0800) expected |= 0xF000;
+      uint16_t value = bits_allocated == 1 ? output[i] :
+        ((uint16_t *) output)[i];
+      if (value != expected) {
+        fprintf(stderr, "error: sample %zu of the %u bits frame %u at bit "
+                "offset %zu unpacked to %u instead of %u\n", i,
+                bits_allocated, frame, first % 8, value, expected);
+        ret = ERROR;
+      }
+    }
+  }
+  free(input);
+  free(packed);
+  free(output);
+  return ret;
+}
+
+int main(void) {
+  int8_t ret = 0;
+  srand(1);
+  ret |= check_unpack_bits();
+  // Frames of an odd number of pixels start at every bit offset
+  ret |= check_frames(1, 1, 1, 0);
+  ret |= check_frames(1, 3, 5, 0);
+  ret |= check_frames(1, 7, 9, 0);
+  ret |= check_frames(1, 8, 8, 0);
+  ret |= check_frames(12, 1, 1, 0);
+  ret |= check_frames(12, 3, 5, 0);
+  ret |= check_frames(12, 3, 5, 1);
+  ret |= check_frames(12, 4, 4, 0);
+  printf("bits: %s\n", ret ? "failed" : "ok");
+  return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
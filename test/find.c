@@ -0,0 +1,362 @@
+// The static functions of the C-FIND index are checked directly
+#include "../dcmr/find.c"
+
+#define NSTUDIES 60
+#define NQUERIES 4000
+#define UID_ROOT "1.2.826.0.1.3680043.2.1125.9."
+
+// Values shared by several records so that queries have several matches, ""
+// for an absent attribute
+static char *g_dates[] = { "20190101", "20190615", "20200115", "20200220",
+                           "20201231", "20210101", "" };
+static char *g_times[] = { "0930", "101500.25", "1015", "120000", "13",
+                           "130000", "235959.123456", "" };
+static char *g_names[] = { "DOE^JOHN", "DOE^JANE", "DOEL^MAX", "SMITH^ANNA",
+                           "ANNA", "O'HARA^KIM", "" };
+static char *g_ids[] = { "P1", "P2", "P3", "P10", "" };
+static char *g_modalities[] = { "CT", "MR", "US", "SR", "" };
+
+#define NVALUES(a) (sizeof (a) / sizeof (char *))
+
+// The instances of a study or a series: their values, then an instance
+// number for their SOP Instance UID
+typedef struct instance_s {
+  uint32_t study;
+  uint32_t series;
+  char     study_uid[UID_MAX_SIZE + 1];
+  char     series_uid[UID_MAX_SIZE + 1];
+  char     instance_uid[UID_MAX_SIZE + 1];
+} instance_t;
+
+// index_directory is not checked, the paths of dcmr.c are not linked
+int32_t generate_path(char *arg, path_t **paths, shard_t *shard) {
+  (void) arg;
+  (void) shard;
+  *paths = NULL;
+  return 0;
+}
+
+void free_paths(path_t **paths) {
+  *paths = NULL;
+}
+
+size_t count_paths(path_t *paths) {
+  (void) paths;
+  return 0;
+}
+
+static int8_t check(uint8_t condition, char *what) {
+  if (!condition) fprintf(stderr, "error: %s\n", what);
+  return condition ? 0 : ERROR;
+}
+
+static void set_tag(tag_t *tag, uint32_t number, char *vr, char *value) {
+  memset(tag, 0, sizeof (tag_t));
+  tag->group = number >> 16;
+  tag->element = number & 0xFFFF;
+  memcpy(tag->vr, vr, 2);
+  tag->data = value;
+  tag->datasize = strlen(value);
+}
+
+// The values of a study or a series are a function of its number, the same
+// for all its instances
+static void index_instance(find_index_t *index, instance_t *instance) {
+  tag_t tags[16];
+  size_t n = 0;
+  uint32_t study = instance->study;
+  uint32_t series = instance->series;
+  char *values[] = {
+    g_dates[study % NVALUES(g_dates)],
+    g_dates[series * 3 % NVALUES(g_dates)],
+    g_times[study * 5 % NVALUES(g_times)],
+    g_ids[study * 3 % NVALUES(g_ids)],
+    g_modalities[series % NVALUES(g_modalities)],
+    g_names[study * 7 % NVALUES(g_names)],
+    g_ids[study % NVALUES(g_ids)]
+  };
+  const uint32_t numbers[] = { 0x00080020, 0x00080021, 0x00080030,
+                               0x00080050, 0x00080060, 0x00100010,
+                               0x00100020 };
+  const char *vrs[] = { "DA", "DA", "TM", "SH", "CS", "PN", "LO" };
+  set_tag(&tags[n++], SOP_INSTANCE_UID, "UI", instance->instance_uid);
+  for (size_t i = 0; i < sizeof (numbers) / sizeof (uint32_t); ++i)
+    if (*values[i]) set_tag(&tags[n++], numbers[i], (char *) vrs[i],
+                            values[i]);
+  set_tag(&tags[n++], STUDY_INSTANCE_UID, "UI", instance->study_uid);
+  set_tag(&tags[n++], SERIES_INSTANCE_UID, "UI", instance->series_uid);
+  memset(&tags[n], 0, sizeof (tag_t));
+  index_object(index, tags);
+}
+
+// Studies of 1 to 3 series of 1 to 3 instances
+static size_t make_instances(instance_t *instances) {
+  size_t n = 0;
+  uint32_t series = 0;
+  for (uint32_t study = 0; study < NSTUDIES; ++study)
+    for (uint32_t i = 0; i <= study % 3; ++i, ++series)
+      for (uint32_t j = 0; j <= (study + i) % 3; ++j, ++n) {
+        instance_t *instance = &instances[n];
+        instance->study = study;
+        instance->series = series;
+        snprintf(instance->study_uid, UID_MAX_SIZE + 1, UID_ROOT "%u", study);
+        snprintf(instance->series_uid, UID_MAX_SIZE + 1, UID_ROOT "%u.%u",
+                 study, series);
+        snprintf(instance->instance_uid, UID_MAX_SIZE + 1,
+                 UID_ROOT "%u.%u.%u", study, series, j);
+      }
+  return n;
+}
+
+static char *pick(char **values, size_t n) {
+  return values[rand() % n];
+}
+
+// A value of the pool of an attribute, a UID of the index for UIDs
+static void pick_value(size_t attribute, char *value) {
+  uint32_t study = rand() % (NSTUDIES + 2);
+  switch (g_attributes[attribute].number) {
+  case 0x00080020:
+  case 0x00080021:
+  case 0x00100030:
+    strcpy(value, pick(g_dates, NVALUES(g_dates)));
+    break;
+  case 0x00080030:
+    strcpy(value, pick(g_times, NVALUES(g_times)));
+    break;
+  case 0x00080060:
+  case 0x00080061:
+    strcpy(value, pick(g_modalities, NVALUES(g_modalities)));
+    break;
+  case 0x00100010:
+    strcpy(value, pick(g_names, NVALUES(g_names)));
+    break;
+  case 0x0020000D:
+    sprintf(value, UID_ROOT "%u", study);
+    break;
+  case 0x0020000E:
+    // Series of other studies or absent
+    sprintf(value, UID_ROOT "%u.%u", study, study * 2 + rand() % 3);
+    break;
+  case 0x00201206:
+  case 0x00201208:
+  case 0x00201209:
+    sprintf(value, "%u", 1 + rand() % 4);
+    break;
+  default:
+    strcpy(value, pick(g_ids, NVALUES(g_ids)));
+  }
+}
+
+// A key value for a matching rule drawn at random among those of its VR
+// Cf DICOM standard Part 4 Sect C.2.2.2
+static void make_key_value(size_t attribute, char *value) {
+  char first[64];
+  char second[64];
+  uint8_t range = is_range_vr((char *) g_attributes[attribute].vr);
+  uint8_t uid = !strncmp(g_attributes[attribute].vr, "UI", 2);
+  uint8_t rule = rand() % 6;
+  pick_value(attribute, first);
+  pick_value(attribute, second);
+  if (rule == 0) {
+    // Universal matching
+    strcpy(value, rand() % 2 ? "" : "*");
+  } else if (rule == 1 && range) {
+    // Open ranges and upper bounds compared on a prefix
+    second[rand() % (strlen(second) + 1)] = 0;
+    if (rand() % 3 == 0) *first = 0;
+    sprintf(value, "%s-%s", first, second);
+  } else if (rule == 2 && !uid && *first) {
+    // A literal prefix or none before the wildcards
+    size_t length = rand() % (strlen(first) + 1);
+    if (rand() % 2) first[rand() % strlen(first)] = '?';
+    sprintf(value, rand() % 3 ? "%.*s*" : "*%.*s", (int) length, first);
+  } else if (rule == 3 || (rule == 2 && uid)) {
+    // Lists of UIDs, repeated or not, and multiple values
+    sprintf(value, "%s\\%s", first, rand() % 4 ? second : first);
+  } else {
+    strcpy(value, first);
+  }
+}
+
+static int compare_find_keys(const void *a, const void *b) {
+  size_t x = *(size_t *) a;
+  size_t y = *(size_t *) b;
+  return x < y ? -1 : x > y;
+}
+
+static uint8_t *put_key(uint8_t *p, uint32_t number, const char *vr,
+                        char *value) {
+  uint16_t group = number >> 16;
+  uint16_t element = number & 0xFFFF;
+  size_t length = strlen(value);
+  uint16_t size = length + length % 2;
+  memcpy(p, &group, 2);
+  memcpy(p + 2, &element, 2);
+  memcpy(p + 4, vr, 2);
+  memcpy(p + 6, &size, 2);
+  memcpy(p + 8, value, length);
+  if (length % 2) p[8 + length] = strncmp(vr, "UI", 2) ? ' ' : 0;
+  return p + 8 + size;
+}
+
+// An explicit little endian identifier of 1 to 3 keys, sorted by number
+static size_t make_identifier(uint8_t level, uint8_t *identifier,
+                              char *description) {
+  size_t attributes[3];
+  size_t nkeys = 1 + rand() % 3;
+  char value[256];
+  uint8_t *p = identifier;
+  for (size_t i = 0; i < nkeys; ++i) {
+    size_t j = 0;
+    attributes[i] = rand() % NATTRIBUTES;
+    while (j < i && attributes[j] != attributes[i]) ++j;
+    if (j < i) --i;
+  }
+  qsort(attributes, nkeys, sizeof (size_t), compare_find_keys);
+  const char *name = level == STUDY_LEVEL ? "STUDY" : "SERIES";
+  uint8_t level_put = 0;
+  strcpy(description, name);
+  for (size_t i = 0; i < nkeys; ++i) {
+    const attribute_t *attribute = &g_attributes[attributes[i]];
+    if (!level_put && attribute->number > QUERY_RETRIEVE_LEVEL) {
+      p = put_key(p, QUERY_RETRIEVE_LEVEL, "CS", (char *) name);
+      level_put = 1;
+    }
+    make_key_value(attributes[i], value);
+    p = put_key(p, attribute->number, attribute->vr, value);
+    sprintf(description + strlen(description), " (%04X,%04X)=\"%s\"",
+            attribute->number >> 16, attribute->number & 0xFFFF, value);
+  }
+  if (!level_put) p = put_key(p, QUERY_RETRIEVE_LEVEL, "CS", (char *) name);
+  return p - identifier;
+}
+
+// The records matched through the indexes are those matched by a scan of
+// the whole level, and find_matches returns as many
+static int8_t check_query(find_index_t *index, uint8_t *identifier,
+                          size_t length, char *description,
+                          uint32_t *nindexed, ssize_t expected) {
+  query_t *query = malloc(sizeof (query_t));
+  uint32_t *candidates = NULL;
+  uint8_t *responses = NULL;
+  size_t responses_length;
+  uint16_t status;
+  int8_t ret = 0;
+  if (query == NULL || (query->values = malloc(length + FIND_MAX_KEYS)) ==
+      NULL) {
+    perror("malloc");
+    free(query);
+    return ERROR;
+  }
+  if (parse_query(identifier, length, EXPLICIT_LITTLE_ENDIAN, query) ==
+      ERROR) {
+    fprintf(stderr, "error: %s: query not parsed\n", description);
+    free(query->values);
+    free(query);
+    return ERROR;
+  }
+  uint32_t nrecords = index->levels[query->level].nrecords;
+  ssize_t n = select_candidates(index, query, &candidates);
+  ssize_t nmatches = 0;
+  if (n == ERROR) ret = ERROR;
+  if (n < nrecords) ++*nindexed;
+  // The candidates matching are sorted, as the records of the scan
+  ssize_t c = 0;
+  for (uint32_t record = 0; record < nrecords && ret == 0; ++record) {
+    if (!match_record(index, query, record)) continue;
+    ++nmatches;
+    while (c < n && !match_record(index, query, candidates[c])) ++c;
+    if (c == n || candidates[c++] != record) {
+      fprintf(stderr, "error: %s: record %u not matched through the index\n",
+              description, record);
+      ret = ERROR;
+    }
+  }
+  for (; ret == 0 && c < n; ++c)
+    if (match_record(index, query, candidates[c])) {
+      fprintf(stderr, "error: %s: record %u matched twice\n", description,
+              candidates[c]);
+      ret = ERROR;
+    }
+  ssize_t found = find_matches(index, identifier, length,
+                               EXPLICIT_LITTLE_ENDIAN, &responses,
+                               &responses_length, &status);
+  if (ret == 0 && (found != nmatches ||
+                   status != (query->unsupported ? 0xFF01 : 0xFF00) ||
+                   (expected >= 0 && nmatches != expected))) {
+    fprintf(stderr, "error: %s: %zd matches found, %zd by the scan\n",
+            description, found, nmatches);
+    ret = ERROR;
+  }
+  free(responses);
+  free(candidates);
+  free(query->values);
+  free(query);
+  return ret;
+}
+
+// Queries whose matches are known
+static int8_t check_fixed(find_index_t *index, size_t nseries) {
+  const char *cases[][3] = {
+    { "STUDY", NULL, NULL },
+    { "SERIES", NULL, NULL },
+    { "STUDY", "UI", UID_ROOT "7" },
+    { "STUDY", "UI", UID_ROOT "7\\" UID_ROOT "7\\" UID_ROOT "8" },
+    { "SERIES", "UI", UID_ROOT "5" },
+    { "STUDY", "UI", UID_ROOT "1000" }
+  };
+  // The study 5 has 3 series
+  const ssize_t expected[] = { NSTUDIES, nseries, 1, 2, 3, 0 };
+  uint32_t nindexed = 0;
+  int8_t ret = 0;
+  for (size_t i = 0; i < sizeof (expected) / sizeof (ssize_t); ++i) {
+    uint8_t identifier[256];
+    char description[256];
+    uint8_t *p = put_key(identifier, QUERY_RETRIEVE_LEVEL, "CS",
+                         (char *) cases[i][0]);
+    if (cases[i][1])
+      p = put_key(p, STUDY_INSTANCE_UID, cases[i][1], (char *) cases[i][2]);
+    sprintf(description, "%s %s", cases[i][0],
+            cases[i][2] ? cases[i][2] : "");
+    ret |= check_query(index, identifier, p - identifier, description,
+                       &nindexed, expected[i]);
+  }
+  return ret;
+}
+
+int main(void) {
+  instance_t *instances = malloc(sizeof (instance_t) * NSTUDIES * 9);
+  find_index_t *index = create_find_index();
+  uint8_t identifier[1024];
+  char description[1024];
+  uint32_t nindexed = 0;
+  int8_t ret = 0;
+  srand(1);
+  if (instances == NULL || index == NULL) {
+    perror("malloc");
+    return EXIT_FAILURE;
+  }
+  size_t n = make_instances(instances);
+  // Instances come in any order, and twice
+  for (size_t i = 0; i < 2 * n; ++i)
+    index_instance(index, &instances[(i * 7919) % n]);
+  size_t nseries = index->levels[SERIES_LEVEL].nrecords;
+  ret |= check(index->levels[STUDY_LEVEL].nrecords == NSTUDIES &&
+               nseries == instances[n - 1].series + 1,
+               "instances indexed wrong");
+  ret |= check_fixed(index, nseries);
+  for (uint32_t i = 0; i < NQUERIES && ret == 0; ++i) {
+    uint8_t level = rand() % 2 ? STUDY_LEVEL : SERIES_LEVEL;
+    size_t length = make_identifier(level, identifier, description);
+    ret |= check_query(index, identifier, length, description, &nindexed,
+                       -1);
+  }
+  // Most keys are answered by an index
+  if (ret == 0)
+    ret = check(nindexed > NQUERIES / 4, "queries not answered by an index");
+  free_find_index(index);
+  free(instances);
+  printf("find: %s\n", ret ? "failed" : "ok");
+  return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "dicom.h"
+#include "dcm.h"
+#include "pixel-data.h"
+#include "jpeg-lossless.h"
+
+#define ERROR -1
+#define MAX_STREAM_SIZE 65536
+
+// Entropy coded data writer, stuffing a zero byte after each 0xFF
+// Cf ISO/IEC 10918-1 Annex F.1.2.3
+typedef struct bit_writer_s {
+  uint8_t  *data;
+  size_t   length;
+  uint32_t buffer;
+  uint8_t  bits;
+} bit_writer_t;
+
+static void put_byte(bit_writer_t *writer, uint8_t byte) {
+  writer->data[writer->length++] = byte;
+}
+
+static void put_bits(bit_writer_t *writer, uint32_t value, uint8_t n) {
+  while (n--) {
+    writer->buffer = writer->buffer << 1 | ((value >> n) & 1);
+    if (++writer->bits == 8) {
+      put_byte(writer, writer->buffer);
+      if ((writer->buffer & 0xFF) == 0xFF) put_byte(writer, 0);
+      writer->buffer = 0;
+      writer->bits = 0;
+    }
+  }
+}
+
+// Pad the last byte with ones before a marker
+static void flush_bits(bit_writer_t *writer) {
+  while (writer->bits) put_bits(writer, 1, 1);
+}
+
+static void put_segment(bit_writer_t *writer, uint8_t marker,
+                        const uint8_t *segment, uint16_t length) {
+  put_byte(writer, 0xFF);
+  put_byte(writer, marker);
+  put_byte(writer, (length + 2) >> 8);
+  put_byte(writer, (length + 2) & 0xFF);
+  memcpy(writer->data + writer->length, segment, length);
+  writer->length += length;
+}
+
+// Code the difference of SSSS category k with the 5 bits code k, then its
+// additional bits
+// Cf ISO/IEC 10918-1 Annex H.1.2.2
+static void put_difference(bit_writer_t *writer, int32_t difference) {
+  difference = (uint16_t) difference;
+  if (difference > 32768) difference -= 65536;
+  uint32_t magnitude = difference < 0 ? -difference : difference;
+  uint8_t ssss = 0;
+  while (magnitude >> ssss) ++ssss;
+  put_bits(writer, ssss, 5);
+  if (ssss == 0 || ssss == 16) return;
+  put_bits(writer, difference < 0 ? difference + (1 << ssss) - 1 : difference,
+           ssss);
+}
+
+// Encode the samples, interleaved, with the first order predictor of the
+// Selection Value 1, restarting each line if restart is set
+// Cf ISO/IEC 10918-1 Annex H.1.2.1
+static size_t encode_sv1(const uint16_t *samples, uint16_t rows,
+                         uint16_t columns, uint8_t ncomponents,
+                         uint8_t precision, uint8_t restart, uint8_t *stream) {
+  bit_writer_t writer = { stream, 0, 0, 0 };
+  uint8_t frame[6 + 3 * 4] = { precision, rows >> 8, rows & 0xFF,
+                               columns >> 8, columns & 0xFF, ncomponents };
+  uint8_t table[17 + 17] = { 0 };
+  uint8_t scan[1 + 2 * 4 + 3] = { ncomponents };
+  uint8_t interval[2] = { columns >> 8, columns & 0xFF };
+  for (uint8_t c = 0; c < ncomponents; ++c) {
+    frame[6 + 3 * c] = c + 1;
+    frame[6 + 3 * c + 1] = 0x11;
+    scan[1 + 2 * c] = c + 1;
+  }
+  // 17 codes of 5 bits for the categories 0 to 16
+  table[1 + 4] = 17;
+  for (uint8_t k = 0; k <= 16; ++k) table[17 + k] = k;
+  scan[1 + 2 * ncomponents] = 1;
+  put_byte(&writer, 0xFF);
+  put_byte(&writer, 0xD8);
+  put_segment(&writer, 0xC3, frame, 6 + 3 * ncomponents);
+  put_segment(&writer, 0xC4, table, sizeof (table));
+  if (restart) put_segment(&writer, 0xDD, interval, sizeof (interval));
+  put_segment(&writer, 0xDA, scan, 1 + 2 * ncomponents + 3);
+  for (uint16_t y = 0; y < rows; ++y) {
+    if (restart && y) {
+      flush_bits(&writer);
+      put_byte(&writer, 0xFF);
+      put_byte(&writer, 0xD0 + (y - 1) % 8);
+    }
+    for (uint16_t x = 0; x < columns; ++x)
+      for (uint8_t c = 0; c < ncomponents; ++c) {
+        size_t i = ((size_t) y * columns + x) * ncomponents + c;
+        int32_t prediction;
+        if (x == 0 && (y == 0 || restart))
+          prediction = 1 << (precision - 1);
+        else if (x == 0)
+          prediction = samples[i - columns * ncomponents];
+        else
+          prediction = samples[i - ncomponents];
+        put_difference(&writer, samples[i] - prediction);
+      }
+  }
+  flush_bits(&writer);
+  put_byte(&writer, 0xFF);
+  put_byte(&writer, 0xD9);
+  return writer.length;
+}
+
+static int8_t check_frame(uint16_t rows, uint16_t columns,
+                          uint8_t ncomponents, uint8_t precision,
+                          uint8_t restart) {
+  pixel_module_t pixel_module;
+  size_t n = (size_t) rows * columns * ncomponents;
+  uint16_t *samples = malloc(sizeof (uint16_t) * n);
+  uint16_t *output = malloc(sizeof (uint16_t) * n);
+  uint8_t *stream = malloc(MAX_STREAM_SIZE);
+  int8_t ret = ERROR;
+  if (samples == NULL || output == NULL || stream == NULL) {
+    perror("malloc");
+    free(samples);
+    free(output);
+    free(stream);
+    return ERROR;
+  }
+  // Smooth areas, edges and extreme values, so that every category shows up
+  for (size_t i = 0; i < n; ++i)
+    samples[i] = (i % 7 == 3 ? (i * 2654435761U) >> 7 : i * 3 + (i / 17)) &
+      ((1 << precision) - 1);
+  samples[n - 1] = (1 << precision) - 1;
+  samples[n / 2] = 0;
+  // A difference of -2^(P-1) to the initial prediction, 32768 of category 16
+  // without additional bits for 16 bits
+  samples[0] = 0;
+  memset(&pixel_module, 0, sizeof (pixel_module_t));
+  pixel_module.rows = rows;
+  pixel_module.columns = columns;
+  pixel_module.samples_per_pixel = ncomponents;
+  pixel_module.bits_allocated = precision > 8 ? 16 : 8;
+  size_t length = encode_sv1(samples, rows, columns, ncomponents, precision,
+                             restart, stream);
+  memset(output, 0xAB, sizeof (uint16_t) * n);
+  if (decode_jpeg_lossless_frame(stream, length, &pixel_module,
+                                 (uint8_t *) output) == ERROR) {
+    fprintf(stderr, "error: %ux%ux%u %u bits frame not decoded\n", rows,
+            columns, ncomponents, precision);
+  } else {
+    ret = 0;
+    for (size_t i = 0; i < n && ret == 0; ++i) {
+      uint16_t value = pixel_module.bits_allocated == 8 ?
+        ((uint8_t *) output)[i] : output[i];
+      if (value != samples[i]) {
+        fprintf(stderr, "error: %ux%ux%u %u bits frame%s differs at %zu\n",
+                rows, columns, ncomponents, precision,
+                restart ? " with restarts" : "", i);
+        ret = ERROR;
+      }
+    }
+  }
+  free(samples);
+  free(output);
+  free(stream);
+  return ret;
+}
+
+int main(void) {
+  int8_t ret = 0;
+  for (uint8_t restart = 0; restart < 2; ++restart) {
+    ret |= check_frame(16, 19, 1, 12, restart);
+    ret |= check_frame(16, 16, 1, 16, restart);
+    ret |= check_frame(9, 11, 3, 8, restart);
+    ret |= check_frame(1, 1, 1, 8, restart);
+  }
+  printf("jpeg-lossless: %s\n", ret ? "failed" : "ok");
+  return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
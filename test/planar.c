@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "dicom.h"
+#include "dcm.h"
+#include "pixel-data.h"
+#include "planar.h"
+
+#define ERROR -1
+
+static int8_t check(uint8_t condition, char *what) {
+  if (!condition) fprintf(stderr, "error: %s\n", what);
+  return condition ? 0 : ERROR;
+}
+
+// Sample s of pixel i, one sample after the other, or one plane after the
+// other
+// Cf DICOM standard Part 3 Sect C.7.6.3.1.3
+static size_t get_sample_offset(size_t i, uint8_t s, size_t npixels,
+                                uint8_t bytes, uint8_t planar) {
+  return (planar ? s * npixels + i : 3 * i + s) * bytes;
+}
+
+// Naive transposition, sample by sample
+static void transpose_reference(const uint8_t *input, uint8_t *output,
+                                size_t npixels, uint8_t bytes,
+                                uint8_t to_planar) {
+  for (size_t i = 0; i < npixels; ++i)
+    for (uint8_t s = 0; s < 3; ++s)
+      memcpy(output + get_sample_offset(i, s, npixels, bytes, to_planar),
+             input + get_sample_offset(i, s, npixels, bytes, !to_planar),
+             bytes);
+}
+
+// Both directions, out of place and in place, against the reference
+static int8_t check_transpose(size_t npixels, uint8_t bytes) {
+  size_t size = 3 * npixels * bytes;
+  uint8_t *input = malloc(size);
+  uint8_t *expected = malloc(size);
+  uint8_t *output = malloc(size);
+  int8_t ret = 0;
+  if (input == NULL || expected == NULL || output == NULL) {
+    perror("malloc");
+    free(input);
+    free(expected);
+    free(output);
+    return ERROR;
+  }
+  for (size_t i = 0; i < size; ++i) input[i] = rand();
+  for (uint8_t to_planar = 0; to_planar < 2; ++to_planar) {
+    int8_t (*convert)(const uint8_t *, uint8_t *, size_t, uint8_t) =
+      to_planar ? interleaved_to_planar : planar_to_interleaved;
+    transpose_reference(input, expected, npixels, bytes, to_planar);
+    memset(output, 0xAB, size);
+    if (convert(input, output, npixels, bytes) == ERROR ||
+        memcmp(output, expected, size)) {
+      fprintf(stderr, "error: %zu pixels of %u bytes to %s\n", npixels,
+              bytes, to_planar ? "planes" : "interleaved pixels");
+      ret = ERROR;
+    }
+    memcpy(output, input, size);
+    if (convert(output, output, npixels, bytes) == ERROR ||
+        memcmp(output, expected, size)) {
+      fprintf(stderr, "error: %zu pixels of %u bytes to %s in place\n",
+              npixels, bytes, to_planar ? "planes" : "interleaved pixels");
+      ret = ERROR;
+    }
+  }
+  free(input);
+  free(expected);
+  free(output);
+  return ret;
+}
+
+// The frame is transposed to the other planar configuration
+static int8_t check_frame(void) {
+  pixel_module_t pixel_module;
+  uint8_t input[5 * 7 * 3 * 2];
+  uint8_t expected[sizeof (input)];
+  uint8_t output[sizeof (input)];
+  int8_t ret = 0;
+  memset(&pixel_module, 0, sizeof (pixel_module_t));
+  pixel_module.rows = 5;
+  pixel_module.columns = 7;
+  pixel_module.samples_per_pixel = 3;
+  pixel_module.bits_allocated = 16;
+  for (size_t i = 0; i < sizeof (input); ++i) input[i] = rand();
+  for (uint8_t planar = 0; planar < 2; ++planar) {
+    pixel_module.planar_configuration = planar;
+    transpose_reference(input, expected, 5 * 7, 2, !planar);
+    ret |= check(transpose_frame(&pixel_module, input, output) == 0 &&
+                 !memcmp(output, expected, sizeof (output)),
+                 planar ? "planar frame transposed wrong" :
+                 "interleaved frame transposed wrong");
+  }
+  pixel_module.samples_per_pixel = 1;
+  ret |= check(transpose_frame(&pixel_module, input, output) == ERROR,
+               "single sample frame transposed");
+  pixel_module.samples_per_pixel = 3;
+  pixel_module.bits_allocated = 32;
+  ret |= check(transpose_frame(&pixel_module, input, output) == ERROR,
+               "32 bits frame transposed");
+  return ret;
+}
+
+int main(void) {
+  // Prime counts, moved by blocks of one pixel past the block size, and
+  // composite counts, moved by blocks dividing them
+  const size_t npixels[] = { 1, 2, 7, 97, 4096, 4099, 6000, 3 * 4096,
+                             512 * 512 + 1, 65537 };
+  int8_t ret = 0;
+  srand(1);
+  for (size_t i = 0; i < sizeof (npixels) / sizeof (size_t); ++i)
+    for (uint8_t bytes = 1; bytes <= 2; ++bytes)
+      ret |= check_transpose(npixels[i], bytes);
+  ret |= check_frame();
+  printf("planar: %s\n", ret ? "failed" : "ok");
+  return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,278 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dicom.h"
+#include "dcm.h"
+#include "pixel-data.h"
+#include "rle.h"
+
+#define ERROR -1
+
+static int8_t check(uint8_t condition, char *what) {
+  if (!condition) fprintf(stderr, "error: %s\n", what);
+  return condition ? 0 : ERROR;
+}
+
+// Literal runs, replicate runs and the no-op byte
+// Cf DICOM standard Part 5 Sect G.3.2
+static int8_t check_segments(void) {
+  const uint8_t segment[] = { 2, 'a', 'b', 'c', 0xFD, 'x', 0x80, 0, 'y',
+                              0x81, 'z' };
+  uint8_t expected[8 + 128];
+  uint8_t output[256];
+  int8_t ret = 0;
+  memcpy(expected, "abcxxxxy", 8);
+  memset(expected + 8, 'z', 128);
+  ssize_t n = decode_rle_segment(segment, sizeof (segment), output,
+                                 sizeof (output));
+  ret |= check(n == 8 + 128 && !memcmp(output, expected, n),
+               "segment decoded wrong");
+  // The output ends in the middle of the segment, padding for instance
+  ret |= check(decode_rle_segment(segment, sizeof (segment), output, 8) == 8,
+               "segment not stopped at the end of the output");
+  ret |= check(decode_rle_segment(segment, sizeof (segment), output, 6) ==
+               ERROR, "replicate run overflowing the output accepted");
+  ret |= check(decode_rle_segment(segment, 3, output, sizeof (output)) ==
+               ERROR, "truncated literal run accepted");
+  ret |= check(decode_rle_segment(segment, 5, output, sizeof (output)) ==
+               ERROR, "truncated replicate run accepted");
+  return ret;
+}
+
+// A frame of the segments given, one after the other behind the header
+static size_t make_frame(const uint8_t **segments, const size_t *lengths,
+                         uint8_t nsegments, uint8_t *frame) {
+  rle_header_t header;
+  size_t length = RLE_HEADER_SIZE;
+  memset(&header, 0, sizeof (rle_header_t));
+  header.number_of_segments = nsegments;
+  for (uint8_t k = 0; k < nsegments; ++k) {
+    header.offsets[k] = length;
+    memcpy(frame + length, segments[k], lengths[k]);
+    length += lengths[k];
+  }
+  memcpy(frame, &header, sizeof (rle_header_t));
+  return length;
+}
+
+// Segments hold the most significant bytes first and the samples one after
+// the other, the output is in the native layout
+// Cf DICOM standard Part 5 Sect G.2
+static int8_t check_frames(void) {
+  pixel_module_t pixel_module;
+  uint8_t frame[RLE_HEADER_SIZE + 64];
+  uint8_t output[64];
+  int8_t ret = 0;
+  memset(&pixel_module, 0, sizeof (pixel_module_t));
+  pixel_module.rows = 2;
+  pixel_module.columns = 2;
+  pixel_module.samples_per_pixel = 1;
+  pixel_module.bits_allocated = 16;
+  const uint8_t high[] = { 0xFD, 0x12 };
+  const uint8_t low[] = { 3, 0x01, 0x02, 0x03, 0x04 };
+  const uint8_t *segments16[] = { high, low };
+  const size_t lengths16[] = { sizeof (high), sizeof (low) };
+  const uint16_t values16[] = { 0x1201, 0x1202, 0x1203, 0x1204 };
+  size_t length = make_frame(segments16, lengths16, 2, frame);
+  ret |= check(decode_rle_frame(frame, length, &pixel_module, output, 2) == 0 &&
+               !memcmp(output, values16, sizeof (values16)),
+               "16 bits frame decoded wrong");
+  pixel_module.samples_per_pixel = 3;
+  pixel_module.bits_allocated = 8;
+  const uint8_t red[] = { 0xFD, 'r' };
+  const uint8_t green[] = { 3, 'g', 'h', 'i', 'j' };
+  const uint8_t blue[] = { 0xFD, 'b' };
+  const uint8_t *segments8[] = { red, green, blue };
+  const size_t lengths8[] = { sizeof (red), sizeof (green), sizeof (blue) };
+  length = make_frame(segments8, lengths8, 3, frame);
+  ret |= check(decode_rle_frame(frame, length, &pixel_module, output, 1) == 0 &&
+               !memcmp(output, "rgbrhbribrjb", 12),
+               "interleaved color frame decoded wrong");
+  pixel_module.planar_configuration = 1;
+  ret |= check(decode_rle_frame(frame, length, &pixel_module, output, 3) == 0 &&
+               !memcmp(output, "rrrrghijbbbb", 12),
+               "planar color frame decoded wrong");
+  // Segments of 4 bytes for 8 pixels
+  pixel_module.rows = 4;
+  ret |= check(decode_rle_frame(frame, length, &pixel_module, output, 1) ==
+               ERROR, "short segments accepted");
+  pixel_module.rows = 2;
+  pixel_module.samples_per_pixel = 1;
+  ret |= check(decode_rle_frame(frame, length, &pixel_module, output, 1) ==
+               ERROR, "segment count mismatch accepted");
+  return ret;
+}
+
+// Runs of 3 equal bytes or more are replicated, shorter ones are copied
+// literally
+static int8_t check_runs(void) {
+  uint8_t output[16];
+  int8_t ret = 0;
+  ret |= check(encode_rle_segment((const uint8_t *) "\1\2\2\3", 4, output) ==
+               6 && output[0] == 3 && !memcmp(output + 1, "\1\2\2\3", 4),
+               "run of 2 inside a literal run replicated");
+  ret |= check(encode_rle_segment((const uint8_t *) "\7\7", 2, output) == 4 &&
+               output[0] == 1, "run of 2 replicated");
+  ret |= check(encode_rle_segment((const uint8_t *) "\5\5\5\6", 4, output) ==
+               4 && output[0] == 0xFE && output[1] == 5 && output[2] == 0 &&
+               output[3] == 6, "run of 3 not replicated");
+  return ret;
+}
+
+// Fill n bytes with a single run, distinct bytes or runs of random lengths
+static void fill(uint8_t *data, size_t n, uint8_t pattern) {
+  size_t i = 0;
+  while (i < n) {
+    size_t run = pattern == 0 ? n :
+      pattern == 1 ? 1 : 1 + (size_t) rand() % 130;
+    uint8_t value = pattern == 1 ? i * 37 + 11 : (size_t) rand();
+    for (; run && i < n; --run) data[i++] = value;
+  }
+}
+
+// Round trip through the encoder and the decoder, segments and frames
+static int8_t check_round_trips(void) {
+  const size_t lengths[] = { 1, 2, 3, 127, 128, 129, 130, 255, 256, 257,
+                             1000 };
+  const uint8_t bits[] = { 8, 16, 32 };
+  int8_t ret = 0;
+  for (size_t l = 0; l < sizeof (lengths) / sizeof (size_t); ++l) {
+    size_t n = lengths[l];
+    size_t size = n * 3 * 4;
+    uint8_t *input = malloc(size);
+    uint8_t *encoded = malloc(RLE_HEADER_SIZE + 3 * 4 *
+                              get_rle_segment_bound(n));
+    uint8_t *output = malloc(size);
+    if (input == NULL || encoded == NULL || output == NULL) {
+      perror("malloc");
+      free(input);
+      free(encoded);
+      free(output);
+      return ERROR;
+    }
+    for (uint8_t pattern = 0; pattern < 3; ++pattern) {
+      fill(input, n, pattern);
+      ssize_t length = encode_rle_segment(input, n, encoded);
+      if (length < 0 || (size_t) length > get_rle_segment_bound(n) ||
+          length % 2 ||
+          decode_rle_segment(encoded, length, output, n) != (ssize_t) n ||
+          memcmp(input, output, n)) {
+        fprintf(stderr, "error: segment of %zu bytes, pattern %u\n", n,
+                pattern);
+        ret = ERROR;
+      }
+      for (uint8_t b = 0; b < sizeof (bits); ++b)
+        for (uint8_t samples = 1; samples <= 3; samples += 2)
+          for (uint8_t planar = 0; planar <= (samples > 1); ++planar) {
+            pixel_module_t pixel_module;
+            memset(&pixel_module, 0, sizeof (pixel_module_t));
+            pixel_module.rows = 1;
+            pixel_module.columns = n;
+            pixel_module.samples_per_pixel = samples;
+            pixel_module.bits_allocated = bits[b];
+            pixel_module.planar_configuration = planar;
+            size_t frame_size = n * samples * bits[b] / 8;
+            fill(input, frame_size, pattern);
+            length = encode_rle_frame(input, &pixel_module, encoded, 2);
+            if (length < 0 ||
+                (size_t) length > get_rle_frame_bound(&pixel_module) ||
+                decode_rle_frame(encoded, length, &pixel_module, output,
+                                 2) == ERROR ||
+                memcmp(input, output, frame_size)) {
+              fprintf(stderr, "error: frame of %zu pixels, %u bits, %u "
+                      "samples, planar %u, pattern %u\n", n, bits[b],
+                      samples, planar, pattern);
+              ret = ERROR;
+            }
+          }
+    }
+    free(input);
+    free(encoded);
+    free(output);
+  }
+  return ret;
+}
+
+// Encode the frames of native pixel data as encapsulated pixel data, then
+// index and decode them back through the Basic Offset Table
+static int8_t check_writer(void) {
+  char source[] = "/tmp/rle-native-XXXXXX";
+  char target[] = "/tmp/rle-encapsulated-XXXXXX";
+  pixel_module_t pixel_module;
+  dicom_meta_t dicom_meta;
+  frame_index_t index;
+  file_t native;
+  file_t encapsulated;
+  tag_t pixel_data;
+  uint32_t frames[5] = { 0, 1, 2, 3, 4 };
+  uint8_t input[5 * 7 * 9 * 3 * 2];
+  uint8_t output[sizeof (input)];
+  int8_t ret = ERROR;
+  memset(&pixel_module, 0, sizeof (pixel_module_t));
+  pixel_module.rows = 7;
+  pixel_module.columns = 9;
+  pixel_module.samples_per_pixel = 3;
+  pixel_module.bits_allocated = 16;
+  pixel_module.number_of_frames = 5;
+  fill(input, sizeof (input), 2);
+  int fd = mkstemp(source);
+  if (fd < 0) {
+    perror("mkstemp");
+    return ERROR;
+  }
+  int8_t written = write_all(fd, input, sizeof (input));
+  close(fd);
+  if (written == ERROR || load_file(source, &native) == ERROR) {
+    unlink(source);
+    return ERROR;
+  }
+  memset(&pixel_data, 0, sizeof (tag_t));
+  pixel_data.data = native.content;
+  pixel_data.datasize = sizeof (input);
+  if ((fd = mkstemp(target)) < 0) {
+    perror("mkstemp");
+  } else {
+    written = write_rle_pixel_data(fd, &native, &pixel_data, &pixel_module,
+                                   3);
+    close(fd);
+    memset(&dicom_meta, 0, sizeof (dicom_meta_t));
+    dicom_meta.transfer_syntax = EXPLICIT_LITTLE_ENDIAN;
+    if (written != ERROR && load_file(target, &encapsulated) != ERROR) {
+      // Basic Offset Table of the 5 frames, the first one at 0
+      uint32_t *table = (uint32_t *) &encapsulated.content[12 + 8];
+      if (build_frame_index(&encapsulated, 0, &dicom_meta, 5, &index) !=
+          ERROR) {
+        if (*(uint32_t *) &encapsulated.content[12 + 4] == 5 * 4 &&
+            table[0] == 0 &&
+            decode_rle_frames(&encapsulated, &index, &pixel_module, frames, 5,
+                              output, 2) != ERROR &&
+            !memcmp(input, output, sizeof (input)))
+          ret = 0;
+        free_frame_index(&index);
+      }
+      unmap_file(&encapsulated);
+      close_file(&encapsulated);
+    }
+    unlink(target);
+  }
+  if (ret == ERROR) fprintf(stderr, "error: encapsulated frames differ\n");
+  unmap_file(&native);
+  close_file(&native);
+  unlink(source);
+  return ret;
+}
+
+int main(void) {
+  int8_t ret = 0;
+  srand(1);
+  ret |= check_segments();
+  ret |= check_frames();
+  ret |= check_runs();
+  ret |= check_round_trips();
+  ret |= check_writer();
+  printf("rle: %s\n", ret ? "failed" : "ok");
+  return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,736 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "dicom.h"
+#include "dcm.h"
+
+#define ERROR -1
+#define DCMR "../dcmr/dcmr"
+#define MAX_PDU (64 << 10)
+// Fragments of the dataset, smaller than its values so that they are split
+#define PDV_SIZE 999
+#define SECONDARY_CAPTURE "1.2.840.10008.5.1.4.1.1.7"
+#define VERIFICATION "1.2.840.10008.1.1"
+#define STUDY_ROOT_FIND "1.2.840.10008.5.1.4.1.2.2.1"
+#define UID_ROOT "1.2.826.0.1.3680043.2.1125.7."
+#define STUDY_DATE 0x00080020
+#define STUDY_TIME 0x00080030
+#define QUERY_RETRIEVE_LEVEL 0x00080052
+#define MODALITY 0x00080060
+#define MODALITIES_IN_STUDY 0x00080061
+#define PRIVATE_CREATOR 0x00090010
+#define PRIVATE_DATA 0x00091001
+#define PRIVATE_SIZE 10000
+#define PATIENT_NAME 0x00100010
+#define PATIENT_ID 0x00100020
+#define NUMBER_OF_STUDY_RELATED_INSTANCES 0x00201208
+#define NUMBER_OF_SERIES_RELATED_INSTANCES 0x00201209
+#define PIXELS (64 * 64 * 2)
+#define STORE_CONTEXT 1
+#define ECHO_CONTEXT 3
+#define FIND_CONTEXT 5
+
+// Cf DICOM standard Part 8 Sect 9.3
+#define A_ASSOCIATE_RQ 0x01
+#define A_ASSOCIATE_AC 0x02
+#define P_DATA_TF 0x04
+#define A_RELEASE_RQ 0x05
+#define A_RELEASE_RP 0x06
+#define COMMAND_FRAGMENT 0x01
+#define LAST_FRAGMENT 0x02
+// Cf DICOM standard Part 7 Sect E.1
+#define C_STORE_RQ 0x0001
+#define C_FIND_RQ 0x0020
+#define C_ECHO_RQ 0x0030
+#define RESPONSE 0x8000
+#define NO_DATA_SET 0x0101
+#define PENDING 0xFF00
+
+// An instance stored then queried, its UIDs under UID_ROOT
+typedef struct object_s {
+  char *instance;
+  char *study;
+  char *series;
+  char *date;
+  char *time;
+  char *name;
+  char *id;
+  char *modality;
+} object_t;
+
+// A key of a C-FIND identifier
+typedef struct find_key_s {
+  uint32_t number;
+  char     *vr;
+  char     *value;
+} find_key_t;
+
+// A query, the number of its matches and the value expected for the key
+// checked in the first match, if any
+typedef struct find_case_s {
+  char       *level;
+  find_key_t keys[3];
+  uint32_t   nmatches;
+  uint32_t   checked;
+  char       *value;
+} find_case_t;
+
+static const object_t g_objects[] = {
+  { "1.1.1", "1", "1.1", "20200115", "101500.25", "DOE^JOHN", "P1", "CT" },
+  { "1.1.2", "1", "1.1", "20200115", "101500.25", "DOE^JOHN", "P1", "CT" },
+  { "1.2.1", "1", "1.2", "20200115", "101500.25", "DOE^JOHN", "P1", "MR" },
+  { "2.1.1", "2", "2.1", "20200220", "130000", "DOE^JANE", "P2", "US" },
+  { "3.1.1", "3", "3.1", "20210101", "235959", "SMITH^ANNA", "P3", "CT" }
+};
+
+#define NOBJECTS (sizeof (g_objects) / sizeof (object_t))
+
+// Cf DICOM standard Part 4 Sect C.2.2.2
+static const find_case_t g_find_cases[] = {
+  // Wildcard matching, with and without a literal prefix
+  { "STUDY", { { PATIENT_NAME, "PN", "DOE*" } }, 2, 0, NULL },
+  { "STUDY", { { PATIENT_NAME, "PN", "*AN?A" } }, 1, 0, NULL },
+  // Range matching, open or not, the upper bound comparing on its length
+  { "STUDY", { { STUDY_DATE, "DA", "20200101-20200131" } }, 1, 0, NULL },
+  { "STUDY", { { STUDY_DATE, "DA", "20200201-" } }, 2, 0, NULL },
+  { "STUDY", { { STUDY_DATE, "DA", "-20200220" } }, 2, 0, NULL },
+  { "STUDY", { { STUDY_TIME, "TM", "1015-1300" } }, 2, 0, NULL },
+  { "STUDY", { { STUDY_TIME, "TM", "1016-1259" } }, 0, 0, NULL },
+  // UID list matching and multiple values
+  { "STUDY", { { STUDY_INSTANCE_UID, "UI", UID_ROOT "1\\" UID_ROOT "3" } }, 2,
+    0, NULL },
+  { "STUDY", { { PATIENT_ID, "LO", "P1\\P3" } }, 2, 0, NULL },
+  { "STUDY", { { MODALITIES_IN_STUDY, "CS", "MR\\US" } }, 2, 0, NULL },
+  // Universal matching, the value of the match being returned
+  { "STUDY", { { PATIENT_NAME, "PN", "*" } }, 3, 0, NULL },
+  { "STUDY", { { STUDY_INSTANCE_UID, "UI", UID_ROOT "1" },
+               { PATIENT_NAME, "PN", "" } }, 1, PATIENT_NAME, "DOE^JOHN" },
+  { "STUDY", { { STUDY_INSTANCE_UID, "UI", UID_ROOT "1" },
+               { NUMBER_OF_STUDY_RELATED_INSTANCES, "IS", "" } }, 1,
+    NUMBER_OF_STUDY_RELATED_INSTANCES, "3" },
+  { "SERIES", { { MODALITY, "CS", "" },
+                { STUDY_INSTANCE_UID, "UI", UID_ROOT "1" } }, 2, 0, NULL },
+  { "SERIES", { { MODALITY, "CS", "CT" } }, 2, 0, NULL },
+  { "SERIES", { { MODALITY, "CS", "CT\\MR" }, { PATIENT_ID, "LO", "P1" } }, 2,
+    0, NULL },
+  { "SERIES", { { SERIES_INSTANCE_UID, "UI",
+                  UID_ROOT "1.1\\" UID_ROOT "3.1" } }, 2, 0, NULL },
+  { "SERIES", { { SERIES_INSTANCE_UID, "UI", UID_ROOT "1.1" },
+                { NUMBER_OF_SERIES_RELATED_INSTANCES, "IS", "" } }, 1,
+    NUMBER_OF_SERIES_RELATED_INSTANCES, "2" },
+  // Study attributes in series queries
+  { "SERIES", { { PATIENT_NAME, "PN", "DOE*" } }, 3, 0, NULL },
+  { "SERIES", { { STUDY_DATE, "DA", "20200101-20201231" } }, 3, 0, NULL },
+  { "SERIES", { { STUDY_TIME, "TM", "-1300" },
+                { MODALITY, "CS", "US" } }, 1, MODALITY, "US" }
+};
+
+#define NFIND_CASES (sizeof (g_find_cases) / sizeof (find_case_t))
+
+// The Storage SCP run as a child, its records read through out
+typedef struct scp_s {
+  pid_t pid;
+  int   out;
+  char  port[8];
+  char  directory[32];
+} scp_t;
+
+// A message received, its command decoded and its dataset kept
+typedef struct message_s {
+  uint16_t command_field;
+  uint16_t status;
+  uint16_t data_set_type;
+  uint8_t  data[MAX_PDU];
+  size_t   length;
+} message_t;
+
+static int8_t check(uint8_t condition, char *what) {
+  if (!condition) fprintf(stderr, "error: %s\n", what);
+  return condition ? 0 : ERROR;
+}
+
+static uint8_t *put_uint16_be(uint8_t *p, uint16_t value) {
+  p[0] = value >> 8;
+  p[1] = value;
+  return p + 2;
+}
+
+static uint8_t *put_uint32_be(uint8_t *p, uint32_t value) {
+  p[0] = value >> 24;
+  p[1] = value >> 16;
+  p[2] = value >> 8;
+  p[3] = value;
+  return p + 4;
+}
+
+static uint32_t get_uint32_be(uint8_t *p) {
+  return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 |
+    (uint32_t) p[2] << 8 | p[3];
+}
+
+static uint8_t *put_item(uint8_t *p, uint8_t type, char *value) {
+  *p++ = type;
+  *p++ = 0;
+  p = put_uint16_be(p, strlen(value));
+  memcpy(p, value, strlen(value));
+  return p + strlen(value);
+}
+
+static uint8_t *put_tag(uint8_t *p, uint32_t number, char *vr,
+                        uint32_t length) {
+  uint16_t group = number >> 16;
+  uint16_t element = number & 0xFFFF;
+  memcpy(p, &group, 2);
+  memcpy(p + 2, &element, 2);
+  if (vr == NULL) {
+    memcpy(p + 4, &length, 4);
+    return p + 8;
+  }
+  memcpy(p + 4, vr, 2);
+  if (is_double_length_vr(vr)) {
+    memset(p + 6, 0, 2);
+    memcpy(p + 8, &length, 4);
+    return p + 12;
+  }
+  uint16_t short_length = length;
+  memcpy(p + 6, &short_length, 2);
+  return p + 8;
+}
+
+// A string value padded to an even length, implicit if vr is NULL
+static uint8_t *put_string(uint8_t *p, uint32_t number, char *vr,
+                           char *value) {
+  size_t length = strlen(value);
+  p = put_tag(p, number, vr, length + length % 2);
+  memcpy(p, value, length);
+  if (length % 2) p[length] = vr == NULL || !strcmp(vr, "UI") ? 0 : ' ';
+  return p + length + length % 2;
+}
+
+static uint8_t *put_uint16(uint8_t *p, uint32_t number, char *vr,
+                           uint16_t value) {
+  p = put_tag(p, number, vr, 2);
+  memcpy(p, &value, 2);
+  return p + 2;
+}
+
+static int8_t read_all(int fd, uint8_t *data, size_t length) {
+  while (length) {
+    ssize_t n = read(fd, data, length);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      fprintf(stderr, "error: connection closed by the SCP\n");
+      return ERROR;
+    }
+    data += n;
+    length -= n;
+  }
+  return 0;
+}
+
+static int8_t read_pdu(int fd, uint8_t *pdu, uint8_t *type,
+                       uint32_t *length) {
+  if (read_all(fd, pdu, 6) == ERROR) return ERROR;
+  *type = pdu[0];
+  *length = get_uint32_be(pdu + 2);
+  if (*length > MAX_PDU) return ERROR;
+  return read_all(fd, pdu, *length);
+}
+
+// Send data as PDVs of size bytes at most, two of them per P-DATA-TF
+// Cf DICOM standard Part 8 Sect 9.3.5
+static int8_t send_pdvs(int fd, uint8_t context, uint8_t control,
+                        uint8_t *data, size_t length, size_t size) {
+  uint8_t pdu[6 + 2 * (6 + PDV_SIZE)];
+  do {
+    uint8_t *p = pdu + 6;
+    for (uint8_t k = 0; k < 2 && length; ++k) {
+      size_t n = length < size ? length : size;
+      p = put_uint32_be(p, n + 2);
+      *p++ = context;
+      *p++ = control | (n == length ? LAST_FRAGMENT : 0);
+      memcpy(p, data, n);
+      p += n;
+      data += n;
+      length -= n;
+    }
+    pdu[0] = P_DATA_TF;
+    pdu[1] = 0;
+    put_uint32_be(pdu + 2, p - pdu - 6);
+    if (write_all(fd, pdu, p - pdu) == ERROR) return ERROR;
+  } while (length);
+  return 0;
+}
+
+// A command in implicit VR little endian, with its group length
+// Cf DICOM standard Part 7 Sect 6.3.1
+static int8_t send_command(int fd, uint8_t context, char *sop_class,
+                           uint16_t command_field, uint16_t message_id,
+                           uint16_t data_set_type, char *sop_instance) {
+  uint8_t command[256];
+  uint8_t *p = put_string(command + 12, 0x00000002, NULL, sop_class);
+  p = put_uint16(p, 0x00000100, NULL, command_field);
+  p = put_uint16(p, 0x00000110, NULL, message_id);
+  if (command_field != C_ECHO_RQ) p = put_uint16(p, 0x00000700, NULL, 0);
+  p = put_uint16(p, 0x00000800, NULL, data_set_type);
+  if (sop_instance) p = put_string(p, 0x00001000, NULL, sop_instance);
+  uint32_t length = p - command - 12;
+  memcpy(put_tag(command, 0x00000000, NULL, 4), &length, 4);
+  return send_pdvs(fd, context, COMMAND_FRAGMENT, command, p - command,
+                   PDV_SIZE);
+}
+
+static void decode_command(uint8_t *command, size_t length,
+                           message_t *message) {
+  for (size_t i = 0; i + 8 <= length;) {
+    uint16_t element;
+    uint32_t size;
+    memcpy(&element, command + i + 2, 2);
+    memcpy(&size, command + i + 4, 4);
+    uint16_t value = 0;
+    if (size == 2) memcpy(&value, command + i + 8, 2);
+    if (element == 0x0100) message->command_field = value;
+    if (element == 0x0800) message->data_set_type = value;
+    if (element == 0x0900) message->status = value;
+    i += 8 + size;
+  }
+}
+
+// Receive a message, its command then its dataset if any
+static int8_t read_message(int fd, message_t *message) {
+  uint8_t *pdu = malloc(MAX_PDU);
+  uint8_t command[1024];
+  size_t command_length = 0;
+  uint8_t type;
+  uint32_t length;
+  int8_t ret = 0;
+  uint8_t done = 0;
+  if (pdu == NULL) {
+    perror("malloc");
+    return ERROR;
+  }
+  message->length = 0;
+  while (!done && ret == 0) {
+    if (read_pdu(fd, pdu, &type, &length) == ERROR || type != P_DATA_TF) {
+      ret = ERROR;
+      break;
+    }
+    for (uint32_t i = 0; i + 6 <= length;) {
+      uint32_t size = get_uint32_be(pdu + i) - 2;
+      uint8_t control = pdu[i + 5];
+      uint8_t *data = pdu + i + 6;
+      if (control & COMMAND_FRAGMENT) {
+        if (command_length + size > sizeof (command)) {
+          ret = ERROR;
+          break;
+        }
+        memcpy(command + command_length, data, size);
+        command_length += size;
+        if (control & LAST_FRAGMENT) {
+          decode_command(command, command_length, message);
+          done = message->data_set_type == NO_DATA_SET;
+        }
+      } else if (message->length + size <= MAX_PDU) {
+        memcpy(message->data + message->length, data, size);
+        message->length += size;
+        done = control & LAST_FRAGMENT;
+      }
+      i += 4 + size + 2;
+    }
+  }
+  free(pdu);
+  return ret;
+}
+
+// A presentation context of an abstract syntax and a transfer syntax
+// Cf DICOM standard Part 8 Sect 9.3.2.2
+static uint8_t *put_context(uint8_t *p, uint8_t id, char *abstract_syntax,
+                            char *transfer_syntax) {
+  *p++ = 0x20;
+  *p++ = 0;
+  p = put_uint16_be(p, 4 + 4 + strlen(abstract_syntax) + 4 +
+                    strlen(transfer_syntax));
+  *p++ = id;
+  *p++ = 0;
+  *p++ = 0;
+  *p++ = 0;
+  p = put_item(p, 0x30, abstract_syntax);
+  return put_item(p, 0x40, transfer_syntax);
+}
+
+// Cf DICOM standard Part 8 Sect 9.3.2
+static int8_t associate(int fd) {
+  uint8_t pdu[1024];
+  uint8_t type;
+  uint32_t length;
+  memset(pdu, 0, sizeof (pdu));
+  uint8_t *p = put_uint16_be(pdu + 6, 1);
+  p += 2;
+  memcpy(p, "STORESCP        ", 16);
+  memcpy(p + 16, "STORESCU        ", 16);
+  p = put_item(p + 64, 0x10, "1.2.840.10008.3.1.1.1");
+  p = put_context(p, STORE_CONTEXT, SECONDARY_CAPTURE,
+                  TRANSFER_TYPE_EXPLICIT_LITTLE_ENDIAN);
+  p = put_context(p, ECHO_CONTEXT, VERIFICATION, TRANSFER_TYPE_IMPLICIT);
+  p = put_context(p, FIND_CONTEXT, STUDY_ROOT_FIND,
+                  TRANSFER_TYPE_EXPLICIT_LITTLE_ENDIAN);
+  *p++ = 0x50;
+  *p++ = 0;
+  p = put_uint16_be(p, 8);
+  *p++ = 0x51;
+  *p++ = 0;
+  p = put_uint16_be(p, 4);
+  p = put_uint32_be(p, MAX_PDU);
+  pdu[0] = A_ASSOCIATE_RQ;
+  put_uint32_be(pdu + 2, p - pdu - 6);
+  if (write_all(fd, pdu, p - pdu) == ERROR ||
+      read_pdu(fd, pdu, &type, &length) == ERROR || type != A_ASSOCIATE_AC) {
+    fprintf(stderr, "error: association not accepted\n");
+    return ERROR;
+  }
+  // Results of the presentation contexts
+  for (size_t i = 68; i + 8 <= length; i += 4 + (pdu[i + 2] << 8 | pdu[i + 3]))
+    if (pdu[i] == 0x21 && pdu[i + 6] != 0) {
+      fprintf(stderr, "error: presentation context %u rejected\n",
+              pdu[i + 4]);
+      return ERROR;
+    }
+  return 0;
+}
+
+// The dataset of a Secondary Capture image, with a private value and pixel
+// data spanning several fragments
+static size_t make_dataset(const object_t *object, uint8_t *dataset) {
+  char uid[UID_MAX_SIZE + 1];
+  snprintf(uid, sizeof (uid), UID_ROOT "%s", object->instance);
+  uint8_t *p = put_string(dataset, 0x00080016, "UI", SECONDARY_CAPTURE);
+  p = put_string(p, SOP_INSTANCE_UID, "UI", uid);
+  p = put_string(p, STUDY_DATE, "DA", object->date);
+  p = put_string(p, STUDY_TIME, "TM", object->time);
+  p = put_string(p, MODALITY, "CS", object->modality);
+  p = put_string(p, PRIVATE_CREATOR, "LO", "STORE");
+  p = put_tag(p, PRIVATE_DATA, "OB", PRIVATE_SIZE);
+  for (size_t i = 0; i < PRIVATE_SIZE; ++i) *p++ = rand();
+  p = put_string(p, PATIENT_NAME, "PN", object->name);
+  p = put_string(p, PATIENT_ID, "LO", object->id);
+  snprintf(uid, sizeof (uid), UID_ROOT "%s", object->study);
+  p = put_string(p, STUDY_INSTANCE_UID, "UI", uid);
+  snprintf(uid, sizeof (uid), UID_ROOT "%s", object->series);
+  p = put_string(p, SERIES_INSTANCE_UID, "UI", uid);
+  p = put_tag(p, PLANE_POSITION_SEQUENCE, "SQ", UNDEFINED_LENGTH);
+  p = put_tag(p, ITEM_TAG, NULL, UNDEFINED_LENGTH);
+  p = put_string(p, IMAGE_POSITION_PATIENT, "DS", "1\\2\\3");
+  p = put_tag(p, ITEM_DELIMITATION_TAG, NULL, 0);
+  p = put_tag(p, SEQUENCE_DELIMITATION_TAG, NULL, 0);
+  p = put_uint16(p, SAMPLES_PER_PIXEL, "US", 1);
+  p = put_string(p, PHOTOMETRIC_INTERPRETATION, "CS", "MONOCHROME2");
+  p = put_uint16(p, ROWS, "US", 64);
+  p = put_uint16(p, COLUMNS, "US", 64);
+  p = put_uint16(p, BITS_ALLOCATED, "US", 16);
+  p = put_uint16(p, BITS_STORED, "US", 12);
+  p = put_uint16(p, HIGH_BIT, "US", 11);
+  p = put_uint16(p, PIXEL_REPRESENTATION, "US", 0);
+  p = put_tag(p, PIXEL_DATA, "OW", PIXELS);
+  for (size_t i = 0; i < PIXELS; ++i) *p++ = rand();
+  return p - dataset;
+}
+
+// The identifier of a query, its keys and the level sorted by number
+// Cf DICOM standard Part 4 Sect C.4.1.1.3
+static size_t make_identifier(const find_case_t *find_case,
+                              uint8_t *identifier) {
+  uint8_t *p = identifier;
+  uint8_t level = 0;
+  for (size_t i = 0; i < 3 && find_case->keys[i].number; ++i) {
+    const find_key_t *key = &find_case->keys[i];
+    if (!level && key->number > QUERY_RETRIEVE_LEVEL) {
+      p = put_string(p, QUERY_RETRIEVE_LEVEL, "CS", find_case->level);
+      level = 1;
+    }
+    p = put_string(p, key->number, key->vr, key->value);
+  }
+  if (!level) p = put_string(p, QUERY_RETRIEVE_LEVEL, "CS", find_case->level);
+  return p - identifier;
+}
+
+// The value of a key of an identifier in explicit VR little endian, without
+// its padding, NULL if absent
+static char *get_key_value(uint8_t *identifier, size_t length,
+                           uint32_t number, char *value, size_t size) {
+  for (size_t i = 0; i + 8 <= length;) {
+    uint16_t group, element, short_size;
+    uint32_t datasize;
+    size_t header = 8;
+    memcpy(&group, identifier + i, 2);
+    memcpy(&element, identifier + i + 2, 2);
+    memcpy(&short_size, identifier + i + 6, 2);
+    datasize = short_size;
+    if (is_double_length_vr((char *) identifier + i + 4)) {
+      memcpy(&datasize, identifier + i + 8, 4);
+      header = 12;
+    }
+    if (((uint32_t) group << 16 | element) == number) {
+      if (datasize >= size || i + header + datasize > length) return NULL;
+      memcpy(value, identifier + i + header, datasize);
+      while (datasize && (value[datasize - 1] == ' ' ||
+                          value[datasize - 1] == 0))
+        --datasize;
+      value[datasize] = 0;
+      return value;
+    }
+    i += header + datasize;
+  }
+  return NULL;
+}
+
+// A port free at the time, for the SCP to listen on
+static int8_t get_free_port(char *port) {
+  struct sockaddr_in address;
+  socklen_t length = sizeof (struct sockaddr_in);
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  memset(&address, 0, sizeof (struct sockaddr_in));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (fd < 0 || bind(fd, (struct sockaddr *) &address, length) ||
+      getsockname(fd, (struct sockaddr *) &address, &length)) {
+    perror("socket");
+    if (fd >= 0) close(fd);
+    return ERROR;
+  }
+  close(fd);
+  snprintf(port, 8, "%u", ntohs(address.sin_port));
+  return 0;
+}
+
+// Run dcmr --store on a free port into a new directory, its records going to
+// a pipe
+static int8_t start_scp(scp_t *scp) {
+  int pipefd[2];
+  strcpy(scp->directory, "/tmp/store-XXXXXX");
+  if (get_free_port(scp->port) == ERROR) return ERROR;
+  if (mkdtemp(scp->directory) == NULL) {
+    perror("mkdtemp");
+    return ERROR;
+  }
+  if (pipe(pipefd)) {
+    perror("pipe");
+    return ERROR;
+  }
+  if ((scp->pid = fork()) < 0) {
+    perror("fork");
+    return ERROR;
+  }
+  if (scp->pid == 0) {
+    int null = open("/dev/null", O_WRONLY);
+    // The counts printed when leaving are not part of the test output
+    dup2(pipefd[1], STDOUT_FILENO);
+    dup2(null, STDERR_FILENO);
+    close(pipefd[0]);
+    close(pipefd[1]);
+    close(null);
+    execl(DCMR, DCMR, "--store", scp->port, scp->directory, (char *) NULL);
+    perror(DCMR);
+    _exit(EXIT_FAILURE);
+  }
+  close(pipefd[1]);
+  scp->out = pipefd[0];
+  return 0;
+}
+
+// Connect to the SCP once it listens
+static int connect_scp(scp_t *scp) {
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof (struct sockaddr_in));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(atoi(scp->port));
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  for (uint32_t i = 0; i < 200; ++i) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+      perror("socket");
+      return ERROR;
+    }
+    if (!connect(fd, (struct sockaddr *) &address,
+                 sizeof (struct sockaddr_in)))
+      return fd;
+    close(fd);
+    usleep(25000);
+  }
+  fprintf(stderr, "error: could not connect to the SCP on %s\n", scp->port);
+  return ERROR;
+}
+
+// Read a line written by the SCP, within a few seconds
+static int8_t read_line(scp_t *scp, char *line, size_t size) {
+  size_t length = 0;
+  struct pollfd pfd = { scp->out, POLLIN, 0 };
+  while (length + 1 < size && poll(&pfd, 1, 5000) == 1 &&
+         read(scp->out, line + length, 1) == 1)
+    if (line[length++] == '\n') {
+      line[length] = 0;
+      return 0;
+    }
+  fprintf(stderr, "error: no record written by the SCP\n");
+  return ERROR;
+}
+
+static void stop_scp(scp_t *scp) {
+  kill(scp->pid, SIGTERM);
+  waitpid(scp->pid, NULL, 0);
+  close(scp->out);
+}
+
+// The file written is the file meta information followed by the dataset as
+// it was sent
+static int8_t check_file(char *path, uint8_t *dataset, size_t length) {
+  FILE *f = fopen(path, "rb");
+  uint8_t *content = malloc(length + 1024);
+  uint32_t group_length;
+  int8_t ret = ERROR;
+  if (f == NULL || content == NULL) {
+    perror(f == NULL ? path : "malloc");
+    if (f) fclose(f);
+    free(content);
+    return ERROR;
+  }
+  size_t size = fread(content, 1, length + 1024, f);
+  fclose(f);
+  memcpy(&group_length, content + PREAMBLE_LENGTH + 4 + 8, 4);
+  size_t header = PREAMBLE_LENGTH + 4 + 12 + group_length;
+  if (size > PREAMBLE_LENGTH + 4 + 12 &&
+      !memcmp(content + PREAMBLE_LENGTH, MAGIC_WORD, 4) &&
+      size == header + length && !memcmp(content + header, dataset, length))
+    ret = 0;
+  else
+    fprintf(stderr, "error: %s differs from the dataset sent\n", path);
+  free(content);
+  return ret;
+}
+
+// Store an object, its dataset split in fragments, then check its file and
+// its record
+static int8_t store_object(scp_t *scp, int fd, message_t *message,
+                           const object_t *object, uint16_t message_id,
+                           uint8_t *dataset) {
+  char uid[UID_MAX_SIZE + 1];
+  char path[1024];
+  char line[2048] = "";
+  char expected[1024 + 64];
+  int8_t ret = ERROR;
+  size_t size = make_dataset(object, dataset);
+  snprintf(uid, sizeof (uid), UID_ROOT "%s", object->instance);
+  snprintf(path, sizeof (path), "%s/%s.dcm", scp->directory, uid);
+  if (send_command(fd, STORE_CONTEXT, SECONDARY_CAPTURE, C_STORE_RQ,
+                   message_id, 0, uid) == 0 &&
+      send_pdvs(fd, STORE_CONTEXT, 0, dataset, size, PDV_SIZE) == 0 &&
+      read_message(fd, message) == 0 &&
+      check(message->command_field == (C_STORE_RQ | RESPONSE) &&
+            message->status == 0, "C-STORE failed") == 0) {
+    ret = check_file(path, dataset, size);
+    // The record of the object is written before its response is sent
+    ret |= read_line(scp, line, sizeof (line));
+    snprintf(expected, sizeof (expected), "\"filename\":\"%s\"", path);
+    uint8_t found = strstr(line, expected) != NULL;
+    snprintf(expected, sizeof (expected),
+             "\"StudyInstanceUID\":\"" UID_ROOT "%s\"", object->study);
+    found &= strstr(line, expected) != NULL;
+    snprintf(expected, sizeof (expected),
+             "\"SeriesInstanceUID\":\"" UID_ROOT "%s\"", object->series);
+    found &= strstr(line, expected) != NULL;
+    ret |= check(found, "record of the object stored wrong");
+  }
+  unlink(path);
+  return ret;
+}
+
+// Send a query and count its pending responses up to the final one, the
+// value of the key checked being the one of the first match
+// Cf DICOM standard Part 7 Sect 9.1.2
+static int8_t check_find(int fd, message_t *message,
+                         const find_case_t *find_case, uint16_t message_id) {
+  uint8_t identifier[1024];
+  char value[256];
+  uint32_t nmatches = 0;
+  uint8_t checked = find_case->checked == 0;
+  size_t length = make_identifier(find_case, identifier);
+  int8_t ret = send_command(fd, FIND_CONTEXT, STUDY_ROOT_FIND, C_FIND_RQ,
+                            message_id, 0, NULL);
+  if (ret == 0)
+    ret = send_pdvs(fd, FIND_CONTEXT, 0, identifier, length, PDV_SIZE);
+  while (ret == 0 && (ret = read_message(fd, message)) == 0 &&
+         message->status == PENDING && message->data_set_type != NO_DATA_SET)
+    if (nmatches++ == 0 && !checked)
+      checked = get_key_value(message->data, message->length,
+                              find_case->checked, value, sizeof (value)) &&
+        !strcmp(value, find_case->value);
+  if (ret == 0 && message->command_field == (C_FIND_RQ | RESPONSE) &&
+      message->status == 0 && nmatches == find_case->nmatches && checked)
+    return 0;
+  const find_key_t *key = &find_case->keys[0];
+  fprintf(stderr, "error: C-FIND of the %s level on (%04X,%04X) \"%s\" "
+          "found %u matches instead of %u%s\n", find_case->level,
+          key->number >> 16, key->number & 0xFFFF, key->value, nmatches,
+          find_case->nmatches, checked ? "" : ", value returned wrong");
+  return ERROR;
+}
+
+// Associate, verify, store the objects, query them and release
+static int8_t check_store(scp_t *scp) {
+  uint8_t *dataset = malloc(PRIVATE_SIZE + PIXELS + 1024);
+  message_t *message = malloc(sizeof (message_t));
+  uint8_t release[10] = { A_RELEASE_RQ, 0, 0, 0, 0, 4, 0, 0, 0, 0 };
+  uint8_t type;
+  uint32_t length;
+  int8_t ret = ERROR;
+  int fd = ERROR;
+  if (dataset == NULL || message == NULL) {
+    perror("malloc");
+    free(dataset);
+    free(message);
+    return ERROR;
+  }
+  if ((fd = connect_scp(scp)) != ERROR && associate(fd) == 0 &&
+      send_command(fd, ECHO_CONTEXT, VERIFICATION, C_ECHO_RQ, 1, NO_DATA_SET,
+                   NULL) == 0 &&
+      read_message(fd, message) == 0 &&
+      check(message->command_field == (C_ECHO_RQ | RESPONSE) &&
+            message->status == 0, "C-ECHO failed") == 0) {
+    ret = 0;
+    for (size_t i = 0; i < NOBJECTS; ++i)
+      ret |= store_object(scp, fd, message, &g_objects[i], 2 + i, dataset);
+    // The objects stored are queried through the index they were added to
+    for (size_t i = 0; i < NFIND_CASES && ret == 0; ++i)
+      ret |= check_find(fd, message, &g_find_cases[i], 2 + NOBJECTS + i);
+    ret |= check(write_all(fd, release, sizeof (release)) == 0 &&
+                 read_pdu(fd, message->data, &type, &length) == 0 &&
+                 type == A_RELEASE_RP, "association not released");
+  }
+  if (fd != ERROR) close(fd);
+  free(dataset);
+  free(message);
+  return ret;
+}
+
+int main(void) {
+  scp_t scp;
+  int8_t ret = 0;
+  srand(1);
+  if (start_scp(&scp) == ERROR) return EXIT_FAILURE;
+  ret |= check_store(&scp);
+  stop_scp(&scp);
+  rmdir(scp.directory);
+  printf("store: %s\n", ret ? "failed" : "ok");
+  return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dicom.h"
+#include "dcm.h"
+#include "stream.h"
+
+#define ERROR -1
+#define PRIVATE_CREATOR 0x00090010
+#define PRIVATE_DATA 0x00091001
+#define PATIENT_NAME 0x00100010
+// Over the initial capacity of the stream, which grows while fed
+#define PRIVATE_SIZE (100 << 10)
+#define PIXELS 64
+
+static uint8_t *put_tag(uint8_t *p, uint32_t number, char *vr,
+                        uint32_t length) {
+  uint16_t group = number >> 16;
+  uint16_t element = number & 0xFFFF;
+  memcpy(p, &group, 2);
+  memcpy(p + 2, &element, 2);
+  if (vr == NULL) {
+    memcpy(p + 4, &length, 4);
+    return p + 8;
+  }
+  memcpy(p + 4, vr, 2);
+  if (is_double_length_vr(vr)) {
+    memset(p + 6, 0, 2);
+    memcpy(p + 8, &length, 4);
+    return p + 12;
+  }
+  uint16_t short_length = length;
+  memcpy(p + 6, &short_length, 2);
+  return p + 8;
+}
+
+static uint8_t *put_string(uint8_t *p, uint32_t number, char *vr,
+                           char *value) {
+  size_t length = strlen(value);
+  p = put_tag(p, number, vr, length + length % 2);
+  memcpy(p, value, length);
+  if (length % 2) p[length] = strcmp(vr, "UI") ? ' ' : 0;
+  return p + length + length % 2;
+}
+
+// An explicit little endian dataset with a sequence of undefined length, a
+// large private value and the pixel data. Return its length.
+static size_t make_dataset(uint8_t *dataset) {
+  uint8_t *p = put_string(dataset, 0x00080016, "UI",
+                          "1.2.840.10008.5.1.4.1.1.7");
+  p = put_string(p, SOP_INSTANCE_UID, "UI", "1.2.3.4.5.6");
+  p = put_string(p, PRIVATE_CREATOR, "LO", "STREAM");
+  p = put_tag(p, PRIVATE_DATA, "OB", PRIVATE_SIZE);
+  for (size_t i = 0; i < PRIVATE_SIZE; ++i) *p++ = i * 7 + (i >> 8);
+  p = put_string(p, PATIENT_NAME, "PN", "DOE^JOHN");
+  p = put_string(p, STUDY_INSTANCE_UID, "UI", "1.2.3.4");
+  p = put_string(p, SERIES_INSTANCE_UID, "UI", "1.2.3.4.5");
+  p = put_tag(p, PLANE_POSITION_SEQUENCE, "SQ", UNDEFINED_LENGTH);
+  for (uint8_t i = 0; i < 2; ++i) {
+    p = put_tag(p, ITEM_TAG, NULL, UNDEFINED_LENGTH);
+    p = put_string(p, IMAGE_POSITION_PATIENT, "DS", i ? "4\\5\\6" : "1\\2\\3");
+    p = put_tag(p, ITEM_DELIMITATION_TAG, NULL, 0);
+  }
+  p = put_tag(p, SEQUENCE_DELIMITATION_TAG, NULL, 0);
+  p = put_tag(p, ROWS, "US", 2);
+  *p++ = 8;
+  *p++ = 0;
+  p = put_tag(p, COLUMNS, "US", 2);
+  *p++ = 8;
+  *p++ = 0;
+  p = put_tag(p, PIXEL_DATA, "OW", PIXELS);
+  for (size_t i = 0; i < PIXELS; ++i) *p++ = i;
+  return p - dataset;
+}
+
+// The file meta information and the dataset, written to path. Return the
+// length of the header before the dataset.
+static ssize_t write_file(char *path, uint8_t *dataset, size_t length) {
+  uint8_t header[PREAMBLE_LENGTH + 4 + 64];
+  memset(header, 0, PREAMBLE_LENGTH);
+  memcpy(header + PREAMBLE_LENGTH, MAGIC_WORD, 4);
+  uint8_t *begin = header + PREAMBLE_LENGTH + 4 + 12;
+  uint8_t *p = put_string(begin, 0x00020010, "UI",
+                          TRANSFER_TYPE_EXPLICIT_LITTLE_ENDIAN);
+  uint32_t group_length = p - begin;
+  memcpy(put_tag(begin - 12, 0x00020000, "UL", 4), &group_length, 4);
+  FILE *f = fopen(path, "wb");
+  if (f == NULL) {
+    perror(path);
+    return ERROR;
+  }
+  fwrite(header, 1, p - header, f);
+  fwrite(dataset, 1, length, f);
+  if (fclose(f)) {
+    perror(path);
+    return ERROR;
+  }
+  return p - header;
+}
+
+// The tags of the stream are those of the file, at the same place after the
+// header, the pixel data aside
+static int8_t check_tags(tag_t *expected, file_t *file, ssize_t header,
+                         stream_t *stream, size_t chunk) {
+  size_t n = 0;
+  while (n < MAX_LOADED_TAG && expected[n].group <= 0x4FFE &&
+         (expected[n].group != 0 || expected[n].element != 0))
+    ++n;
+  if (stream->ntags != n) {
+    fprintf(stderr, "error: %zu tags streamed by chunks of %zu instead of "
+            "%zu\n", stream->ntags, chunk, n);
+    return ERROR;
+  }
+  for (size_t i = 0; i < n; ++i) {
+    tag_t *a = &expected[i];
+    tag_t *b = &stream->tags[i];
+    if (a->group != b->group || a->element != b->element ||
+        memcmp(a->vr, b->vr, 2) || a->datasize != b->datasize ||
+        (uint8_t *) a->data - file->content !=
+        (uint8_t *) b->data - stream->file.content + header) {
+      fprintf(stderr, "error: tag %zu (%04X,%04X) streamed by chunks of %zu "
+              "differs\n", i, a->group, a->element, chunk);
+      return ERROR;
+    }
+  }
+  return 0;
+}
+
+// Feed the dataset by chunks, down to a byte at a time, and compare the
+// tags with those decoded from the file
+static int8_t check_chunks(char *path, uint8_t *dataset, size_t length) {
+  const size_t chunks[] = { 1, 2, 3, 7, 64, 1000, 65536 };
+  file_t file;
+  dicom_meta_t dicom_meta;
+  tag_t tags[MAX_LOADED_TAG];
+  stream_t *stream = malloc(sizeof (stream_t));
+  int8_t ret = 0;
+  ssize_t header = write_file(path, dataset, length);
+  if (stream == NULL) {
+    perror("malloc");
+    return ERROR;
+  }
+  if (header == ERROR || load_file(path, &file) == ERROR) {
+    free(stream);
+    return ERROR;
+  }
+  ssize_t offset = decode_dataset(&file, &dicom_meta, tags, MAX_LOADED_TAG);
+  if (offset < 0) {
+    fprintf(stderr, "error: %s: could not decode the dataset\n", path);
+    ret = ERROR;
+  }
+  for (size_t c = 0; ret == 0 && c < sizeof (chunks) / sizeof (size_t); ++c) {
+    open_stream(&dicom_meta, path, stream);
+    for (size_t i = 0; ret == 0 && i < length; i += chunks[c])
+      ret = feed_stream(stream, dataset + i, i + chunks[c] < length ?
+                        chunks[c] : length - i);
+    if (ret == 0 && close_stream(stream) + header != offset) {
+      fprintf(stderr, "error: stream by chunks of %zu ends at %zd instead "
+              "of %zd\n", chunks[c], close_stream(stream) + header, offset);
+      ret = ERROR;
+    }
+    if (ret == 0 && stream->length != length) {
+      fprintf(stderr, "error: %llu bytes streamed instead of %zu\n",
+              (unsigned long long) stream->length, length);
+      ret = ERROR;
+    }
+    if (ret == 0) ret = check_tags(tags, &file, header, stream, chunks[c]);
+    free_stream(stream);
+  }
+  free(stream);
+  unmap_file(&file);
+  close_file(&file);
+  return ret;
+}
+
+// A dataset ending in the middle of a tag is reported when closed
+static int8_t check_truncated(dicom_meta_t *dicom_meta, uint8_t *dataset) {
+  stream_t *stream = malloc(sizeof (stream_t));
+  int8_t ret = 0;
+  if (stream == NULL) {
+    perror("malloc");
+    return ERROR;
+  }
+  open_stream(dicom_meta, "truncated", stream);
+  if (feed_stream(stream, dataset, 40) == ERROR ||
+      close_stream(stream) != ERROR) {
+    fprintf(stderr, "error: truncated dataset accepted\n");
+    ret = ERROR;
+  }
+  free_stream(stream);
+  free(stream);
+  return ret;
+}
+
+int main(void) {
+  char path[] = "/tmp/stream-XXXXXX";
+  uint8_t *dataset = malloc(PRIVATE_SIZE + 1024);
+  dicom_meta_t dicom_meta;
+  int fd = mkstemp(path);
+  if (fd < 0 || dataset == NULL) {
+    perror(fd < 0 ? "mkstemp" : "malloc");
+    free(dataset);
+    return EXIT_FAILURE;
+  }
+  close(fd);
+  size_t length = make_dataset(dataset);
+  memset(&dicom_meta, 0, sizeof (dicom_meta_t));
+  dicom_meta.transfer_syntax = EXPLICIT_LITTLE_ENDIAN;
+  int8_t ret = check_chunks(path, dataset, length);
+  ret |= check_truncated(&dicom_meta, dataset);
+  unlink(path);
+  free(dataset);
+  printf("stream: %s\n", ret ? "failed" : "ok");
+  return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
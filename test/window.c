@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dicom.h"
+#include "dcm.h"
+
+#define ERROR -1
+#define PRIVATE_CREATOR 0x00090010
+#define PRIVATE_DATA 0x00091001
+#define STUDY "1.2.826.0.1.3680043.2.1125.1"
+#define SERIES "1.2.826.0.1.3680043.2.1125.1.1"
+#define POSITION "1\\2\\3 "
+
+static uint8_t g_value(size_t i) {
+  return (uint8_t) (i * 7 + (i >> 8));
+}
+
+static void write_tag(FILE *f, uint32_t number, char *vr, uint32_t length) {
+  uint16_t group = number >> 16;
+  uint16_t element = number & 0xFFFF;
+  fwrite(&group, 2, 1, f);
+  fwrite(&element, 2, 1, f);
+  if (vr == NULL) {
+    fwrite(&length, 4, 1, f);
+  } else if (is_double_length_vr(vr)) {
+    uint16_t reserved = 0;
+    fwrite(vr, 1, 2, f);
+    fwrite(&reserved, 2, 1, f);
+    fwrite(&length, 4, 1, f);
+  } else {
+    uint16_t short_length = length;
+    fwrite(vr, 1, 2, f);
+    fwrite(&short_length, 2, 1, f);
+  }
+}
+
+static void write_string(FILE *f, uint32_t number, char *vr, char *value) {
+  size_t length = strlen(value);
+  write_tag(f, number, vr, length + length % 2);
+  fwrite(value, 1, length, f);
+  if (length % 2) fputc(0, f);
+}
+
+// An explicit little endian file whose header, a private value of size bytes
+// followed by the UIDs and a sequence, is larger than the window
+static int8_t write_file(char *path, size_t size, size_t pixels) {
+  FILE *f = fopen(path, "wb");
+  if (f == NULL) {
+    perror(path);
+    return ERROR;
+  }
+  for (int i = 0; i < 128; ++i) fputc(0, f);
+  fwrite("DICM", 1, 4, f);
+  uint32_t group_length = 8 + 20;
+  write_tag(f, 0x00020000, "UL", 4);
+  fwrite(&group_length, 4, 1, f);
+  write_string(f, 0x00020010, "UI", TRANSFER_TYPE_EXPLICIT_LITTLE_ENDIAN);
+  write_string(f, SOP_INSTANCE_UID, "UI", "1.2.3.4.5");
+  write_string(f, PRIVATE_CREATOR, "LO", "WINDOW");
+  write_tag(f, PRIVATE_DATA, "OB", size);
+  for (size_t i = 0; i < size; ++i) fputc(g_value(i), f);
+  write_string(f, STUDY_INSTANCE_UID, "UI", STUDY);
+  write_string(f, SERIES_INSTANCE_UID, "UI", SERIES);
+  write_tag(f, PLANE_POSITION_SEQUENCE, "SQ", UNDEFINED_LENGTH);
+  write_tag(f, ITEM_TAG, NULL, UNDEFINED_LENGTH);
+  write_string(f, IMAGE_POSITION_PATIENT, "DS", POSITION);
+  write_tag(f, ITEM_DELIMITATION_TAG, NULL, 0);
+  write_tag(f, SEQUENCE_DELIMITATION_TAG, NULL, 0);
+  write_tag(f, PIXEL_DATA, "OW", pixels);
+  for (size_t i = 0; i < pixels; ++i) fputc(0, f);
+  if (fclose(f)) {
+    perror(path);
+    return ERROR;
+  }
+  return 0;
+}
+
+static int8_t check_string(tag_t *tags, uint32_t number, char *expected) {
+  char *value = (char *) get_tag_data(tags, number);
+  int8_t ret = value != NULL && !strcmp(trim(value, NULL), expected) ?
+    0 : ERROR;
+  if (ret == ERROR)
+    fprintf(stderr, "error: (%04X,%04X) is %s instead of %s\n", number >> 16,
+            number & 0xFFFF, value ? value : "missing", expected);
+  free(value);
+  return ret;
+}
+
+// The tags decoded before the window grew over the rest of the header still
+// point to their value
+static int8_t check_dataset(char *path, size_t window, size_t size) {
+  file_t file;
+  dicom_meta_t dicom_meta;
+  tag_t tags[MAX_LOADED_TAG];
+  int8_t ret = 0;
+  memset(&file, 0, sizeof (file_t));
+  if (load_file_window(path, window, &file) == ERROR) return ERROR;
+  if (decode_dataset(&file, &dicom_meta, tags, MAX_LOADED_TAG) < 0) {
+    fprintf(stderr, "error: %s: could not decode the dataset\n", path);
+    ret = ERROR;
+  } else {
+    tag_t *tag = get_tag(tags, PRIVATE_DATA);
+    if (tag == NULL || tag->datasize != size) {
+      fprintf(stderr, "error: private value missing\n");
+      ret = ERROR;
+    } else {
+      for (size_t i = 0; i < size && ret != ERROR; ++i)
+        if (((uint8_t *) tag->data)[i] != g_value(i)) {
+          fprintf(stderr, "error: private value differs at %zu\n", i);
+          ret = ERROR;
+        }
+    }
+    if (check_string(tags, SOP_INSTANCE_UID, "1.2.3.4.5") == ERROR ||
+        check_string(tags, PRIVATE_CREATOR, "WINDOW") == ERROR ||
+        check_string(tags, STUDY_INSTANCE_UID, STUDY) == ERROR ||
+        check_string(tags, SERIES_INSTANCE_UID, SERIES) == ERROR ||
+        check_string(tags, IMAGE_POSITION_PATIENT, "1\\2\\3") == ERROR)
+      ret = ERROR;
+  }
+  unmap_file(&file);
+  close_file(&file);
+  return ret;
+}
+
+int main(void) {
+  char path[] = "/tmp/window-XXXXXX";
+  size_t page = sysconf(_SC_PAGESIZE);
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    perror("mkstemp");
+    return EXIT_FAILURE;
+  }
+  close(fd);
+  int8_t ret = 0;
+  // Values ending on both sides of the window boundaries
+  for (size_t size = 3 * page - 64; size <= 3 * page + 64 && ret != ERROR;
+       size += 2)
+    if (write_file(path, size, 4 * page) == ERROR ||
+        check_dataset(path, page, size) == ERROR)
+      ret = ERROR;
+  unlink(path);
+  printf("window: %s\n", ret == ERROR ? "failed" : "ok");
+  return ret == ERROR ? EXIT_FAILURE : EXIT_SUCCESS;
+}